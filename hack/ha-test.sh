@@ -0,0 +1,146 @@
+#!/bin/bash
+# High availability smoke test: two reflectors ("nodes") attached to the same two LANs, paired over a direct link.
+# Queries sent by a host on the first LAN must reach a host on the second LAN exactly once, before and after the
+# active node is killed.
+# Needs root (or a user namespace with CAP_NET_ADMIN), iproute2 and python3.
+#
+# Usage: hack/ha-test.sh [path/to/mdns-reflector]
+set -euo pipefail
+SELF=$(readlink -f -- "$0")
+HERE=$(dirname -- "$SELF")
+REFLECTOR=$(readlink -f -- "${1:-$HERE/../build/src/mdns-reflector}")
+WORK=$(mktemp -d)
+PREFIX=mr$$
+NAMESPACES=("$PREFIX-switch" "$PREFIX-node-a" "$PREFIX-node-b" "$PREFIX-host-1" "$PREFIX-host-2")
+declare -A PIDS=()
+
+cleanup() {
+  for pid in "${PIDS[@]}"; do
+    kill "$pid" 2>/dev/null || true
+  done
+  for ns in "${NAMESPACES[@]}"; do
+    ip netns del "$ns" 2>/dev/null || true
+  done
+  rm -rf "$WORK"
+}
+trap cleanup EXIT
+
+for ns in "${NAMESPACES[@]}"; do
+  ip netns add "$ns"
+  ip -n "$ns" link set lo up
+done
+
+# Two LANs, each a bridge in the switch namespace.
+SWITCH=$PREFIX-switch
+for n in 1 2; do
+  ip -n "$SWITCH" link add "br$n" type bridge mcast_snooping 0
+  ip -n "$SWITCH" link set "br$n" up
+done
+
+# Attach a namespace to a LAN.
+# $1: namespace, $2: interface name in the namespace, $3: LAN number, $4: address
+attach() {
+  local port=p$RANDOM
+  ip -n "$1" link add "$2" type veth peer name "$port" netns "$SWITCH"
+  ip -n "$SWITCH" link set "$port" master "br$3" up
+  ip -n "$1" addr add "$4/24" dev "$2"
+  ip -n "$1" link set "$2" up
+}
+attach "$PREFIX-host-1" eth0 1 10.1.0.2
+attach "$PREFIX-host-2" eth0 2 10.2.0.2
+attach "$PREFIX-node-a" lan1 1 10.1.0.11
+attach "$PREFIX-node-a" lan2 2 10.2.0.11
+attach "$PREFIX-node-b" lan1 1 10.1.0.12
+attach "$PREFIX-node-b" lan2 2 10.2.0.12
+ip -n "$PREFIX-node-a" link add ha type veth peer name ha netns "$PREFIX-node-b"
+ip -n "$PREFIX-node-a" addr add 192.0.2.1/30 dev ha
+ip -n "$PREFIX-node-b" addr add 192.0.2.2/30 dev ha
+ip -n "$PREFIX-node-a" link set ha up
+ip -n "$PREFIX-node-b" link set ha up
+
+# $1: node letter, $2: local HA address, $3: peer HA address, $4: priority
+start_reflector() {
+  cat > "$WORK/$1.ini" <<INI
+[global]
+family = ipv4
+stats_file = $WORK/$1.stats
+
+[zone lan]
+interfaces = lan1 lan2
+
+[ha]
+local = $2:5390
+peer = $3:5390
+priority = $4
+heartbeat_ms = 100
+failover_ms = 500
+INI
+  ip netns exec "$PREFIX-node-$1" "$REFLECTOR" -fn -l info -c "$WORK/$1.ini" 2> "$WORK/$1.log" &
+  PIDS[$1]=$!
+}
+start_reflector a 192.0.2.1 192.0.2.2 200
+start_reflector b 192.0.2.2 192.0.2.1 100
+sleep 1.5
+
+# Send 5 queries from host 1 and print how many copies host 2 received.
+# $1: label distinguishing the round
+round() {
+  ip netns exec "$PREFIX-host-2" python3 - 10.2.0.2 > "$WORK/received" <<'PY' &
+import socket, sys
+s = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+s.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+s.bind(('', 5353))
+s.setsockopt(socket.IPPROTO_IP, socket.IP_ADD_MEMBERSHIP, socket.inet_aton('224.0.0.251') + socket.inet_aton(sys.argv[1]))
+s.settimeout(2)
+n = 0
+try:
+    while True:
+        s.recvfrom(9000)
+        n += 1
+except socket.timeout:
+    pass
+print(n)
+PY
+  local listener=$!
+  sleep 0.5
+  ip netns exec "$PREFIX-host-1" python3 - 10.1.0.2 "$1" <<'PY'
+import socket, struct, sys
+s = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+s.setsockopt(socket.IPPROTO_IP, socket.IP_MULTICAST_TTL, 255)
+s.setsockopt(socket.IPPROTO_IP, socket.IP_MULTICAST_IF, socket.inet_aton(sys.argv[1]))
+s.bind((sys.argv[1], 5353))
+for i in range(5):
+    service = '_hatest%s%d._tcp.local' % (sys.argv[2], i)
+    name = b''.join(bytes([len(label)]) + label.encode() for label in service.split('.')) + b'\0'
+    s.sendto(struct.pack('!6H', 0, 0, 1, 0, 0, 0) + name + struct.pack('!HH', 12, 1), ('224.0.0.251', 5353))
+PY
+  wait "$listener"
+  cat "$WORK/received"
+}
+
+# $1: round description, $2: copies received
+check() {
+  if [ "$2" -ne 5 ]; then
+    echo "FAIL: $1: host 2 received $2 copies of 5 queries" >&2
+    cat "$WORK/a.log" "$WORK/b.log" >&2
+    exit 1
+  fi
+  echo "OK: $1: host 2 received each query once"
+}
+
+check "node a active" "$(round a)"
+kill -USR1 "${PIDS[b]}"
+sleep 0.2
+grep -h '^ha' "$WORK/b.stats"
+
+kill "${PIDS[a]}"
+unset 'PIDS[a]'
+sleep 1
+check "node a killed" "$(round b)"
+kill -USR1 "${PIDS[b]}"
+sleep 0.2
+grep -h '^ha' "$WORK/b.stats"
+if ! grep -q 'ha: now active' "$WORK/b.log"; then
+  echo "FAIL: node b did not take over" >&2
+  exit 1
+fi
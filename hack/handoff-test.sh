@@ -0,0 +1,122 @@
+#!/bin/bash
+# Handoff smoke test: a reflector between two host namespaces is replaced by a new instance while a host sends a
+# steady stream of queries. Every query must reach the host on the other side, and the old instance must exit.
+# Needs root (or a user namespace with CAP_NET_ADMIN), iproute2 and python3.
+#
+# Usage: hack/handoff-test.sh [path/to/mdns-reflector]
+set -euo pipefail
+SELF=$(readlink -f -- "$0")
+HERE=$(dirname -- "$SELF")
+REFLECTOR=$(readlink -f -- "${1:-$HERE/../build/src/mdns-reflector}")
+WORK=$(mktemp -d)
+PREFIX=mr$$
+NAMESPACES=("$PREFIX-router" "$PREFIX-host-a" "$PREFIX-host-b")
+PIDS=()
+QUERIES=300
+
+cleanup() {
+  for pid in "${PIDS[@]}"; do
+    kill "$pid" 2>/dev/null || true
+  done
+  for ns in "${NAMESPACES[@]}"; do
+    ip netns del "$ns" 2>/dev/null || true
+  done
+  rm -rf "$WORK"
+}
+trap cleanup EXIT
+
+for ns in "${NAMESPACES[@]}"; do
+  ip netns add "$ns"
+  ip -n "$ns" link set lo up
+done
+ROUTER=$PREFIX-router
+for n in 1 2; do
+  host=$PREFIX-host-$([ "$n" = 1 ] && echo a || echo b)
+  ip -n "$ROUTER" link add "lan$n" type veth peer name eth0 netns "$host"
+  ip -n "$ROUTER" addr add "10.$n.0.1/24" dev "lan$n"
+  ip -n "$host" addr add "10.$n.0.2/24" dev eth0
+  ip -n "$ROUTER" link set "lan$n" up
+  ip -n "$host" link set eth0 up
+done
+
+cat > "$WORK/reflector.ini" <<INI
+[global]
+family = ipv4
+handoff_socket = $WORK/handoff.sock
+
+[zone lan]
+interfaces = lan1 lan2
+
+[discovery lan]
+zone = lan
+domain = lan.home.arpa
+listen = 10.1.0.1:5300
+INI
+start_reflector() {
+  ip netns exec "$ROUTER" "$REFLECTOR" -f -p "$WORK/reflector.pid" -l info -c "$WORK/reflector.ini" \
+    2> "$WORK/$1.log" &
+  PIDS+=($!)
+}
+start_reflector old
+OLD=${PIDS[0]}
+sleep 1
+
+ip netns exec "$PREFIX-host-b" python3 - 10.2.0.2 > "$WORK/received" <<'PY' &
+import socket, sys
+s = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+s.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+s.bind(('', 5353))
+s.setsockopt(socket.IPPROTO_IP, socket.IP_ADD_MEMBERSHIP, socket.inet_aton('224.0.0.251') + socket.inet_aton(sys.argv[1]))
+s.settimeout(2)
+seen = set()
+try:
+    while True:
+        seen.add(s.recvfrom(9000)[0][:2])
+except socket.timeout:
+    pass
+print(len(seen))
+PY
+LISTENER=$!
+sleep 0.5
+
+# one query every 10 ms, each with its own ID; the new instance starts a second into the stream
+ip netns exec "$PREFIX-host-a" python3 - 10.1.0.2 "$QUERIES" <<'PY' &
+import socket, struct, sys, time
+s = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+s.setsockopt(socket.IPPROTO_IP, socket.IP_MULTICAST_TTL, 255)
+s.setsockopt(socket.IPPROTO_IP, socket.IP_MULTICAST_IF, socket.inet_aton(sys.argv[1]))
+s.bind((sys.argv[1], 5353))
+name = b''.join(bytes([len(label)]) + label.encode() for label in '_handofftest._tcp.local'.split('.')) + b'\0'
+for i in range(int(sys.argv[2])):
+    s.sendto(struct.pack('!6H', i + 1, 0, 1, 0, 0, 0) + name + struct.pack('!HH', 12, 1), ('224.0.0.251', 5353))
+    time.sleep(0.01)
+PY
+SENDER=$!
+sleep 1
+start_reflector new
+NEW=${PIDS[1]}
+
+wait "$SENDER"
+wait "$LISTENER"
+if kill -0 "$OLD" 2>/dev/null; then
+  echo "FAIL: the old instance is still running" >&2
+  cat "$WORK/old.log" "$WORK/new.log" >&2
+  exit 1
+fi
+if ! kill -0 "$NEW" 2>/dev/null; then
+  echo "FAIL: the new instance exited" >&2
+  cat "$WORK/old.log" "$WORK/new.log" >&2
+  exit 1
+fi
+if [ "$(cat "$WORK/reflector.pid")" != "$NEW" ]; then
+  echo "FAIL: the new instance didn't take the PID file over" >&2
+  exit 1
+fi
+grep -h 'handoff' "$WORK/old.log" "$WORK/new.log"
+
+RECEIVED=$(cat "$WORK/received")
+if [ "$RECEIVED" -ne "$QUERIES" ]; then
+  echo "FAIL: host B received $RECEIVED of $QUERIES queries" >&2
+  exit 1
+fi
+echo "OK: host B received all $QUERIES queries across the handoff"
@@ -0,0 +1,109 @@
+#!/bin/bash
+# Network namespace smoke test: one reflector in the current namespace reflects between interfaces of two tenant
+# namespaces, named as NETNS:IFNAME. A query sent by a host of tenant A must reach a host of tenant B, also after the
+# interface of tenant B was deleted and created again.
+# Needs root (or a user namespace with CAP_SYS_ADMIN and a writable /run), iproute2 and python3.
+#
+# Usage: hack/netns-test.sh [path/to/mdns-reflector]
+set -euo pipefail
+SELF=$(readlink -f -- "$0")
+HERE=$(dirname -- "$SELF")
+REFLECTOR=$(readlink -f -- "${1:-$HERE/../build/src/mdns-reflector}")
+WORK=$(mktemp -d)
+PREFIX=mr$$
+NAMESPACES=("$PREFIX-tenant-a" "$PREFIX-tenant-b" "$PREFIX-host-a" "$PREFIX-host-b")
+PIDS=()
+
+cleanup() {
+  for pid in "${PIDS[@]}"; do
+    kill "$pid" 2>/dev/null || true
+  done
+  for ns in "${NAMESPACES[@]}"; do
+    ip netns del "$ns" 2>/dev/null || true
+  done
+  rm -rf "$WORK"
+}
+trap cleanup EXIT
+
+for ns in "${NAMESPACES[@]}"; do
+  ip netns add "$ns"
+  ip -n "$ns" link set lo up
+done
+
+# Connect a tenant to its host: lan0 in the tenant namespace, eth0 in the host namespace.
+# $1: tenant letter, $2: tenant number
+connect_tenant() {
+  local tenant=$PREFIX-tenant-$1 host=$PREFIX-host-$1 n=$2
+  ip -n "$tenant" link add lan0 type veth peer name eth0 netns "$host"
+  ip -n "$tenant" addr add "10.$n.0.1/24" dev lan0
+  ip -n "$host" addr add "10.$n.0.2/24" dev eth0
+  ip -n "$tenant" link set lan0 up
+  ip -n "$host" link set eth0 up
+}
+connect_tenant a 1
+connect_tenant b 2
+
+"$REFLECTOR" -fn -l info "$PREFIX-tenant-a:lan0" "$PREFIX-tenant-b:lan0" 2> "$WORK/reflector.log" &
+PIDS+=($!)
+sleep 1
+
+# Send 5 queries from the host of tenant A and count those reaching the host of tenant B.
+# $1: file to write the count to
+send_queries() {
+  ip netns exec "$PREFIX-host-b" python3 - 10.2.0.2 > "$1" <<'PY' &
+import socket, struct, sys
+s = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+s.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+s.bind(('', 5353))
+s.setsockopt(socket.IPPROTO_IP, socket.IP_ADD_MEMBERSHIP, socket.inet_aton('224.0.0.251') + socket.inet_aton(sys.argv[1]))
+s.settimeout(2)
+n = 0
+try:
+    while True:
+        s.recvfrom(9000)
+        n += 1
+except socket.timeout:
+    pass
+print(n)
+PY
+  local listener=$!
+  sleep 0.5
+  ip netns exec "$PREFIX-host-a" python3 - 10.1.0.2 <<'PY'
+import socket, struct, sys
+s = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+s.setsockopt(socket.IPPROTO_IP, socket.IP_MULTICAST_TTL, 255)
+s.setsockopt(socket.IPPROTO_IP, socket.IP_MULTICAST_IF, socket.inet_aton(sys.argv[1]))
+s.bind((sys.argv[1], 5353))
+name = b''.join(bytes([len(label)]) + label.encode() for label in '_netnstest._tcp.local'.split('.')) + b'\0'
+for _ in range(5):
+    s.sendto(struct.pack('!6H', 0, 0, 1, 0, 0, 0) + name + struct.pack('!HH', 12, 1), ('224.0.0.251', 5353))
+PY
+  wait "$listener"
+}
+
+# $1: file with the count, $2: what is checked
+check_received() {
+  local received
+  received=$(cat "$1")
+  if [ "$received" -ne 5 ]; then
+    echo "FAIL: $2: host of tenant B received $received of 5 queries" >&2
+    cat "$WORK/reflector.log" >&2
+    exit 1
+  fi
+  echo "OK: $2: host of tenant B received all 5 queries"
+}
+
+send_queries "$WORK/received"
+check_received "$WORK/received" "across namespaces"
+
+# Hot-plug: the interface of tenant B goes away and comes back with another index.
+ip -n "$PREFIX-tenant-b" link del lan0
+sleep 0.5
+connect_tenant b 2
+sleep 1
+send_queries "$WORK/received-again"
+check_received "$WORK/received-again" "after the interface came back"
+if ! grep -qF "came back" "$WORK/reflector.log"; then
+  echo "FAIL: the reflector did not log the interface coming back" >&2
+  exit 1
+fi
@@ -0,0 +1,119 @@
+#!/bin/bash
+# Relay mode smoke test: two reflectors in separate network namespaces ("sites") joined by a routed link.
+# A query sent by a host at site A must reach a host at site B through the relay.
+# Needs root (or a user namespace with CAP_NET_ADMIN), iproute2 and python3.
+#
+# Usage: hack/relay-test.sh [path/to/mdns-reflector]
+set -euo pipefail
+SELF=$(readlink -f -- "$0")
+HERE=$(dirname -- "$SELF")
+REFLECTOR=$(readlink -f -- "${1:-$HERE/../build/src/mdns-reflector}")
+WORK=$(mktemp -d)
+PREFIX=mr$$
+NAMESPACES=("$PREFIX-site-a" "$PREFIX-site-b" "$PREFIX-host-a" "$PREFIX-host-b")
+PIDS=()
+
+cleanup() {
+  for pid in "${PIDS[@]}"; do
+    kill "$pid" 2>/dev/null || true
+  done
+  for ns in "${NAMESPACES[@]}"; do
+    ip netns del "$ns" 2>/dev/null || true
+  done
+  rm -rf "$WORK"
+}
+trap cleanup EXIT
+
+for ns in "${NAMESPACES[@]}"; do
+  ip netns add "$ns"
+  ip -n "$ns" link set lo up
+done
+
+# Set up one site: a LAN interface to a host namespace, a second (idle) LAN interface, and a WAN address.
+# $1: site letter, $2: site number
+setup_site() {
+  local site=$PREFIX-site-$1 host=$PREFIX-host-$1 n=$2
+  ip -n "$site" link add lan0 type veth peer name eth0 netns "$host"
+  ip -n "$site" link add lan1 type veth peer name lan1p
+  ip -n "$site" addr add "10.$n.0.1/24" dev lan0
+  ip -n "$site" addr add "10.$n.1.1/24" dev lan1
+  ip -n "$host" addr add "10.$n.0.2/24" dev eth0
+  for dev in lan0 lan1 lan1p; do
+    ip -n "$site" link set "$dev" up
+  done
+  ip -n "$host" link set eth0 up
+}
+setup_site a 1
+setup_site b 2
+ip -n "$PREFIX-site-a" link add wan type veth peer name wan netns "$PREFIX-site-b"
+ip -n "$PREFIX-site-a" addr add 192.0.2.1/30 dev wan
+ip -n "$PREFIX-site-b" addr add 192.0.2.2/30 dev wan
+ip -n "$PREFIX-site-a" link set wan up
+ip -n "$PREFIX-site-b" link set wan up
+
+# $1: site letter, $2: local relay address, $3: peer relay address
+start_reflector() {
+  cat > "$WORK/$1.ini" <<INI
+[global]
+family = ipv4
+stats_file = $WORK/$1.stats
+
+[zone lan]
+interfaces = lan0 lan1
+
+[relay remote]
+zone = lan
+local = $2:5380
+peer = $3:5380
+INI
+  ip netns exec "$PREFIX-site-$1" "$REFLECTOR" -fn -l info -c "$WORK/$1.ini" 2> "$WORK/$1.log" &
+  PIDS+=($!)
+}
+start_reflector a 192.0.2.1 192.0.2.2
+start_reflector b 192.0.2.2 192.0.2.1
+sleep 1
+
+ip netns exec "$PREFIX-host-b" python3 - 10.2.0.2 > "$WORK/received" <<'PY' &
+import socket, struct, sys
+s = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+s.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+s.bind(('', 5353))
+s.setsockopt(socket.IPPROTO_IP, socket.IP_ADD_MEMBERSHIP, socket.inet_aton('224.0.0.251') + socket.inet_aton(sys.argv[1]))
+s.settimeout(3)
+n = 0
+try:
+    while True:
+        s.recvfrom(9000)
+        n += 1
+except socket.timeout:
+    pass
+print(n)
+PY
+LISTENER=$!
+sleep 0.5
+
+ip netns exec "$PREFIX-host-a" python3 - 10.1.0.2 <<'PY'
+import socket, struct, sys
+s = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+s.setsockopt(socket.IPPROTO_IP, socket.IP_MULTICAST_TTL, 255)
+s.setsockopt(socket.IPPROTO_IP, socket.IP_MULTICAST_IF, socket.inet_aton(sys.argv[1]))
+s.bind((sys.argv[1], 5353))
+name = b''.join(bytes([len(label)]) + label.encode() for label in '_relaytest._tcp.local'.split('.')) + b'\0'
+for _ in range(5):
+    s.sendto(struct.pack('!6H', 0, 0, 1, 0, 0, 0) + name + struct.pack('!HH', 12, 1), ('224.0.0.251', 5353))
+PY
+
+wait "$LISTENER"
+for pid in "${PIDS[@]}"; do
+  kill -USR1 "$pid"
+done
+sleep 0.5
+grep -h '^relay' "$WORK/a.stats" "$WORK/b.stats"
+
+RECEIVED=$(cat "$WORK/received")
+if [ "$RECEIVED" -ne 5 ]; then
+  echo "FAIL: host at site B received $RECEIVED of 5 queries" >&2
+  cat "$WORK/a.log" "$WORK/b.log" >&2
+  exit 1
+fi
+echo "OK: host at site B received all 5 queries"
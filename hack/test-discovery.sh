@@ -0,0 +1,125 @@
+#!/bin/bash
+# Discovery proxy smoke test: a reflector in one network namespace learns the records a host announces with mDNS,
+# and a client in another namespace browses them with unicast DNS through the proxy.
+# Needs root (or a user namespace with CAP_NET_ADMIN), iproute2, python3 and dig.
+#
+# Usage: hack/test-discovery.sh [path/to/mdns-reflector]
+set -euo pipefail
+SELF=$(readlink -f -- "$0")
+HERE=$(dirname -- "$SELF")
+REFLECTOR=$(readlink -f -- "${1:-$HERE/../build/src/mdns-reflector}")
+WORK=$(mktemp -d)
+PREFIX=mr$$
+NAMESPACES=("$PREFIX-proxy" "$PREFIX-host" "$PREFIX-client")
+PIDS=()
+
+cleanup() {
+  for pid in "${PIDS[@]}"; do
+    kill "$pid" 2>/dev/null || true
+  done
+  for ns in "${NAMESPACES[@]}"; do
+    ip netns del "$ns" 2>/dev/null || true
+  done
+  rm -rf "$WORK"
+}
+trap cleanup EXIT
+
+for ns in "${NAMESPACES[@]}"; do
+  ip netns add "$ns"
+  ip -n "$ns" link set lo up
+done
+
+# The proxy has a LAN interface to the host, a second (idle) LAN interface, and a routed link to the client.
+ip -n "$PREFIX-proxy" link add lan0 type veth peer name eth0 netns "$PREFIX-host"
+ip -n "$PREFIX-proxy" link add lan1 type veth peer name lan1p
+ip -n "$PREFIX-proxy" link add wan type veth peer name eth0 netns "$PREFIX-client"
+ip -n "$PREFIX-proxy" addr add 10.1.0.1/24 dev lan0
+ip -n "$PREFIX-proxy" addr add 10.1.1.1/24 dev lan1
+ip -n "$PREFIX-proxy" addr add 192.0.2.1/30 dev wan
+ip -n "$PREFIX-host" addr add 10.1.0.2/24 dev eth0
+ip -n "$PREFIX-client" addr add 192.0.2.2/30 dev eth0
+for dev in lan0 lan1 lan1p wan; do
+  ip -n "$PREFIX-proxy" link set "$dev" up
+done
+ip -n "$PREFIX-host" link set eth0 up
+ip -n "$PREFIX-client" link set eth0 up
+
+cat > "$WORK/proxy.ini" <<INI
+[global]
+family = ipv4
+
+[zone lan]
+interfaces = lan0 lan1
+
+[discovery test]
+zone = lan
+domain = test.home.arpa
+listen = 192.0.2.1:5300
+INI
+ip netns exec "$PREFIX-proxy" "$REFLECTOR" -fn -l info -c "$WORK/proxy.ini" 2> "$WORK/proxy.log" &
+PIDS+=($!)
+sleep 1
+
+# Announce a printer from the host: PTR, SRV, TXT and A records in one unsolicited response.
+ip netns exec "$PREFIX-host" python3 - 10.1.0.2 <<'PY'
+import socket, struct, sys
+def name(s):
+    return b''.join(bytes([len(label)]) + label.encode() for label in s.split('.')) + b'\0'
+def record(owner, rrtype, ttl, rdata, rrclass=0x8001):
+    return name(owner) + struct.pack('!HHIH', rrtype, rrclass, ttl, len(rdata)) + rdata
+srv = struct.pack('!HHH', 0, 0, 631) + name('printer.local')
+msg = struct.pack('!6H', 0, 0x8400, 0, 4, 0, 0) + \
+      record('_ipp._tcp.local', 12, 4500, name('Printer._ipp._tcp.local'), 1) + \
+      record('Printer._ipp._tcp.local', 33, 120, srv) + \
+      record('Printer._ipp._tcp.local', 16, 4500, b'\x0atxtvers=1') + \
+      record('printer.local', 1, 120, socket.inet_aton(sys.argv[1]))
+s = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+s.setsockopt(socket.IPPROTO_IP, socket.IP_MULTICAST_TTL, 255)
+s.setsockopt(socket.IPPROTO_IP, socket.IP_MULTICAST_IF, socket.inet_aton(sys.argv[1]))
+s.bind((sys.argv[1], 5353))
+s.sendto(msg, ('224.0.0.251', 5353))
+PY
+sleep 0.5
+
+FAILED=0
+# $1: description, $2: expected output, $3...: dig arguments
+check() {
+  local description=$1 expected=$2
+  shift 2
+  local got
+  got=$(ip netns exec "$PREFIX-client" dig @192.0.2.1 -p 5300 +short +time=2 +tries=1 "$@" | tr '\n' ' ' | sed 's/ $//')
+  if [ "$got" = "$expected" ]; then
+    echo "OK: $description"
+  else
+    echo "FAIL: $description: expected '$expected', got '$got'" >&2
+    FAILED=1
+  fi
+}
+check "browse over UDP" "Printer._ipp._tcp.test.home.arpa." _ipp._tcp.test.home.arpa PTR
+check "browse over TCP" "Printer._ipp._tcp.test.home.arpa." +tcp _ipp._tcp.test.home.arpa PTR
+check "resolve the service" "0 0 631 printer.test.home.arpa." Printer._ipp._tcp.test.home.arpa SRV
+check "resolve the host" "10.1.0.2" printer.test.home.arpa A
+
+# The SRV target must be written in full (RFC 2782), although the owner name already holds a suffix of it.
+if ! ip netns exec "$PREFIX-client" python3 - <<'PY'; then
+import socket, struct
+def name(s):
+    return b''.join(bytes([len(label)]) + label.encode() for label in s.split('.')) + b'\0'
+s = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+s.settimeout(2)
+s.sendto(struct.pack('!6H', 1, 0x0100, 1, 0, 0, 0) + name('Printer._ipp._tcp.test.home.arpa') +
+         struct.pack('!HH', 33, 1), ('192.0.2.1', 5300))
+msg = s.recv(65536)
+target = struct.pack('!HHH', 0, 0, 631) + name('printer.test.home.arpa')
+raise SystemExit(0 if target in msg else 1)
+PY
+  echo "FAIL: SRV target is compressed" >&2
+  FAILED=1
+else
+  echo "OK: SRV target is not compressed"
+fi
+
+if [ "$FAILED" -ne 0 ]; then
+  cat "$WORK/proxy.log" >&2
+  exit 1
+fi
@@ -10,6 +10,7 @@ Source0:        %{name}-%{version}.tar.gz
 BuildRequires:  systemd
 BuildRequires:  gcc
 BuildRequires:  make
+BuildRequires:  systemtap-sdt-devel
 %if 0%{?rhel} == 7
 BuildRequires:  cmake3
 %global cmake %{cmake3}
@@ -33,6 +34,14 @@ in a separate LAN but those devices can still be discovered in other LANs.
 mDNS Reflector supports zone based reflection and IPv6.
 
 
+%package devel
+Summary:        static library for embedding the mDNS reflector
+
+%description devel
+The mDNS reflector as a static library, libmdnsreflector.a, with its API in mdnsreflector.h,
+for programs that reflect mDNS in their own event loop.
+
+
 %prep
 %setup -q
 
@@ -58,6 +67,11 @@ install -t $RPM_BUILD_ROOT%{_unitdir} misc/mdns-reflector.service
 %license COPYING
 %doc README.md
 
+%files devel
+%{_libdir}/libmdnsreflector.a
+%{_includedir}/mdnsreflector.h
+%license COPYING
+
 %post
 %systemd_post mdns-reflector.service
 
@@ -0,0 +1,121 @@
+/*
+    This file is part of mDNS Reflector (mdns-reflector), a lightweight and performant multicast DNS (mDNS) reflector.
+    Copyright (C) 2021 Yuxiang Zhu <me@yux.im>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "aggregate.h"
+#include "dns.h"
+#include <stdlib.h>
+#include <string.h>
+
+struct aggregator *new_aggregator(struct reflection_if *rif) {
+    struct aggregator *aggregator = calloc(1, sizeof(struct aggregator));
+    if (!aggregator)
+        return NULL;
+    aggregator->rif = rif;
+    aggregator->max_size = 1500 - 40 - 8;
+    return aggregator;
+}
+
+bool aggregate_eligible(const struct aggregator *aggregator, const uint8_t *msg, size_t len) {
+    struct dns_header header;
+    if (len < DNS_HEADER_SIZE || len > aggregator->max_size)
+        return false;
+    dns_parse_header(msg, &header);
+    return header.id == 0 && (header.flags & DNS_FLAG_QR) && !(header.flags & DNS_FLAG_TC) &&
+           !header.counts[DNS_SECTION_QUESTION];
+}
+
+bool aggregate_has_room(const struct aggregator *aggregator, size_t len) {
+    return aggregator->nmessages < AGGREGATE_MESSAGES_MAX && aggregator->arena_len + len <= AGGREGATE_ARENA_SIZE;
+}
+
+void aggregate_add(struct aggregator *aggregator, const uint8_t *msg, size_t len, int family) {
+    memcpy(aggregator->arena + aggregator->arena_len, msg, len);
+    aggregator->messages[aggregator->nmessages].offset = aggregator->arena_len;
+    aggregator->messages[aggregator->nmessages].len = len;
+    aggregator->nmessages++;
+    aggregator->arena_len += len;
+    aggregator->family = family;
+}
+
+/// Remember a record hash.
+/// \return true if it was seen before
+static bool seen_before(struct aggregator *aggregator, uint64_t hash) {
+    if (!hash)
+        hash = 1;  // 0 marks empty slots
+    for (size_t i = (size_t) hash % AGGREGATE_HASHES;; i = (i + 1) % AGGREGATE_HASHES) {
+        if (aggregator->hashes[i] == hash)
+            return true;
+        if (!aggregator->hashes[i]) {
+            aggregator->hashes[i] = hash;
+            return false;
+        }
+    }
+}
+
+int aggregate_flush(struct aggregator *aggregator, aggregate_emit emit, void *ctx, struct aggregate_result *result) {
+    uint8_t out[AGGREGATE_ARENA_SIZE];
+    struct dns_writer writer;
+    int r = 0;
+    memset(result, 0, sizeof(*result));
+    if (!aggregator->nmessages)
+        return 0;
+    uint16_t flags = (uint16_t) (DNS_FLAG_QR | DNS_FLAG_AA);
+    memset(aggregator->hashes, 0, sizeof(aggregator->hashes));
+    dns_writer_init(&writer, out, aggregator->max_size);
+    for (unsigned int section = DNS_SECTION_ANSWER; section < DNS_SECTIONS; ++section) {
+        for (size_t i = 0; i < aggregator->nmessages; ++i) {
+            const uint8_t *msg = aggregator->arena + aggregator->messages[i].offset;
+            size_t len = aggregator->messages[i].len;
+            struct dns_parser parser;
+            struct dns_record record;
+            dns_parser_init(&parser, msg, len);
+            while (dns_parser_next(&parser, &record) == 1) {
+                if (record.section < section)
+                    continue;
+                if (record.section > section)
+                    break;
+                uint64_t hash;
+                if (dns_record_hash(msg, len, &record, &hash) == -1)
+                    break;
+                if (seen_before(aggregator, hash)) {
+                    result->duplicates++;
+                    continue;
+                }
+                int wr = dns_writer_record(&writer, msg, len, &record);
+                if (wr == -1 && writer.len > DNS_HEADER_SIZE) {
+                    // full: send what we have and continue in a new message
+                    if (emit(ctx, aggregator, out, dns_writer_finish(&writer, 0, flags)) == -1)
+                        r = -1;
+                    result->messages++;
+                    dns_writer_init(&writer, out, aggregator->max_size);
+                    wr = dns_writer_record(&writer, msg, len, &record);
+                }
+                if (wr < 0)
+                    break;
+            }
+        }
+    }
+    if (writer.len > DNS_HEADER_SIZE) {
+        if (emit(ctx, aggregator, out, dns_writer_finish(&writer, 0, flags)) == -1)
+            r = -1;
+        result->messages++;
+    }
+    aggregator->nmessages = 0;
+    aggregator->arena_len = 0;
+    return r;
+}
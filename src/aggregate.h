@@ -0,0 +1,84 @@
+/*
+    This file is part of mDNS Reflector (mdns-reflector), a lightweight and performant multicast DNS (mDNS) reflector.
+    Copyright (C) 2021 Yuxiang Zhu <me@yux.im>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef MDNS_REFLECTOR_AGGREGATE_H
+#define MDNS_REFLECTOR_AGGREGATE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define AGGREGATE_ARENA_SIZE 16384
+#define AGGREGATE_MESSAGES_MAX 32
+/// size of the duplicate detection table; larger than the number of records that fit in the arena
+#define AGGREGATE_HASHES 2048
+
+struct reflection_if;
+
+/// Collects responses to one destination interface during a short window and merges their records into as few
+/// messages as fit the egress MTU. Memory is bounded by the arena; responses that don't fit force an early flush.
+struct aggregator {
+    /// largest message to send, derived from the interface MTU
+    size_t max_size;
+    int family;
+    /// destination interface
+    struct reflection_if *rif;
+    /// whether the aggregator is waiting in the reflector's flush queue
+    bool pending;
+    uint64_t deadline_ns;
+    struct aggregator *next_pending;
+    size_t nmessages;
+    size_t arena_len;
+    struct {
+        size_t offset;
+        size_t len;
+    } messages[AGGREGATE_MESSAGES_MAX];
+    uint8_t arena[AGGREGATE_ARENA_SIZE];
+    uint64_t hashes[AGGREGATE_HASHES];
+};
+
+/// Result of a flush.
+struct aggregate_result {
+    /// messages emitted
+    size_t messages;
+    /// duplicate records removed
+    size_t duplicates;
+};
+
+/// Called for each merged message.
+/// \return 0 on success or -1 to abort the flush
+typedef int (*aggregate_emit)(void *ctx, struct aggregator *aggregator, const uint8_t *msg, size_t len);
+
+struct aggregator *new_aggregator(struct reflection_if *rif);
+
+/// Check whether a message can be aggregated: a multicast response without questions that fits in one message.
+/// Queries, truncated responses and legacy unicast responses are sent immediately.
+bool aggregate_eligible(const struct aggregator *aggregator, const uint8_t *msg, size_t len);
+
+/// Check whether a message fits in the aggregator without flushing it first.
+bool aggregate_has_room(const struct aggregator *aggregator, size_t len);
+
+/// Queue a message. The caller must check aggregate_eligible() and aggregate_has_room() first.
+void aggregate_add(struct aggregator *aggregator, const uint8_t *msg, size_t len, int family);
+
+/// Merge queued messages and emit them. Records are written section by section, and identical records are written
+/// only once. The aggregator is empty afterwards.
+/// \return 0 on success or -1 if `emit` failed
+int aggregate_flush(struct aggregator *aggregator, aggregate_emit emit, void *ctx, struct aggregate_result *result);
+
+#endif //MDNS_REFLECTOR_AGGREGATE_H
@@ -0,0 +1,937 @@
+/*
+    This file is part of mDNS Reflector (mdns-reflector), a lightweight and performant multicast DNS (mDNS) reflector.
+    Copyright (C) 2021 Yuxiang Zhu <me@yux.im>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "config.h"
+#include "logging.h"
+#include "reflection_zone.h"
+#include "iftable.h"
+#include "netns.h"
+#include "rewrite.h"
+#include "hosttable.h"
+#include "aggregate.h"
+#include "heavyhitters.h"
+#include "relay.h"
+#include "discovery.h"
+#include "ha.h"
+#include "interest.h"
+#include "sockaddr.h"
+#include "stats.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <errno.h>
+#include <syslog.h>
+#include <limits.h>
+#include <net/if.h>
+
+#define CONFIG_LINE_MAX 4096
+
+struct zone_config {
+    char name[ZONE_NAME_MAX];
+    bool ipv6;
+    bool ipv4;
+    /// protocols reflected in the zone, a bit per enum protocol_id
+    unsigned int protocols;
+    size_t nifs;
+    char (*ifnames)[IFSPEC_MAX];
+    /// interfaces with multicast-to-unicast conversion
+    size_t nunicast;
+    char (*unicast_ifnames)[IFSPEC_MAX];
+    /// interfaces with response aggregation
+    size_t naggregation;
+    char (*aggregation_ifnames)[IFSPEC_MAX];
+    /// interfaces that are sent to only while hosts listen
+    size_t nlistener;
+    char (*listener_ifnames)[IFSPEC_MAX];
+    /// forward mDNS packets only to interfaces interested in them
+    bool interest;
+};
+
+struct config_parser {
+    const char *path;
+    struct netns_iftables iftables;
+    unsigned int line;
+    struct options *options;
+    bool in_global;
+    struct zone_config *zone;
+    unsigned int next_zone_index;
+    struct rewrite_class *rewrite;
+    struct relay *relay;
+    struct discovery *discovery;
+    bool in_ha;
+};
+
+static char *trim(char *s) {
+    while (isspace((unsigned char) *s))
+        ++s;
+    char *end = s + strlen(s);
+    while (end > s && isspace((unsigned char) end[-1]))
+        --end;
+    *end = '\0';
+    return s;
+}
+
+static int parse_bool(const char *value, bool *result) {
+    if (strcasecmp(value, "yes") == 0 || strcasecmp(value, "true") == 0 || strcasecmp(value, "on") == 0 ||
+        strcmp(value, "1") == 0) {
+        *result = true;
+        return 0;
+    }
+    if (strcasecmp(value, "no") == 0 || strcasecmp(value, "false") == 0 || strcasecmp(value, "off") == 0 ||
+        strcmp(value, "0") == 0) {
+        *result = false;
+        return 0;
+    }
+    return -1;
+}
+
+/// Parse a non-negative integer with an optional k, m or g (powers of 1024) suffix.
+static int parse_size(const char *value, unsigned long max, unsigned long *result) {
+    char *end;
+    errno = 0;
+    unsigned long n = strtoul(value, &end, 10);
+    if (errno || end == value || *value == '-')
+        return -1;
+    unsigned long unit = 1;
+    switch (tolower((unsigned char) *end)) {
+        case 'k':
+            unit = 1024;
+            ++end;
+            break;
+        case 'm':
+            unit = 1024 * 1024;
+            ++end;
+            break;
+        case 'g':
+            unit = 1024 * 1024 * 1024;
+            ++end;
+            break;
+    }
+    if (*end || n > max / unit)
+        return -1;
+    *result = n * unit;
+    return 0;
+}
+
+static int parse_int_size(const char *value, int *result) {
+    unsigned long n;
+    if (parse_size(value, INT_MAX, &n) == -1)
+        return -1;
+    *result = (int) n;
+    return 0;
+}
+
+static int parse_int(const char *value, long min, long max, int *result) {
+    char *end;
+    errno = 0;
+    long n = strtol(value, &end, 10);
+    if (errno || end == value || *end || n < min || n > max)
+        return -1;
+    *result = (int) n;
+    return 0;
+}
+
+static int parse_family(const char *value, bool *ipv6, bool *ipv4) {
+    if (strcmp(value, "both") == 0) {
+        *ipv6 = *ipv4 = true;
+    } else if (strcmp(value, "ipv6") == 0) {
+        *ipv6 = true;
+        *ipv4 = false;
+    } else if (strcmp(value, "ipv4") == 0) {
+        *ipv6 = false;
+        *ipv4 = true;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+static int parse_log_level(const char *value, int *level) {
+    if (strcmp(value, "debug") == 0)
+        *level = LOG_DEBUG;
+    else if (strcmp(value, "info") == 0)
+        *level = LOG_INFO;
+    else if (strcmp(value, "warning") == 0)
+        *level = LOG_WARNING;
+    else if (strcmp(value, "error") == 0)
+        *level = LOG_ERR;
+    else
+        return -1;
+    return 0;
+}
+
+static int add_ifname(char (**ifnames)[IFSPEC_MAX], size_t *nifs, const char *ifname) {
+    if (strlen(ifname) >= IFSPEC_MAX) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    char (*new_ifnames)[IFSPEC_MAX] = realloc(*ifnames, (*nifs + 1) * sizeof(*new_ifnames));
+    if (!new_ifnames)
+        return -1;
+    *ifnames = new_ifnames;
+    snprintf(new_ifnames[(*nifs)++], IFSPEC_MAX, "%s", ifname);
+    return 0;
+}
+
+/// Parse a list of interface names separated by spaces or commas.
+static int parse_ifnames(struct config_parser *parser, char *value, char (**ifnames)[IFSPEC_MAX], size_t *nifs) {
+    for (char *saveptr, *ifname = strtok_r(value, " \t,", &saveptr); ifname;
+         ifname = strtok_r(NULL, " \t,", &saveptr)) {
+        if (add_ifname(ifnames, nifs, ifname) == -1) {
+            log_err(LOG_ERR, "%s:%u: invalid interface '%s'", parser->path, parser->line, ifname);
+            return -2;
+        }
+    }
+    return 0;
+}
+
+static int parse_global_option(struct config_parser *parser, const char *key, const char *value) {
+    struct options *options = parser->options;
+    if (strcmp(key, "log_level") == 0) {
+        int level;
+        if (parse_log_level(value, &level) == -1)
+            return -1;
+        if (!options->log_level_set)
+            options->log_level = level;
+    } else if (strcmp(key, "family") == 0) {
+        bool ipv6, ipv4;
+        if (parse_family(value, &ipv6, &ipv4) == -1)
+            return -1;
+        if (!options->family_set) {
+            options->ipv6_only = !ipv4;
+            options->ipv4_only = !ipv6;
+        }
+    } else if (strcmp(key, "stats_file") == 0) {
+        if (strlen(value) >= MAXPATHLEN)
+            return -1;
+        snprintf(options->stats_file, MAXPATHLEN, "%s", value);
+    } else if (strcmp(key, "handoff_socket") == 0) {
+        if (strlen(value) >= MAXPATHLEN)
+            return -1;
+        snprintf(options->handoff_socket, MAXPATHLEN, "%s", value);
+    } else if (strcmp(key, "socket_rcvbuf") == 0) {
+        return parse_int_size(value, &options->rcvbuf);
+    } else if (strcmp(key, "socket_sndbuf") == 0) {
+        return parse_int_size(value, &options->sndbuf);
+    } else if (strcmp(key, "adaptive_buffers") == 0) {
+        return parse_bool(value, &options->adaptive_buffers);
+    } else if (strcmp(key, "socket_rcvbuf_max") == 0) {
+        return parse_int_size(value, &options->rcvbuf_max);
+    } else if (strcmp(key, "socket_sndbuf_max") == 0) {
+        return parse_int_size(value, &options->sndbuf_max);
+    } else if (strcmp(key, "low_latency") == 0) {
+        return parse_bool(value, &options->low_latency);
+    } else if (strcmp(key, "latency_stats") == 0) {
+        return parse_bool(value, &options->latency_stats);
+    } else if (strcmp(key, "busy_poll_usec") == 0) {
+        return parse_int(value, 0, INT_MAX, &options->busy_poll_usec);
+    } else if (strcmp(key, "spin_budget_usec") == 0) {
+        return parse_int(value, 0, 1000000, &options->spin_budget_usec);
+    } else if (strcmp(key, "cpu") == 0) {
+        return parse_int(value, -1, INT_MAX, &options->cpu);
+    } else if (strcmp(key, "sched_fifo_priority") == 0) {
+        return parse_int(value, 0, 99, &options->sched_fifo_priority);
+    } else if (strcmp(key, "lock_memory") == 0) {
+        return parse_bool(value, &options->lock_memory);
+    } else if (strcmp(key, "ingress_validation") == 0) {
+        return parse_bool(value, &options->ingress_validation);
+    } else if (strcmp(key, "aggregation_window_ms") == 0) {
+        return parse_int(value, 1, 120, &options->aggregation_window_ms);
+    } else if (strcmp(key, "unicast_max_hosts") == 0) {
+        return parse_int(value, 1, HOST_TABLE_MAX, &options->unicast_max_hosts);
+    } else if (strcmp(key, "host_timeout") == 0) {
+        return parse_int(value, 1, INT_MAX, &options->host_timeout_sec);
+    } else if (strcmp(key, "interest_timeout") == 0) {
+        return parse_int(value, 1, INT_MAX, &options->interest_timeout_sec);
+    } else if (strcmp(key, "interest_flood_interval") == 0) {
+        return parse_int(value, 1, INT_MAX, &options->interest_flood_interval_sec);
+    } else if (strcmp(key, "listener_timeout") == 0) {
+        return parse_int(value, 1, INT_MAX, &options->listener_timeout_sec);
+    } else if (strcmp(key, "dualstack_dedup") == 0) {
+        return parse_bool(value, &options->dualstack_dedup);
+    } else if (strcmp(key, "dualstack_window_ms") == 0) {
+        return parse_int(value, 1, 5000, &options->dualstack_window_ms);
+    } else if (strcmp(key, "recompress") == 0) {
+        return parse_bool(value, &options->recompress);
+    } else if (strcmp(key, "recompress_min_saving") == 0) {
+        return parse_int(value, 1, 65535, &options->recompress_min_saving);
+    } else if (strcmp(key, "stall_threshold_ms") == 0) {
+        return parse_int(value, 0, 60000, &options->stall_threshold_ms);
+    } else if (strcmp(key, "heavy_hitters") == 0) {
+        return parse_bool(value, &options->heavy_hitters);
+    } else if (strcmp(key, "heavy_hitters_top") == 0) {
+        return parse_int(value, 1, HEAVY_HITTERS_CAPACITY, &options->heavy_hitters_top);
+    } else if (strcmp(key, "heavy_hitters_half_life") == 0) {
+        return parse_int(value, 1, INT_MAX, &options->heavy_hitters_half_life_sec);
+    } else if (strcmp(key, "tx_threads") == 0) {
+        return parse_int(value, 0, TX_THREADS_MAX, &options->tx_threads);
+    } else if (strcmp(key, "tx_ring_size") == 0) {
+        int size;
+        if (parse_int(value, 16, 4096, &size) == -1 || (size & (size - 1)))
+            return -1;
+        options->tx_ring_size = size;
+    } else {
+        log_msg(LOG_ERR, "%s:%u: unknown option '%s' in global section", parser->path, parser->line, key);
+        errno = EINVAL;
+        return -2;
+    }
+    return 0;
+}
+
+static int parse_zone_option(struct config_parser *parser, const char *key, char *value) {
+    struct zone_config *zone = parser->zone;
+    if (strcmp(key, "interfaces") == 0) {
+        return parse_ifnames(parser, value, &zone->ifnames, &zone->nifs);
+    } else if (strcmp(key, "unicast_conversion") == 0) {
+        return parse_ifnames(parser, value, &zone->unicast_ifnames, &zone->nunicast);
+    } else if (strcmp(key, "aggregation") == 0) {
+        return parse_ifnames(parser, value, &zone->aggregation_ifnames, &zone->naggregation);
+    } else if (strcmp(key, "listener_awareness") == 0) {
+        return parse_ifnames(parser, value, &zone->listener_ifnames, &zone->nlistener);
+    } else if (strcmp(key, "family") == 0) {
+        if (parse_family(value, &zone->ipv6, &zone->ipv4) == -1)
+            return -1;
+    } else if (strcmp(key, "interest_forwarding") == 0) {
+        return parse_bool(value, &zone->interest);
+    } else if (strcmp(key, "protocols") == 0) {
+        char *saveptr;
+        zone->protocols = 0;
+        for (char *name = strtok_r(value, " \t,", &saveptr); name; name = strtok_r(NULL, " \t,", &saveptr)) {
+            const struct protocol *protocol = protocol_find(name);
+            if (!protocol)
+                return -1;
+            zone->protocols |= 1u << protocol->id;
+        }
+        if (!zone->protocols)
+            return -1;
+    } else {
+        log_msg(LOG_ERR, "%s:%u: unknown option '%s' in zone %s", parser->path, parser->line, key, zone->name);
+        errno = EINVAL;
+        return -2;
+    }
+    return 0;
+}
+
+static int parse_rewrite_option(struct config_parser *parser, const char *key, char *value) {
+    struct rewrite_class *rc = parser->rewrite;
+    char *saveptr;
+    if (strcmp(key, "interfaces") == 0) {
+        return parse_ifnames(parser, value, &rc->ifnames, &rc->nifnames);
+    } else if (strcmp(key, "drop_aaaa") == 0) {
+        for (char *range = strtok_r(value, " \t,", &saveptr); range; range = strtok_r(NULL, " \t,", &saveptr)) {
+            if (strcmp(range, "link-local") == 0)
+                rc->drop_aaaa_link_local = true;
+            else if (strcmp(range, "ula") == 0)
+                rc->drop_aaaa_ula = true;
+            else
+                return -1;
+        }
+    } else if (strcmp(key, "a_prefixes") == 0) {
+        for (char *prefix = strtok_r(value, " \t,", &saveptr); prefix; prefix = strtok_r(NULL, " \t,", &saveptr)) {
+            if (rc->nprefixes4 >= REWRITE_PREFIXES_MAX) {
+                log_msg(LOG_ERR, "%s:%u: too many prefixes (limit is %d)", parser->path, parser->line,
+                        REWRITE_PREFIXES_MAX);
+                return -2;
+            }
+            if (parse_ipv4_prefix(prefix, &rc->prefixes4[rc->nprefixes4]) == -1) {
+                log_msg(LOG_ERR, "%s:%u: invalid prefix '%s'", parser->path, parser->line, prefix);
+                return -2;
+            }
+            rc->nprefixes4++;
+        }
+    } else {
+        log_msg(LOG_ERR, "%s:%u: unknown option '%s' in rewrite class %s", parser->path, parser->line, key, rc->name);
+        errno = EINVAL;
+        return -2;
+    }
+    return 0;
+}
+
+static int parse_relay_option(struct config_parser *parser, const char *key, char *value) {
+    struct relay *relay = parser->relay;
+    int n;
+    if (strcmp(key, "zone") == 0) {
+        if (!*value || strlen(value) >= ZONE_NAME_MAX)
+            return -1;
+        snprintf(relay->zone_name, sizeof(relay->zone_name), "%s", value);
+    } else if (strcmp(key, "local") == 0) {
+        return sockaddr_parse(value, &relay->local);
+    } else if (strcmp(key, "peer") == 0) {
+        return sockaddr_parse(value, &relay->peer);
+    } else if (strcmp(key, "max_datagram") == 0) {
+        if (parse_int(value, 512, RELAY_DATAGRAM_MAX, &n) == -1)
+            return -1;
+        relay->max_datagram = (size_t) n;
+    } else if (strcmp(key, "batch_ms") == 0) {
+        return parse_int(value, 0, 100, &relay->batch_ms);
+    } else if (strcmp(key, "dedup") == 0) {
+        return parse_bool(value, &relay->dedup);
+    } else if (strcmp(key, "dedup_ms") == 0) {
+        return parse_int(value, 1, 60000, &relay->dedup_ms);
+    } else {
+        log_msg(LOG_ERR, "%s:%u: unknown option '%s' in relay %s", parser->path, parser->line, key, relay->name);
+        errno = EINVAL;
+        return -2;
+    }
+    return 0;
+}
+
+static int parse_discovery_option(struct config_parser *parser, const char *key, char *value) {
+    struct discovery *discovery = parser->discovery;
+    int n;
+    if (strcmp(key, "zone") == 0) {
+        if (!*value || strlen(value) >= ZONE_NAME_MAX)
+            return -1;
+        snprintf(discovery->zone_name, sizeof(discovery->zone_name), "%s", value);
+    } else if (strcmp(key, "domain") == 0) {
+        return discovery_set_domain(discovery, value);
+    } else if (strcmp(key, "listen") == 0) {
+        return sockaddr_parse(value, &discovery->listen);
+    } else if (strcmp(key, "max_records") == 0) {
+        if (parse_int(value, 16, 1 << 20, &n) == -1)
+            return -1;
+        discovery->max_records = (size_t) n;
+    } else if (strcmp(key, "query_on_demand") == 0) {
+        return parse_bool(value, &discovery->query_on_demand);
+    } else if (strcmp(key, "query_wait_ms") == 0) {
+        return parse_int(value, 0, 5000, &discovery->query_wait_ms);
+    } else {
+        log_msg(LOG_ERR, "%s:%u: unknown option '%s' in discovery proxy %s", parser->path, parser->line, key,
+                discovery->name);
+        errno = EINVAL;
+        return -2;
+    }
+    return 0;
+}
+
+static int parse_ha_option(struct config_parser *parser, const char *key, char *value) {
+    struct ha *ha = parser->options->ha;
+    if (strcmp(key, "local") == 0) {
+        return sockaddr_parse(value, &ha->local);
+    } else if (strcmp(key, "peer") == 0) {
+        return sockaddr_parse(value, &ha->peer);
+    } else if (strcmp(key, "priority") == 0) {
+        return parse_int(value, 1, 255, &ha->priority);
+    } else if (strcmp(key, "heartbeat_ms") == 0) {
+        return parse_int(value, 10, 10000, &ha->heartbeat_ms);
+    } else if (strcmp(key, "failover_ms") == 0) {
+        return parse_int(value, 20, 60000, &ha->failover_ms);
+    } else if (strcmp(key, "preempt") == 0) {
+        return parse_bool(value, &ha->preempt);
+    } else if (strcmp(key, "sync_fingerprints") == 0) {
+        return parse_bool(value, &ha->sync);
+    } else {
+        log_msg(LOG_ERR, "%s:%u: unknown option '%s' in ha", parser->path, parser->line, key);
+        errno = EINVAL;
+        return -2;
+    }
+}
+
+/// Check the high availability pairing.
+static int check_ha(const struct ha *ha) {
+    if (!ha)
+        return 0;
+    if (!ha->local.ss_family || !ha->peer.ss_family) {
+        log_msg(LOG_ERR, "ha needs local and peer");
+        return -1;
+    }
+    if (ha->local.ss_family != ha->peer.ss_family) {
+        log_msg(LOG_ERR, "local and peer addresses of ha are of different families");
+        return -1;
+    }
+    if (ha->failover_ms < 2 * ha->heartbeat_ms) {
+        log_msg(LOG_ERR, "failover_ms of ha must be at least twice heartbeat_ms");
+        return -1;
+    }
+    return 0;
+}
+
+/// Check relays and resolve the zones they relay.
+static int check_relays(struct options *options) {
+    for (struct relay *relay = options->relays; relay; relay = relay->next) {
+        if (!relay->zone_name[0] || !relay->local.ss_family || !relay->peer.ss_family) {
+            log_msg(LOG_ERR, "relay %s needs zone, local and peer", relay->name);
+            return -1;
+        }
+        if (relay->local.ss_family != relay->peer.ss_family) {
+            log_msg(LOG_ERR, "local and peer addresses of relay %s are of different families", relay->name);
+            return -1;
+        }
+        const struct reflection_zone *rz = find_reflection_zone(options->rz_list6, relay->zone_name);
+        if (!rz)
+            rz = find_reflection_zone(options->rz_list4, relay->zone_name);
+        if (!rz) {
+            log_msg(LOG_ERR, "unknown zone %s in relay %s", relay->zone_name, relay->name);
+            return -1;
+        }
+        relay->zone_index = rz->zone_index;
+    }
+    return 0;
+}
+
+/// Check discovery proxies, resolve their zones and allocate their record stores.
+static int check_discoveries(struct options *options) {
+    for (struct discovery *discovery = options->discoveries; discovery; discovery = discovery->next) {
+        if (!discovery->zone_name[0] || !discovery->domain_len || !discovery->listen.ss_family) {
+            log_msg(LOG_ERR, "discovery proxy %s needs zone, domain and listen", discovery->name);
+            return -1;
+        }
+        const struct reflection_zone *rz = find_reflection_zone(options->rz_list6, discovery->zone_name);
+        if (!rz)
+            rz = find_reflection_zone(options->rz_list4, discovery->zone_name);
+        if (!rz) {
+            log_msg(LOG_ERR, "unknown zone %s in discovery proxy %s", discovery->zone_name, discovery->name);
+            return -1;
+        }
+        discovery->zone_index = rz->zone_index;
+        if (record_store_init(&discovery->store, discovery->max_records) == -1) {
+            log_err(LOG_ERR, "can't malloc");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/// Attach destination classes to the interfaces they list.
+static int assign_rewrite_class(struct reflection_zone *rz_list, const struct rewrite_class *rc, const char *ifname,
+                                bool *found) {
+    for (struct reflection_zone *rz = rz_list; rz; rz = rz->next) {
+        for (struct reflection_if *rif = rz->first_if; rif; rif = rif->next) {
+            if (strcmp(rif->ifname, ifname) != 0 || rif->protocol->id != PROTOCOL_MDNS)
+                continue;
+            if (rif->rewrite && rif->rewrite != rc) {
+                log_msg(LOG_ERR, "interface %s is in both rewrite classes %s and %s", ifname, rif->rewrite->name,
+                        rc->name);
+                return -1;
+            }
+            rif->rewrite = rc;
+            *found = true;
+        }
+    }
+    return 0;
+}
+
+/// Attach destination classes to the interfaces they list.
+static int assign_rewrite_classes(struct options *options) {
+    for (const struct rewrite_class *rc = options->rewrite_classes; rc; rc = rc->next) {
+        for (size_t i = 0; i < rc->nifnames; ++i) {
+            bool found = false;
+            if (assign_rewrite_class(options->rz_list6, rc, rc->ifnames[i], &found) == -1 ||
+                assign_rewrite_class(options->rz_list4, rc, rc->ifnames[i], &found) == -1)
+                return -1;
+            if (!found) {
+                log_msg(LOG_ERR, "interface %s of rewrite class %s is not in any zone", rc->ifnames[i], rc->name);
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+static bool has_ifname(char (*ifnames)[IFSPEC_MAX], size_t nifs, const char *ifname) {
+    for (size_t i = 0; i < nifs; ++i) {
+        if (strcmp(ifnames[i], ifname) == 0)
+            return true;
+    }
+    return false;
+}
+
+static int add_reflection_zone(struct config_parser *parser, struct zone_config *zone, bool ipv6) {
+    struct options *options = parser->options;
+    struct reflection_zone **rz_list = ipv6 ? &options->rz_list6 : &options->rz_list4;
+    struct reflection_zone *rz = new_reflection_zone(parser->next_zone_index, zone->name, *rz_list);
+    if (!rz) {
+        log_err(LOG_ERR, "%s: can't malloc", parser->path);
+        return -1;
+    }
+    *rz_list = rz;
+    rz->protocols = zone->protocols;
+    if (zone->interest && (zone->protocols & 1u << PROTOCOL_MDNS) && !(rz->interest = new_interest_table())) {
+        log_err(LOG_ERR, "%s: can't malloc", parser->path);
+        return -1;
+    }
+    for (size_t i = 0; i < zone->nifs; ++i) {
+        const struct netns_iftable *table;
+        const struct iftable_entry *entry = netns_iftables_find(&parser->iftables, zone->ifnames[i], &table);
+        if (!entry) {
+            log_msg(LOG_ERR, "%s: unknown interface %s in zone %s", parser->path, zone->ifnames[i], zone->name);
+            return -1;
+        }
+        for (unsigned int p = 0; p < PROTOCOLS; ++p) {
+            if (!(zone->protocols & 1u << p))
+                continue;
+            struct reflection_if *rif = netns_new_reflection_if(table, entry, rz);
+            if (!rif) {
+                log_err(LOG_ERR, "%s: can't malloc", parser->path);
+                return -1;
+            }
+            rif->protocol = &protocols[p];
+            rif->listener_aware = has_ifname(zone->listener_ifnames, zone->nlistener, rif->ifname);
+            // IGMP and MLD reports are only received in the reflector's own namespace
+            if (rif->listener_aware && rif->netns_slot) {
+                log_msg(LOG_ERR, "%s: listener_awareness is not supported for interface %s in another network "
+                                 "namespace", parser->path, rif->ifname);
+                return -1;
+            }
+            // unicast conversion and aggregation are mDNS features
+            if (p != PROTOCOL_MDNS)
+                continue;
+            if ((has_ifname(zone->unicast_ifnames, zone->nunicast, rif->ifname) &&
+                 !(rif->hosts = new_host_table())) ||
+                (has_ifname(zone->aggregation_ifnames, zone->naggregation, rif->ifname) &&
+                 !(rif->aggregator = new_aggregator(rif)))) {
+                log_err(LOG_ERR, "%s: can't malloc", parser->path);
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+/// Check that interfaces listed in a per-interface zone option are members of the zone.
+static int check_zone_ifnames(struct config_parser *parser, const struct zone_config *zone,
+                              char (*ifnames)[IFSPEC_MAX], size_t nifs, const char *option) {
+    for (size_t i = 0; i < nifs; ++i) {
+        if (!has_ifname(zone->ifnames, zone->nifs, ifnames[i])) {
+            log_msg(LOG_ERR, "%s: %s interface %s is not in zone %s", parser->path, option, ifnames[i], zone->name);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int finish_zone(struct config_parser *parser) {
+    struct zone_config *zone = parser->zone;
+    if (!zone)
+        return 0;
+    parser->zone = NULL;
+    int r = 0;
+    struct options *options = parser->options;
+    if (check_zone_ifnames(parser, zone, zone->unicast_ifnames, zone->nunicast, "unicast_conversion") == -1 ||
+        check_zone_ifnames(parser, zone, zone->aggregation_ifnames, zone->naggregation, "aggregation") == -1 ||
+        check_zone_ifnames(parser, zone, zone->listener_ifnames, zone->nlistener, "listener_awareness") == -1)
+        r = -1;
+    if (r == 0 && zone->ipv6 && !options->ipv4_only && add_reflection_zone(parser, zone, true) == -1)
+        r = -1;
+    if (r == 0 && zone->ipv4 && !options->ipv6_only && add_reflection_zone(parser, zone, false) == -1)
+        r = -1;
+    parser->next_zone_index++;
+    free(zone->ifnames);
+    free(zone->unicast_ifnames);
+    free(zone->aggregation_ifnames);
+    free(zone->listener_ifnames);
+    free(zone);
+    return r;
+}
+
+static int parse_rewrite_section(struct config_parser *parser, const char *name) {
+    struct options *options = parser->options;
+    if (!*name || strlen(name) >= REWRITE_CLASS_NAME_MAX)
+        return -1;
+    unsigned int nclasses = 0;
+    for (const struct rewrite_class *rc = options->rewrite_classes; rc; rc = rc->next, ++nclasses) {
+        if (strcmp(rc->name, name) == 0) {
+            log_msg(LOG_ERR, "%s:%u: duplicate rewrite class %s", parser->path, parser->line, name);
+            return -2;
+        }
+    }
+    if (nclasses >= REWRITE_CLASSES_MAX) {
+        log_msg(LOG_ERR, "%s:%u: too many rewrite classes (limit is %d)", parser->path, parser->line,
+                REWRITE_CLASSES_MAX);
+        return -2;
+    }
+    struct rewrite_class *rc = new_rewrite_class(nclasses, name, options->rewrite_classes);
+    if (!rc) {
+        log_err(LOG_ERR, "%s: can't malloc", parser->path);
+        return -2;
+    }
+    options->rewrite_classes = rc;
+    parser->rewrite = rc;
+    return 0;
+}
+
+static int parse_relay_section(struct config_parser *parser, const char *name) {
+    struct options *options = parser->options;
+    if (!*name || strlen(name) >= RELAY_NAME_MAX)
+        return -1;
+    for (const struct relay *relay = options->relays; relay; relay = relay->next) {
+        if (strcmp(relay->name, name) == 0) {
+            log_msg(LOG_ERR, "%s:%u: duplicate relay %s", parser->path, parser->line, name);
+            return -2;
+        }
+    }
+    struct relay *relay = new_relay(name, options->relays);
+    if (!relay) {
+        log_err(LOG_ERR, "%s: can't malloc", parser->path);
+        return -2;
+    }
+    options->relays = relay;
+    parser->relay = relay;
+    return 0;
+}
+
+static int parse_discovery_section(struct config_parser *parser, const char *name) {
+    struct options *options = parser->options;
+    if (!*name || strlen(name) >= DISCOVERY_NAME_MAX)
+        return -1;
+    for (const struct discovery *discovery = options->discoveries; discovery; discovery = discovery->next) {
+        if (strcmp(discovery->name, name) == 0) {
+            log_msg(LOG_ERR, "%s:%u: duplicate discovery proxy %s", parser->path, parser->line, name);
+            return -2;
+        }
+    }
+    struct discovery *discovery = new_discovery(name, options->discoveries);
+    if (!discovery) {
+        log_err(LOG_ERR, "%s: can't malloc", parser->path);
+        return -2;
+    }
+    options->discoveries = discovery;
+    parser->discovery = discovery;
+    return 0;
+}
+
+static int parse_ha_section(struct config_parser *parser) {
+    struct options *options = parser->options;
+    if (options->ha) {
+        log_msg(LOG_ERR, "%s:%u: duplicate ha section", parser->path, parser->line);
+        return -2;
+    }
+    options->ha = new_ha();
+    if (!options->ha) {
+        log_err(LOG_ERR, "%s: can't malloc", parser->path);
+        return -2;
+    }
+    parser->in_ha = true;
+    return 0;
+}
+
+static int parse_section(struct config_parser *parser, char *section) {
+    if (finish_zone(parser) == -1)
+        return -2;
+    section = trim(section);
+    parser->in_global = false;
+    parser->rewrite = NULL;
+    parser->relay = NULL;
+    parser->discovery = NULL;
+    parser->in_ha = false;
+    if (strcmp(section, "global") == 0) {
+        // zones are set up as soon as they end, so later global options would not apply to them
+        if (parser->next_zone_index) {
+            log_msg(LOG_ERR, "%s:%u: the global section must come before zone sections", parser->path, parser->line);
+            return -2;
+        }
+        parser->in_global = true;
+        return 0;
+    }
+    if (strcmp(section, "ha") == 0)
+        return parse_ha_section(parser);
+    if (strncmp(section, "rewrite", 7) == 0 && isspace((unsigned char) section[7]))
+        return parse_rewrite_section(parser, trim(section + 7));
+    if (strncmp(section, "relay", 5) == 0 && isspace((unsigned char) section[5]))
+        return parse_relay_section(parser, trim(section + 5));
+    if (strncmp(section, "discovery", 9) == 0 && isspace((unsigned char) section[9]))
+        return parse_discovery_section(parser, trim(section + 9));
+    if (strncmp(section, "zone", 4) != 0 || !isspace((unsigned char) section[4]))
+        return -1;
+    const char *name = trim(section + 4);
+    if (!*name || strlen(name) >= ZONE_NAME_MAX)
+        return -1;
+    if (find_reflection_zone(parser->options->rz_list6, name) ||
+        find_reflection_zone(parser->options->rz_list4, name)) {
+        log_msg(LOG_ERR, "%s:%u: duplicate zone %s", parser->path, parser->line, name);
+        return -2;
+    }
+    struct zone_config *zone = calloc(1, sizeof(struct zone_config));
+    if (!zone) {
+        log_err(LOG_ERR, "%s: can't malloc", parser->path);
+        return -2;
+    }
+    snprintf(zone->name, ZONE_NAME_MAX, "%s", name);
+    zone->ipv6 = true;
+    zone->ipv4 = true;
+    zone->protocols = 1u << PROTOCOL_MDNS;
+    parser->zone = zone;
+    return 0;
+}
+
+static int parse_line(struct config_parser *parser, char *line) {
+    char *comment = strpbrk(line, "#;");
+    if (comment)
+        *comment = '\0';
+    line = trim(line);
+    if (!*line)
+        return 0;
+    if (*line == '[') {
+        char *end = strchr(line, ']');
+        if (!end || end[1])
+            return -1;
+        *end = '\0';
+        return parse_section(parser, line + 1);
+    }
+    char *eq = strchr(line, '=');
+    if (!eq)
+        return -1;
+    *eq = '\0';
+    char *key = trim(line);
+    char *value = trim(eq + 1);
+    int r;
+    if (parser->zone) {
+        r = parse_zone_option(parser, key, value);
+    } else if (parser->rewrite) {
+        r = parse_rewrite_option(parser, key, value);
+    } else if (parser->relay) {
+        r = parse_relay_option(parser, key, value);
+    } else if (parser->discovery) {
+        r = parse_discovery_option(parser, key, value);
+    } else if (parser->in_ha) {
+        r = parse_ha_option(parser, key, value);
+    } else if (parser->in_global) {
+        r = parse_global_option(parser, key, value);
+    } else {
+        log_msg(LOG_ERR, "%s:%u: option '%s' outside of a section", parser->path, parser->line, key);
+        return -2;
+    }
+    if (r == -1) {
+        log_msg(LOG_ERR, "%s:%u: invalid value '%s' for option '%s'", parser->path, parser->line, value, key);
+        return -2;
+    }
+    return r;
+}
+
+static void free_parser(struct config_parser *parser) {
+    if (parser->zone) {
+        free(parser->zone->ifnames);
+        free(parser->zone->unicast_ifnames);
+        free(parser->zone->aggregation_ifnames);
+        free(parser->zone->listener_ifnames);
+        free(parser->zone);
+    }
+    netns_iftables_free(&parser->iftables);
+}
+
+int load_config(const char *path, struct options *options) {
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        log_err(LOG_ERR, "can't open configuration file %s", path);
+        return -1;
+    }
+    struct config_parser parser = {
+            .path = path,
+            .options = options,
+    };
+    char line[CONFIG_LINE_MAX];
+    int r = 0;
+    while (fgets(line, sizeof(line), file)) {
+        parser.line++;
+        int pr = parse_line(&parser, line);
+        if (pr == -1)
+            log_msg(LOG_ERR, "%s:%u: syntax error", path, parser.line);
+        if (pr < 0) {
+            r = -1;
+            break;
+        }
+    }
+    if (r == 0 && ferror(file)) {
+        log_err(LOG_ERR, "can't read configuration file %s", path);
+        r = -1;
+    }
+    if (r == 0 && finish_zone(&parser) == -1)
+        r = -1;
+    if (r == 0 && assign_rewrite_classes(options) == -1)
+        r = -1;
+    if (r == 0 && check_relays(options) == -1)
+        r = -1;
+    if (r == 0 && check_discoveries(options) == -1)
+        r = -1;
+    if (r == 0 && check_ha(options->ha) == -1)
+        r = -1;
+    free_parser(&parser);
+    fclose(file);
+    return r;
+}
+
+void options_init(struct options *options) {
+    memset(options, 0, sizeof(struct options));
+    options->log_level = LOG_WARNING;
+    options->rcvbuf_max = 4 * 1024 * 1024;
+    options->sndbuf_max = 4 * 1024 * 1024;
+    options->busy_poll_usec = 50;
+    options->spin_budget_usec = 200;
+    options->cpu = -1;
+    options->unicast_max_hosts = 4;
+    options->host_timeout_sec = 600;
+    options->interest_timeout_sec = 3600;
+    options->interest_flood_interval_sec = 60;
+    options->listener_timeout_sec = 600;
+    options->dualstack_window_ms = 250;
+    options->recompress_min_saving = 16;
+    options->ingress_validation = true;
+    options->aggregation_window_ms = 20;
+    options->heavy_hitters_top = 10;
+    options->heavy_hitters_half_life_sec = 60;
+    options->tx_ring_size = 256;
+    options->stall_threshold_ms = 100;
+}
+
+int set_global_option(struct options *options, const char *key, const char *value) {
+    struct config_parser parser = {
+            .path = "option",
+            .options = options,
+    };
+    int r = parse_global_option(&parser, key, value);
+    if (r == -1)
+        log_msg(LOG_ERR, "invalid value '%s' for option '%s'", value, key);
+    return r < 0 ? -1 : 0;
+}
+
+int add_zone(struct options *options, const char *name, const char *const *settings, size_t nsettings) {
+    struct config_parser parser = {
+            .path = "zone settings",
+            .options = options,
+    };
+    // zones of both families share their index
+    const struct reflection_zone *lists[] = {options->rz_list6, options->rz_list4};
+    for (size_t i = 0; i < 2; ++i) {
+        for (const struct reflection_zone *rz = lists[i]; rz; rz = rz->next) {
+            if (rz->zone_index >= parser.next_zone_index)
+                parser.next_zone_index = rz->zone_index + 1;
+        }
+    }
+    char line[CONFIG_LINE_MAX];
+    snprintf(line, sizeof(line), "zone %s", name);
+    int r = parse_section(&parser, line);
+    if (r == -1)
+        log_msg(LOG_ERR, "invalid zone name '%s'", name);
+    for (size_t i = 0; i < nsettings && r == 0; ++i) {
+        parser.line = (unsigned int) i + 1;
+        if ((size_t) snprintf(line, sizeof(line), "%s", settings[i]) >= sizeof(line) || strchr(line, '[')) {
+            log_msg(LOG_ERR, "%s:%u: invalid setting", parser.path, parser.line);
+            r = -1;
+            break;
+        }
+        r = parse_line(&parser, line);
+        if (r == -1)
+            log_msg(LOG_ERR, "%s:%u: syntax error", parser.path, parser.line);
+    }
+    if (r == 0)
+        r = finish_zone(&parser);
+    free_parser(&parser);
+    return r < 0 ? -1 : 0;
+}
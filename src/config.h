@@ -0,0 +1,53 @@
+/*
+    This file is part of mDNS Reflector (mdns-reflector), a lightweight and performant multicast DNS (mDNS) reflector.
+    Copyright (C) 2021 Yuxiang Zhu <me@yux.im>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef MDNS_REFLECTOR_CONFIG_H
+#define MDNS_REFLECTOR_CONFIG_H
+
+#include "options.h"
+
+/// Load reflection zones and settings from a configuration file.
+///
+/// The file is INI-like. A `[global]` section holds daemon-wide settings and every `[zone NAME]`
+/// section describes one reflection zone:
+///
+///     [global]
+///     log_level = info
+///
+///     [zone lan]
+///     interfaces = br-lan0 br-lan1
+///     family = both
+///
+/// \param path configuration file path
+/// \param options options to fill in; zone lists must be empty
+/// \return 0 on success or -1 on error
+int load_config(const char *path, struct options *options);
+
+/// Set options to their defaults.
+void options_init(struct options *options);
+
+/// Set a daemon-wide option as if it were in the `[global]` section of a configuration file.
+/// \return 0 on success or -1 if the option is unknown or the value is invalid
+int set_global_option(struct options *options, const char *key, const char *value);
+
+/// Add a reflection zone as if it were a `[zone NAME]` section of a configuration file.
+/// \param settings lines of the section, such as "interfaces = br-lan0 br-lan1"
+/// \return 0 on success or -1 on error
+int add_zone(struct options *options, const char *name, const char *const *settings, size_t nsettings);
+
+#endif //MDNS_REFLECTOR_CONFIG_H
@@ -0,0 +1,581 @@
+/*
+    This file is part of mDNS Reflector (mdns-reflector), a lightweight and performant multicast DNS (mDNS) reflector.
+    Copyright (C) 2021 Yuxiang Zhu <me@yux.im>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "discovery.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NS_PER_SEC 1000000000u
+/// "local" in wire format, including the root label
+static const uint8_t LOCAL_DOMAIN[] = "\x05local";
+#define LOCAL_DOMAIN_LEN 7
+/// most answer and additional records in one response
+#define ANSWER_RECORDS_MAX 64
+
+struct cached_record {
+    uint64_t name_hash;
+    uint64_t learned_ns;
+    uint64_t expire_ns;
+    uint16_t type;
+    /// class without the cache-flush bit
+    uint16_t rrclass;
+    uint16_t rdlength;
+    uint16_t name_len;
+    struct cached_record *bucket_next;
+    struct cached_record *older, *newer;
+    /// owner name, then RDATA with names uncompressed
+    uint8_t data[];
+};
+
+static const uint8_t *record_rdata(const struct cached_record *rec) {
+    return rec->data + rec->name_len;
+}
+
+struct discovery *new_discovery(const char *name, struct discovery *list) {
+    struct discovery *discovery = calloc(1, sizeof(struct discovery));
+    if (!discovery)
+        return NULL;
+    snprintf(discovery->name, sizeof(discovery->name), "%s", name);
+    discovery->max_records = 4096;
+    discovery->query_on_demand = true;
+    discovery->query_wait_ms = 500;
+    discovery->udp_fd = -1;
+    discovery->tcp_fd = -1;
+    for (size_t i = 0; i < DISCOVERY_TCP_CONNECTIONS_MAX; ++i)
+        discovery->conns[i].fd = -1;
+    discovery->next = list;
+    return discovery;
+}
+
+void free_discoveries(struct discovery *list) {
+    while (list) {
+        struct discovery *next = list->next;
+        record_store_free(&list->store);
+        free(list);
+        list = next;
+    }
+}
+
+int discovery_set_domain(struct discovery *discovery, const char *domain) {
+    size_t n = 0;
+    const char *label = domain;
+    while (*label) {
+        const char *dot = strchr(label, '.');
+        size_t label_len = dot ? (size_t) (dot - label) : strlen(label);
+        if (!label_len || label_len > 63 || n + 1 + label_len + 1 > DNS_NAME_MAX)
+            return -1;
+        discovery->domain[n++] = (uint8_t) label_len;
+        memcpy(discovery->domain + n, label, label_len);
+        n += label_len;
+        label += label_len + (dot ? 1 : 0);
+    }
+    if (!n)
+        return -1;
+    discovery->domain[n++] = 0;
+    discovery->domain_len = n;
+    snprintf(discovery->domain_text, sizeof(discovery->domain_text), "%s", domain);
+    return 0;
+}
+
+int record_store_init(struct record_store *store, size_t max_records) {
+    memset(store, 0, sizeof(*store));
+    store->max_records = max_records;
+    store->nbuckets = 16;
+    while (store->nbuckets < max_records)
+        store->nbuckets <<= 1;
+    store->buckets = calloc(store->nbuckets, sizeof(struct cached_record *));
+    return store->buckets ? 0 : -1;
+}
+
+void record_store_free(struct record_store *store) {
+    struct cached_record *rec = store->oldest;
+    while (rec) {
+        struct cached_record *next = rec->newer;
+        free(rec);
+        rec = next;
+    }
+    free(store->buckets);
+    memset(store, 0, sizeof(*store));
+}
+
+static void unlink_age(struct record_store *store, struct cached_record *rec) {
+    if (rec->older)
+        rec->older->newer = rec->newer;
+    else
+        store->oldest = rec->newer;
+    if (rec->newer)
+        rec->newer->older = rec->older;
+    else
+        store->newest = rec->older;
+    rec->older = rec->newer = NULL;
+}
+
+static void link_newest(struct record_store *store, struct cached_record *rec) {
+    rec->older = store->newest;
+    rec->newer = NULL;
+    if (store->newest)
+        store->newest->newer = rec;
+    else
+        store->oldest = rec;
+    store->newest = rec;
+}
+
+static struct cached_record **bucket_of(const struct record_store *store, uint64_t name_hash) {
+    return &store->buckets[name_hash & (store->nbuckets - 1)];
+}
+
+static void remove_record(struct record_store *store, struct cached_record *rec) {
+    for (struct cached_record **p = bucket_of(store, rec->name_hash); *p; p = &(*p)->bucket_next) {
+        if (*p == rec) {
+            *p = rec->bucket_next;
+            break;
+        }
+    }
+    unlink_age(store, rec);
+    store->nrecords--;
+    free(rec);
+}
+
+/// Remove expired records from the bucket of a name.
+static void purge_bucket(struct record_store *store, uint64_t name_hash, uint64_t now_ns) {
+    struct cached_record **p = bucket_of(store, name_hash);
+    while (*p) {
+        struct cached_record *rec = *p;
+        if (rec->expire_ns > now_ns) {
+            p = &rec->bucket_next;
+            continue;
+        }
+        *p = rec->bucket_next;
+        unlink_age(store, rec);
+        store->nrecords--;
+        free(rec);
+    }
+}
+
+static bool same_rrset(const struct cached_record *rec, uint64_t name_hash, const uint8_t *name, size_t name_len,
+                       uint16_t type, uint16_t rrclass) {
+    return rec->name_hash == name_hash && rec->type == type && rec->rrclass == rrclass &&
+           dns_name_equal(rec->data, rec->name_len, name, name_len);
+}
+
+/// Decompress the names in the RDATA of a record.
+/// \return length of the RDATA, or 0 if it is malformed or too large
+static size_t read_rdata(const uint8_t *msg, size_t len, const struct dns_record *record, uint8_t *out) {
+    size_t prefix;
+    unsigned int nnames = dns_rdata_names(record->type, &prefix);
+    size_t rdata = record->rdata;
+    size_t rdata_end = record->rdata + record->rdlength;
+    if (prefix > record->rdlength)
+        return 0;
+    memcpy(out, msg + rdata, prefix);
+    size_t n = prefix;
+    rdata += prefix;
+    for (unsigned int i = 0; i < nnames; ++i) {
+        size_t name_len;
+        if (n + DNS_NAME_MAX > DISCOVERY_RDATA_MAX)
+            return 0;
+        size_t next = dns_read_name(msg, len, rdata, out + n, &name_len);
+        if (!next || next > rdata_end)
+            return 0;
+        n += name_len;
+        rdata = next;
+    }
+    if (n + (rdata_end - rdata) > DISCOVERY_RDATA_MAX)
+        return 0;
+    memcpy(out + n, msg + rdata, rdata_end - rdata);
+    return n + (rdata_end - rdata);
+}
+
+/// Add or refresh one record.
+/// \return 1 if the record was stored, 0 if not
+static int learn_record(struct discovery *discovery, const uint8_t *msg, size_t len, const struct dns_record *record,
+                        uint64_t now_ns) {
+    struct record_store *store = &discovery->store;
+    uint8_t name[DNS_NAME_MAX];
+    size_t name_len;
+    uint8_t rdata[DISCOVERY_RDATA_MAX];
+    if (record->type == DNS_TYPE_OPT || record->type == DNS_TYPE_NSEC)
+        return 0;
+    if (!dns_read_name(msg, len, record->offset, name, &name_len) ||
+        dns_name_suffix(name, name_len, LOCAL_DOMAIN, LOCAL_DOMAIN_LEN) < 0)
+        return 0;
+    size_t rdlength = read_rdata(msg, len, record, rdata);
+    if (!rdlength && record->rdlength)
+        return 0;
+    uint16_t rrclass = record->rrclass & DNS_CLASS_MASK;
+    uint64_t name_hash = dns_name_hash(name, name_len);
+    purge_bucket(store, name_hash, now_ns);
+    struct cached_record *match = NULL;
+    for (struct cached_record *rec = *bucket_of(store, name_hash); rec; rec = rec->bucket_next) {
+        if (!same_rrset(rec, name_hash, name, name_len, record->type, rrclass))
+            continue;
+        if (rec->rdlength == rdlength && memcmp(record_rdata(rec), rdata, rdlength) == 0)
+            match = rec;
+        else if ((record->rrclass & ~DNS_CLASS_MASK) && rec->learned_ns + NS_PER_SEC < now_ns &&
+                 rec->expire_ns > now_ns + NS_PER_SEC)
+            // RFC 6762 section 10.2: the cache-flush bit obsoletes other records of the set after a second
+            rec->expire_ns = now_ns + NS_PER_SEC;
+    }
+    if (!record->ttl) {
+        // goodbye packet: the record is deleted after a second
+        if (match && match->expire_ns > now_ns + NS_PER_SEC)
+            match->expire_ns = now_ns + NS_PER_SEC;
+        return 0;
+    }
+    if (!match) {
+        if (store->nrecords >= store->max_records) {
+            remove_record(store, store->oldest);
+            discovery->stats.evicted++;
+        }
+        match = malloc(sizeof(struct cached_record) + name_len + rdlength);
+        if (!match)
+            return 0;
+        match->name_hash = name_hash;
+        match->type = record->type;
+        match->rrclass = rrclass;
+        match->name_len = (uint16_t) name_len;
+        match->rdlength = (uint16_t) rdlength;
+        memcpy(match->data, name, name_len);
+        memcpy(match->data + name_len, rdata, rdlength);
+        struct cached_record **bucket = bucket_of(store, name_hash);
+        match->bucket_next = *bucket;
+        *bucket = match;
+        store->nrecords++;
+    } else {
+        unlink_age(store, match);
+    }
+    link_newest(store, match);
+    match->learned_ns = now_ns;
+    match->expire_ns = now_ns + (uint64_t) record->ttl * NS_PER_SEC;
+    return 1;
+}
+
+size_t discovery_learn(struct discovery *discovery, const uint8_t *msg, size_t len, uint64_t now_ns) {
+    struct dns_parser parser;
+    struct dns_record record;
+    size_t learned = 0;
+    if (dns_parser_init(&parser, msg, len) == -1 || !(parser.header.flags & DNS_FLAG_QR))
+        return 0;
+    while (dns_parser_next(&parser, &record) == 1) {
+        // authority records of responses only appear in probes, which are not answers
+        if (record.section == DNS_SECTION_ANSWER || record.section == DNS_SECTION_ADDITIONAL)
+            learned += (size_t) learn_record(discovery, msg, len, &record, now_ns);
+    }
+    discovery->stats.learned += learned;
+    return learned;
+}
+
+/// Map a name under "local" to the proxy domain. Other names are copied unchanged.
+/// \return length of the mapped name, or 0 if it is too long
+static size_t map_to_domain(const struct discovery *discovery, const uint8_t *name, size_t name_len, uint8_t *out) {
+    long suffix = dns_name_suffix(name, name_len, LOCAL_DOMAIN, LOCAL_DOMAIN_LEN);
+    if (suffix < 0) {
+        memcpy(out, name, name_len);
+        return name_len;
+    }
+    if ((size_t) suffix + discovery->domain_len > DNS_NAME_MAX)
+        return 0;
+    memcpy(out, name, (size_t) suffix);
+    memcpy(out + suffix, discovery->domain, discovery->domain_len);
+    return (size_t) suffix + discovery->domain_len;
+}
+
+static size_t name_length(const uint8_t *name) {
+    size_t n = 0;
+    while (name[n])
+        n += 1u + name[n];
+    return n + 1;
+}
+
+/// Addresses that remote clients can't reach.
+static bool is_link_local_address(const struct cached_record *rec) {
+    const uint8_t *rdata = record_rdata(rec);
+    if (rec->type == DNS_TYPE_A && rec->rdlength == 4)
+        return rdata[0] == 169 && rdata[1] == 254;
+    if (rec->type == DNS_TYPE_AAAA && rec->rdlength == 16)
+        return rdata[0] == 0xfe && (rdata[1] & 0xc0) == 0x80;
+    return false;
+}
+
+static void put_u16(uint8_t *p, uint16_t v) {
+    p[0] = (uint8_t) (v >> 8);
+    p[1] = (uint8_t) v;
+}
+
+/// Write a stored record with its names mapped to the proxy domain.
+/// Nothing is written if the record does not fit.
+/// \return 0 on success or -1 if the buffer is full
+static int write_cached_record(struct dns_writer *writer, const struct discovery *discovery,
+                               const struct cached_record *rec, unsigned int section, uint64_t now_ns) {
+    size_t saved_len = writer->len;
+    size_t saved_nsuffixes = writer->nsuffixes;
+    uint8_t name[DNS_NAME_MAX];
+    size_t name_len = map_to_domain(discovery, rec->data, rec->name_len, name);
+    uint64_t ttl = (rec->expire_ns - now_ns) / NS_PER_SEC;
+    uint8_t fixed[10];
+    put_u16(fixed, rec->type);
+    put_u16(fixed + 2, rec->rrclass);
+    put_u16(fixed + 4, 0);
+    put_u16(fixed + 6, (uint16_t) (ttl < DISCOVERY_TTL_MAX ? ttl : DISCOVERY_TTL_MAX));
+    if (!name_len || dns_writer_name(writer, name, name_len) == -1 || dns_writer_bytes(writer, fixed, 10) == -1)
+        goto overflow;
+    size_t rdlength_offset = writer->len - 2;
+    const uint8_t *rdata = record_rdata(rec);
+    size_t prefix;
+    unsigned int nnames = dns_rdata_names(rec->type, &prefix);
+    if (dns_writer_bytes(writer, rdata, prefix) == -1)
+        goto overflow;
+    size_t pos = prefix;
+    for (unsigned int i = 0; i < nnames; ++i) {
+        size_t rdata_name_len = name_length(rdata + pos);
+        name_len = map_to_domain(discovery, rdata + pos, rdata_name_len, name);
+        // unlike mDNS, unicast DNS does not allow compressing the target of an SRV record
+        if (!name_len || (rec->type == DNS_TYPE_SRV ? dns_writer_name_uncompressed(writer, name, name_len)
+                                                    : dns_writer_name(writer, name, name_len)) == -1)
+            goto overflow;
+        pos += rdata_name_len;
+    }
+    if (dns_writer_bytes(writer, rdata + pos, rec->rdlength - pos) == -1)
+        goto overflow;
+    put_u16(writer->buf + rdlength_offset, (uint16_t) (writer->len - rdlength_offset - 2));
+    writer->counts[section]++;
+    return 0;
+    overflow:
+    dns_writer_rewind(writer, saved_len, saved_nsuffixes);
+    writer->overflow = false;
+    return -1;
+}
+
+/// Records chosen for a response, to avoid writing one twice.
+struct answer_set {
+    size_t n;
+    const struct cached_record *records[ANSWER_RECORDS_MAX];
+};
+
+static bool answer_set_has(const struct answer_set *set, const struct cached_record *rec) {
+    for (size_t i = 0; i < set->n; ++i) {
+        if (set->records[i] == rec)
+            return true;
+    }
+    return false;
+}
+
+/// Write the records of a name with a type, or of any type if `type` is DNS_TYPE_ANY.
+/// \return -1 if the buffer became full, otherwise the number of records of the name of any type
+static int write_records(struct dns_writer *writer, struct discovery *discovery, const uint8_t *name,
+                         size_t name_len, uint16_t type, unsigned int section, struct answer_set *set,
+                         uint64_t now_ns) {
+    struct record_store *store = &discovery->store;
+    uint64_t name_hash = dns_name_hash(name, name_len);
+    purge_bucket(store, name_hash, now_ns);
+    int nrecords = 0;
+    for (struct cached_record *rec = *bucket_of(store, name_hash); rec; rec = rec->bucket_next) {
+        if (rec->name_hash != name_hash || !dns_name_equal(rec->data, rec->name_len, name, name_len))
+            continue;
+        nrecords++;
+        if ((type != DNS_TYPE_ANY && rec->type != type) || is_link_local_address(rec) || answer_set_has(set, rec))
+            continue;
+        if (set->n >= ANSWER_RECORDS_MAX || write_cached_record(writer, discovery, rec, section, now_ns) == -1)
+            return -1;
+        set->records[set->n++] = rec;
+    }
+    return nrecords;
+}
+
+/// Add the records that RFC 6763 section 12 recommends along with answers: SRV and TXT records of PTR targets,
+/// and addresses of SRV targets.
+static void write_additional(struct dns_writer *writer, struct discovery *discovery, struct answer_set *set,
+                             uint64_t now_ns) {
+    static const uint16_t PTR_TARGET_TYPES[] = {DNS_TYPE_SRV, DNS_TYPE_TXT};
+    static const uint16_t SRV_TARGET_TYPES[] = {DNS_TYPE_A, DNS_TYPE_AAAA};
+    // Records appended while iterating are visited too, so SRV records found through PTR records get addresses.
+    for (size_t i = 0; i < set->n; ++i) {
+        const struct cached_record *rec = set->records[i];
+        const uint16_t *types;
+        const uint8_t *target = record_rdata(rec);
+        if (rec->type == DNS_TYPE_PTR) {
+            types = PTR_TARGET_TYPES;
+        } else if (rec->type == DNS_TYPE_SRV && rec->rdlength > 6) {
+            types = SRV_TARGET_TYPES;
+            target += 6;
+        } else {
+            continue;
+        }
+        for (size_t t = 0; t < 2; ++t) {
+            if (write_records(writer, discovery, target, name_length(target), types[t], DNS_SECTION_ADDITIONAL, set,
+                              now_ns) == -1)
+                return;
+        }
+    }
+}
+
+/// Find the UDP payload size a query advertises with EDNS(0).
+/// \return the size, or 0 if the query has no OPT record
+static size_t edns_payload_size(struct dns_parser *parser) {
+    struct dns_record record;
+    while (dns_parser_next(parser, &record) == 1) {
+        if (record.section == DNS_SECTION_ADDITIONAL && record.type == DNS_TYPE_OPT)
+            return record.rrclass > 512 ? record.rrclass : 512;
+    }
+    return 0;
+}
+
+#define RCODE_FORMERR 1
+#define RCODE_NXDOMAIN 3
+#define RCODE_NOTIMP 4
+#define RCODE_REFUSED 5
+/// recursion desired; copied from the query
+#define FLAG_RD 0x0100u
+#define CLASS_IN 1
+#define CLASS_ANY 255
+
+static size_t finish_error(struct dns_writer *writer, uint16_t id, uint16_t flags, unsigned int rcode) {
+    return dns_writer_finish(writer, id, (uint16_t) (DNS_FLAG_QR | (flags & FLAG_RD) | rcode));
+}
+
+int discovery_answer(struct discovery *discovery, const uint8_t *query, size_t len, bool tcp, uint64_t now_ns,
+                     uint8_t *out, size_t cap, struct discovery_answer *answer) {
+    struct dns_parser parser;
+    struct dns_record question;
+    struct dns_writer writer;
+    memset(answer, 0, sizeof(*answer));
+    if (dns_parser_init(&parser, query, len) == -1 || (parser.header.flags & DNS_FLAG_QR))
+        return -1;
+    uint16_t id = parser.header.id;
+    uint16_t flags = parser.header.flags;
+    dns_writer_init(&writer, out, cap < 512 ? cap : 512);
+    if (DNS_OPCODE(flags) != 0) {
+        discovery->stats.refused++;
+        answer->len = finish_error(&writer, id, flags, RCODE_NOTIMP);
+        return 0;
+    }
+    uint8_t qname[DNS_NAME_MAX];
+    size_t qname_len;
+    if (parser.header.counts[DNS_SECTION_QUESTION] != 1 || dns_parser_next(&parser, &question) != 1 ||
+        !dns_read_name(query, len, question.offset, qname, &qname_len)) {
+        discovery->stats.refused++;
+        answer->len = finish_error(&writer, id, flags, RCODE_FORMERR);
+        return 0;
+    }
+    size_t payload_size = edns_payload_size(&parser);
+    size_t limit = tcp ? cap : payload_size ? payload_size : 512;
+    // room for the OPT record of the response
+    size_t opt_size = payload_size ? 11 : 0;
+    dns_writer_init(&writer, out, (limit < cap ? limit : cap) - opt_size);
+    dns_writer_record(&writer, query, len, &question);
+    long suffix = dns_name_suffix(qname, qname_len, discovery->domain, discovery->domain_len);
+    uint16_t qclass = question.rrclass & DNS_CLASS_MASK;
+    if (suffix < 0 || (qclass != CLASS_IN && qclass != CLASS_ANY) ||
+        (size_t) suffix + LOCAL_DOMAIN_LEN > DNS_NAME_MAX) {
+        discovery->stats.refused++;
+        answer->len = finish_error(&writer, id, flags, RCODE_REFUSED);
+        return 0;
+    }
+    memcpy(answer->local_name, qname, (size_t) suffix);
+    memcpy(answer->local_name + suffix, LOCAL_DOMAIN, LOCAL_DOMAIN_LEN);
+    answer->local_name_len = (size_t) suffix + LOCAL_DOMAIN_LEN;
+    answer->qtype = question.type;
+
+    struct answer_set set = {0};
+    int nrecords = write_records(&writer, discovery, answer->local_name, answer->local_name_len, question.type,
+                                 DNS_SECTION_ANSWER, &set, now_ns);
+    bool truncated = nrecords == -1;
+    size_t nanswers = set.n;
+    if (!truncated)
+        write_additional(&writer, discovery, &set, now_ns);
+    answer->miss = !nanswers && !truncated;
+    unsigned int rcode = 0;
+    if (nanswers || truncated)
+        discovery->stats.answered++;
+    else if (!nrecords && suffix > 0) {
+        // nothing is known about the name; the domain itself always exists
+        rcode = RCODE_NXDOMAIN;
+        discovery->stats.nxdomain++;
+    }
+    if (truncated)
+        discovery->stats.truncated++;
+    if (opt_size) {
+        // restore the room reserved for OPT: root name, type, UDP payload size, TTL and empty RDATA
+        static const uint8_t OPT[11] = {0, 0, DNS_TYPE_OPT, 0x10, 0x00, 0, 0, 0, 0, 0, 0};
+        writer.cap += opt_size;
+        dns_writer_bytes(&writer, OPT, sizeof(OPT));
+        writer.counts[DNS_SECTION_ADDITIONAL]++;
+    }
+    answer->len = dns_writer_finish(&writer, id, (uint16_t) (DNS_FLAG_QR | DNS_FLAG_AA | (flags & FLAG_RD) |
+                                                            (truncated ? DNS_FLAG_TC : 0) | rcode));
+    return 0;
+}
+
+bool discovery_may_query(struct discovery *discovery, const uint8_t *name, size_t name_len, uint16_t qtype,
+                         uint64_t now_ns) {
+    uint64_t hash = dns_name_hash(name, name_len) ^ qtype;
+    size_t slot = hash & (DISCOVERY_RECENT_QUERIES - 1);
+    if (discovery->recent_queries[slot].hash == hash && discovery->recent_queries[slot].sent_ns &&
+        now_ns - discovery->recent_queries[slot].sent_ns < NS_PER_SEC)
+        return false;
+    discovery->recent_queries[slot].hash = hash;
+    discovery->recent_queries[slot].sent_ns = now_ns;
+    return true;
+}
+
+struct parked_query *discovery_park(struct discovery *discovery, int conn, const struct sockaddr_storage *client,
+                                    const uint8_t *query, size_t len, uint64_t now_ns) {
+    if (discovery->query_wait_ms <= 0 || len > DISCOVERY_TCP_QUERY_MAX)
+        return NULL;
+    for (size_t i = 0; i < DISCOVERY_PARKED_MAX; ++i) {
+        struct parked_query *parked = &discovery->parked[i];
+        if (parked->used)
+            continue;
+        parked->used = true;
+        parked->deadline_ns = now_ns + (uint64_t) discovery->query_wait_ms * 1000000u;
+        parked->conn = conn;
+        if (client)
+            parked->client = *client;
+        parked->len = len;
+        memcpy(parked->query, query, len);
+        if (conn >= 0)
+            discovery->conns[conn].deadline_ns = parked->deadline_ns + NS_PER_SEC;
+        return parked;
+    }
+    return NULL;
+}
+
+void discovery_unpark_conn(struct discovery *discovery, int conn) {
+    for (size_t i = 0; i < DISCOVERY_PARKED_MAX; ++i) {
+        if (discovery->parked[i].used && discovery->parked[i].conn == conn)
+            discovery->parked[i].used = false;
+    }
+}
+
+bool discovery_parked_due(const struct parked_query *parked, const struct discovery_answer *answer, uint64_t due_ns) {
+    // a query that can't be answered at all is dropped right away
+    return !answer->len || !answer->miss || parked->deadline_ns <= due_ns;
+}
+
+size_t discovery_build_query(const uint8_t *name, size_t name_len, uint16_t qtype, uint8_t *out, size_t cap) {
+    struct dns_writer writer;
+    uint8_t fixed[4];
+    put_u16(fixed, qtype);
+    put_u16(fixed + 2, CLASS_IN);
+    dns_writer_init(&writer, out, cap);
+    if (dns_writer_name(&writer, name, name_len) == -1 || dns_writer_bytes(&writer, fixed, sizeof(fixed)) == -1)
+        return 0;
+    writer.counts[DNS_SECTION_QUESTION] = 1;
+    return dns_writer_finish(&writer, 0, 0);
+}
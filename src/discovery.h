@@ -0,0 +1,183 @@
+/*
+    This file is part of mDNS Reflector (mdns-reflector), a lightweight and performant multicast DNS (mDNS) reflector.
+    Copyright (C) 2021 Yuxiang Zhu <me@yux.im>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef MDNS_REFLECTOR_DISCOVERY_H
+#define MDNS_REFLECTOR_DISCOVERY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include "dns.h"
+#include "reflection_zone.h"
+
+#define DISCOVERY_NAME_MAX 32
+/// unicast answers are given at most this TTL, since the records may change at any time on the link
+#define DISCOVERY_TTL_MAX 10
+/// largest RDATA kept in the store; larger records (big TXT records) are not learned
+#define DISCOVERY_RDATA_MAX 1024
+/// unicast queries waiting for an on-demand mDNS query to be answered
+#define DISCOVERY_PARKED_MAX 32
+#define DISCOVERY_TCP_CONNECTIONS_MAX 16
+/// TCP connections are closed if the query is not complete within this time
+#define DISCOVERY_TCP_TIMEOUT_MS 5000
+/// largest DNS message accepted over TCP
+#define DISCOVERY_TCP_QUERY_MAX 4096
+/// on-demand mDNS queries remembered to ask each question at most once per second; a power of two
+#define DISCOVERY_RECENT_QUERIES 64
+
+struct discovery_stats {
+    /// records learned from responses, including refreshes
+    uint64_t learned;
+    /// records evicted to stay within `max_records`
+    uint64_t evicted;
+    uint64_t udp_queries;
+    uint64_t tcp_queries;
+    /// queries answered with at least one record
+    uint64_t answered;
+    uint64_t nxdomain;
+    /// queries outside the domain or malformed
+    uint64_t refused;
+    uint64_t truncated;
+    /// mDNS queries sent because the store had no answer
+    uint64_t mdns_queries;
+};
+
+struct cached_record;
+
+/// Records learned from mDNS responses in a zone, bounded by a record count. Records expire with their TTL,
+/// and the least recently refreshed record is evicted when the store is full.
+struct record_store {
+    size_t max_records;
+    size_t nrecords;
+    /// hash of the lowercased owner name to a chain of records
+    size_t nbuckets;
+    struct cached_record **buckets;
+    /// least recently refreshed record first
+    struct cached_record *oldest, *newest;
+};
+
+/// A query waiting for an on-demand mDNS query to be answered.
+struct parked_query {
+    bool used;
+    uint64_t deadline_ns;
+    /// TCP connection to answer on, or -1 for UDP
+    int conn;
+    struct sockaddr_storage client;
+    size_t len;
+    uint8_t query[DISCOVERY_TCP_QUERY_MAX];
+};
+
+struct discovery_conn {
+    int fd;
+    uint64_t deadline_ns;
+    size_t len;
+    /// two-byte length followed by the message
+    uint8_t buf[2 + DISCOVERY_TCP_QUERY_MAX];
+};
+
+/// A DNS-SD discovery proxy (RFC 8766): answers unicast DNS queries for names under `domain` from records
+/// learned in a zone, where the names end in "local".
+struct discovery {
+    char name[DISCOVERY_NAME_MAX];
+    char zone_name[ZONE_NAME_MAX];
+    /// index of the zone, resolved when the configuration is loaded
+    unsigned int zone_index;
+    /// domain in wire format
+    uint8_t domain[DNS_NAME_MAX];
+    size_t domain_len;
+    char domain_text[DNS_NAME_MAX];
+    struct sockaddr_storage listen;
+    size_t max_records;
+    /// send an mDNS query when the store has no answer, and wait up to `query_wait_ms` for responses
+    bool query_on_demand;
+    int query_wait_ms;
+    int udp_fd;
+    int tcp_fd;
+    struct discovery_conn conns[DISCOVERY_TCP_CONNECTIONS_MAX];
+    struct parked_query parked[DISCOVERY_PARKED_MAX];
+    struct record_store store;
+    struct {
+        uint64_t hash;
+        uint64_t sent_ns;
+    } recent_queries[DISCOVERY_RECENT_QUERIES];
+    struct discovery_stats stats;
+    struct discovery *next;
+};
+
+/// Result of answering a query.
+struct discovery_answer {
+    size_t len;
+    /// whether the store had no answer, so that an mDNS query may find one
+    bool miss;
+    /// question of the query mapped to the zone, in wire format, if `miss` is set
+    uint8_t local_name[DNS_NAME_MAX];
+    size_t local_name_len;
+    uint16_t qtype;
+};
+
+struct discovery *new_discovery(const char *name, struct discovery *list);
+
+void free_discoveries(struct discovery *list);
+
+/// Set the domain from its text form, like "iot.home.arpa".
+/// \return 0 on success or -1 if it is not a valid domain name
+int discovery_set_domain(struct discovery *discovery, const char *domain);
+
+/// Allocate the record store.
+/// \return 0 on success or -1 on error
+int record_store_init(struct record_store *store, size_t max_records);
+
+void record_store_free(struct record_store *store);
+
+/// Learn the answer and additional records of an mDNS response.
+/// \return number of records learned
+size_t discovery_learn(struct discovery *discovery, const uint8_t *msg, size_t len, uint64_t now_ns);
+
+/// Answer a unicast DNS query from the store.
+/// \param cap largest response to build; UDP responses that don't fit are truncated
+/// \param tcp whether the query came over TCP, so that responses are not limited by an EDNS buffer size
+/// \return 0 if the query got a response in `out`, or -1 if it should be ignored
+int discovery_answer(struct discovery *discovery, const uint8_t *query, size_t len, bool tcp, uint64_t now_ns,
+                     uint8_t *out, size_t cap, struct discovery_answer *answer);
+
+/// Check whether an on-demand mDNS query may be sent: RFC 6762 section 5.2 asks not to repeat a question within
+/// a second. The query is remembered as sent if so.
+bool discovery_may_query(struct discovery *discovery, const uint8_t *name, size_t name_len, uint16_t qtype,
+                         uint64_t now_ns);
+
+/// Park a query until an on-demand mDNS query is answered or `query_wait_ms` passes. The TCP connection of the
+/// query is kept open for a second longer than that.
+/// \param conn TCP connection the query came on, or -1 for UDP
+/// \param client address of the client of a UDP query
+/// \return the parked query, or NULL if waiting is disabled, all slots are taken or the query is too large
+struct parked_query *discovery_park(struct discovery *discovery, int conn, const struct sockaddr_storage *client,
+                                    const uint8_t *query, size_t len, uint64_t now_ns);
+
+/// Forget the query parked for a TCP connection, if any.
+void discovery_unpark_conn(struct discovery *discovery, int conn);
+
+/// Check whether a parked query is to be answered now: the store has an answer, or its wait ended by `due_ns`.
+/// \param answer what the store answers to the parked query now
+bool discovery_parked_due(const struct parked_query *parked, const struct discovery_answer *answer, uint64_t due_ns);
+
+/// Build an mDNS query for a name and type.
+/// \return length of the query
+size_t discovery_build_query(const uint8_t *name, size_t name_len, uint16_t qtype, uint8_t *out, size_t cap);
+
+#endif //MDNS_REFLECTOR_DISCOVERY_H
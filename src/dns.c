@@ -0,0 +1,486 @@
+/*
+    This file is part of mDNS Reflector (mdns-reflector), a lightweight and performant multicast DNS (mDNS) reflector.
+    Copyright (C) 2021 Yuxiang Zhu <me@yux.im>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "dns.h"
+#include <string.h>
+
+#define DNS_POINTER 0xc0u
+#define DNS_POINTER_MAX 0x3fffu
+
+static uint16_t read_u16(const uint8_t *p) {
+    return (uint16_t) (p[0] << 8 | p[1]);
+}
+
+static uint32_t read_u32(const uint8_t *p) {
+    return (uint32_t) p[0] << 24 | (uint32_t) p[1] << 16 | (uint32_t) p[2] << 8 | p[3];
+}
+
+static void write_u16(uint8_t *p, uint16_t v) {
+    p[0] = (uint8_t) (v >> 8);
+    p[1] = (uint8_t) v;
+}
+
+void dns_parse_header(const uint8_t *msg, struct dns_header *header) {
+    header->id = read_u16(msg);
+    header->flags = read_u16(msg + 2);
+    for (unsigned int i = 0; i < DNS_SECTIONS; ++i)
+        header->counts[i] = read_u16(msg + 4 + 2 * i);
+}
+
+int dns_parser_init(struct dns_parser *parser, const uint8_t *msg, size_t len) {
+    if (len < DNS_HEADER_SIZE)
+        return -1;
+    parser->msg = msg;
+    parser->len = len;
+    dns_parse_header(msg, &parser->header);
+    parser->offset = DNS_HEADER_SIZE;
+    parser->section = DNS_SECTION_QUESTION;
+    parser->remaining = parser->header.counts[DNS_SECTION_QUESTION];
+    return 0;
+}
+
+int dns_parser_next(struct dns_parser *parser, struct dns_record *record) {
+    while (!parser->remaining) {
+        if (parser->section + 1 >= DNS_SECTIONS)
+            return 0;
+        parser->remaining = parser->header.counts[++parser->section];
+    }
+    const uint8_t *msg = parser->msg;
+    size_t len = parser->len;
+    size_t pos = dns_skip_name(msg, len, parser->offset);
+    if (!pos || pos + 4 > len)
+        return -1;
+    record->section = parser->section;
+    record->offset = parser->offset;
+    record->type = read_u16(msg + pos);
+    record->rrclass = read_u16(msg + pos + 2);
+    pos += 4;
+    if (parser->section == DNS_SECTION_QUESTION) {
+        record->ttl = 0;
+        record->rdlength = 0;
+    } else {
+        if (pos + 6 > len)
+            return -1;
+        record->ttl = read_u32(msg + pos);
+        record->rdlength = read_u16(msg + pos + 4);
+        pos += 6;
+        if (pos + record->rdlength > len)
+            return -1;
+    }
+    record->rdata = pos;
+    record->end = pos + record->rdlength;
+    parser->offset = record->end;
+    parser->remaining--;
+    return 1;
+}
+
+size_t dns_skip_name(const uint8_t *msg, size_t len, size_t offset) {
+    while (offset < len) {
+        uint8_t label = msg[offset];
+        if ((label & DNS_POINTER) == DNS_POINTER)
+            return offset + 2 <= len ? offset + 2 : 0;
+        if (label & DNS_POINTER)
+            return 0;  // extended label types are not supported
+        if (!label)
+            return offset + 1;
+        offset += 1u + label;
+    }
+    return 0;
+}
+
+size_t dns_read_name(const uint8_t *msg, size_t len, size_t offset, uint8_t *name, size_t *name_len) {
+    size_t n = 0;
+    size_t next = 0;
+    // Every pointer must point before the labels it was found in, which rules out loops.
+    size_t limit = offset;
+    for (;;) {
+        if (offset >= len)
+            return 0;
+        uint8_t label = msg[offset];
+        if ((label & DNS_POINTER) == DNS_POINTER) {
+            if (offset + 1 >= len)
+                return 0;
+            size_t target = (size_t) (label & ~DNS_POINTER) << 8 | msg[offset + 1];
+            if (!next)
+                next = offset + 2;
+            if (target >= limit)
+                return 0;
+            offset = limit = target;
+            continue;
+        }
+        if (label & DNS_POINTER)
+            return 0;
+        if (n + 1u + label > DNS_NAME_MAX || offset + 1u + label > len)
+            return 0;
+        memcpy(name + n, msg + offset, 1u + label);
+        n += 1u + label;
+        if (!label) {
+            *name_len = n;
+            return next ? next : offset + 1;
+        }
+        offset += 1u + label;
+    }
+}
+
+unsigned int dns_rdata_names(uint16_t type, size_t *prefix) {
+    *prefix = 0;
+    switch (type) {
+        case DNS_TYPE_NS:
+        case DNS_TYPE_CNAME:
+        case DNS_TYPE_PTR:
+        case DNS_TYPE_DNAME:
+        case DNS_TYPE_NSEC:  // RFC 6762 section 18.14 allows compressing the next domain name
+            return 1;
+        case DNS_TYPE_MX:
+            *prefix = 2;
+            return 1;
+        case DNS_TYPE_SRV:
+            *prefix = 6;
+            return 1;
+        case DNS_TYPE_SOA:
+            return 2;
+        default:
+            return 0;
+    }
+}
+
+#define FNV_OFFSET_BASIS 0xcbf29ce484222325u
+#define FNV_PRIME 0x100000001b3u
+
+static uint64_t hash_bytes(uint64_t hash, const uint8_t *data, size_t len) {
+    for (size_t i = 0; i < len; ++i)
+        hash = (hash ^ data[i]) * FNV_PRIME;
+    return hash;
+}
+
+static uint64_t hash_name(uint64_t hash, const uint8_t *name, size_t name_len) {
+    for (size_t i = 0; i < name_len; ++i) {
+        uint8_t c = name[i];
+        if (c >= 'A' && c <= 'Z')
+            c = (uint8_t) (c - 'A' + 'a');
+        hash = (hash ^ c) * FNV_PRIME;
+    }
+    return hash;
+}
+
+uint64_t dns_name_hash(const uint8_t *name, size_t name_len) {
+    return hash_name(FNV_OFFSET_BASIS, name, name_len);
+}
+
+bool dns_name_equal(const uint8_t *a, size_t a_len, const uint8_t *b, size_t b_len) {
+    if (a_len != b_len)
+        return false;
+    for (size_t i = 0; i < a_len; ++i) {
+        uint8_t ca = a[i], cb = b[i];
+        if (ca >= 'A' && ca <= 'Z')
+            ca = (uint8_t) (ca - 'A' + 'a');
+        if (cb >= 'A' && cb <= 'Z')
+            cb = (uint8_t) (cb - 'A' + 'a');
+        if (ca != cb)
+            return false;
+    }
+    return true;
+}
+
+long dns_name_suffix(const uint8_t *name, size_t name_len, const uint8_t *suffix, size_t suffix_len) {
+    // Only label boundaries are candidates, so "xlocal" does not end with "local".
+    for (size_t pos = 0; pos + suffix_len <= name_len; pos += 1u + name[pos]) {
+        if (pos + suffix_len == name_len)
+            return dns_name_equal(name + pos, suffix_len, suffix, suffix_len) ? (long) pos : -1;
+        if (!name[pos])
+            break;
+    }
+    return -1;
+}
+
+int dns_record_hash(const uint8_t *msg, size_t len, const struct dns_record *record, uint64_t *hash) {
+    uint8_t name[DNS_NAME_MAX];
+    size_t name_len;
+    size_t pos = dns_read_name(msg, len, record->offset, name, &name_len);
+    if (!pos)
+        return -1;
+    uint64_t h = hash_name(FNV_OFFSET_BASIS, name, name_len);
+    if (record->section == DNS_SECTION_QUESTION) {
+        *hash = hash_bytes(h, msg + pos, 4);
+        return 0;
+    }
+    // type, class and TTL; RDLENGTH depends on compression
+    h = hash_bytes(h, msg + pos, 8);
+    size_t rdata = record->rdata;
+    size_t rdata_end = record->rdata + record->rdlength;
+    size_t prefix;
+    unsigned int nnames = dns_rdata_names(record->type, &prefix);
+    if (nnames) {
+        if (prefix > record->rdlength)
+            return -1;
+        h = hash_bytes(h, msg + rdata, prefix);
+        rdata += prefix;
+        for (unsigned int i = 0; i < nnames; ++i) {
+            size_t next = dns_read_name(msg, len, rdata, name, &name_len);
+            if (!next || next > rdata_end)
+                return -1;
+            h = hash_name(h, name, name_len);
+            rdata = next;
+        }
+    }
+    *hash = hash_bytes(h, msg + rdata, rdata_end - rdata);
+    return 0;
+}
+
+static bool is_protocol_label(const uint8_t *label) {
+    if (label[0] != 4 || label[1] != '_')
+        return false;
+    char p0 = (char) (label[2] | 0x20), p1 = (char) (label[3] | 0x20), p2 = (char) (label[4] | 0x20);
+    return (p0 == 't' && p1 == 'c' && p2 == 'p') || (p0 == 'u' && p1 == 'd' && p2 == 'p');
+}
+
+size_t dns_service_type(const uint8_t *msg, size_t len, size_t offset, char *out, size_t out_size) {
+    uint8_t name[DNS_NAME_MAX];
+    size_t name_len;
+    if (!dns_read_name(msg, len, offset, name, &name_len))
+        return 0;
+    // find "_service._tcp" or "_service._udp"
+    size_t prev = 0, start = 0;
+    bool found = false;
+    for (size_t pos = 0; name[pos]; pos += name[pos] + 1u) {
+        if (pos && name[prev + 1] == '_' && is_protocol_label(name + pos)) {
+            start = prev;
+            found = true;
+            break;
+        }
+        prev = pos;
+    }
+    if (!found)
+        return 0;
+    size_t n = 0;
+    for (size_t pos = start; name[pos]; pos += name[pos] + 1u) {
+        size_t label = name[pos];
+        if (n + label + 2 > out_size)
+            return 0;
+        if (n)
+            out[n++] = '.';
+        memcpy(out + n, name + pos + 1, label);
+        n += label;
+    }
+    out[n] = '\0';
+    return n;
+}
+
+uint64_t dns_fingerprint(const uint8_t *msg, size_t len) {
+    return hash_bytes(FNV_OFFSET_BASIS, msg, len);
+}
+
+void dns_writer_init(struct dns_writer *writer, uint8_t *buf, size_t cap) {
+    // Suffixes are only read through the index, so only the index needs clearing.
+    memset(writer->counts, 0, sizeof(writer->counts));
+    memset(writer->index, 0, sizeof(writer->index));
+    writer->nsuffixes = 0;
+    writer->buf = buf;
+    writer->cap = cap;
+    writer->len = DNS_HEADER_SIZE;
+    writer->overflow = cap < DNS_HEADER_SIZE;
+}
+
+/// Compare a name written to the output, following pointers, with an uncompressed name.
+static bool output_name_equals(const struct dns_writer *writer, size_t offset, const uint8_t *name) {
+    const uint8_t *buf = writer->buf;
+    for (;;) {
+        uint8_t label = buf[offset];
+        if ((label & DNS_POINTER) == DNS_POINTER) {
+            // The writer only produces pointers to earlier names, so this terminates.
+            offset = (size_t) (label & ~DNS_POINTER) << 8 | buf[offset + 1];
+            continue;
+        }
+        if (label != *name)
+            return false;
+        if (!label)
+            return true;
+        if (memcmp(buf + offset + 1, name + 1, label) != 0)
+            return false;
+        offset += 1u + label;
+        name += 1u + label;
+    }
+}
+
+/// Hash the suffixes of an uncompressed name, from the last label to the first: the hash of the suffix starting at
+/// label `i` covers that label and the hash of the rest.
+/// \param positions output offsets of the labels, without the root label
+/// \param hashes output hash of each suffix
+/// \return number of labels
+static size_t hash_suffixes(const uint8_t *name, size_t positions[DNS_NAME_MAX / 2],
+                            uint32_t hashes[DNS_NAME_MAX / 2]) {
+    size_t nlabels = 0;
+    for (size_t pos = 0; name[pos]; pos += 1u + name[pos])
+        positions[nlabels++] = pos;
+    // Candidates are compared in full, so a label only contributes its length and its first and last bytes.
+    uint32_t hash = 0;
+    for (size_t i = nlabels; i-- > 0;) {
+        const uint8_t *label = name + positions[i];
+        hash = (hash ^ (uint32_t) label[0] << 16 ^ (uint32_t) label[1] << 8 ^ label[label[0]]) * 0x9e3779b1u;
+        hashes[i] = hash;
+    }
+    return nlabels;
+}
+
+static size_t suffix_slot(uint32_t hash) {
+    return (hash ^ hash >> 16) & (DNS_WRITER_INDEX_SIZE - 1);
+}
+
+/// Find an earlier suffix equal to the suffix of a name.
+/// \return offset of the suffix in the output, or 0 if there is none
+static uint16_t find_suffix(const struct dns_writer *writer, const uint8_t *suffix, uint32_t hash) {
+    for (size_t slot = suffix_slot(hash); writer->index[slot]; slot = (slot + 1) & (DNS_WRITER_INDEX_SIZE - 1)) {
+        size_t i = writer->index[slot] - 1u;
+        if (writer->suffix_hashes[i] == hash && output_name_equals(writer, writer->suffixes[i], suffix))
+            return writer->suffixes[i];
+    }
+    return 0;
+}
+
+static void add_suffix(struct dns_writer *writer, size_t offset, uint32_t hash) {
+    if (writer->nsuffixes == DNS_WRITER_SUFFIXES_MAX || offset > DNS_POINTER_MAX)
+        return;
+    size_t slot = suffix_slot(hash);
+    while (writer->index[slot])
+        slot = (slot + 1) & (DNS_WRITER_INDEX_SIZE - 1);
+    size_t i = writer->nsuffixes++;
+    writer->suffixes[i] = (uint16_t) offset;
+    writer->suffix_hashes[i] = hash;
+    writer->suffix_slots[i] = (uint8_t) slot;
+    writer->index[slot] = (uint8_t) (i + 1);
+}
+
+void dns_writer_rewind(struct dns_writer *writer, size_t len, size_t nsuffixes) {
+    // Suffixes are removed in the reverse order of insertion, which keeps linear probing intact.
+    while (writer->nsuffixes > nsuffixes)
+        writer->index[writer->suffix_slots[--writer->nsuffixes]] = 0;
+    writer->len = len;
+}
+
+static int write_name(struct dns_writer *writer, const uint8_t *name, size_t name_len, bool compress) {
+    size_t positions[DNS_NAME_MAX / 2];
+    uint32_t hashes[DNS_NAME_MAX / 2];
+    size_t nlabels = hash_suffixes(name, positions, hashes);
+    // Find the longest suffix of the name that was written before.
+    size_t match = name_len;
+    uint16_t target = 0;
+    size_t matched_label = nlabels;
+    for (size_t i = 0; compress && i < nlabels; ++i) {
+        target = find_suffix(writer, name + positions[i], hashes[i]);
+        if (target) {
+            match = positions[i];
+            matched_label = i;
+            break;
+        }
+    }
+    size_t total = match < name_len ? match + 2 : name_len;
+    if (writer->len + total > writer->cap) {
+        writer->overflow = true;
+        return -1;
+    }
+    // The labels written now become compression targets for later names.
+    for (size_t i = 0; i < matched_label; ++i)
+        add_suffix(writer, writer->len + positions[i], hashes[i]);
+    if (match < name_len) {
+        memcpy(writer->buf + writer->len, name, match);
+        writer->len += match;
+        write_u16(writer->buf + writer->len, (uint16_t) (DNS_POINTER << 8 | target));
+        writer->len += 2;
+    } else {
+        memcpy(writer->buf + writer->len, name, name_len);
+        writer->len += name_len;
+    }
+    return 0;
+}
+
+int dns_writer_name(struct dns_writer *writer, const uint8_t *name, size_t name_len) {
+    return write_name(writer, name, name_len, true);
+}
+
+int dns_writer_name_uncompressed(struct dns_writer *writer, const uint8_t *name, size_t name_len) {
+    return write_name(writer, name, name_len, false);
+}
+
+int dns_writer_bytes(struct dns_writer *writer, const void *data, size_t len) {
+    if (writer->len + len > writer->cap) {
+        writer->overflow = true;
+        return -1;
+    }
+    memcpy(writer->buf + writer->len, data, len);
+    writer->len += len;
+    return 0;
+}
+
+static int write_record(struct dns_writer *writer, const uint8_t *msg, size_t len, const struct dns_record *record) {
+    uint8_t name[DNS_NAME_MAX];
+    size_t name_len;
+    size_t pos = dns_read_name(msg, len, record->offset, name, &name_len);
+    if (!pos)
+        return -2;
+    if (dns_writer_name(writer, name, name_len) == -1)
+        return -1;
+    if (record->section == DNS_SECTION_QUESTION)
+        return dns_writer_bytes(writer, msg + pos, 4);
+    // type, class and TTL are copied as is; RDLENGTH is filled in once RDATA is written.
+    if (dns_writer_bytes(writer, msg + pos, 10) == -1)
+        return -1;
+    size_t rdlength_offset = writer->len - 2;
+    size_t rdata = record->rdata;
+    size_t rdata_end = record->rdata + record->rdlength;
+    size_t prefix;
+    unsigned int nnames = dns_rdata_names(record->type, &prefix);
+    if (nnames) {
+        if (prefix > record->rdlength)
+            return -2;
+        if (dns_writer_bytes(writer, msg + rdata, prefix) == -1)
+            return -1;
+        rdata += prefix;
+        for (unsigned int i = 0; i < nnames; ++i) {
+            size_t next = dns_read_name(msg, len, rdata, name, &name_len);
+            if (!next || next > rdata_end)
+                return -2;
+            if (dns_writer_name(writer, name, name_len) == -1)
+                return -1;
+            rdata = next;
+        }
+    }
+    if (dns_writer_bytes(writer, msg + rdata, rdata_end - rdata) == -1)
+        return -1;
+    write_u16(writer->buf + rdlength_offset, (uint16_t) (writer->len - rdlength_offset - 2));
+    return 0;
+}
+
+int dns_writer_record(struct dns_writer *writer, const uint8_t *msg, size_t len, const struct dns_record *record) {
+    size_t saved_len = writer->len;
+    size_t saved_nsuffixes = writer->nsuffixes;
+    int r = write_record(writer, msg, len, record);
+    if (r < 0) {
+        dns_writer_rewind(writer, saved_len, saved_nsuffixes);
+        return r;
+    }
+    writer->counts[record->section]++;
+    return 0;
+}
+
+size_t dns_writer_finish(struct dns_writer *writer, uint16_t id, uint16_t flags) {
+    write_u16(writer->buf, id);
+    write_u16(writer->buf + 2, flags);
+    for (unsigned int i = 0; i < DNS_SECTIONS; ++i)
+        write_u16(writer->buf + 4 + 2 * i, writer->counts[i]);
+    return writer->len;
+}
@@ -0,0 +1,194 @@
+/*
+    This file is part of mDNS Reflector (mdns-reflector), a lightweight and performant multicast DNS (mDNS) reflector.
+    Copyright (C) 2021 Yuxiang Zhu <me@yux.im>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef MDNS_REFLECTOR_DNS_H
+#define MDNS_REFLECTOR_DNS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define DNS_HEADER_SIZE 12
+/// maximum length of an uncompressed name in wire format, including the root label
+#define DNS_NAME_MAX 255
+
+#define DNS_FLAG_QR 0x8000u
+#define DNS_FLAG_AA 0x0400u
+#define DNS_FLAG_TC 0x0200u
+#define DNS_OPCODE(flags) (((flags) >> 11) & 0xfu)
+#define DNS_RCODE(flags) ((flags) & 0xfu)
+
+#define DNS_TYPE_A 1
+#define DNS_TYPE_NS 2
+#define DNS_TYPE_CNAME 5
+#define DNS_TYPE_SOA 6
+#define DNS_TYPE_PTR 12
+#define DNS_TYPE_MX 15
+#define DNS_TYPE_TXT 16
+#define DNS_TYPE_AAAA 28
+#define DNS_TYPE_SRV 33
+#define DNS_TYPE_DNAME 39
+#define DNS_TYPE_OPT 41
+#define DNS_TYPE_NSEC 47
+#define DNS_TYPE_ANY 255
+
+/// the top bit of the class is the cache-flush bit in answers and the unicast-response bit in questions
+#define DNS_CLASS_MASK 0x7fffu
+
+enum dns_section {
+    DNS_SECTION_QUESTION,
+    DNS_SECTION_ANSWER,
+    DNS_SECTION_AUTHORITY,
+    DNS_SECTION_ADDITIONAL,
+    DNS_SECTIONS
+};
+
+struct dns_header {
+    uint16_t id;
+    uint16_t flags;
+    uint16_t counts[DNS_SECTIONS];
+};
+
+/// A question or resource record located in a message. All offsets are relative to the start of the message.
+struct dns_record {
+    /// one of enum dns_section
+    unsigned int section;
+    /// offset of the owner name
+    size_t offset;
+    /// offset right after the record
+    size_t end;
+    uint16_t type;
+    uint16_t rrclass;
+    /// TTL; 0 for questions
+    uint32_t ttl;
+    /// offset of RDATA; equal to `end` for questions
+    size_t rdata;
+    uint16_t rdlength;
+};
+
+struct dns_parser {
+    const uint8_t *msg;
+    size_t len;
+    struct dns_header header;
+    size_t offset;
+    unsigned int section;
+    unsigned int remaining;
+};
+
+void dns_parse_header(const uint8_t *msg, struct dns_header *header);
+
+/// Start parsing a message.
+/// \return 0 on success or -1 if the message is shorter than a header
+int dns_parser_init(struct dns_parser *parser, const uint8_t *msg, size_t len);
+
+/// Locate the next question or resource record.
+/// \return 1 if a record was found, 0 at the end of the message, or -1 if the message is malformed
+int dns_parser_next(struct dns_parser *parser, struct dns_record *record);
+
+/// Skip a possibly compressed name.
+/// \return offset right after the name, or 0 if the name is malformed
+size_t dns_skip_name(const uint8_t *msg, size_t len, size_t offset);
+
+/// Read a possibly compressed name into uncompressed wire format.
+/// \param name output buffer of DNS_NAME_MAX bytes
+/// \param name_len length of the output name including the root label
+/// \return offset right after the name in the message, or 0 if the name is malformed
+size_t dns_read_name(const uint8_t *msg, size_t len, size_t offset, uint8_t *name, size_t *name_len);
+
+/// Find where names are stored in the RDATA of a record type.
+/// \param type record type
+/// \param prefix bytes before the first name
+/// \return number of consecutive names after `prefix`, or 0 if the RDATA has no (compressible) names
+unsigned int dns_rdata_names(uint16_t type, size_t *prefix);
+
+/// Hash the content of a record: owner name and names in RDATA are decompressed and compared case-insensitively,
+/// so the same record gets the same hash in any message.
+/// \param hash output hash
+/// \return 0 on success or -1 if the record is malformed
+int dns_record_hash(const uint8_t *msg, size_t len, const struct dns_record *record, uint64_t *hash);
+
+/// Hash an uncompressed name case-insensitively.
+uint64_t dns_name_hash(const uint8_t *name, size_t name_len);
+
+/// Compare two uncompressed names case-insensitively.
+bool dns_name_equal(const uint8_t *a, size_t a_len, const uint8_t *b, size_t b_len);
+
+/// Check whether an uncompressed name ends with the labels of another, case-insensitively.
+/// \return offset of the suffix in `name`, or -1 if it does not end with it
+long dns_name_suffix(const uint8_t *name, size_t name_len, const uint8_t *suffix, size_t suffix_len);
+
+/// Extract the service type of a DNS-SD name, e.g. "_ipp._tcp.local" from "Printer._ipp._tcp.local" or
+/// "_printer._sub._ipp._tcp.local".
+/// \param offset offset of the name in the message
+/// \param out output buffer for the service type in dotted form
+/// \param out_size size of the output buffer
+/// \return length of the service type, or 0 if the name is not a DNS-SD name or is malformed
+size_t dns_service_type(const uint8_t *msg, size_t len, size_t offset, char *out, size_t out_size);
+
+/// Fingerprint a whole message, to recognize copies of the same packet.
+uint64_t dns_fingerprint(const uint8_t *msg, size_t len);
+
+#define DNS_WRITER_SUFFIXES_MAX 128
+/// size of the suffix index; a power of two, twice the number of suffixes
+#define DNS_WRITER_INDEX_SIZE 256
+
+/// Builds a message with name compression. Records must be added in section order.
+/// Every name suffix written is indexed by its hash, so the longest suffix of a new name that was written before is
+/// found with one lookup per label.
+struct dns_writer {
+    uint8_t *buf;
+    size_t cap;
+    size_t len;
+    uint16_t counts[DNS_SECTIONS];
+    bool overflow;
+    size_t nsuffixes;
+    /// offsets of names and name suffixes written so far, as compression targets
+    uint16_t suffixes[DNS_WRITER_SUFFIXES_MAX];
+    uint32_t suffix_hashes[DNS_WRITER_SUFFIXES_MAX];
+    /// index slot of each suffix, to remove suffixes again
+    uint8_t suffix_slots[DNS_WRITER_SUFFIXES_MAX];
+    /// open-addressing index from suffix hash to suffix number + 1, 0 if empty
+    uint8_t index[DNS_WRITER_INDEX_SIZE];
+};
+
+void dns_writer_init(struct dns_writer *writer, uint8_t *buf, size_t cap);
+
+/// Write an uncompressed wire-format name, compressing it against names written before.
+/// \return 0 on success or -1 if the buffer is full
+int dns_writer_name(struct dns_writer *writer, const uint8_t *name, size_t name_len);
+
+/// Write an uncompressed wire-format name in full, for names that must not be compressed in unicast DNS such as
+/// SRV targets (RFC 2782). Its suffixes are still compression targets for later names.
+/// \return 0 on success or -1 if the buffer is full
+int dns_writer_name_uncompressed(struct dns_writer *writer, const uint8_t *name, size_t name_len);
+
+int dns_writer_bytes(struct dns_writer *writer, const void *data, size_t len);
+
+/// Undo writes back to an earlier length and number of suffixes.
+void dns_writer_rewind(struct dns_writer *writer, size_t len, size_t nsuffixes);
+
+/// Copy a question or resource record from another message, re-encoding every name in it.
+/// Nothing is written if the record does not fit or is malformed.
+/// \return 0 on success, -1 if the buffer is full, or -2 if the record is malformed
+int dns_writer_record(struct dns_writer *writer, const uint8_t *msg, size_t len, const struct dns_record *record);
+
+/// Write the header.
+/// \return length of the message
+size_t dns_writer_finish(struct dns_writer *writer, uint16_t id, uint16_t flags);
+
+#endif //MDNS_REFLECTOR_DNS_H
@@ -0,0 +1,34 @@
+/*
+    This file is part of mDNS Reflector (mdns-reflector), a lightweight and performant multicast DNS (mDNS) reflector.
+    Copyright (C) 2021 Yuxiang Zhu <me@yux.im>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "dualstack.h"
+#include "dns.h"
+
+bool dualstack_is_duplicate(struct dualstack_filter *filter, unsigned int zone_index, unsigned int ifindex,
+                            unsigned int protocol, const uint8_t *msg, size_t len, int family, uint64_t now_ns,
+                            uint64_t window_ns) {
+    uint64_t key = dns_fingerprint(msg, len);
+    key ^= ((uint64_t) zone_index << 48 | (uint64_t) protocol << 32 | ifindex) * 0x9e3779b97f4a7c15u;
+    int seen_family;
+    if (fpcache_find(&filter->seen, key, now_ns, window_ns, &seen_family) && seen_family != family) {
+        fpcache_remove(&filter->seen, key);
+        return true;
+    }
+    fpcache_put(&filter->seen, key, family, now_ns);
+    return false;
+}
@@ -0,0 +1,42 @@
+/*
+    This file is part of mDNS Reflector (mdns-reflector), a lightweight and performant multicast DNS (mDNS) reflector.
+    Copyright (C) 2021 Yuxiang Zhu <me@yux.im>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef MDNS_REFLECTOR_DUALSTACK_H
+#define MDNS_REFLECTOR_DUALSTACK_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "fpcache.h"
+
+/// Recognizes packets that a dual-stack host sent over both IPv4 and IPv6.
+struct dualstack_filter {
+    /// fingerprints of packets mixed with the zone, interface and protocol they were received on, tagged with the
+    /// address family
+    struct fpcache seen;
+};
+
+/// Check whether the same packet was received on the same interface of a zone over the other address family within
+/// `window_ns`, and otherwise remember it. Each packet matches at most one copy of the other family.
+/// \param protocol protocol id of the interface
+/// \return true if the packet is the second copy of a dual-stack transmission
+bool dualstack_is_duplicate(struct dualstack_filter *filter, unsigned int zone_index, unsigned int ifindex,
+                            unsigned int protocol, const uint8_t *msg, size_t len, int family, uint64_t now_ns,
+                            uint64_t window_ns);
+
+#endif //MDNS_REFLECTOR_DUALSTACK_H
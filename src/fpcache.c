@@ -0,0 +1,47 @@
+/*
+    This file is part of mDNS Reflector (mdns-reflector), a lightweight and performant multicast DNS (mDNS) reflector.
+    Copyright (C) 2021 Yuxiang Zhu <me@yux.im>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "fpcache.h"
+
+static size_t slot_of(uint64_t fingerprint) {
+    return (size_t) (fingerprint ^ fingerprint >> 32) & (FPCACHE_SIZE - 1);
+}
+
+bool fpcache_find(const struct fpcache *cache, uint64_t fingerprint, uint64_t now_ns, uint64_t window_ns, int *tag) {
+    size_t slot = slot_of(fingerprint);
+    if (!cache->slots[slot].used || cache->slots[slot].fingerprint != fingerprint ||
+        now_ns - cache->slots[slot].time_ns >= window_ns)
+        return false;
+    if (tag)
+        *tag = cache->slots[slot].tag;
+    return true;
+}
+
+void fpcache_put(struct fpcache *cache, uint64_t fingerprint, int tag, uint64_t now_ns) {
+    size_t slot = slot_of(fingerprint);
+    cache->slots[slot].fingerprint = fingerprint;
+    cache->slots[slot].time_ns = now_ns;
+    cache->slots[slot].tag = tag;
+    cache->slots[slot].used = true;
+}
+
+void fpcache_remove(struct fpcache *cache, uint64_t fingerprint) {
+    size_t slot = slot_of(fingerprint);
+    if (cache->slots[slot].fingerprint == fingerprint)
+        cache->slots[slot].used = false;
+}
@@ -0,0 +1,52 @@
+/*
+    This file is part of mDNS Reflector (mdns-reflector), a lightweight and performant multicast DNS (mDNS) reflector.
+    Copyright (C) 2021 Yuxiang Zhu <me@yux.im>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef MDNS_REFLECTOR_FPCACHE_H
+#define MDNS_REFLECTOR_FPCACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/// number of fingerprints a cache remembers; a power of two
+#define FPCACHE_SIZE 1024
+
+/// Remembers fingerprints of recently seen messages, each with the time it was seen and a tag such as the direction
+/// or address family. The cache is direct-mapped: a colliding fingerprint only evicts an older one, so memory and
+/// time stay constant.
+struct fpcache {
+    struct {
+        uint64_t fingerprint;
+        uint64_t time_ns;
+        int tag;
+        bool used;
+    } slots[FPCACHE_SIZE];
+};
+
+/// Look up a fingerprint remembered within `window_ns`.
+/// \param tag set to the tag it was remembered with, if found; may be NULL
+/// \return whether it was found
+bool fpcache_find(const struct fpcache *cache, uint64_t fingerprint, uint64_t now_ns, uint64_t window_ns, int *tag);
+
+/// Remember a fingerprint, replacing the one that shared its slot.
+void fpcache_put(struct fpcache *cache, uint64_t fingerprint, int tag, uint64_t now_ns);
+
+/// Forget a fingerprint, if it is remembered.
+void fpcache_remove(struct fpcache *cache, uint64_t fingerprint);
+
+#endif //MDNS_REFLECTOR_FPCACHE_H
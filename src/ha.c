@@ -0,0 +1,182 @@
+/*
+    This file is part of mDNS Reflector (mdns-reflector), a lightweight and performant multicast DNS (mDNS) reflector.
+    Copyright (C) 2021 Yuxiang Zhu <me@yux.im>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "ha.h"
+#include "dns.h"
+#include <stdlib.h>
+#include <string.h>
+#include <netinet/in.h>
+
+#define HA_MAGIC0 'm'
+#define HA_MAGIC1 'H'
+#define NS_PER_MS 1000000u
+
+struct ha *new_ha(void) {
+    struct ha *ha = calloc(1, sizeof(struct ha));
+    if (!ha)
+        return NULL;
+    ha->priority = 100;
+    ha->heartbeat_ms = 200;
+    ha->failover_ms = 1000;
+    ha->preempt = true;
+    ha->sync = true;
+    ha->fd = -1;
+    return ha;
+}
+
+void free_ha(struct ha *ha) {
+    free(ha);
+}
+
+const char *ha_state_name(enum ha_state state) {
+    return state == HA_ACTIVE ? "active" : "standby";
+}
+
+void ha_start(struct ha *ha, uint64_t now_ns) {
+    ha->state = HA_STANDBY;
+    ha->started_ns = now_ns;
+    ha->next_heartbeat_ns = now_ns;
+}
+
+/// \return whether this node is preferred over the peer
+static bool wins_over_peer(const struct ha *ha) {
+    if (ha->priority != ha->peer_priority)
+        return ha->priority > ha->peer_priority;
+    const void *local, *peer;
+    size_t len;
+    if (ha->local.ss_family == AF_INET6) {
+        local = &((const struct sockaddr_in6 *) &ha->local)->sin6_addr;
+        peer = &((const struct sockaddr_in6 *) &ha->peer)->sin6_addr;
+        len = sizeof(struct in6_addr);
+    } else {
+        local = &((const struct sockaddr_in *) &ha->local)->sin_addr;
+        peer = &((const struct sockaddr_in *) &ha->peer)->sin_addr;
+        len = sizeof(struct in_addr);
+    }
+    return memcmp(local, peer, len) > 0;
+}
+
+bool ha_update(struct ha *ha, uint64_t now_ns, const char **reason) {
+    uint64_t failover_ns = (uint64_t) ha->failover_ms * NS_PER_MS;
+    bool peer_alive = ha->peer_seen && now_ns - ha->peer_heard_ns < failover_ns;
+    enum ha_state state = ha->state;
+    if (!peer_alive) {
+        if (state == HA_STANDBY && now_ns - ha->started_ns >= failover_ns) {
+            state = HA_ACTIVE;
+            *reason = ha->peer_seen ? "peer is silent" : "no peer heard since start";
+        }
+    } else if (ha->peer_state == HA_ACTIVE) {
+        if (state == HA_ACTIVE && !wins_over_peer(ha)) {
+            state = HA_STANDBY;
+            *reason = "peer is active and preferred";
+        } else if (state == HA_STANDBY && ha->preempt && ha->priority > ha->peer_priority) {
+            state = HA_ACTIVE;
+            *reason = "preempting peer with lower priority";
+        }
+    } else if (state == HA_STANDBY && wins_over_peer(ha)) {
+        state = HA_ACTIVE;
+        *reason = "peer is standby";
+    }
+    if (state == ha->state)
+        return false;
+    ha->state = state;
+    ha->stats.transitions++;
+    // tell the peer right away
+    ha->next_heartbeat_ns = now_ns;
+    return true;
+}
+
+uint64_t ha_next_deadline(const struct ha *ha) {
+    uint64_t deadline = ha->next_heartbeat_ns;
+    if (ha->state == HA_STANDBY) {
+        uint64_t since = ha->peer_seen ? ha->peer_heard_ns : ha->started_ns;
+        uint64_t failover = since + (uint64_t) ha->failover_ms * NS_PER_MS;
+        if (failover < deadline)
+            deadline = failover;
+    }
+    return deadline;
+}
+
+static void put_u16(uint8_t *p, uint16_t v) {
+    p[0] = (uint8_t) (v >> 8);
+    p[1] = (uint8_t) v;
+}
+
+static void put_u32(uint8_t *p, uint32_t v) {
+    put_u16(p, (uint16_t) (v >> 16));
+    put_u16(p + 2, (uint16_t) v);
+}
+
+static uint32_t get_u32(const uint8_t *p) {
+    return (uint32_t) p[0] << 24 | (uint32_t) p[1] << 16 | (uint32_t) p[2] << 8 | p[3];
+}
+
+size_t ha_build_heartbeat(struct ha *ha, uint8_t *out, size_t cap, uint64_t now_ns) {
+    size_t count = ha->npending;
+    if (HA_HEADER_SIZE + count * 8 > cap)
+        count = (cap - HA_HEADER_SIZE) / 8;
+    out[0] = HA_MAGIC0;
+    out[1] = HA_MAGIC1;
+    out[2] = HA_VERSION;
+    out[3] = (uint8_t) ha->state;
+    out[4] = (uint8_t) ha->priority;
+    out[5] = 0;
+    put_u16(out + 6, (uint16_t) count);
+    put_u32(out + 8, ++ha->seq);
+    for (size_t i = 0; i < count; ++i) {
+        put_u32(out + HA_HEADER_SIZE + i * 8, (uint32_t) (ha->pending[i] >> 32));
+        put_u32(out + HA_HEADER_SIZE + i * 8 + 4, (uint32_t) ha->pending[i]);
+    }
+    ha->npending = 0;
+    ha->next_heartbeat_ns = now_ns + (uint64_t) ha->heartbeat_ms * NS_PER_MS;
+    return HA_HEADER_SIZE + count * 8;
+}
+
+int ha_receive_heartbeat(struct ha *ha, const uint8_t *msg, size_t len, uint64_t now_ns) {
+    if (len < HA_HEADER_SIZE || msg[0] != HA_MAGIC0 || msg[1] != HA_MAGIC1 || msg[2] != HA_VERSION ||
+        msg[3] > HA_ACTIVE)
+        return -1;
+    size_t count = (size_t) msg[6] << 8 | msg[7];
+    if (len != HA_HEADER_SIZE + count * 8)
+        return -1;
+    ha->peer_seen = true;
+    ha->peer_heard_ns = now_ns;
+    ha->peer_state = (enum ha_state) msg[3];
+    ha->peer_priority = msg[4];
+    for (size_t i = 0; i < count; ++i) {
+        const uint8_t *p = msg + HA_HEADER_SIZE + i * 8;
+        uint64_t fingerprint = (uint64_t) get_u32(p) << 32 | get_u32(p + 4);
+        fpcache_put(&ha->synced, fingerprint, 0, now_ns);
+    }
+    ha->stats.heartbeats_rx++;
+    ha->stats.fingerprints_synced += count;
+    return 0;
+}
+
+bool ha_is_duplicate(struct ha *ha, const uint8_t *msg, size_t len, uint64_t now_ns) {
+    uint64_t fingerprint = dns_fingerprint(msg, len);
+    if (fpcache_find(&ha->synced, fingerprint, now_ns, (uint64_t) HA_SYNC_WINDOW_MS * NS_PER_MS, NULL))
+        return true;
+    if (!ha->sync)
+        return false;
+    if (ha->npending < HA_SYNC_MAX)
+        ha->pending[ha->npending++] = fingerprint;
+    else
+        ha->stats.sync_overflows++;
+    return false;
+}
@@ -0,0 +1,116 @@
+/*
+    This file is part of mDNS Reflector (mdns-reflector), a lightweight and performant multicast DNS (mDNS) reflector.
+    Copyright (C) 2021 Yuxiang Zhu <me@yux.im>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef MDNS_REFLECTOR_HA_H
+#define MDNS_REFLECTOR_HA_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include "fpcache.h"
+
+/// heartbeat header: two magic bytes, version, state, priority, reserved byte, fingerprint count and sequence number
+#define HA_HEADER_SIZE 12
+#define HA_VERSION 1
+/// fingerprints of reflected packets sent in one heartbeat
+#define HA_SYNC_MAX 128
+/// how long a fingerprint from the peer suppresses the same packet
+#define HA_SYNC_WINDOW_MS 2000
+
+enum ha_state {
+    HA_STANDBY,
+    HA_ACTIVE,
+};
+
+struct ha_stats {
+    uint64_t heartbeats_tx;
+    uint64_t heartbeats_rx;
+    /// datagrams from unknown sources or malformed
+    uint64_t rx_errors;
+    uint64_t transitions;
+    /// packets not reflected while standby
+    uint64_t standby_drops;
+    /// packets not reflected because the peer reflected them recently
+    uint64_t duplicate_drops;
+    /// fingerprints received from the peer
+    uint64_t fingerprints_synced;
+    /// fingerprints not sent because too many packets were reflected between heartbeats
+    uint64_t sync_overflows;
+};
+
+/// Active/standby pairing with another reflector. Both exchange heartbeats over unicast UDP; exactly one of them
+/// reflects at a time, and the standby takes over when the active one is silent for `failover_ms`.
+struct ha {
+    struct sockaddr_storage local;
+    struct sockaddr_storage peer;
+    /// the node with the higher priority is preferred; ties are broken by the higher address
+    int priority;
+    int heartbeat_ms;
+    int failover_ms;
+    /// take over from an active peer with a lower priority
+    bool preempt;
+    /// send fingerprints of reflected packets to the peer, so that it doesn't reflect them again after a failover
+    bool sync;
+    int fd;
+    enum ha_state state;
+    uint64_t started_ns;
+    uint64_t next_heartbeat_ns;
+    bool peer_seen;
+    uint64_t peer_heard_ns;
+    enum ha_state peer_state;
+    int peer_priority;
+    uint32_t seq;
+    /// fingerprints of packets reflected since the last heartbeat
+    size_t npending;
+    uint64_t pending[HA_SYNC_MAX];
+    /// fingerprints received from the peer
+    struct fpcache synced;
+    struct ha_stats stats;
+};
+
+struct ha *new_ha(void);
+
+void free_ha(struct ha *ha);
+
+const char *ha_state_name(enum ha_state state);
+
+/// Start as standby; the node goes active after `failover_ms` unless an active peer is heard from.
+void ha_start(struct ha *ha, uint64_t now_ns);
+
+/// Re-evaluate the state after time passed or a heartbeat arrived.
+/// \param reason set to why the state changed
+/// \return true if the state changed
+bool ha_update(struct ha *ha, uint64_t now_ns, const char **reason);
+
+/// \return when ha_update() or a heartbeat is next due
+uint64_t ha_next_deadline(const struct ha *ha);
+
+/// Build a heartbeat carrying the pending fingerprints, and schedule the next one.
+/// \return length of the heartbeat
+size_t ha_build_heartbeat(struct ha *ha, uint8_t *out, size_t cap, uint64_t now_ns);
+
+/// Process a heartbeat from the peer.
+/// \return 0 on success or -1 if it is malformed
+int ha_receive_heartbeat(struct ha *ha, const uint8_t *msg, size_t len, uint64_t now_ns);
+
+/// Check whether the peer reflected a packet recently, and otherwise queue its fingerprint for the peer.
+/// \return true if the packet should not be reflected again
+bool ha_is_duplicate(struct ha *ha, const uint8_t *msg, size_t len, uint64_t now_ns);
+
+#endif //MDNS_REFLECTOR_HA_H
@@ -0,0 +1,403 @@
+/*
+    This file is part of mDNS Reflector (mdns-reflector), a lightweight and performant multicast DNS (mDNS) reflector.
+    Copyright (C) 2021 Yuxiang Zhu <me@yux.im>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "handoff.h"
+#include "logging.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#if defined(MSG_NOSIGNAL)
+#define SEND_FLAGS MSG_NOSIGNAL
+#else
+#define SEND_FLAGS 0
+#endif
+
+/// room for the sockets of one record
+union handoff_control {
+    struct cmsghdr align;
+    char buf[CMSG_SPACE(sizeof(int) * HANDOFF_FDS_MAX)];
+};
+
+/// header that both instances send first
+static const struct handoff_header HEADER = {
+        .magic = HANDOFF_MAGIC,
+        .version = HANDOFF_VERSION,
+        .record_size = sizeof(struct handoff_record),
+};
+
+static int set_path(struct sockaddr_un *sun, const char *path) {
+    memset(sun, 0, sizeof(*sun));
+    sun->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(sun->sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    memcpy(sun->sun_path, path, strlen(path));
+    return 0;
+}
+
+static int wait_fd(int fd, short events) {
+    struct pollfd pfd = {.fd = fd, .events = events};
+    int r;
+    do {
+        r = poll(&pfd, 1, HANDOFF_TIMEOUT_MS);
+    } while (r == -1 && errno == EINTR);
+    if (r == 0)
+        errno = ETIMEDOUT;
+    return r > 0 ? 0 : -1;
+}
+
+/// Send what the socket takes of `len` bytes, attaching `nfds` sockets to them.
+/// \return number of bytes sent, or -1 on error
+static ssize_t send_some(int fd, const void *buf, size_t len, const int *fds, size_t nfds) {
+    union handoff_control control;
+    struct iovec iov = {
+            .iov_base = (void *) buf,
+            .iov_len = len,
+    };
+    struct msghdr mh = {
+            .msg_iov = &iov,
+            .msg_iovlen = 1,
+    };
+    if (nfds) {
+        memset(&control, 0, sizeof(control));
+        mh.msg_control = control.buf;
+        mh.msg_controllen = CMSG_SPACE(sizeof(int) * nfds);
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&mh);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int) * nfds);
+        memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * nfds);
+    }
+    ssize_t n;
+    do {
+        n = sendmsg(fd, &mh, SEND_FLAGS);
+    } while (n == -1 && errno == EINTR);
+    return n;
+}
+
+/// Send `len` bytes, attaching `nfds` sockets to the first of them.
+static int send_full(int fd, const void *buf, size_t len, const int *fds, size_t nfds) {
+    size_t sent = 0;
+    while (sent < len) {
+        ssize_t n = send_some(fd, (const char *) buf + sent, len - sent, sent ? NULL : fds, sent ? 0 : nfds);
+        if (n == -1) {
+            if ((errno == EAGAIN || errno == EWOULDBLOCK) && wait_fd(fd, POLLOUT) == 0)
+                continue;
+            return -1;
+        }
+        sent += (size_t) n;
+    }
+    return 0;
+}
+
+/// Receive exactly `len` bytes, collecting the sockets attached to them.
+/// \param fds receives up to HANDOFF_FDS_MAX sockets, or NULL to close any
+/// \return number of sockets received, or -1 on error or if the connection closed
+static int recv_full(int fd, void *buf, size_t len, int *fds) {
+    union handoff_control control;
+    size_t received = 0;
+    int nfds = 0;
+    while (received < len) {
+        if (wait_fd(fd, POLLIN) == -1)
+            goto fail;
+        struct iovec iov = {
+                .iov_base = (char *) buf + received,
+                .iov_len = len - received,
+        };
+        struct msghdr mh = {
+                .msg_iov = &iov,
+                .msg_iovlen = 1,
+                .msg_control = control.buf,
+                .msg_controllen = sizeof(control.buf),
+        };
+        ssize_t n = recvmsg(fd, &mh, 0);
+        if (n == -1) {
+            if (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK)
+                continue;
+            goto fail;
+        }
+        for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&mh); cmsg; cmsg = CMSG_NXTHDR(&mh, cmsg)) {
+            if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+                continue;
+            size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            for (size_t i = 0; i < count; ++i) {
+                int received_fd;
+                memcpy(&received_fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+                if (fds && nfds < HANDOFF_FDS_MAX)
+                    fds[nfds++] = received_fd;
+                else
+                    close(received_fd);
+            }
+        }
+        if (n == 0 || (mh.msg_flags & MSG_CTRUNC)) {
+            errno = n == 0 ? ECONNRESET : EPROTO;
+            goto fail;
+        }
+        received += (size_t) n;
+    }
+    return nfds;
+    fail:
+    for (int i = 0; i < nfds; ++i)
+        close(fds[i]);
+    return -1;
+}
+
+int handoff_listen(const char *path) {
+    struct sockaddr_un sun;
+    if (set_path(&sun, path) == -1) {
+        log_err(LOG_ERR, "handoff: %s", path);
+        return -1;
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd == -1) {
+        log_err(LOG_ERR, "handoff: socket");
+        return -1;
+    }
+    // The socket is left by an instance that exited, or by the one that just handed over and no longer needs it.
+    if (unlink(path) == -1 && errno != ENOENT) {
+        log_err(LOG_ERR, "handoff: unlink %s", path);
+        goto cleanup;
+    }
+    if (bind(fd, (const struct sockaddr *) &sun, sizeof(sun)) == -1) {
+        log_err(LOG_ERR, "handoff: bind %s", path);
+        goto cleanup;
+    }
+    if (listen(fd, 1) == -1) {
+        log_err(LOG_ERR, "handoff: listen");
+        goto cleanup;
+    }
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags == -1 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1) {
+        log_err(LOG_ERR, "handoff: fcntl");
+        goto cleanup;
+    }
+    return fd;
+    cleanup:
+    close(fd);
+    return -1;
+}
+
+int handoff_connect(struct handoff *handoff, const char *path) {
+    memset(handoff, 0, sizeof(*handoff));
+    handoff->fd = -1;
+    struct sockaddr_un sun;
+    if (set_path(&sun, path) == -1) {
+        log_err(LOG_ERR, "handoff: %s", path);
+        return -1;
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd == -1) {
+        log_err(LOG_ERR, "handoff: socket");
+        return -1;
+    }
+    if (connect(fd, (const struct sockaddr *) &sun, sizeof(sun)) == -1) {
+        close(fd);
+        if (errno == ENOENT || errno == ECONNREFUSED) {
+            log_msg(LOG_INFO, "handoff: no instance running at %s", path);
+            return 0;
+        }
+        log_err(LOG_ERR, "handoff: connect %s", path);
+        return -1;
+    }
+    handoff->fd = fd;
+    struct handoff_header theirs;
+    if (send_full(fd, &HEADER, sizeof(HEADER), NULL, 0) == -1 || recv_full(fd, &theirs, sizeof(theirs), NULL) == -1) {
+        log_err(LOG_ERR, "handoff: no answer from the instance running at %s", path);
+        goto fail;
+    }
+    if (memcmp(&HEADER, &theirs, sizeof(HEADER)) != 0) {
+        log_msg(LOG_WARNING, "handoff: the running instance speaks another version; opening sockets anew");
+        handoff_finish(handoff, false);
+        return 0;
+    }
+    for (;;) {
+        struct handoff_entry entry = {.taken = false};
+        int fds[HANDOFF_FDS_MAX];
+        int nfds = recv_full(fd, &entry.record, sizeof(entry.record), fds);
+        if (nfds == -1) {
+            log_err(LOG_ERR, "handoff: failed to receive sockets");
+            goto fail;
+        }
+        if (!entry.record.nfds || (uint32_t) nfds != entry.record.nfds) {
+            for (int i = 0; i < nfds; ++i)
+                close(fds[i]);
+            if (!entry.record.nfds)
+                break;
+            log_msg(LOG_ERR, "handoff: expected %u socket(s) for %.*s, got %d", entry.record.nfds,
+                    HANDOFF_KEY_MAX, entry.record.key, nfds);
+            goto fail;
+        }
+        entry.record.key[HANDOFF_KEY_MAX - 1] = '\0';
+        for (int i = 0; i < HANDOFF_FDS_MAX; ++i)
+            entry.fds[i] = i < nfds ? fds[i] : -1;
+        struct handoff_entry *entries = realloc(handoff->entries, (handoff->nentries + 1) * sizeof(*entries));
+        if (!entries) {
+            log_err(LOG_ERR, "can't malloc");
+            for (int i = 0; i < nfds; ++i)
+                close(fds[i]);
+            goto fail;
+        }
+        handoff->entries = entries;
+        handoff->entries[handoff->nentries++] = entry;
+    }
+    log_msg(LOG_WARNING, "handoff: received %zu socket set(s) from the instance running at %s", handoff->nentries,
+            path);
+    return 0;
+    fail:
+    handoff_finish(handoff, false);
+    return -1;
+}
+
+struct handoff_entry *handoff_take(struct handoff *handoff, const char *key) {
+    for (size_t i = 0; i < handoff->nentries; ++i) {
+        struct handoff_entry *entry = &handoff->entries[i];
+        if (!entry->taken && strcmp(entry->record.key, key) == 0) {
+            entry->taken = true;
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+void handoff_finish(struct handoff *handoff, bool ready) {
+    if (handoff->fd >= 0) {
+        const char message = HANDOFF_READY;
+        if (ready && send_full(handoff->fd, &message, 1, NULL, 0) == -1)
+            log_err(LOG_WARNING, "handoff: failed to tell the running instance to stop");
+        close(handoff->fd);
+    }
+    // Sockets of interfaces, relays and discovery proxies that are not in our configuration. The running instance
+    // still has them open, until it stops.
+    for (size_t i = 0; i < handoff->nentries; ++i) {
+        struct handoff_entry *entry = &handoff->entries[i];
+        for (int j = 0; !entry->taken && j < HANDOFF_FDS_MAX; ++j) {
+            if (entry->fds[j] >= 0)
+                close(entry->fds[j]);
+        }
+    }
+    free(handoff->entries);
+    handoff->entries = NULL;
+    handoff->nentries = 0;
+    handoff->fd = -1;
+}
+
+void handoff_conn_init(struct handoff_conn *conn, int fd, uint64_t deadline_ns) {
+    memset(conn, 0, sizeof(*conn));
+    conn->fd = fd;
+    conn->deadline_ns = deadline_ns;
+}
+
+int handoff_conn_receive_header(struct handoff_conn *conn) {
+    while (conn->header_received < sizeof(conn->theirs)) {
+        ssize_t n = recv(conn->fd, (char *) &conn->theirs + conn->header_received,
+                         sizeof(conn->theirs) - conn->header_received, 0);
+        if (n == -1 && errno == EINTR)
+            continue;
+        if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return 0;
+        if (n <= 0) {
+            if (n == 0)
+                errno = ECONNRESET;
+            log_err(LOG_WARNING, "handoff: no request from the new instance");
+            return -1;
+        }
+        conn->header_received += (size_t) n;
+    }
+    if (memcmp(&HEADER, &conn->theirs, sizeof(HEADER)) != 0) {
+        log_msg(LOG_WARNING, "handoff: the new instance speaks another version");
+        return -1;
+    }
+    return 1;
+}
+
+/// Close the sockets of a record that were not sent.
+static void close_entry_fds(struct handoff_entry *entry) {
+    for (int i = 0; i < HANDOFF_FDS_MAX; ++i) {
+        if (entry->fds[i] >= 0)
+            close(entry->fds[i]);
+        entry->fds[i] = -1;
+    }
+}
+
+int handoff_conn_queue(struct handoff_conn *conn, const struct handoff_record *record, const int *fds) {
+    struct handoff_entry entry = {.record = *record, .taken = false};
+    for (int i = 0; i < HANDOFF_FDS_MAX; ++i)
+        entry.fds[i] = -1;
+    if (record->nfds > HANDOFF_FDS_MAX) {
+        errno = EINVAL;
+        return -1;
+    }
+    for (uint32_t i = 0; i < record->nfds; ++i) {
+        entry.fds[i] = dup(fds[i]);
+        if (entry.fds[i] == -1)
+            goto fail;
+    }
+    struct handoff_entry *queue = realloc(conn->queue, (conn->nqueued + 1) * sizeof(*queue));
+    if (!queue)
+        goto fail;
+    conn->queue = queue;
+    conn->queue[conn->nqueued++] = entry;
+    return 0;
+    fail:
+    close_entry_fds(&entry);
+    return -1;
+}
+
+int handoff_conn_flush(struct handoff_conn *conn) {
+    while (conn->header_sent < sizeof(HEADER)) {
+        ssize_t n = send_some(conn->fd, (const char *) &HEADER + conn->header_sent, sizeof(HEADER) - conn->header_sent,
+                              NULL, 0);
+        if (n == -1)
+            return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+        conn->header_sent += (size_t) n;
+    }
+    while (conn->next < conn->nqueued) {
+        struct handoff_entry *entry = &conn->queue[conn->next];
+        ssize_t n = send_some(conn->fd, (const char *) &entry->record + conn->sent, sizeof(entry->record) - conn->sent,
+                              conn->sent ? NULL : entry->fds, conn->sent ? 0 : entry->record.nfds);
+        if (n == -1)
+            return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+        // the sockets went with the first byte of the record
+        close_entry_fds(entry);
+        conn->sent += (size_t) n;
+        if (conn->sent == sizeof(entry->record)) {
+            conn->next++;
+            conn->sent = 0;
+        }
+    }
+    return 1;
+}
+
+void handoff_conn_close(struct handoff_conn *conn) {
+    if (conn->fd >= 0)
+        close(conn->fd);
+    for (size_t i = 0; i < conn->nqueued; ++i)
+        close_entry_fds(&conn->queue[i]);
+    free(conn->queue);
+    memset(conn, 0, sizeof(*conn));
+    conn->fd = -1;
+}
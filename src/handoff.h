@@ -0,0 +1,133 @@
+/*
+    This file is part of mDNS Reflector (mdns-reflector), a lightweight and performant multicast DNS (mDNS) reflector.
+    Copyright (C) 2021 Yuxiang Zhu <me@yux.im>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef MDNS_REFLECTOR_HANDOFF_H
+#define MDNS_REFLECTOR_HANDOFF_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "stats.h"
+#include "hosttable.h"
+
+/// Handing open sockets over from a running instance to a new one over a Unix socket, for upgrades without
+/// interruption. The new instance connects and sends a header; the running one answers with the same header followed
+/// by a record for each socket set, with the sockets attached as SCM_RIGHTS, and an empty record. Once started, the
+/// new instance sends HANDOFF_READY and the running one stops. If the connection closes before that, the running
+/// instance carries on.
+
+#define HANDOFF_MAGIC 0x6d726866u
+/// bumped whenever struct handoff_record or its meaning changes
+#define HANDOFF_VERSION 1u
+#define HANDOFF_KEY_MAX 96
+#define HANDOFF_FDS_MAX 2
+#define HANDOFF_READY 'R'
+/// longest wait of the new instance for the running one at each step, and of the running instance for the new one to
+/// take all sockets
+#define HANDOFF_TIMEOUT_MS 2000
+
+struct handoff_header {
+    uint32_t magic;
+    uint32_t version;
+    /// size of struct handoff_record, which differs between builds for other platforms
+    uint32_t record_size;
+};
+
+/// Sockets of one interface, relay, discovery proxy or HA pairing, identified by a key that the new instance derives
+/// from its own configuration.
+struct handoff_record {
+    char key[HANDOFF_KEY_MAX];
+    /// number of attached sockets, or 0 for the record ending the list
+    uint32_t nfds;
+    /// counters and learned state of a reflection interface
+    struct if_stats stats;
+    uint64_t listener_seen_ns;
+    bool has_hosts;
+    struct host_table hosts;
+};
+
+/// A record with its sockets, received from the running instance or queued for a new one.
+struct handoff_entry {
+    struct handoff_record record;
+    int fds[HANDOFF_FDS_MAX];
+    bool taken;
+};
+
+/// Sockets received from the running instance.
+struct handoff {
+    /// connection to the running instance, or -1
+    int fd;
+    struct handoff_entry *entries;
+    size_t nentries;
+};
+
+/// Listen for a new instance at `path`, replacing a socket left there by a previous instance.
+/// \return non-blocking listening socket, or -1 on error
+int handoff_listen(const char *path);
+
+/// Connect to the instance running at `path` and receive its sockets.
+/// \return 0 on success, also if no instance is running or it speaks another version, leaving no entries; -1 on error
+int handoff_connect(struct handoff *handoff, const char *path);
+
+/// Take the sockets of a key, which are then owned by the caller.
+/// \return the entry, or NULL if the running instance had no sockets for the key
+struct handoff_entry *handoff_take(struct handoff *handoff, const char *key);
+
+/// Tell the running instance to stop, close the sockets nobody took, and free everything.
+/// \param ready whether the new instance started, or false to let the running instance carry on
+void handoff_finish(struct handoff *handoff, bool ready);
+
+/// A connection of a new instance to the running one, served without blocking as it becomes readable or writable:
+/// the header of the new instance is received, then our header and the queued records are sent.
+struct handoff_conn {
+    /// accepted non-blocking connection, or -1
+    int fd;
+    /// when the new instance must have taken all sockets
+    uint64_t deadline_ns;
+    struct handoff_header theirs;
+    size_t header_received;
+    /// bytes of our header sent
+    size_t header_sent;
+    /// records to send, with duplicates of their sockets, which are closed once sent
+    struct handoff_entry *queue;
+    size_t nqueued;
+    /// index of the record being sent, and bytes of it sent
+    size_t next;
+    size_t sent;
+};
+
+/// Start serving a new instance on an accepted non-blocking connection.
+void handoff_conn_init(struct handoff_conn *conn, int fd, uint64_t deadline_ns);
+
+/// Receive what is available of the new instance's header.
+/// \return 1 once the header is complete and the new instance speaks our version, 0 if more is to come, or -1 if it
+/// speaks another version, on error, or if the connection closed
+int handoff_conn_receive_header(struct handoff_conn *conn);
+
+/// Queue a record for sending. Its sockets are duplicated, so the caller may close them before they are sent.
+/// \return 0 on success or -1 on error
+int handoff_conn_queue(struct handoff_conn *conn, const struct handoff_record *record, const int *fds);
+
+/// Send what the connection takes of our header and the queued records.
+/// \return 1 once everything is sent, 0 if the connection must become writable first, or -1 on error
+int handoff_conn_flush(struct handoff_conn *conn);
+
+/// Close the connection and the sockets of records not sent yet.
+void handoff_conn_close(struct handoff_conn *conn);
+
+#endif //MDNS_REFLECTOR_HANDOFF_H
@@ -0,0 +1,221 @@
+/*
+    This file is part of mDNS Reflector (mdns-reflector), a lightweight and performant multicast DNS (mDNS) reflector.
+    Copyright (C) 2021 Yuxiang Zhu <me@yux.im>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "heavyhitters.h"
+#include "dns.h"
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <netinet/in.h>
+
+void heavy_hitters_init(struct heavy_hitters *hh) {
+    memset(hh, 0, sizeof(*hh));
+}
+
+static void heap_swap(struct heavy_hitters *hh, size_t a, size_t b) {
+    uint8_t ea = hh->heap[a];
+    uint8_t eb = hh->heap[b];
+    hh->heap[a] = eb;
+    hh->heap[b] = ea;
+    hh->heap_pos[eb] = (uint8_t) a;
+    hh->heap_pos[ea] = (uint8_t) b;
+}
+
+static uint64_t heap_count(const struct heavy_hitters *hh, size_t pos) {
+    return hh->entries[hh->heap[pos]].count;
+}
+
+/// Restore the heap after an entry was added at `pos`.
+static void sift_up(struct heavy_hitters *hh, size_t pos) {
+    while (pos) {
+        size_t parent = (pos - 1) / 2;
+        if (heap_count(hh, parent) <= heap_count(hh, pos))
+            return;
+        heap_swap(hh, pos, parent);
+        pos = parent;
+    }
+}
+
+/// Restore the heap after the count at `pos` grew.
+static void sift_down(struct heavy_hitters *hh, size_t pos) {
+    for (;;) {
+        size_t smallest = pos;
+        size_t left = 2 * pos + 1;
+        size_t right = left + 1;
+        if (left < hh->n && heap_count(hh, left) < heap_count(hh, smallest))
+            smallest = left;
+        if (right < hh->n && heap_count(hh, right) < heap_count(hh, smallest))
+            smallest = right;
+        if (smallest == pos)
+            return;
+        heap_swap(hh, pos, smallest);
+        pos = smallest;
+    }
+}
+
+static size_t index_find(const struct heavy_hitters *hh, uint64_t hash, const uint8_t *key, size_t key_len) {
+    for (size_t i = hash & (HEAVY_HITTERS_INDEX_SIZE - 1);; i = (i + 1) & (HEAVY_HITTERS_INDEX_SIZE - 1)) {
+        if (!hh->index[i])
+            return i;
+        const struct heavy_hitter *e = &hh->entries[hh->index[i] - 1];
+        if (e->hash == hash && e->key_len == key_len && memcmp(e->key, key, key_len) == 0)
+            return i;
+    }
+}
+
+/// Remove an index slot, shifting back the entries after it so that lookups don't stop early.
+static void index_remove(struct heavy_hitters *hh, size_t slot) {
+    const size_t mask = HEAVY_HITTERS_INDEX_SIZE - 1;
+    size_t hole = slot;
+    for (size_t i = (slot + 1) & mask; hh->index[i]; i = (i + 1) & mask) {
+        size_t home = hh->entries[hh->index[i] - 1].hash & mask;
+        // move the entry into the hole if its home slot is not between the hole and its current slot
+        if (((i - home) & mask) >= ((i - hole) & mask)) {
+            hh->index[hole] = hh->index[i];
+            hole = i;
+        }
+    }
+    hh->index[hole] = 0;
+}
+
+void heavy_hitters_update(struct heavy_hitters *hh, const void *key, size_t key_len, uint64_t weight) {
+    if (key_len > HEAVY_HITTERS_KEY_MAX)
+        key_len = HEAVY_HITTERS_KEY_MAX;
+    uint64_t hash = dns_fingerprint(key, key_len);
+    size_t slot = index_find(hh, hash, key, key_len);
+    if (hh->index[slot]) {
+        size_t e = hh->index[slot] - 1u;
+        hh->entries[e].count += weight;
+        sift_down(hh, hh->heap_pos[e]);
+        return;
+    }
+    size_t e;
+    uint64_t base = 0;
+    bool appended = hh->n < HEAVY_HITTERS_CAPACITY;
+    if (appended) {
+        e = hh->n;
+        hh->heap[hh->n] = (uint8_t) e;
+        hh->heap_pos[e] = (uint8_t) hh->n;
+        hh->n++;
+    } else {
+        // replace the entry with the smallest count
+        e = hh->heap[0];
+        base = hh->entries[e].count;
+        index_remove(hh, index_find(hh, hh->entries[e].hash, hh->entries[e].key, hh->entries[e].key_len));
+        slot = index_find(hh, hash, key, key_len);
+    }
+    struct heavy_hitter *entry = &hh->entries[e];
+    entry->count = base + weight;
+    entry->error = base;
+    entry->hash = hash;
+    entry->key_len = key_len;
+    memcpy(entry->key, key, key_len);
+    hh->index[slot] = (uint8_t) (e + 1);
+    if (appended)
+        sift_up(hh, hh->heap_pos[e]);
+    else
+        sift_down(hh, 0);
+}
+
+void heavy_hitters_decay(struct heavy_hitters *hh, unsigned int halvings) {
+    if (!halvings)
+        return;
+    // halving is monotonic, so the heap order is preserved
+    for (size_t i = 0; i < hh->n; ++i) {
+        hh->entries[i].count = halvings < 64 ? hh->entries[i].count >> halvings : 0;
+        hh->entries[i].error = halvings < 64 ? hh->entries[i].error >> halvings : 0;
+    }
+}
+
+static int cmp_count_desc(const void *a, const void *b) {
+    uint64_t ac = (*(const struct heavy_hitter *const *) a)->count;
+    uint64_t bc = (*(const struct heavy_hitter *const *) b)->count;
+    return (ac < bc) - (ac > bc);
+}
+
+size_t heavy_hitters_top(const struct heavy_hitters *hh, const struct heavy_hitter **top, size_t n) {
+    const struct heavy_hitter *all[HEAVY_HITTERS_CAPACITY];
+    for (size_t i = 0; i < hh->n; ++i)
+        all[i] = &hh->entries[i];
+    qsort(all, hh->n, sizeof(all[0]), cmp_count_desc);
+    if (n > hh->n)
+        n = hh->n;
+    size_t written = 0;
+    for (size_t i = 0; i < n && all[i]->count; ++i)
+        top[written++] = all[i];
+    return written;
+}
+
+void traffic_top_init(struct traffic_top *top, uint64_t now_ns) {
+    heavy_hitters_init(&top->talkers);
+    heavy_hitters_init(&top->services);
+    top->decayed_ns = now_ns;
+}
+
+static void record_talker(struct traffic_top *top, const struct sockaddr_storage *source, const char *ifname) {
+    struct talker_key key;
+    memset(&key, 0, sizeof(key));
+    key.family = (uint8_t) source->ss_family;
+    if (source->ss_family == AF_INET6)
+        memcpy(key.addr, &((const struct sockaddr_in6 *) source)->sin6_addr, 16);
+    else
+        memcpy(key.addr, &((const struct sockaddr_in *) source)->sin_addr, 4);
+    strncpy(key.ifname, ifname, sizeof(key.ifname) - 1);
+    heavy_hitters_update(&top->talkers, &key, sizeof(key), 1);
+}
+
+static void record_services(struct traffic_top *top, const uint8_t *msg, size_t len) {
+    struct dns_parser parser;
+    struct dns_record record;
+    char services[TRAFFIC_TOP_SERVICES_PER_PACKET][HEAVY_HITTERS_KEY_MAX];
+    size_t service_lens[TRAFFIC_TOP_SERVICES_PER_PACKET];
+    size_t n = 0;
+    if (dns_parser_init(&parser, msg, len) == -1)
+        return;
+    while (n < TRAFFIC_TOP_SERVICES_PER_PACKET && dns_parser_next(&parser, &record) == 1) {
+        if (record.section != DNS_SECTION_QUESTION && record.section != DNS_SECTION_ANSWER)
+            break;
+        size_t service_len = dns_service_type(msg, len, record.offset, services[n], sizeof(services[n]));
+        if (!service_len)
+            continue;
+        // a response usually names the same service type in several records; count it once
+        bool seen = false;
+        for (size_t i = 0; i < n && !seen; ++i)
+            seen = service_lens[i] == service_len && memcmp(services[i], services[n], service_len) == 0;
+        if (seen)
+            continue;
+        service_lens[n] = service_len;
+        heavy_hitters_update(&top->services, services[n], service_len, 1);
+        n++;
+    }
+}
+
+void traffic_top_record(struct traffic_top *top, const struct sockaddr_storage *source, const char *ifname,
+                        const uint8_t *msg, size_t len) {
+    record_talker(top, source, ifname);
+    record_services(top, msg, len);
+}
+
+void traffic_top_decay(struct traffic_top *top, uint64_t half_life_ns, uint64_t now_ns) {
+    if (now_ns - top->decayed_ns < half_life_ns)
+        return;
+    uint64_t halvings = (now_ns - top->decayed_ns) / half_life_ns;
+    heavy_hitters_decay(&top->talkers, halvings > 64 ? 64 : (unsigned int) halvings);
+    heavy_hitters_decay(&top->services, halvings > 64 ? 64 : (unsigned int) halvings);
+    top->decayed_ns += halvings * half_life_ns;
+}
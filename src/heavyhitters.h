@@ -0,0 +1,98 @@
+/*
+    This file is part of mDNS Reflector (mdns-reflector), a lightweight and performant multicast DNS (mDNS) reflector.
+    Copyright (C) 2021 Yuxiang Zhu <me@yux.im>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef MDNS_REFLECTOR_HEAVYHITTERS_H
+#define MDNS_REFLECTOR_HEAVYHITTERS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <net/if.h>
+#include <sys/socket.h>
+
+/// number of keys tracked by each sketch
+#define HEAVY_HITTERS_CAPACITY 64
+#define HEAVY_HITTERS_KEY_MAX 64
+/// size of the key index; a power of two, twice the capacity
+#define HEAVY_HITTERS_INDEX_SIZE 128
+
+struct heavy_hitter {
+    /// estimated count; overestimates the true count by at most `error`
+    uint64_t count;
+    uint64_t error;
+    uint64_t hash;
+    size_t key_len;
+    uint8_t key[HEAVY_HITTERS_KEY_MAX];
+};
+
+/// Space-saving sketch: tracks the most frequent keys of a stream in fixed memory.
+/// Counters are kept in a min-heap and indexed by a hash table, so an update costs O(log capacity).
+/// When a new key arrives and the sketch is full, it replaces the key with the smallest count and inherits that
+/// count as its error bound.
+struct heavy_hitters {
+    size_t n;
+    struct heavy_hitter entries[HEAVY_HITTERS_CAPACITY];
+    /// entry indices ordered as a min-heap by count
+    uint8_t heap[HEAVY_HITTERS_CAPACITY];
+    /// position of each entry in the heap
+    uint8_t heap_pos[HEAVY_HITTERS_CAPACITY];
+    /// open-addressing index from key hash to entry index + 1, 0 if empty
+    uint8_t index[HEAVY_HITTERS_INDEX_SIZE];
+};
+
+void heavy_hitters_init(struct heavy_hitters *hh);
+
+/// Count a key. Keys longer than HEAVY_HITTERS_KEY_MAX are truncated.
+void heavy_hitters_update(struct heavy_hitters *hh, const void *key, size_t key_len, uint64_t weight);
+
+/// Halve all counts `halvings` times so that the sketch follows recent traffic.
+void heavy_hitters_decay(struct heavy_hitters *hh, unsigned int halvings);
+
+/// Get the keys with the highest counts.
+/// \param top output array of at most `n` entries, sorted by decreasing count
+/// \return number of entries written
+size_t heavy_hitters_top(const struct heavy_hitters *hh, const struct heavy_hitter **top, size_t n);
+
+/// at most this many service types are counted per packet
+#define TRAFFIC_TOP_SERVICES_PER_PACKET 4
+
+/// Key of the top talkers sketch: a source address on an interface.
+struct talker_key {
+    uint8_t family;
+    uint8_t addr[16];
+    char ifname[IF_NAMESIZE];
+};
+
+/// Top talkers and top service types of received packets.
+struct traffic_top {
+    struct heavy_hitters talkers;
+    /// keys are service types in dotted form without a terminating NUL
+    struct heavy_hitters services;
+    /// monotonic time of the last decay
+    uint64_t decayed_ns;
+};
+
+void traffic_top_init(struct traffic_top *top, uint64_t now_ns);
+
+/// Count a received packet for its source and the service types named in its questions and answers.
+void traffic_top_record(struct traffic_top *top, const struct sockaddr_storage *source, const char *ifname,
+                        const uint8_t *msg, size_t len);
+
+/// Halve all counts once per elapsed half-life.
+void traffic_top_decay(struct traffic_top *top, uint64_t half_life_ns, uint64_t now_ns);
+
+#endif //MDNS_REFLECTOR_HEAVYHITTERS_H
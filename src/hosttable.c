@@ -0,0 +1,76 @@
+/*
+    This file is part of mDNS Reflector (mdns-reflector), a lightweight and performant multicast DNS (mDNS) reflector.
+    Copyright (C) 2021 Yuxiang Zhu <me@yux.im>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "hosttable.h"
+#include <stdlib.h>
+#include <string.h>
+
+struct host_table *new_host_table(void) {
+    return calloc(1, sizeof(struct host_table));
+}
+
+static bool same_host(const struct learned_host *host, const struct sockaddr_storage *addr) {
+    if (host->addr.sa.sa_family != addr->ss_family)
+        return false;
+    if (addr->ss_family == AF_INET6) {
+        const struct sockaddr_in6 *sa6 = (const struct sockaddr_in6 *) addr;
+        return host->addr.sin6.sin6_port == sa6->sin6_port && host->addr.sin6.sin6_scope_id == sa6->sin6_scope_id &&
+               memcmp(&host->addr.sin6.sin6_addr, &sa6->sin6_addr, sizeof(sa6->sin6_addr)) == 0;
+    }
+    const struct sockaddr_in *sa4 = (const struct sockaddr_in *) addr;
+    return host->addr.sin.sin_port == sa4->sin_port && host->addr.sin.sin_addr.s_addr == sa4->sin_addr.s_addr;
+}
+
+void host_table_learn(struct host_table *table, const struct sockaddr_storage *addr, uint64_t now_ns) {
+    struct learned_host *host = NULL;
+    for (size_t i = 0; i < table->n; ++i) {
+        if (same_host(&table->hosts[i], addr)) {
+            table->hosts[i].last_seen_ns = now_ns;
+            return;
+        }
+    }
+    if (table->n < HOST_TABLE_MAX) {
+        host = &table->hosts[table->n++];
+    } else {
+        host = &table->hosts[0];
+        for (size_t i = 1; i < table->n; ++i) {
+            if (table->hosts[i].last_seen_ns < host->last_seen_ns)
+                host = &table->hosts[i];
+        }
+    }
+    memset(host, 0, sizeof(*host));
+    if (addr->ss_family == AF_INET6)
+        memcpy(&host->addr.sin6, addr, sizeof(struct sockaddr_in6));
+    else
+        memcpy(&host->addr.sin, addr, sizeof(struct sockaddr_in));
+    host->last_seen_ns = now_ns;
+}
+
+size_t host_table_expire(struct host_table *table, uint64_t now_ns, uint64_t timeout_ns) {
+    size_t n = 0;
+    for (size_t i = 0; i < table->n; ++i) {
+        if (now_ns - table->hosts[i].last_seen_ns < timeout_ns)
+            table->hosts[n++] = table->hosts[i];
+    }
+    table->n = n;
+    return n;
+}
+
+socklen_t learned_host_len(const struct learned_host *host) {
+    return host->addr.sa.sa_family == AF_INET6 ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in);
+}
@@ -0,0 +1,60 @@
+/*
+    This file is part of mDNS Reflector (mdns-reflector), a lightweight and performant multicast DNS (mDNS) reflector.
+    Copyright (C) 2021 Yuxiang Zhu <me@yux.im>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef MDNS_REFLECTOR_HOSTTABLE_H
+#define MDNS_REFLECTOR_HOSTTABLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#define HOST_TABLE_MAX 64
+
+struct learned_host {
+    union {
+        struct sockaddr sa;
+        struct sockaddr_in sin;
+        struct sockaddr_in6 sin6;
+    } addr;
+    uint64_t last_seen_ns;
+};
+
+/// Bounded table of mDNS hosts seen on an interface.
+struct host_table {
+    size_t n;
+    struct learned_host hosts[HOST_TABLE_MAX];
+};
+
+struct host_table *new_host_table(void);
+
+/// Record that a host was seen. If the table is full, the host seen least recently is replaced.
+/// \param table host table
+/// \param addr source address of the host
+/// \param now_ns current monotonic time
+void host_table_learn(struct host_table *table, const struct sockaddr_storage *addr, uint64_t now_ns);
+
+/// Remove hosts not seen for `timeout_ns`.
+/// \return number of hosts left
+size_t host_table_expire(struct host_table *table, uint64_t now_ns, uint64_t timeout_ns);
+
+/// Get the length of a host address for sendto().
+socklen_t learned_host_len(const struct learned_host *host);
+
+#endif //MDNS_REFLECTOR_HOSTTABLE_H
@@ -0,0 +1,142 @@
+/*
+    This file is part of mDNS Reflector (mdns-reflector), a lightweight and performant multicast DNS (mDNS) reflector.
+    Copyright (C) 2021 Yuxiang Zhu <me@yux.im>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "iftable.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ifaddrs.h>
+#include <sys/socket.h>
+
+#if defined(AF_PACKET)
+
+#include <linux/if_packet.h>
+
+#elif defined(AF_LINK)
+#include <net/if_dl.h>
+#endif
+
+static int cmp_entry(const void *a, const void *b) {
+    return strcmp(((const struct iftable_entry *) a)->ifname, ((const struct iftable_entry *) b)->ifname);
+}
+
+/// One getifaddrs() item, remembering its position so that sorting keeps the dump order of addresses.
+struct ifaddr_record {
+    struct iftable_entry entry;
+    size_t seq;
+};
+
+static int cmp_record(const void *a, const void *b) {
+    const struct ifaddr_record *ra = a, *rb = b;
+    int r = strcmp(ra->entry.ifname, rb->entry.ifname);
+    if (r)
+        return r;
+    return ra->seq < rb->seq ? -1 : ra->seq > rb->seq;
+}
+
+int iftable_load(struct iftable *table) {
+    table->n = 0;
+    table->entries = NULL;
+    struct ifaddrs *ifaddrs;
+    if (getifaddrs(&ifaddrs) == -1)
+        return -1;
+    size_t n = 0;
+    for (struct ifaddrs *ifa = ifaddrs; ifa; ifa = ifa->ifa_next)
+        ++n;
+    struct ifaddr_record *records = calloc(n ? n : 1, sizeof(struct ifaddr_record));
+    if (!records) {
+        freeifaddrs(ifaddrs);
+        return -1;
+    }
+    n = 0;
+    for (struct ifaddrs *ifa = ifaddrs; ifa; ifa = ifa->ifa_next) {
+        if (!ifa->ifa_name || strlen(ifa->ifa_name) >= IF_NAMESIZE)
+            continue;
+        struct ifaddr_record *record = &records[n];
+        record->seq = n++;
+        struct iftable_entry *entry = &record->entry;
+        snprintf(entry->ifname, IF_NAMESIZE, "%s", ifa->ifa_name);
+        if (!ifa->ifa_addr)
+            continue;
+        switch (ifa->ifa_addr->sa_family) {
+            case AF_INET:
+                entry->has_addr4 = true;
+                entry->addr4 = ((struct sockaddr_in *) ifa->ifa_addr)->sin_addr;
+                break;
+            case AF_INET6:
+                entry->has_addr6 = IN6_IS_ADDR_LINKLOCAL(&((struct sockaddr_in6 *) ifa->ifa_addr)->sin6_addr);
+                entry->addr6 = ((struct sockaddr_in6 *) ifa->ifa_addr)->sin6_addr;
+                break;
+#if defined(AF_PACKET)
+            case AF_PACKET:
+                entry->ifindex = (unsigned int) ((struct sockaddr_ll *) ifa->ifa_addr)->sll_ifindex;
+                break;
+#elif defined(AF_LINK)
+            case AF_LINK:
+                entry->ifindex = ((struct sockaddr_dl *) ifa->ifa_addr)->sdl_index;
+                break;
+#endif
+            default:
+                break;
+        }
+    }
+    freeifaddrs(ifaddrs);
+    // Merge the records of each interface. The first IPv4 address is the primary one, like SIOCGIFADDR returns.
+    qsort(records, n, sizeof(struct ifaddr_record), cmp_record);
+    struct iftable_entry *entries = (struct iftable_entry *) records;
+    size_t m = 0;
+    for (size_t i = 0; i < n; ++i) {
+        const struct iftable_entry *entry = &records[i].entry;
+        if (m && strcmp(entries[m - 1].ifname, entry->ifname) == 0) {
+            struct iftable_entry *merged = &entries[m - 1];
+            if (entry->ifindex)
+                merged->ifindex = entry->ifindex;
+            if (entry->has_addr4 && !merged->has_addr4) {
+                merged->has_addr4 = true;
+                merged->addr4 = entry->addr4;
+            }
+            if (entry->has_addr6 && !merged->has_addr6) {
+                merged->has_addr6 = true;
+                merged->addr6 = entry->addr6;
+            }
+            continue;
+        }
+        memmove(&entries[m++], entry, sizeof(struct iftable_entry));
+    }
+    for (size_t i = 0; i < m; ++i) {
+        if (!entries[i].ifindex)
+            entries[i].ifindex = if_nametoindex(entries[i].ifname);
+    }
+    table->n = m;
+    table->entries = entries;
+    return 0;
+}
+
+void iftable_free(struct iftable *table) {
+    free(table->entries);
+    table->entries = NULL;
+    table->n = 0;
+}
+
+const struct iftable_entry *iftable_find(const struct iftable *table, const char *ifname) {
+    struct iftable_entry key;
+    if (strlen(ifname) >= IF_NAMESIZE)
+        return NULL;
+    snprintf(key.ifname, IF_NAMESIZE, "%s", ifname);
+    return bsearch(&key, table->entries, table->n, sizeof(struct iftable_entry), cmp_entry);
+}
@@ -0,0 +1,57 @@
+/*
+    This file is part of mDNS Reflector (mdns-reflector), a lightweight and performant multicast DNS (mDNS) reflector.
+    Copyright (C) 2021 Yuxiang Zhu <me@yux.im>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef MDNS_REFLECTOR_IFTABLE_H
+#define MDNS_REFLECTOR_IFTABLE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <netinet/in.h>
+#include <net/if.h>
+
+struct iftable_entry {
+    char ifname[IF_NAMESIZE];
+    unsigned int ifindex;
+    /// whether `addr4` holds the first IPv4 address of the interface
+    bool has_addr4;
+    struct in_addr addr4;
+    /// whether `addr6` holds the first IPv6 link-local address of the interface
+    bool has_addr6;
+    struct in6_addr addr6;
+};
+
+/// Snapshot of network interfaces, sorted by name.
+struct iftable {
+    size_t n;
+    struct iftable_entry *entries;
+};
+
+/// Load names, indices and addresses of all network interfaces with a single getifaddrs() dump.
+/// \param table table to fill
+/// \return 0 on success or -1 on error
+int iftable_load(struct iftable *table);
+
+void iftable_free(struct iftable *table);
+
+/// Find an interface by name.
+/// \param table interface table
+/// \param ifname interface name
+/// \return the entry, or NULL if not found
+const struct iftable_entry *iftable_find(const struct iftable *table, const char *ifname);
+
+#endif //MDNS_REFLECTOR_IFTABLE_H
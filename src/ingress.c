@@ -0,0 +1,105 @@
+/*
+    This file is part of mDNS Reflector (mdns-reflector), a lightweight and performant multicast DNS (mDNS) reflector.
+    Copyright (C) 2021 Yuxiang Zhu <me@yux.im>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "ingress.h"
+#include "dns.h"
+#include <string.h>
+
+#define MDNS_PORT 5353
+#define MDNS_TTL 255
+/// smallest possible question: root name, type and class
+#define MIN_QUESTION_SIZE 5
+/// smallest possible resource record: root name, type, class, TTL and RDLENGTH
+#define MIN_RECORD_SIZE 11
+
+static const char *const VERDICT_NAMES[INGRESS_VERDICTS] = {
+        [INGRESS_ACCEPT] = "accepted",
+        [INGRESS_DROP_TTL] = "ttl",
+        [INGRESS_DROP_SOURCE_PORT] = "source_port",
+        [INGRESS_DROP_SHORT] = "short",
+        [INGRESS_DROP_OPCODE] = "opcode",
+        [INGRESS_DROP_RCODE] = "rcode",
+        [INGRESS_DROP_COUNTS] = "counts",
+        [INGRESS_DROP_FORMAT] = "format",
+};
+
+const char *ingress_verdict_name(enum ingress_verdict verdict) {
+    return verdict < INGRESS_VERDICTS ? VERDICT_NAMES[verdict] : "unknown";
+}
+
+static inline uint16_t read_u16(const uint8_t *p) {
+    return (uint16_t) (p[0] << 8 | p[1]);
+}
+
+/// Check the counts of a DNS message against its length.
+static enum ingress_verdict check_counts(const uint8_t *msg, size_t len) {
+    size_t questions = read_u16(msg + 4);
+    size_t records = (size_t) read_u16(msg + 6) + read_u16(msg + 8) + read_u16(msg + 10);
+    if (!questions && !records)
+        return INGRESS_DROP_COUNTS;
+    if (questions * MIN_QUESTION_SIZE + records * MIN_RECORD_SIZE > len - DNS_HEADER_SIZE)
+        return INGRESS_DROP_COUNTS;
+    return INGRESS_ACCEPT;
+}
+
+enum ingress_verdict ingress_check(const uint8_t *msg, size_t len, uint16_t source_port, int ttl) {
+    // RFC 6762 section 11: packets not sent with TTL 255 may have come from off the link.
+    if (ttl >= 0 && ttl != MDNS_TTL)
+        return INGRESS_DROP_TTL;
+    if (len < DNS_HEADER_SIZE)
+        return INGRESS_DROP_SHORT;
+    uint16_t flags = read_u16(msg + 2);
+    // RFC 6762 section 6: responses from other ports must be ignored. Queries from other ports are legacy unicast
+    // queries and are valid.
+    if ((flags & DNS_FLAG_QR) && source_port != MDNS_PORT)
+        return INGRESS_DROP_SOURCE_PORT;
+    // RFC 6762 section 18.3 and 18.11: messages with non-zero opcode or rcode must be ignored.
+    if (DNS_OPCODE(flags))
+        return INGRESS_DROP_OPCODE;
+    if (DNS_RCODE(flags))
+        return INGRESS_DROP_RCODE;
+    return check_counts(msg, len);
+}
+
+/// \return whether a message starts with a string
+static bool starts_with(const uint8_t *msg, size_t len, const char *prefix) {
+    size_t n = strlen(prefix);
+    return len >= n && memcmp(msg, prefix, n) == 0;
+}
+
+enum ingress_verdict ingress_check_ssdp(const uint8_t *msg, size_t len, uint16_t source_port, int ttl) {
+    (void) source_port;
+    (void) ttl;
+    if (!starts_with(msg, len, "NOTIFY * HTTP/1.1\r\n") && !starts_with(msg, len, "M-SEARCH * HTTP/1.1\r\n"))
+        return INGRESS_DROP_FORMAT;
+    return INGRESS_ACCEPT;
+}
+
+enum ingress_verdict ingress_check_wsd(const uint8_t *msg, size_t len, uint16_t source_port, int ttl) {
+    (void) source_port;
+    (void) ttl;
+    size_t i = 0;
+    // an optional UTF-8 byte order mark and whitespace may precede the XML declaration or the envelope
+    if (starts_with(msg, len, "\xef\xbb\xbf"))
+        i = 3;
+    while (i < len && (msg[i] == ' ' || msg[i] == '\t' || msg[i] == '\r' || msg[i] == '\n'))
+        ++i;
+    if (i == len || msg[i] != '<')
+        return INGRESS_DROP_FORMAT;
+    return INGRESS_ACCEPT;
+}
@@ -0,0 +1,63 @@
+/*
+    This file is part of mDNS Reflector (mdns-reflector), a lightweight and performant multicast DNS (mDNS) reflector.
+    Copyright (C) 2021 Yuxiang Zhu <me@yux.im>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef MDNS_REFLECTOR_INGRESS_H
+#define MDNS_REFLECTOR_INGRESS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/// Result of ingress validation: 0 to accept, or why the packet is dropped.
+enum ingress_verdict {
+    INGRESS_ACCEPT = 0,
+    /// IP TTL or hop limit is not 255, so the packet did not originate on the link
+    INGRESS_DROP_TTL,
+    /// response not sent from port 5353
+    INGRESS_DROP_SOURCE_PORT,
+    /// shorter than a DNS header
+    INGRESS_DROP_SHORT,
+    /// non-zero opcode
+    INGRESS_DROP_OPCODE,
+    /// non-zero response code
+    INGRESS_DROP_RCODE,
+    /// no records, or more records than fit in the datagram
+    INGRESS_DROP_COUNTS,
+    /// not a message of the protocol, e.g. an SSDP response or a WS-Discovery message that isn't XML
+    INGRESS_DROP_FORMAT,
+    INGRESS_VERDICTS,
+};
+
+/// Name of a drop reason, as used in statistics.
+const char *ingress_verdict_name(enum ingress_verdict verdict);
+
+/// Validate a received packet against RFC 6762 before reflecting it. Only fixed-offset fields are checked,
+/// so this is cheap enough to run on every packet.
+/// \param msg packet
+/// \param len length of the packet
+/// \param source_port source UDP port
+/// \param ttl IP TTL or hop limit, or -1 if unknown
+/// \return INGRESS_ACCEPT, or the reason to drop the packet
+enum ingress_verdict ingress_check(const uint8_t *msg, size_t len, uint16_t source_port, int ttl);
+
+/// Validate an SSDP message: only NOTIFY and M-SEARCH requests are multicast; responses are unicast.
+enum ingress_verdict ingress_check_ssdp(const uint8_t *msg, size_t len, uint16_t source_port, int ttl);
+
+/// Validate a WS-Discovery message: a SOAP envelope, so XML.
+enum ingress_verdict ingress_check_wsd(const uint8_t *msg, size_t len, uint16_t source_port, int ttl);
+
+#endif //MDNS_REFLECTOR_INGRESS_H
@@ -0,0 +1,246 @@
+/*
+    This file is part of mDNS Reflector (mdns-reflector), a lightweight and performant multicast DNS (mDNS) reflector.
+    Copyright (C) 2021 Yuxiang Zhu <me@yux.im>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "interest.h"
+#include "dns.h"
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#define FNV_OFFSET_BASIS 0xcbf29ce484222325u
+#define FNV_PRIME 0x100000001b3u
+
+struct interest_table *new_interest_table(void) {
+    return calloc(1, sizeof(struct interest_table));
+}
+
+static uint64_t hash_type(const char *type) {
+    uint64_t hash = FNV_OFFSET_BASIS;
+    for (; *type; ++type) {
+        hash ^= (uint8_t) tolower((unsigned char) *type);
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
+
+static size_t key_slot(uint64_t type_hash, unsigned int ifindex) {
+    uint64_t h = type_hash ^ ((uint64_t) ifindex * 0x9e3779b97f4a7c15u);
+    return (size_t) (h ^ h >> 32) & (INTEREST_INDEX_SIZE - 1);
+}
+
+/// \return slot of the index holding an entry, or INTEREST_INDEX_SIZE if there is none
+static size_t find_slot(const struct interest_table *table, uint64_t type_hash, unsigned int ifindex) {
+    for (size_t slot = key_slot(type_hash, ifindex);; slot = (slot + 1) & (INTEREST_INDEX_SIZE - 1)) {
+        if (!table->index[slot])
+            return INTEREST_INDEX_SIZE;
+        const struct interest_entry *entry = &table->entries[table->index[slot] - 1];
+        if (entry->type_hash == type_hash && entry->ifindex == ifindex)
+            return slot;
+    }
+}
+
+static const struct interest_entry *find_entry(const struct interest_table *table, uint64_t type_hash,
+                                               unsigned int ifindex) {
+    size_t slot = find_slot(table, type_hash, ifindex);
+    return slot == INTEREST_INDEX_SIZE ? NULL : &table->entries[table->index[slot] - 1];
+}
+
+static void index_entry(struct interest_table *table, size_t i) {
+    size_t slot = key_slot(table->entries[i].type_hash, table->entries[i].ifindex);
+    while (table->index[slot])
+        slot = (slot + 1) & (INTEREST_INDEX_SIZE - 1);
+    table->index[slot] = (uint16_t) (i + 1);
+}
+
+/// Remove an index slot, moving later entries of the probe sequence back so that lookups still find them.
+static void unindex_slot(struct interest_table *table, size_t slot) {
+    table->index[slot] = 0;
+    for (size_t next = (slot + 1) & (INTEREST_INDEX_SIZE - 1); table->index[next];
+         next = (next + 1) & (INTEREST_INDEX_SIZE - 1)) {
+        const struct interest_entry *entry = &table->entries[table->index[next] - 1];
+        size_t home = key_slot(entry->type_hash, entry->ifindex);
+        // the entry can move to the free slot unless its home lies between the free slot and where it is
+        if (((next - home) & (INTEREST_INDEX_SIZE - 1)) >= ((next - slot) & (INTEREST_INDEX_SIZE - 1))) {
+            table->index[slot] = table->index[next];
+            table->index[next] = 0;
+            slot = next;
+        }
+    }
+}
+
+static void lru_unlink(struct interest_table *table, size_t i) {
+    struct interest_entry *entry = &table->entries[i];
+    if (entry->lru_prev)
+        table->entries[entry->lru_prev - 1].lru_next = entry->lru_next;
+    else
+        table->lru_head = entry->lru_next;
+    if (entry->lru_next)
+        table->entries[entry->lru_next - 1].lru_prev = entry->lru_prev;
+    else
+        table->lru_tail = entry->lru_prev;
+}
+
+static void lru_append(struct interest_table *table, size_t i) {
+    struct interest_entry *entry = &table->entries[i];
+    entry->lru_prev = table->lru_tail;
+    entry->lru_next = 0;
+    if (table->lru_tail)
+        table->entries[table->lru_tail - 1].lru_next = (uint16_t) (i + 1);
+    else
+        table->lru_head = (uint16_t) (i + 1);
+    table->lru_tail = (uint16_t) (i + 1);
+}
+
+/// Remove an entry, moving the last entry into its place.
+static void remove_entry(struct interest_table *table, size_t i) {
+    struct interest_entry *entry = &table->entries[i];
+    unindex_slot(table, find_slot(table, entry->type_hash, entry->ifindex));
+    lru_unlink(table, i);
+    size_t last = --table->n;
+    if (i == last)
+        return;
+    *entry = table->entries[last];
+    table->index[find_slot(table, entry->type_hash, entry->ifindex)] = (uint16_t) (i + 1);
+    if (entry->lru_prev)
+        table->entries[entry->lru_prev - 1].lru_next = (uint16_t) (i + 1);
+    else
+        table->lru_head = (uint16_t) (i + 1);
+    if (entry->lru_next)
+        table->entries[entry->lru_next - 1].lru_prev = (uint16_t) (i + 1);
+    else
+        table->lru_tail = (uint16_t) (i + 1);
+}
+
+static uint64_t last_used(const struct interest_entry *entry) {
+    uint64_t t = entry->queried_ns > entry->responder_ns ? entry->queried_ns : entry->responder_ns;
+    return t > entry->flooded_ns ? t : entry->flooded_ns;
+}
+
+size_t interest_expire(struct interest_table *table, uint64_t now_ns, uint64_t timeout_ns) {
+    while (table->lru_head && now_ns - last_used(&table->entries[table->lru_head - 1]) >= timeout_ns)
+        remove_entry(table, table->lru_head - 1);
+    return table->n;
+}
+
+/// Find or add the entry of a type on an interface, and mark it as the most recently used; the caller refreshes one
+/// of its times. When the table is full, the entry used least recently is replaced.
+static struct interest_entry *get_entry(struct interest_table *table, uint64_t type_hash, unsigned int ifindex) {
+    struct interest_entry *entry = (struct interest_entry *) find_entry(table, type_hash, ifindex);
+    if (entry) {
+        size_t i = (size_t) (entry - table->entries);
+        lru_unlink(table, i);
+        lru_append(table, i);
+        return entry;
+    }
+    if (table->n == INTEREST_ENTRIES_MAX) {
+        remove_entry(table, table->lru_head - 1);
+        table->stats.evictions++;
+    }
+    entry = &table->entries[table->n];
+    memset(entry, 0, sizeof(*entry));
+    entry->type_hash = type_hash;
+    entry->ifindex = ifindex;
+    index_entry(table, table->n);
+    lru_append(table, table->n++);
+    return entry;
+}
+
+/// Collect the distinct service types of the questions of a query or the answers of a response.
+/// \return 0 on success, or -1 if the packet has too many types or is malformed
+static int collect_types(const uint8_t *msg, size_t len, struct interest_packet *packet) {
+    struct dns_parser parser;
+    struct dns_record record;
+    unsigned int section = packet->response ? DNS_SECTION_ANSWER : DNS_SECTION_QUESTION;
+    int r;
+    if (dns_parser_init(&parser, msg, len) == -1)
+        return -1;
+    while ((r = dns_parser_next(&parser, &record)) == 1 && record.section <= section) {
+        char type[DNS_NAME_MAX];
+        if (record.section != section || !dns_service_type(msg, len, record.offset, type, sizeof(type)))
+            continue;
+        uint64_t hash = hash_type(type);
+        bool seen = false;
+        for (size_t i = 0; i < packet->ntypes && !seen; ++i)
+            seen = packet->types[i] == hash;
+        if (seen)
+            continue;
+        if (packet->ntypes == INTEREST_TYPES_PER_PACKET)
+            return -1;
+        packet->types[packet->ntypes++] = hash;
+    }
+    return r == -1 ? -1 : 0;
+}
+
+void interest_observe(struct interest_table *table, const uint8_t *msg, size_t len, unsigned int ifindex,
+                      uint64_t now_ns, uint64_t flood_interval_ns, struct interest_packet *packet) {
+    struct dns_header header;
+    memset(packet, 0, sizeof(*packet));
+    packet->flood = true;
+    if (len < DNS_HEADER_SIZE) {
+        table->stats.unfiltered_packets++;
+        return;
+    }
+    dns_parse_header(msg, &header);
+    packet->response = header.flags & DNS_FLAG_QR;
+    // Probes must reach every link to detect name conflicts.
+    if ((!packet->response && header.counts[DNS_SECTION_AUTHORITY]) || collect_types(msg, len, packet) == -1 ||
+        !packet->ntypes) {
+        packet->ntypes = 0;
+        table->stats.unfiltered_packets++;
+        return;
+    }
+    packet->flood = false;
+    for (size_t i = 0; i < packet->ntypes; ++i) {
+        if (ifindex) {
+            struct interest_entry *entry = get_entry(table, packet->types[i], ifindex);
+            if (packet->response)
+                entry->responder_ns = now_ns;
+            else
+                entry->queried_ns = now_ns;
+        }
+        if (packet->response)
+            continue;
+        // Flood the first query for a type and then one per interval, so that new responders are found.
+        struct interest_entry *flood = get_entry(table, packet->types[i], 0);
+        if (!flood->flooded_ns || now_ns - flood->flooded_ns >= flood_interval_ns) {
+            flood->flooded_ns = now_ns;
+            packet->flood = true;
+        }
+    }
+    if (packet->response)
+        table->stats.filtered_responses++;
+    else if (packet->flood)
+        table->stats.flooded_queries++;
+    else
+        table->stats.directed_queries++;
+}
+
+bool interest_wanted(const struct interest_table *table, const struct interest_packet *packet, unsigned int ifindex,
+                     uint64_t now_ns, uint64_t timeout_ns) {
+    if (packet->flood)
+        return true;
+    for (size_t i = 0; i < packet->ntypes; ++i) {
+        const struct interest_entry *entry = find_entry(table, packet->types[i], ifindex);
+        if (!entry)
+            continue;
+        uint64_t seen_ns = packet->response ? entry->queried_ns : entry->responder_ns;
+        if (seen_ns && now_ns - seen_ns < timeout_ns)
+            return true;
+    }
+    return false;
+}
@@ -0,0 +1,101 @@
+/*
+    This file is part of mDNS Reflector (mdns-reflector), a lightweight and performant multicast DNS (mDNS) reflector.
+    Copyright (C) 2021 Yuxiang Zhu <me@yux.im>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef MDNS_REFLECTOR_INTEREST_H
+#define MDNS_REFLECTOR_INTEREST_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/// entries kept per zone; when full, the least recently used one is dropped
+#define INTEREST_ENTRIES_MAX 512
+/// size of the entry index; a power of two, twice the capacity
+#define INTEREST_INDEX_SIZE 1024
+/// at most this many service types are considered per packet; packets with more are flooded
+#define INTEREST_TYPES_PER_PACKET 8
+
+/// What is known about a service type on an interface. Entries with ifindex 0 only track flooding of the type.
+struct interest_entry {
+    uint64_t type_hash;
+    unsigned int ifindex;
+    /// when the type was last queried from the interface, 0 if never
+    uint64_t queried_ns;
+    /// when a responder for the type was last heard on the interface, 0 if never
+    uint64_t responder_ns;
+    /// when a query for the type was last flooded to all interfaces (ifindex 0 only)
+    uint64_t flooded_ns;
+    /// neighbours in the order of last use, as entry index + 1, 0 if none
+    uint16_t lru_prev;
+    uint16_t lru_next;
+};
+
+struct interest_stats {
+    uint64_t flooded_queries;
+    uint64_t directed_queries;
+    uint64_t filtered_responses;
+    uint64_t unfiltered_packets;
+    /// copies not sent to an interface because nobody there was interested
+    uint64_t pruned;
+    uint64_t evictions;
+};
+
+/// Service types queried and answered on the interfaces of a zone, to forward packets only where they are wanted.
+struct interest_table {
+    size_t n;
+    struct interest_entry entries[INTEREST_ENTRIES_MAX];
+    /// open-addressing index from key hash to entry index + 1, 0 if empty
+    uint16_t index[INTEREST_INDEX_SIZE];
+    /// least and most recently used entries, as entry index + 1, 0 if the table is empty
+    uint16_t lru_head;
+    uint16_t lru_tail;
+    struct interest_stats stats;
+};
+
+/// Service types of one packet and how it is to be forwarded.
+struct interest_packet {
+    /// whether the packet is a response
+    bool response;
+    /// whether the packet goes to all interfaces regardless of interest
+    bool flood;
+    size_t ntypes;
+    uint64_t types[INTEREST_TYPES_PER_PACKET];
+};
+
+struct interest_table *new_interest_table(void);
+
+/// Learn from a received mDNS packet and decide how to forward it.
+/// Questions of queries record interest on the receiving interface, answers of responses record responders.
+/// Queries for a type are flooded at most once per `flood_interval_ns`, and otherwise only sent to interfaces with
+/// responders. Probes and packets without DNS-SD service types are always flooded.
+/// \param ifindex interface the packet was received on, or 0 if it was not received on a local interface
+/// \param packet output packet classification
+void interest_observe(struct interest_table *table, const uint8_t *msg, size_t len, unsigned int ifindex,
+                      uint64_t now_ns, uint64_t flood_interval_ns, struct interest_packet *packet);
+
+/// Check whether a classified packet is wanted on an interface: queries where responders of one of their types
+/// were heard, responses where one of their types was queried, within `timeout_ns`.
+bool interest_wanted(const struct interest_table *table, const struct interest_packet *packet, unsigned int ifindex,
+                     uint64_t now_ns, uint64_t timeout_ns);
+
+/// Drop entries not refreshed for `timeout_ns`. Entries are kept in the order of last use, so only the expired ones
+/// are looked at.
+/// \return number of entries left
+size_t interest_expire(struct interest_table *table, uint64_t now_ns, uint64_t timeout_ns);
+
+#endif //MDNS_REFLECTOR_INTEREST_H
@@ -0,0 +1,61 @@
+/*
+    This file is part of mDNS Reflector (mdns-reflector), a lightweight and performant multicast DNS (mDNS) reflector.
+    Copyright (C) 2021 Yuxiang Zhu <me@yux.im>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "latency.h"
+
+static unsigned int bucket_index(uint64_t ns) {
+    if (ns < LATENCY_SUB_BUCKETS)
+        return (unsigned int) ns;
+    unsigned int msb = 63u - (unsigned int) __builtin_clzll(ns);
+    unsigned int exponent = msb - LATENCY_SUB_BUCKET_BITS + 1;
+    unsigned int sub = (unsigned int) (ns >> (exponent - 1)) & (LATENCY_SUB_BUCKETS - 1);
+    return exponent * LATENCY_SUB_BUCKETS + sub;
+}
+
+static uint64_t bucket_upper_bound(unsigned int index) {
+    unsigned int exponent = index / LATENCY_SUB_BUCKETS;
+    uint64_t sub = index % LATENCY_SUB_BUCKETS;
+    if (exponent == 0)
+        return sub;
+    uint64_t lower = (LATENCY_SUB_BUCKETS + sub) << (exponent - 1);
+    return lower + (UINT64_C(1) << (exponent - 1)) - 1;
+}
+
+void latency_record(struct latency_histogram *histogram, uint64_t ns) {
+    histogram->count++;
+    histogram->buckets[bucket_index(ns)]++;
+    if (ns > histogram->max_ns)
+        histogram->max_ns = ns;
+}
+
+uint64_t latency_percentile(const struct latency_histogram *histogram, double percentile) {
+    if (!histogram->count)
+        return 0;
+    uint64_t rank = (uint64_t) ((double) histogram->count * percentile / 100.0 + 0.5);
+    if (rank < 1)
+        rank = 1;
+    uint64_t seen = 0;
+    for (unsigned int i = 0; i < LATENCY_BUCKETS; ++i) {
+        seen += histogram->buckets[i];
+        if (seen >= rank) {
+            uint64_t bound = bucket_upper_bound(i);
+            return bound < histogram->max_ns ? bound : histogram->max_ns;
+        }
+    }
+    return histogram->max_ns;
+}
@@ -0,0 +1,43 @@
+/*
+    This file is part of mDNS Reflector (mdns-reflector), a lightweight and performant multicast DNS (mDNS) reflector.
+    Copyright (C) 2021 Yuxiang Zhu <me@yux.im>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef MDNS_REFLECTOR_LATENCY_H
+#define MDNS_REFLECTOR_LATENCY_H
+
+#include <stdint.h>
+
+#define LATENCY_SUB_BUCKET_BITS 4
+#define LATENCY_SUB_BUCKETS (1u << LATENCY_SUB_BUCKET_BITS)
+#define LATENCY_BUCKETS ((64 - LATENCY_SUB_BUCKET_BITS + 1) * LATENCY_SUB_BUCKETS)
+
+/// Log-linear latency histogram: every power of 2 is split into 16 buckets, so the relative error is below 6.25%.
+struct latency_histogram {
+    uint64_t count;
+    uint64_t max_ns;
+    uint64_t buckets[LATENCY_BUCKETS];
+};
+
+void latency_record(struct latency_histogram *histogram, uint64_t ns);
+
+/// Get a percentile of the recorded latencies.
+/// \param histogram histogram
+/// \param percentile percentile between 0 and 100
+/// \return upper bound of the bucket the percentile falls into in nanoseconds, or 0 if nothing is recorded
+uint64_t latency_percentile(const struct latency_histogram *histogram, double percentile);
+
+#endif //MDNS_REFLECTOR_LATENCY_H
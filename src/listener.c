@@ -0,0 +1,99 @@
+/*
+    This file is part of mDNS Reflector (mdns-reflector), a lightweight and performant multicast DNS (mDNS) reflector.
+    Copyright (C) 2021 Yuxiang Zhu <me@yux.im>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "listener.h"
+#include <stdbool.h>
+#include <string.h>
+
+#define IGMP_V1_MEMBERSHIP_REPORT 0x12
+#define IGMP_V2_MEMBERSHIP_REPORT 0x16
+#define IGMP_V3_MEMBERSHIP_REPORT 0x22
+
+// group record types of IGMPv3 and MLDv2 reports (RFC 3376 section 4.2.12, RFC 3810 section 5.2.12)
+#define MODE_IS_INCLUDE 1
+#define MODE_IS_EXCLUDE 2
+#define CHANGE_TO_INCLUDE_MODE 3
+#define CHANGE_TO_EXCLUDE_MODE 4
+#define ALLOW_NEW_SOURCES 5
+
+static inline uint16_t read_u16(const uint8_t *p) {
+    return (uint16_t) (p[0] << 8 | p[1]);
+}
+
+/// Parse the group records of an IGMPv3 or MLDv2 report.
+/// \param records first group record
+/// \param nrecords number of records the header claims
+/// \param addr_len length of addresses in the records
+/// \param groups receives the addresses of groups listened to, `addr_len` bytes each
+/// \return number of groups stored
+static size_t parse_group_records(const uint8_t *records, const uint8_t *end, size_t nrecords, size_t addr_len,
+                                  uint8_t *groups, size_t max) {
+    size_t n = 0;
+    const uint8_t *p = records;
+    for (size_t i = 0; i < nrecords && n < max; ++i) {
+        if ((size_t) (end - p) < 4 + addr_len)
+            break;
+        uint8_t type = p[0];
+        size_t aux_len = (size_t) p[1] * 4;
+        size_t nsources = read_u16(p + 2);
+        size_t record_len = 4 + addr_len + nsources * addr_len + aux_len;
+        if ((size_t) (end - p) < record_len)
+            break;
+        // Excluding sources means listening to all others; including none is a leave.
+        bool listening = type == MODE_IS_EXCLUDE || type == CHANGE_TO_EXCLUDE_MODE ||
+                         ((type == MODE_IS_INCLUDE || type == CHANGE_TO_INCLUDE_MODE || type == ALLOW_NEW_SOURCES) &&
+                          nsources);
+        if (listening)
+            memcpy(groups + n++ * addr_len, p + 4, addr_len);
+        p += record_len;
+    }
+    return n;
+}
+
+size_t igmp_joined_groups(const uint8_t *msg, size_t len, struct in_addr *groups, size_t max) {
+    if (len < 8 || !max)
+        return 0;
+    switch (msg[0]) {
+        case IGMP_V1_MEMBERSHIP_REPORT:
+        case IGMP_V2_MEMBERSHIP_REPORT:
+            memcpy(&groups[0], msg + 4, sizeof(groups[0]));
+            return 1;
+        case IGMP_V3_MEMBERSHIP_REPORT:
+            return parse_group_records(msg + 8, msg + len, read_u16(msg + 6), sizeof(groups[0]),
+                                       (uint8_t *) groups, max);
+        default:
+            return 0;
+    }
+}
+
+size_t mld_joined_groups(const uint8_t *msg, size_t len, struct in6_addr *groups, size_t max) {
+    if (!max)
+        return 0;
+    switch (len >= 8 ? msg[0] : 0) {
+        case LISTENER_MLD_REPORT:
+            if (len < 8 + sizeof(groups[0]))
+                return 0;
+            memcpy(&groups[0], msg + 8, sizeof(groups[0]));
+            return 1;
+        case LISTENER_MLD_V2_REPORT:
+            return parse_group_records(msg + 8, msg + len, read_u16(msg + 6), sizeof(groups[0]),
+                                       (uint8_t *) groups, max);
+        default:
+            return 0;
+    }
+}
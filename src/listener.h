@@ -0,0 +1,49 @@
+/*
+    This file is part of mDNS Reflector (mdns-reflector), a lightweight and performant multicast DNS (mDNS) reflector.
+    Copyright (C) 2021 Yuxiang Zhu <me@yux.im>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef MDNS_REFLECTOR_LISTENER_H
+#define MDNS_REFLECTOR_LISTENER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <netinet/in.h>
+
+/// most groups taken from one membership report
+#define LISTENER_GROUPS_MAX 16
+
+/// ICMPv6 types of MLD version 1 and version 2 listener reports
+#define LISTENER_MLD_REPORT 131
+#define LISTENER_MLD_V2_REPORT 143
+
+/// Find the groups that an IGMP membership report (version 1, 2 or 3) says its sender listens to.
+/// Leaves and other IGMP messages yield no groups.
+/// \param msg IGMP message, without the IP header
+/// \param groups receives the groups
+/// \param max room in `groups`
+/// \return number of groups stored
+size_t igmp_joined_groups(const uint8_t *msg, size_t len, struct in_addr *groups, size_t max);
+
+/// Find the groups that an MLD listener report (version 1 or 2) says its sender listens to.
+/// Done messages and other ICMPv6 messages yield no groups.
+/// \param msg ICMPv6 message
+/// \param groups receives the groups
+/// \param max room in `groups`
+/// \return number of groups stored
+size_t mld_joined_groups(const uint8_t *msg, size_t len, struct in6_addr *groups, size_t max);
+
+#endif //MDNS_REFLECTOR_LISTENER_H
@@ -31,14 +31,9 @@ void log_setlevel(int level) {
     log_level = level;
 }
 
-void log_msg(int priority, const char *fmt, ...) {
-    if (priority > log_level)
-        return;
+static void log_vmsg(int priority, const char *fmt, va_list ap) {
     char buffer[1024];
-    va_list ap;
-    va_start(ap, fmt);
     vsnprintf(buffer, sizeof(buffer), fmt, ap);
-    va_end(ap);
     if (!log_to_syslog) {
         fprintf(stderr, "%s\n", buffer);
     } else {
@@ -46,6 +41,22 @@ void log_msg(int priority, const char *fmt, ...) {
     }
 }
 
+void log_msg(int priority, const char *fmt, ...) {
+    if (priority > log_level)
+        return;
+    va_list ap;
+    va_start(ap, fmt);
+    log_vmsg(priority, fmt, ap);
+    va_end(ap);
+}
+
+void log_force(int priority, const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    log_vmsg(priority, fmt, ap);
+    va_end(ap);
+}
+
 void log_err(int priority, const char *fmt, ...) {
     if (priority > log_level)
         return;
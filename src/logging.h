@@ -29,4 +29,7 @@ void log_msg(int priority, const char *fmt, ...);
 
 void log_err(int priority, const char *fmt, ...);
 
+/// Log a message regardless of the logging level.
+void log_force(int priority, const char *fmt, ...);
+
 #endif //MDNS_REFLECTOR_LOGGING_H
@@ -0,0 +1,96 @@
+/*
+    This file is part of mDNS Reflector (mdns-reflector), a lightweight and performant multicast DNS (mDNS) reflector.
+    Copyright (C) 2021 Yuxiang Zhu <me@yux.im>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "loopmon.h"
+#include "logging.h"
+#include <stdio.h>
+#include <syslog.h>
+
+/// stalls are logged at most once per this interval, and counted in the statistics
+#define STALL_LOG_INTERVAL_NS 1000000000u
+
+void loop_begin(struct loop_stats *loop, uint64_t now_ns) {
+    loop->busy_start_ns = now_ns;
+    loop->iteration_busy_ns = 0;
+    loop->event_kind = NULL;
+    loop->culprit_ns = 0;
+    loop->culprit_kind = NULL;
+    loop->culprit_name = NULL;
+}
+
+void loop_event(struct loop_stats *loop, const char *kind, const char *name, uint64_t now_ns) {
+    if (loop->event_kind && now_ns - loop->event_start_ns >= loop->culprit_ns) {
+        loop->culprit_ns = now_ns - loop->event_start_ns;
+        loop->culprit_kind = loop->event_kind;
+        loop->culprit_name = loop->event_name;
+    }
+    loop->event_kind = kind;
+    loop->event_name = name;
+    loop->event_start_ns = now_ns;
+}
+
+void loop_waited(struct loop_stats *loop, uint64_t wait_start_ns, uint64_t now_ns) {
+    loop_event(loop, NULL, NULL, wait_start_ns);
+    loop->iteration_busy_ns += wait_start_ns - loop->busy_start_ns;
+    loop->idle_ns += now_ns - wait_start_ns;
+    loop->busy_start_ns = now_ns;
+    loop->last_poll_ns = now_ns;
+}
+
+static void describe_culprit(const struct loop_stats *loop, char *buf, size_t size) {
+    if (!loop->culprit_kind)
+        snprintf(buf, size, "none");
+    else if (loop->culprit_name)
+        snprintf(buf, size, "%s:%s", loop->culprit_kind, loop->culprit_name);
+    else
+        snprintf(buf, size, "%s", loop->culprit_kind);
+}
+
+void loop_end(struct loop_stats *loop, uint64_t now_ns, uint64_t stall_threshold_ns) {
+    loop_event(loop, NULL, NULL, now_ns);
+    uint64_t busy = loop->iteration_busy_ns + (now_ns - loop->busy_start_ns);
+    loop->busy_ns += busy;
+    loop->iterations++;
+    if (busy > loop->longest_ns) {
+        loop->longest_ns = busy;
+        describe_culprit(loop, loop->longest_culprit, sizeof(loop->longest_culprit));
+    }
+    if (!stall_threshold_ns || busy <= stall_threshold_ns)
+        return;
+    loop->stalls++;
+    // Logging may be what stalls, so do not let a slow log make every following iteration log too.
+    if (loop->last_stall_log_ns && now_ns - loop->last_stall_log_ns < STALL_LOG_INTERVAL_NS)
+        return;
+    loop->last_stall_log_ns = now_ns;
+    char culprit[LOOP_CULPRIT_MAX];
+    describe_culprit(loop, culprit, sizeof(culprit));
+    log_msg(LOG_WARNING, "event loop stalled for %llu ms, longest in %s (%llu ms); %llu stall(s) so far",
+            (unsigned long long) (busy / 1000000u), culprit, (unsigned long long) (loop->culprit_ns / 1000000u),
+            (unsigned long long) loop->stalls);
+}
+
+double loop_interval_utilization(const struct loop_stats *loop) {
+    uint64_t busy = loop->busy_ns - loop->marked_busy_ns;
+    uint64_t idle = loop->idle_ns - loop->marked_idle_ns;
+    return busy + idle ? (double) busy / (double) (busy + idle) : 0.0;
+}
+
+void loop_mark(struct loop_stats *loop) {
+    loop->marked_busy_ns = loop->busy_ns;
+    loop->marked_idle_ns = loop->idle_ns;
+}
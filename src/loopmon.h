@@ -0,0 +1,84 @@
+/*
+    This file is part of mDNS Reflector (mdns-reflector), a lightweight and performant multicast DNS (mDNS) reflector.
+    Copyright (C) 2021 Yuxiang Zhu <me@yux.im>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef MDNS_REFLECTOR_LOOPMON_H
+#define MDNS_REFLECTOR_LOOPMON_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/// room for the description of an event, e.g. "interface:eth0" or "relay:site-b"
+#define LOOP_CULPRIT_MAX 48
+
+/// Timing of event loop iterations: how long each one kept the loop from polling, which event took longest in it,
+/// and how much of the time the loop is busy.
+struct loop_stats {
+    uint64_t iterations;
+    /// time spent handling events and timers
+    uint64_t busy_ns;
+    /// time spent waiting for events, including spinning in low-latency mode
+    uint64_t idle_ns;
+    /// busy and idle time at the previous statistics dump
+    uint64_t marked_busy_ns;
+    uint64_t marked_idle_ns;
+    /// iterations busy for longer than the stall threshold
+    uint64_t stalls;
+    /// the longest iteration and the event that took longest in it
+    uint64_t longest_ns;
+    char longest_culprit[LOOP_CULPRIT_MAX];
+    /// when the last wait for events returned
+    uint64_t last_poll_ns;
+    /// when a stall was last logged
+    uint64_t last_stall_log_ns;
+
+    // the current iteration
+    uint64_t busy_start_ns;
+    uint64_t iteration_busy_ns;
+    uint64_t event_start_ns;
+    const char *event_kind;
+    const char *event_name;
+    uint64_t culprit_ns;
+    const char *culprit_kind;
+    const char *culprit_name;
+};
+
+/// Start an iteration.
+void loop_begin(struct loop_stats *loop, uint64_t now_ns);
+
+/// Charge the time since the previous call to the event being handled, and start handling another one.
+/// \param kind kind of the event, e.g. "interface", or NULL if no event is handled from now on
+/// \param name name of the interface, relay, etc., or NULL; must stay valid until the iteration ends
+void loop_event(struct loop_stats *loop, const char *kind, const char *name, uint64_t now_ns);
+
+/// Account a wait for events, which does not count towards the length of the iteration.
+/// \param wait_start_ns when the wait started
+/// \param now_ns when it returned
+void loop_waited(struct loop_stats *loop, uint64_t wait_start_ns, uint64_t now_ns);
+
+/// End an iteration, logging it if it kept the loop busy for longer than the stall threshold.
+/// \param stall_threshold_ns threshold, or 0 to never log
+void loop_end(struct loop_stats *loop, uint64_t now_ns, uint64_t stall_threshold_ns);
+
+/// Share of the time the loop was busy since the previous call to loop_mark(), or since start.
+/// \return utilisation between 0 and 1
+double loop_interval_utilization(const struct loop_stats *loop);
+
+/// Remember busy and idle time so far, to measure utilisation from now on.
+void loop_mark(struct loop_stats *loop);
+
+#endif //MDNS_REFLECTOR_LOOPMON_H
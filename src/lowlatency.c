@@ -0,0 +1,92 @@
+/*
+    This file is part of mDNS Reflector (mdns-reflector), a lightweight and performant multicast DNS (mDNS) reflector.
+    Copyright (C) 2021 Yuxiang Zhu <me@yux.im>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#if defined(__linux__)
+#define _GNU_SOURCE
+#endif
+
+#include "lowlatency.h"
+#include "logging.h"
+#include <string.h>
+#include <errno.h>
+#include <syslog.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+
+#if defined(__linux__)
+#if !defined(SO_BUSY_POLL)
+#define SO_BUSY_POLL 46
+#endif
+#if !defined(SO_PREFER_BUSY_POLL)
+#define SO_PREFER_BUSY_POLL 69
+#endif
+#endif
+
+#define PREFAULT_STACK_SIZE (64 * 1024)
+
+int lowlatency_setup_thread(const struct options *options) {
+    if (options->cpu >= 0) {
+#if defined(__linux__)
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET((size_t) options->cpu, &set);
+        if (sched_setaffinity(0, sizeof(set), &set) == -1) {
+            log_err(LOG_ERR, "sched_setaffinity CPU %d", options->cpu);
+            return -1;
+        }
+#else
+        log_msg(LOG_WARNING, "CPU pinning is not supported on this platform");
+#endif
+    }
+    if (options->sched_fifo_priority > 0) {
+        struct sched_param param = {.sched_priority = options->sched_fifo_priority};
+        if (sched_setscheduler(0, SCHED_FIFO, &param) == -1) {
+            log_err(LOG_ERR, "sched_setscheduler SCHED_FIFO priority %d", options->sched_fifo_priority);
+            return -1;
+        }
+    }
+    if (options->lock_memory && mlockall(MCL_CURRENT | MCL_FUTURE) == -1) {
+        log_err(LOG_ERR, "mlockall");
+        return -1;
+    }
+    return 0;
+}
+
+void lowlatency_setup_socket(int fd, const struct options *options) {
+#if defined(__linux__)
+    const int ON = 1;
+    int usec = options->busy_poll_usec;
+    if (usec > 0) {
+        if (setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &usec, sizeof(usec)) == -1)
+            log_err(LOG_WARNING, "setsockopt SO_BUSY_POLL");
+        else if (setsockopt(fd, SOL_SOCKET, SO_PREFER_BUSY_POLL, &ON, sizeof(ON)) == -1)
+            log_err(LOG_DEBUG, "setsockopt SO_PREFER_BUSY_POLL");
+    }
+#else
+    (void) fd;
+    (void) options;
+#endif
+}
+
+void lowlatency_prefault(void *buffer, size_t size) {
+    volatile char stack[PREFAULT_STACK_SIZE];
+    for (size_t i = 0; i < sizeof(stack); i += 512)
+        stack[i] = 0;
+    memset(buffer, 0, size);
+}
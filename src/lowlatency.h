@@ -0,0 +1,38 @@
+/*
+    This file is part of mDNS Reflector (mdns-reflector), a lightweight and performant multicast DNS (mDNS) reflector.
+    Copyright (C) 2021 Yuxiang Zhu <me@yux.im>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef MDNS_REFLECTOR_LOWLATENCY_H
+#define MDNS_REFLECTOR_LOWLATENCY_H
+
+#include "options.h"
+#include <stddef.h>
+
+/// Pin the calling thread to a CPU, switch it to SCHED_FIFO and lock process memory, as configured.
+/// \param options options
+/// \return 0 on success or -1 on error
+int lowlatency_setup_thread(const struct options *options);
+
+/// Enable busy polling on a receive socket. Failures are logged but not fatal.
+/// \param fd socket fd
+/// \param options options
+void lowlatency_setup_socket(int fd, const struct options *options);
+
+/// Touch the stack and the given buffer so that no page faults happen on the packet path.
+void lowlatency_prefault(void *buffer, size_t size);
+
+#endif //MDNS_REFLECTOR_LOWLATENCY_H
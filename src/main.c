@@ -17,28 +17,86 @@
 */
 
 #include "options.h"
+#include "config.h"
 #include "daemon.h"
 #include "logging.h"
 #include "reflection_zone.h"
 #include "reflector.h"
+#include "iftable.h"
+#include "netns.h"
+#include "timeutil.h"
+#include "lowlatency.h"
+#include "sdnotify.h"
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdbool.h>
 #include <string.h>
 #include <unistd.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <libgen.h>
 #include <syslog.h>
+#include <signal.h>
 #include <sys/param.h>
 
 static const char *DEFAULT_PID_FILE = "/var/run/mdns-reflector/mdns-reflector.pid";
 
+/// how often to try to take the PID file over from an instance that handed over
+#define PID_FILE_RETRY_MS 100
+
+static volatile sig_atomic_t stopping;
+static volatile sig_atomic_t reload_requested;
+static volatile sig_atomic_t stats_requested;
+/// pipe that signal handlers write to, waking the event loop up
+static int signal_pipe[2] = {-1, -1};
+
+static void signal_handler(int sig) {
+    switch (sig) {
+        case SIGTERM:
+            stopping = 1;
+            break;
+        case SIGHUP:
+            reload_requested = 1;
+            break;
+        case SIGUSR1:
+            stats_requested = 1;
+            break;
+    }
+    if (signal_pipe[1] >= 0) {
+        int saved_errno = errno;
+        const char byte = 0;
+        // a full pipe already wakes the loop up
+        ssize_t n = write(signal_pipe[1], &byte, 1);
+        (void) n;
+        errno = saved_errno;
+    }
+}
+
+/// Create the non-blocking pipe that signal handlers wake the event loop up with.
+static int open_signal_pipe(void) {
+    if (pipe(signal_pipe) == -1) {
+        log_err(LOG_ERR, "pipe");
+        return -1;
+    }
+    for (int i = 0; i < 2; ++i) {
+        int flags = fcntl(signal_pipe[i], F_GETFL, 0);
+        if (flags == -1 || fcntl(signal_pipe[i], F_SETFL, flags | O_NONBLOCK) == -1 ||
+            fcntl(signal_pipe[i], F_SETFD, FD_CLOEXEC) == -1) {
+            log_err(LOG_ERR, "fcntl");
+            close(signal_pipe[0]);
+            close(signal_pipe[1]);
+            signal_pipe[0] = signal_pipe[1] = -1;
+            return -1;
+        }
+    }
+    return 0;
+}
+
 static int parse_args(const char *program, int argc, char *argv[], struct options *options) {
-    memset(options, 0, sizeof(struct options));
+    options_init(options);
     strcpy(options->pid_file, DEFAULT_PID_FILE);
-    options->log_level = LOG_WARNING;
     int ch;
-    while ((ch = getopt(argc, argv, "hdfp:n64l:")) != -1) {
+    while ((ch = getopt(argc, argv, "hdfp:n64l:c:")) != -1) {
         switch (ch) {
             case 'h':
                 options->help = true;
@@ -48,6 +106,7 @@ static int parse_args(const char *program, int argc, char *argv[], struct option
                 options->foreground = true;
                 options->no_pid_file = true;
                 options->log_level = LOG_DEBUG;
+                options->log_level_set = true;
                 break;
             case 'f':
                 options->foreground = true;
@@ -60,11 +119,16 @@ static int parse_args(const char *program, int argc, char *argv[], struct option
                 break;
             case '6':
                 options->ipv6_only = true;
+                options->family_set = true;
                 break;
             case '4':
                 options->ipv4_only = true;
+                options->family_set = true;
                 break;
             case 'l': {
+                // an empty level, as passed by the systemd units when LOGGING_LEVEL is empty, leaves it unset
+                if (!*optarg)
+                    break;
                 if (strcmp(optarg, "debug") == 0)
                     options->log_level = LOG_DEBUG;
                 else if (strcmp(optarg, "info") == 0)
@@ -78,8 +142,12 @@ static int parse_args(const char *program, int argc, char *argv[], struct option
                     errno = EINVAL;
                     return -1;
                 }
+                options->log_level_set = true;
                 break;
             }
+            case 'c':
+                snprintf(options->config_file, MAXPATHLEN, "%s", optarg);
+                break;
             case '?':
             default:
                 errno = EINVAL;
@@ -96,13 +164,30 @@ static int parse_args(const char *program, int argc, char *argv[], struct option
     if (!options->pid_file[0]) {
         strcpy(options->pid_file, DEFAULT_PID_FILE);
     }
+    if (options->config_file[0]) {
+        if (optind < argc) {
+            fputs("ERROR: Interfaces can't be specified on the command line when '-c' is used.\n", stderr);
+            return -1;
+        }
+        struct options *base = malloc(sizeof(struct options));
+        if (!base) {
+            log_err(LOG_ERR, "%s: can't malloc", program);
+            return -1;
+        }
+        *base = *options;
+        options->base = base;
+        if (load_config(options->config_file, options) == -1)
+            return -1;
+        log_setlevel(options->log_level);
+    }
+    struct netns_iftables iftables = {0};
     for (int i = 0; i < argc - optind; ++i) {
         const char *arg = argv[optind + i];
         bool separator = strcmp(arg, "--") == 0;
         if (!options->ipv4_only && (!options->rz_list6 || separator)) {
             // new IPv6 reflection zone
             struct reflection_zone *rz6 = new_reflection_zone(options->rz_list6 ? options->rz_list6->zone_index + 1 : 0,
-                                                              options->rz_list6);
+                                                              NULL, options->rz_list6);
             if (!rz6) {
                 log_err(LOG_ERR, "%s: can't malloc", program);
                 return -1;
@@ -112,7 +197,7 @@ static int parse_args(const char *program, int argc, char *argv[], struct option
         if (!options->ipv6_only && (!options->rz_list4 || separator)) {
             // new IPv4 reflection zone
             struct reflection_zone *rz4 = new_reflection_zone(options->rz_list4 ? options->rz_list4->zone_index + 1 : 0,
-                                                              options->rz_list4);
+                                                              NULL, options->rz_list4);
             if (!rz4) {
                 log_err(LOG_ERR, "%s: can't malloc", program);
                 return -1;
@@ -121,14 +206,15 @@ static int parse_args(const char *program, int argc, char *argv[], struct option
         }
         if (separator)
             continue;
-        unsigned int ifindex = if_nametoindex(arg);
-        if (!ifindex) {
+        const struct netns_iftable *table;
+        const struct iftable_entry *entry = netns_iftables_find(&iftables, arg, &table);
+        if (!entry) {
             log_msg(LOG_ERR, "%s: unknown interface %s", program, arg);
             return -1;
         }
         if (!options->ipv4_only) {
             // new IPv6 reflection interface
-            struct reflection_if *rif = new_reflection_if(ifindex, arg, options->rz_list6);
+            struct reflection_if *rif = netns_new_reflection_if(table, entry, options->rz_list6);
             if (!rif) {
                 log_err(LOG_ERR, "%s: can't malloc", program);
                 return -1;
@@ -136,13 +222,14 @@ static int parse_args(const char *program, int argc, char *argv[], struct option
         }
         if (!options->ipv6_only) {
             // new IPv4 reflection interface
-            struct reflection_if *rif = new_reflection_if(ifindex, arg, options->rz_list4);
+            struct reflection_if *rif = netns_new_reflection_if(table, entry, options->rz_list4);
             if (!rif) {
                 log_err(LOG_ERR, "%s: can't malloc", program);
                 return -1;
             }
         }
     }
+    netns_iftables_free(&iftables);
     // Check reflection zones
     if (!options->ipv4_only && !check_reflection_zone(options->rz_list6)) {
         return -1;
@@ -159,16 +246,22 @@ static void usage(const char *program, FILE *file) {
 
     fprintf(file, "usage: %s [OPTION]... <IFNAME> <IFNAME>...\n", program);
     fprintf(file, "   or: %s [OPTION]... <IFNAME> <IFNAME>... [-- <IFNAME> <IFNAME>...]...\n", program);
+    fprintf(file, "   or: %s [OPTION]... -c <CONFIG_FILE>\n", program);
     fprintf(file, "Use '--' to separate reflection zones. A mDNS packet coming from an interface will only ");
     fprintf(file, "be reflected to other interfaces within the same zone.\n");
+    fprintf(file, "Prefix an interface with 'NETNS:' to reflect it in another network namespace.\n");
     fprintf(file, "\n");
     fprintf(file, "Examples:\n");
     fprintf(file, "  # Reflect between eth0 and eth1\n");
     fprintf(file, "  %s eth0 eth1\n", program);
     fprintf(file, "  # Reflect 2 zones. br-lan0, br-lan1 and br-lan2 are in one zone. br-lan3 br-lan4 are in the other zone.\n");
     fprintf(file, "  %s br-lan0 br-lan1 br-lan2 -- br-lan3 br-lan4\n", program);
+    fprintf(file, "  # Reflect between br0 of network namespaces tenant1 and tenant2 (see 'ip netns')\n");
+    fprintf(file, "  %s tenant1:br0 tenant2:br0\n", program);
+    fprintf(file, "  # Read reflection zones from a configuration file. Send SIGHUP to reload it.\n");
+    fprintf(file, "  %s -c /etc/mdns-reflector/reflector.ini\n", program);
     fprintf(file, "\n");
-    fprintf(file, "Options\n");  // hdfp:n64l:
+    fprintf(file, "Options\n");  // hdfp:n64l:c:
     fprintf(file, " -d\tdebug mode (implies -f -n -l debug)\n");
     fprintf(file, " -f\tforeground mode\n");
     fprintf(file, " -n\tdon't create PID file\n");
@@ -176,6 +269,7 @@ static void usage(const char *program, FILE *file) {
     fprintf(file, " -p\tPID file path (default is %s)\n", DEFAULT_PID_FILE);
     fprintf(file, " -4\tIPV4 only mode (disable IPv6 support)\n");
     fprintf(file, " -6\tIPV6 only mode (disable IPv4 support)\n");
+    fprintf(file, " -c\tload reflection zones and settings from a configuration file\n");
     fprintf(file, " -h\tshow this help\n");
     fprintf(file, "\n");
     fprintf(file, "See https://github.com/vfreex/mdns-reflector for updates, bug reports, and answers\n");
@@ -183,15 +277,101 @@ static void usage(const char *program, FILE *file) {
 
 }
 
+/// Run the reflector until SIGTERM, reloading the configuration file on SIGHUP and dumping statistics on SIGUSR1,
+/// and keep the service manager informed.
+/// \param pid_file_locked whether the PID file is locked by an instance that is to hand over to this one
+static int run(struct options *options, bool pid_file_locked) {
+    if (open_signal_pipe() == -1)
+        return -1;
+    struct sigaction sa = {.sa_handler = signal_handler, .sa_flags = 0};
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGTERM, &sa, NULL);
+    sigaction(SIGUSR1, &sa, NULL);
+    // also without a configuration file, so that `systemctl reload` doesn't kill the daemon
+    sigaction(SIGHUP, &sa, NULL);
+    struct sigaction ignore = {.sa_handler = SIG_IGN, .sa_flags = 0};
+    sigemptyset(&ignore.sa_mask);
+    sigaction(SIGPIPE, &ignore, NULL);
+
+    struct mdns_reflector *reflector = reflector_new(options);
+    if (!reflector)
+        return -1;
+    int r = -1;
+    struct sdnotify notify = {.fd = -1};
+    if (mdns_reflector_start(reflector) == -1 || reflector_watch_wakeup(reflector, signal_pipe[0]) == -1)
+        goto end;
+    if (pid_file_locked && !reflector_took_over(reflector)) {
+        log_msg(LOG_ERR, "another instance is running and didn't hand over");
+        goto end;
+    }
+    if (options->low_latency) {
+        // after the transmit threads started, so that they are not pinned to the CPU of the event loop
+        if (lowlatency_setup_thread(options) == -1)
+            goto end;
+        log_msg(LOG_INFO, "low-latency mode: spin budget %d us, busy poll %d us, CPU %d",
+                options->spin_budget_usec, options->busy_poll_usec, options->cpu);
+    }
+    if (sdnotify_open(&notify, monotonic_ns()) == -1)
+        goto end;
+    sdnotify_send(&notify, "READY=1");
+
+    while (!stopping && !reflector_handed_off(reflector)) {
+        if (pid_file_locked) {
+            // the instance that handed over exits after sending what it had queued
+            int already_running = create_and_lock_pid_file(options->pid_file);
+            if (already_running < 0)
+                log_err(LOG_ERR, "can't create PID file %s", options->pid_file);
+            pid_file_locked = already_running > 0;
+        }
+        if (reload_requested) {
+            reload_requested = 0;
+            if (options->config_file[0]) {
+                sdnotify_reloading(&notify);
+                mdns_reflector_reload(reflector);
+                sdnotify_send(&notify, "READY=1");
+            } else {
+                log_msg(LOG_WARNING, "no configuration file to reload");
+            }
+        }
+        if (stats_requested) {
+            stats_requested = 0;
+            mdns_reflector_dump_stats(reflector);
+        }
+        int timeout_ms = mdns_reflector_timeout_ms(reflector);
+        if (sdnotify_watchdog_enabled(&notify)) {
+            uint64_t now = monotonic_ns();
+            uint64_t deadline = notify.watchdog_deadline_ns;
+            int watchdog_ms = deadline > now ? (int) ((deadline - now + 999999u) / 1000000u) : 0;
+            if (timeout_ms < 0 || watchdog_ms < timeout_ms)
+                timeout_ms = watchdog_ms;
+        }
+        if (pid_file_locked && (timeout_ms < 0 || timeout_ms > PID_FILE_RETRY_MS))
+            timeout_ms = PID_FILE_RETRY_MS;
+        if (reflector_run_once(reflector, timeout_ms) == -1)
+            goto end;
+        sdnotify_watchdog(&notify, monotonic_ns());
+    }
+
+    r = 0;
+    end:
+    sdnotify_send(&notify, "STOPPING=1");
+    sdnotify_close(&notify);
+    mdns_reflector_free(reflector);
+    return r;
+}
+
 int main(int argc, char *argv[]) {
     char program[MAXPATHLEN];
     snprintf(program, sizeof(program), "%s", basename(argv[0]));
     struct options options;
 
+    uint64_t start = monotonic_ns();
     if (parse_args(program, argc, argv, &options) == -1) {
         fprintf(stderr, "\nRun '%s -h' for help.\n", program);
         return EXIT_FAILURE;
     }
+    log_msg(LOG_INFO, "startup: configuration parsing and interface discovery took %.3f ms",
+            (double) (monotonic_ns() - start) / 1e6);
 
     if (options.help) {
         usage(program, stdout);
@@ -202,17 +382,20 @@ int main(int argc, char *argv[]) {
         daemonize(program);
     }
 
+    bool pid_file_locked = false;
     if (!options.no_pid_file) {
         int already_running = create_and_lock_pid_file(options.pid_file);
         if (already_running < 0) {
             log_err(LOG_ERR, "%s: can't create PID file %s", program, options.pid_file);
             return EXIT_FAILURE;
-        } else if (already_running) {
+        } else if (already_running && !options.handoff_socket[0]) {
             log_msg(LOG_ERR, "%s: another instance is running", program);
             return EXIT_FAILURE;
         }
+        // the running instance may hand over, and the PID file with it
+        pid_file_locked = already_running;
     }
 
-    int r = run_event_loop(&options);
+    int r = run(&options, pid_file_locked);
     return r;
 }
@@ -27,8 +27,10 @@
 #include <netinet/in.h>
 #include <net/if.h>
 
-int mcast_join(int fd, const struct sockaddr_storage *sa, socklen_t sa_len, uint32_t ifindex) {
+int mcast_join(int fd, const struct sockaddr_storage *sa, socklen_t sa_len, uint32_t ifindex,
+               const struct in_addr *if_addr4) {
 #if defined(MCAST_JOIN_GROUP)
+    (void) if_addr4;
     int level;
     switch (sa->ss_family) {
         case AF_INET6:
@@ -64,7 +66,9 @@ int mcast_join(int fd, const struct sockaddr_storage *sa, socklen_t sa_len, uint
         case AF_INET: {
             struct ip_mreq mreq4;
             struct ifreq ifreq;
-            if (ifindex > 0) {
+            if (if_addr4) {
+                mreq4.imr_interface = *if_addr4;
+            } else if (ifindex > 0) {
                 if (if_indextoname(ifindex, ifreq.ifr_name) == NULL)
                     return -1;
                 if (ioctl(fd, SIOCGIFADDR, &ifreq) == -1)
@@ -21,13 +21,16 @@
 
 #include <stdint.h>
 #include <sys/socket.h>
+#include <netinet/in.h>
 
 /// Join a multicast group.
 /// \param fd socket fd
 /// \param sa multicast group address
 /// \param sa_len length of multicast group address
 /// \param ifindex interface index, or 0 to let the kernel decide
+/// \param if_addr4 IPv4 address of the interface, or NULL to look it up; only used where MCAST_JOIN_GROUP is missing
 /// \return 0 ON success or -1 ON error
-int mcast_join(int fd, const struct sockaddr_storage *sa, socklen_t sa_len, uint32_t ifindex);
+int mcast_join(int fd, const struct sockaddr_storage *sa, socklen_t sa_len, uint32_t ifindex,
+               const struct in_addr *if_addr4);
 
 #endif //MDNS_REFLECTOR_MCAST_H
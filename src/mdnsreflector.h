@@ -0,0 +1,165 @@
+/*
+    This file is part of mDNS Reflector (mdns-reflector), a lightweight and performant multicast DNS (mDNS) reflector.
+    Copyright (C) 2021 Yuxiang Zhu <me@yux.im>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef MDNS_REFLECTOR_MDNSREFLECTOR_H
+#define MDNS_REFLECTOR_MDNSREFLECTOR_H
+
+/// \file
+/// Embedding API of mDNS Reflector, for running reflection inside another program's event loop.
+///
+/// A reflector is created, configured with zones and options, and started. Its file descriptor then becomes
+/// readable whenever packets are waiting; the caller polls it, along with the timeout from
+/// mdns_reflector_timeout_ms(), and calls mdns_reflector_process(). The reflector never blocks and installs no signal
+/// handlers. It is not thread-safe: all calls for one reflector must be made from the same thread.
+///
+///     struct mdns_reflector *reflector = mdns_reflector_new();
+///     const char *const ifs[] = {"br-lan", "br-iot"};
+///     struct mdns_reflector_zone zone = {.name = "lan", .interfaces = ifs, .ninterfaces = 2};
+///     if (mdns_reflector_add_zone(reflector, &zone) == -1 || mdns_reflector_start(reflector) == -1)
+///         ...
+///     struct pollfd pfd = {.fd = mdns_reflector_fd(reflector), .events = POLLIN};
+///     for (;;) {
+///         poll(&pfd, 1, mdns_reflector_timeout_ms(reflector));
+///         if (mdns_reflector_process(reflector, 64) == -1)
+///             ...
+///     }
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct mdns_reflector;
+
+#define MDNS_REFLECTOR_IPV4 1u
+#define MDNS_REFLECTOR_IPV6 2u
+
+/// Description of a reflection zone: packets are reflected among its interfaces.
+struct mdns_reflector_zone {
+    const char *name;
+    /// names of the interfaces, prefixed with `NETNS:` for interfaces in other network namespaces
+    const char *const *interfaces;
+    size_t ninterfaces;
+    /// MDNS_REFLECTOR_IPV4 and/or MDNS_REFLECTOR_IPV6, or 0 for both
+    unsigned int families;
+    /// further settings, written as in a `[zone]` section of the configuration file, such as
+    /// "protocols = mdns ssdp" or "unicast_conversion = wlan0"
+    const char *const *settings;
+    size_t nsettings;
+};
+
+/// Counters of one interface, address family and protocol.
+struct mdns_reflector_if_stats {
+    /// valid until the interface is removed or the configuration reloaded
+    const char *ifname;
+    const char *zone;
+    const char *protocol;
+    /// MDNS_REFLECTOR_IPV4 or MDNS_REFLECTOR_IPV6
+    unsigned int family;
+    uint64_t rx_packets;
+    uint64_t rx_bytes;
+    uint64_t tx_packets;
+    uint64_t tx_bytes;
+    /// packets not sent because the send queue was full
+    uint64_t tx_dropped;
+    /// packets dropped by the kernel because the receive queue was full (Linux only)
+    uint64_t kernel_drops;
+};
+
+/// Timing of the work done by mdns_reflector_process() and other calls.
+struct mdns_reflector_loop_stats {
+    uint64_t iterations;
+    /// time spent in calls, and between them
+    uint64_t busy_ns;
+    uint64_t idle_ns;
+    uint64_t longest_iteration_ns;
+    /// iterations longer than the `stall_threshold_ms` option
+    uint64_t stalls;
+};
+
+/// Create a reflector with default options and no zones.
+/// \return the reflector, or NULL if out of memory
+struct mdns_reflector *mdns_reflector_new(void);
+
+/// Stop a reflector, closing its sockets, and free it.
+void mdns_reflector_free(struct mdns_reflector *reflector);
+
+/// Load zones and options from a configuration file, like `mdns-reflector -c`. Only before the reflector is started.
+/// The file can be reloaded later with mdns_reflector_reload().
+/// \return 0 on success or -1 on error
+int mdns_reflector_load_config(struct mdns_reflector *reflector, const char *path);
+
+/// Set an option of the `[global]` section of the configuration file, such as "recompress" to "yes".
+/// Only before the reflector is started.
+/// \return 0 on success or -1 if the option is unknown or its value invalid
+int mdns_reflector_set_option(struct mdns_reflector *reflector, const char *key, const char *value);
+
+/// Add a reflection zone. Only before the reflector is started; add interfaces to it later with
+/// mdns_reflector_add_interface().
+/// \return 0 on success or -1 on error
+int mdns_reflector_add_zone(struct mdns_reflector *reflector, const struct mdns_reflector_zone *zone);
+
+/// Open the sockets of all zones, relays and discovery proxies.
+/// \return 0 on success or -1 on error
+int mdns_reflector_start(struct mdns_reflector *reflector);
+
+/// File descriptor to poll for readability; it becomes readable when mdns_reflector_process() has work to do.
+int mdns_reflector_fd(const struct mdns_reflector *reflector);
+
+/// Time until mdns_reflector_process() has to be called even if the file descriptor is not readable.
+/// \return timeout in milliseconds, or -1 if there are no timers
+int mdns_reflector_timeout_ms(const struct mdns_reflector *reflector);
+
+/// Handle pending packets and due timers without blocking.
+/// \param budget most packets to receive from interfaces, or 0 for no limit. The file descriptor stays readable
+/// while packets are left over.
+/// \return number of packets received from interfaces, or -1 on a fatal error
+int mdns_reflector_process(struct mdns_reflector *reflector, unsigned int budget);
+
+/// Add an interface, named as in struct mdns_reflector_zone, to a zone of a started or stopped reflector, for all
+/// families and protocols of the zone.
+/// \return 0 on success or -1 on error, such as an unknown zone or interface, or an interface already in a zone
+int mdns_reflector_add_interface(struct mdns_reflector *reflector, const char *zone, const char *ifname);
+
+/// Remove an interface from a zone, closing its sockets.
+/// \return 0 on success or -1 if the interface is not in the zone
+int mdns_reflector_remove_interface(struct mdns_reflector *reflector, const char *zone, const char *ifname);
+
+/// Reload the configuration file given to mdns_reflector_load_config(), keeping the sockets of unchanged interfaces.
+/// \return 0 on success, or -1 if the file is invalid and the running configuration was kept
+int mdns_reflector_reload(struct mdns_reflector *reflector);
+
+/// Write all statistics to the `stats_file` option, or to the log.
+void mdns_reflector_dump_stats(struct mdns_reflector *reflector);
+
+/// Read the counters of the interfaces.
+/// \param stats receives up to `max` entries
+/// \return number of entries available, which may be more than `max`
+size_t mdns_reflector_get_if_stats(const struct mdns_reflector *reflector, struct mdns_reflector_if_stats *stats,
+                                   size_t max);
+
+/// Read the timing of the reflector's work.
+void mdns_reflector_get_loop_stats(const struct mdns_reflector *reflector, struct mdns_reflector_loop_stats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //MDNS_REFLECTOR_MDNSREFLECTOR_H
@@ -0,0 +1,486 @@
+/*
+    This file is part of mDNS Reflector (mdns-reflector), a lightweight and performant multicast DNS (mDNS) reflector.
+    Copyright (C) 2021 Yuxiang Zhu <me@yux.im>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+// Microbenchmarks of per-packet functions.
+//
+// Each benchmark is warmed up, then calibrated so that one repetition runs for at least the minimum time,
+// then repeated. Times and cycles per operation are reported as minimum, median and maximum over the repetitions;
+// compare minimums between commits on the same machine. Allocations per operation are counted by wrapping malloc()
+// where the linker supports it. Results are printed as JSON.
+
+#include "logging.h"
+#include "reflection_zone.h"
+#include "dns.h"
+#include "ingress.h"
+#include "rewrite.h"
+#include "recompress.h"
+#include "sockaddr.h"
+#include "heavyhitters.h"
+#include "spsc.h"
+#include "timeutil.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <syslog.h>
+#include <arpa/inet.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_CYCLES 1
+#endif
+
+#define REPETITIONS_MAX 1000
+
+static volatile uint64_t sink;
+
+#if defined(MICROBENCH_COUNT_ALLOCATIONS)
+static uint64_t allocations;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t n, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void __real_free(void *ptr);
+
+void *__wrap_malloc(size_t size) {
+    allocations++;
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t n, size_t size) {
+    allocations++;
+    return __real_calloc(n, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+    allocations++;
+    return __real_realloc(ptr, size);
+}
+
+void __wrap_free(void *ptr) {
+    __real_free(ptr);
+}
+#endif
+
+static inline uint64_t cycles(void) {
+#if defined(HAVE_CYCLES)
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+/// Sample packets and state shared by the benchmarks.
+static struct {
+    uint8_t query[512];
+    size_t query_len;
+    uint8_t response[1500];
+    size_t response_len;
+    struct dns_record response_record;
+    struct reflection_zone *zones;
+    struct reflection_if *src_rif;
+    unsigned int nifs;
+    struct rewrite_class *rewrite;
+    struct sockaddr_storage addr4;
+    struct sockaddr_storage addr6;
+    struct traffic_top top;
+    struct spsc_ring ring;
+} fixture;
+
+static size_t put_name(uint8_t *buf, size_t len, const char *name) {
+    while (*name) {
+        const char *dot = strchr(name, '.');
+        size_t label = dot ? (size_t) (dot - name) : strlen(name);
+        buf[len++] = (uint8_t) label;
+        memcpy(buf + len, name, label);
+        len += label;
+        name += label + (dot ? 1 : 0);
+    }
+    buf[len++] = 0;
+    return len;
+}
+
+static size_t put_u16(uint8_t *buf, size_t len, unsigned int v) {
+    buf[len++] = (uint8_t) (v >> 8);
+    buf[len++] = (uint8_t) v;
+    return len;
+}
+
+static size_t put_record(uint8_t *buf, size_t len, const char *name, unsigned int type, const void *rdata,
+                         size_t rdlength) {
+    len = put_name(buf, len, name);
+    len = put_u16(buf, len, type);
+    len = put_u16(buf, len, 0x8001);
+    len = put_u16(buf, len, 0);
+    len = put_u16(buf, len, 120);
+    len = put_u16(buf, len, (unsigned int) rdlength);
+    memcpy(buf + len, rdata, rdlength);
+    return len + rdlength;
+}
+
+static void setup_packets(void) {
+    // a browse query
+    uint8_t *q = fixture.query;
+    memset(q, 0, DNS_HEADER_SIZE);
+    q[5] = 1;
+    size_t len = put_name(q, DNS_HEADER_SIZE, "_airplay._tcp.local");
+    len = put_u16(q, len, DNS_TYPE_PTR);
+    fixture.query_len = put_u16(q, len, 1);
+
+    // a typical service response: PTR, SRV, TXT, A and AAAA
+    uint8_t *r = fixture.response;
+    memset(r, 0, DNS_HEADER_SIZE);
+    r[2] = 0x84;
+    r[7] = 1;
+    r[11] = 4;
+    uint8_t rdata[256];
+    size_t rdlength = put_name(rdata, 0, "Living Room._airplay._tcp.local");
+    len = put_record(r, DNS_HEADER_SIZE, "_airplay._tcp.local", DNS_TYPE_PTR, rdata, rdlength);
+    uint8_t srv[256] = {0, 0, 0, 0, 0x1b, 0x58};
+    rdlength = put_name(srv, 6, "living-room.local");
+    len = put_record(r, len, "Living Room._airplay._tcp.local", DNS_TYPE_SRV, srv, rdlength);
+    const char txt[] = "\x0d" "deviceid=1234" "\x0c" "features=0x5" "\x0b" "model=AppTV";
+    len = put_record(r, len, "Living Room._airplay._tcp.local", DNS_TYPE_TXT, txt, sizeof(txt) - 1);
+    const uint8_t a[] = {192, 168, 1, 20};
+    len = put_record(r, len, "living-room.local", DNS_TYPE_A, a, sizeof(a));
+    const uint8_t aaaa[] = {0x20, 0x01, 0x0d, 0xb8, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x14};
+    fixture.response_len = put_record(r, len, "living-room.local", DNS_TYPE_AAAA, aaaa, sizeof(aaaa));
+    struct dns_parser parser;
+    dns_parser_init(&parser, fixture.response, fixture.response_len);
+    dns_parser_next(&parser, &fixture.response_record);
+}
+
+static int setup_zones(unsigned int nzones, unsigned int nifs_per_zone) {
+    unsigned int ifindex = 1;
+    for (unsigned int z = 0; z < nzones; ++z) {
+        struct reflection_zone *rz = new_reflection_zone(z, NULL, fixture.zones);
+        if (!rz)
+            return -1;
+        fixture.zones = rz;
+        for (unsigned int i = 0; i < nifs_per_zone; ++i) {
+            char ifname[IF_NAMESIZE];
+            snprintf(ifname, sizeof(ifname), "eth%u", ifindex);
+            struct reflection_if *rif = new_reflection_if(ifindex++, ifname, rz);
+            if (!rif)
+                return -1;
+            if (!fixture.src_rif)
+                fixture.src_rif = rif;
+        }
+    }
+    fixture.nifs = ifindex - 1;
+    return 0;
+}
+
+static int setup(void) {
+    setup_packets();
+    if (setup_zones(8, 8) == -1)
+        return -1;
+    fixture.rewrite = new_rewrite_class(0, "guest", NULL);
+    if (!fixture.rewrite)
+        return -1;
+    fixture.rewrite->drop_aaaa_link_local = true;
+    struct sockaddr_in *sa4 = (struct sockaddr_in *) &fixture.addr4;
+    sa4->sin_family = AF_INET;
+    sa4->sin_port = htons(5353);
+    inet_pton(AF_INET, "192.168.1.20", &sa4->sin_addr);
+    struct sockaddr_in6 *sa6 = (struct sockaddr_in6 *) &fixture.addr6;
+    sa6->sin6_family = AF_INET6;
+    sa6->sin6_port = htons(5353);
+    sa6->sin6_scope_id = 2;
+    inet_pton(AF_INET6, "fe80::1c2b:3aff:fe4d:5e6f", &sa6->sin6_addr);
+    traffic_top_init(&fixture.top, 0);
+    // entries the size of a queued packet of the pipelined mode
+    if (spsc_ring_init(&fixture.ring, 256, 48) == -1)
+        return -1;
+    return 0;
+}
+
+static void bench_destination_walk(size_t iterations) {
+    uint64_t n = 0;
+    for (size_t i = 0; i < iterations; ++i) {
+        struct reflection_if *src = fixture.src_rif;
+        for (struct reflection_if *dst = src->zone->first_if; dst; dst = dst->next) {
+            if (dst != src)
+                n += dst->ifindex;
+        }
+    }
+    sink = n;
+}
+
+static void bench_find_reflection_if(size_t iterations) {
+    uint64_t n = 0;
+    for (size_t i = 0; i < iterations; ++i) {
+        unsigned int ifindex = (unsigned int) (i % fixture.nifs) + 1;
+        n += (uintptr_t) find_reflection_if(fixture.zones, 0, ifindex, &protocols[PROTOCOL_MDNS]);
+    }
+    sink = n;
+}
+
+static void bench_sockaddr_to_string4(size_t iterations) {
+    uint64_t n = 0;
+    for (size_t i = 0; i < iterations; ++i)
+        n += (uintptr_t) sockaddr_storage_to_string(&fixture.addr4);
+    sink = n;
+}
+
+static void bench_sockaddr_to_string6(size_t iterations) {
+    uint64_t n = 0;
+    for (size_t i = 0; i < iterations; ++i)
+        n += (uintptr_t) sockaddr_storage_to_string(&fixture.addr6);
+    sink = n;
+}
+
+static void bench_log_msg_disabled(size_t iterations) {
+    for (size_t i = 0; i < iterations; ++i)
+        log_msg(LOG_DEBUG, "received %zu bytes from interface %s", fixture.response_len, "eth1");
+}
+
+static void bench_ingress_query(size_t iterations) {
+    uint64_t n = 0;
+    for (size_t i = 0; i < iterations; ++i)
+        n += ingress_check(fixture.query, fixture.query_len, 5353, 255);
+    sink = n;
+}
+
+static void bench_ingress_response(size_t iterations) {
+    uint64_t n = 0;
+    for (size_t i = 0; i < iterations; ++i)
+        n += ingress_check(fixture.response, fixture.response_len, 5353, 255);
+    sink = n;
+}
+
+static void bench_rewrite_scan(size_t iterations) {
+    uint8_t out[1500];
+    unsigned int dropped;
+    uint64_t n = 0;
+    for (size_t i = 0; i < iterations; ++i)
+        n += rewrite_message(fixture.rewrite, fixture.response, fixture.response_len, out, sizeof(out), &dropped);
+    sink = n;
+}
+
+static void bench_fingerprint(size_t iterations) {
+    uint64_t n = 0;
+    for (size_t i = 0; i < iterations; ++i)
+        n += dns_fingerprint(fixture.response, fixture.response_len);
+    sink = n;
+}
+
+static void bench_record_hash(size_t iterations) {
+    uint64_t n = 0;
+    for (size_t i = 0; i < iterations; ++i) {
+        uint64_t hash;
+        dns_record_hash(fixture.response, fixture.response_len, &fixture.response_record, &hash);
+        n += hash;
+    }
+    sink = n;
+}
+
+static void bench_service_type(size_t iterations) {
+    char service[DNS_NAME_MAX];
+    uint64_t n = 0;
+    for (size_t i = 0; i < iterations; ++i)
+        n += dns_service_type(fixture.response, fixture.response_len, fixture.response_record.offset, service,
+                              sizeof(service));
+    sink = n;
+}
+
+/// The fixture response has no compression at all, like those of many cheap responders.
+static void bench_recompress_estimate(size_t iterations) {
+    uint64_t n = 0;
+    for (size_t i = 0; i < iterations; ++i)
+        n += recompress_estimate(fixture.response, fixture.response_len);
+    sink = n;
+}
+
+static void bench_recompress_message(size_t iterations) {
+    uint8_t out[1500];
+    uint64_t n = 0;
+    for (size_t i = 0; i < iterations; ++i)
+        n += recompress_message(fixture.response, fixture.response_len, out, sizeof(out));
+    sink = n;
+}
+
+static void bench_traffic_top_record(size_t iterations) {
+    for (size_t i = 0; i < iterations; ++i)
+        traffic_top_record(&fixture.top, &fixture.addr6, "eth1", fixture.response, fixture.response_len);
+}
+
+/// Many distinct keys, so that most updates evict the smallest counter.
+static void bench_heavy_hitters_churn(size_t iterations) {
+    for (size_t i = 0; i < iterations; ++i) {
+        uint32_t key = (uint32_t) (i * 2654435761u) % 4096;
+        heavy_hitters_update(&fixture.top.talkers, &key, sizeof(key), 1);
+    }
+}
+
+/// Push and pop on one thread: the cost of the ring itself, without cache line transfers between threads.
+static void bench_spsc_push_pop(size_t iterations) {
+    uint8_t entry[48] = {0};
+    uint64_t n = 0;
+    for (size_t i = 0; i < iterations; ++i) {
+        entry[0] = (uint8_t) i;
+        spsc_ring_push(&fixture.ring, entry);
+        const uint8_t *popped = spsc_ring_peek(&fixture.ring);
+        n += popped[0];
+        spsc_ring_consume(&fixture.ring);
+    }
+    sink = n;
+}
+
+struct benchmark {
+    const char *name;
+    void (*run)(size_t iterations);
+};
+
+static const struct benchmark BENCHMARKS[] = {
+        {"destination_set/walk_zone_of_8",          bench_destination_walk},
+        {"destination_set/find_reflection_if_of_64", bench_find_reflection_if},
+        {"sockaddr_storage_to_string/ipv4",         bench_sockaddr_to_string4},
+        {"sockaddr_storage_to_string/ipv6_link_local", bench_sockaddr_to_string6},
+        {"log_msg/disabled",                        bench_log_msg_disabled},
+        {"classification/ingress_check_query",      bench_ingress_query},
+        {"classification/ingress_check_response",   bench_ingress_response},
+        {"classification/rewrite_scan_no_match",    bench_rewrite_scan},
+        {"fingerprint/packet",                      bench_fingerprint},
+        {"fingerprint/record",                      bench_record_hash},
+        {"recompress/estimate",                     bench_recompress_estimate},
+        {"recompress/message",                      bench_recompress_message},
+        {"heavy_hitters/service_type",              bench_service_type},
+        {"heavy_hitters/record_response",           bench_traffic_top_record},
+        {"heavy_hitters/update_churn",              bench_heavy_hitters_churn},
+        {"pipeline/spsc_push_pop",                  bench_spsc_push_pop},
+};
+
+struct sample {
+    double ns;
+    double cycles;
+};
+
+static int cmp_double(const void *a, const void *b) {
+    double av = *(const double *) a;
+    double bv = *(const double *) b;
+    return (av > bv) - (av < bv);
+}
+
+static void print_stats(const char *key, double *values, int n) {
+    qsort(values, (size_t) n, sizeof(double), cmp_double);
+    printf("\"%s\": {\"min\": %.3f, \"median\": %.3f, \"max\": %.3f}", key, values[0], values[n / 2], values[n - 1]);
+}
+
+static void run_benchmark(const struct benchmark *b, int repetitions, uint64_t min_time_ns, bool first) {
+    // warm up caches and branch predictors, and find an iteration count that runs for at least min_time_ns
+    size_t iterations = 1000;
+    for (;;) {
+        uint64_t start = monotonic_ns();
+        b->run(iterations);
+        uint64_t elapsed = monotonic_ns() - start;
+        if (elapsed >= min_time_ns || iterations >= ((size_t) 1 << 40))
+            break;
+        iterations *= 2;
+    }
+    double ns[REPETITIONS_MAX], cyc[REPETITIONS_MAX];
+    double allocs = 0;
+    for (int r = 0; r < repetitions; ++r) {
+#if defined(MICROBENCH_COUNT_ALLOCATIONS)
+        uint64_t allocations_before = allocations;
+#endif
+        uint64_t start = monotonic_ns();
+        uint64_t start_cycles = cycles();
+        b->run(iterations);
+        uint64_t end_cycles = cycles();
+        uint64_t end = monotonic_ns();
+#if defined(MICROBENCH_COUNT_ALLOCATIONS)
+        allocs += (double) (allocations - allocations_before) / (double) iterations;
+#endif
+        ns[r] = (double) (end - start) / (double) iterations;
+        cyc[r] = (double) (end_cycles - start_cycles) / (double) iterations;
+    }
+    printf("%s\n    {\"name\": \"%s\", \"iterations\": %zu, \"repetitions\": %d, ", first ? "" : ",", b->name,
+           iterations, repetitions);
+    print_stats("ns_per_op", ns, repetitions);
+#if defined(HAVE_CYCLES)
+    printf(", ");
+    print_stats("cycles_per_op", cyc, repetitions);
+#else
+    printf(", \"cycles_per_op\": null");
+#endif
+#if defined(MICROBENCH_COUNT_ALLOCATIONS)
+    printf(", \"allocations_per_op\": %.3f}", allocs / repetitions);
+#else
+    printf(", \"allocations_per_op\": null}");
+#endif
+}
+
+static void print_usage(const char *program) {
+    fprintf(stderr, "Usage: %s [-r REPETITIONS] [-t MIN_TIME_MS] [-f FILTER]\n", program);
+    fprintf(stderr, "Options:\n"
+                    "    -r REPETITIONS   number of timed repetitions per benchmark (default 15)\n"
+                    "    -t MIN_TIME_MS   minimum duration of one repetition in milliseconds (default 20)\n"
+                    "    -f FILTER        only run benchmarks whose name contains FILTER\n");
+}
+
+int main(int argc, char *argv[]) {
+    int repetitions = 15;
+    long min_time_ms = 20;
+    const char *filter = NULL;
+    int ch;
+    while ((ch = getopt(argc, argv, "r:t:f:h")) != -1) {
+        switch (ch) {
+            case 'r':
+                repetitions = atoi(optarg);
+                break;
+            case 't':
+                min_time_ms = atol(optarg);
+                break;
+            case 'f':
+                filter = optarg;
+                break;
+            default:
+                print_usage(argv[0]);
+                return ch == 'h' ? 0 : 1;
+        }
+    }
+    if (repetitions < 1 || repetitions > REPETITIONS_MAX || min_time_ms < 1) {
+        print_usage(argv[0]);
+        return 1;
+    }
+    // benchmarks measure the per-packet cost with logging at its default level
+    log_setlevel(LOG_WARNING);
+    if (setup() == -1) {
+        fprintf(stderr, "can't set up benchmarks\n");
+        return 1;
+    }
+    printf("{\n  \"cycles_counter\": %s,\n  \"benchmarks\": [",
+#if defined(HAVE_CYCLES)
+           "\"rdtsc\""
+#else
+           "null"
+#endif
+    );
+    bool first = true;
+    for (size_t i = 0; i < sizeof(BENCHMARKS) / sizeof(BENCHMARKS[0]); ++i) {
+        if (filter && !strstr(BENCHMARKS[i].name, filter))
+            continue;
+        run_benchmark(&BENCHMARKS[i], repetitions, (uint64_t) min_time_ms * 1000000u, first);
+        fflush(stdout);
+        first = false;
+    }
+    printf("\n  ]\n}\n");
+    free_reflection_zones(fixture.zones);
+    free_rewrite_classes(fixture.rewrite);
+    return 0;
+}
@@ -0,0 +1,305 @@
+/*
+    This file is part of mDNS Reflector (mdns-reflector), a lightweight and performant multicast DNS (mDNS) reflector.
+    Copyright (C) 2021 Yuxiang Zhu <me@yux.im>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#if defined(__linux__)
+#define _GNU_SOURCE
+#endif
+
+#include "netns.h"
+#include "logging.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+/// A namespace file, identifying a namespace whatever it is named.
+struct netns_file {
+    dev_t dev;
+    ino_t ino;
+    /// number of interfaces, interface tables and link monitors referring to the slot; it is free once 0
+    unsigned int refs;
+};
+
+/// Namespaces seen by the process, indexed by slot. A slot is only reused once nothing refers to it: a namespace
+/// without sockets may go away, and its file then stand for another one.
+static pthread_mutex_t registry_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct netns_file *registry;
+static size_t nregistered;
+
+static int netns_path(const char *netns, char *path, size_t size) {
+    int n = netns[0] == '/' ? snprintf(path, size, "%s", netns) : snprintf(path, size, NETNS_RUN_DIR "/%s", netns);
+    if (n < 0 || (size_t) n >= size) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    return 0;
+}
+
+/// Find the slot of a namespace file and refer to it, taking a free slot if the namespace is new.
+/// \return the slot, or -1 on error
+static long register_netns(const struct netns_file *file) {
+    if (!nregistered) {
+        // slot 0 is our own namespace, also when it is named explicitly
+        if (!(registry = malloc(sizeof(struct netns_file))))
+            return -1;
+        struct stat own;
+        registry[0] = stat("/proc/self/ns/net", &own) == 0 ? (struct netns_file) {own.st_dev, own.st_ino, 0}
+                                                           : (struct netns_file) {0, 0, 0};
+        nregistered = 1;
+    }
+    if (registry[0].dev == file->dev && registry[0].ino == file->ino)
+        return 0;
+    size_t free_slot = 0;
+    for (size_t i = 1; i < nregistered; ++i) {
+        if (registry[i].refs && registry[i].dev == file->dev && registry[i].ino == file->ino) {
+            registry[i].refs++;
+            return (long) i;
+        }
+        if (!registry[i].refs && !free_slot)
+            free_slot = i;
+    }
+    if (!free_slot) {
+        if (nregistered == NETNS_SLOTS) {
+            errno = ENOSPC;
+            return -1;
+        }
+        struct netns_file *new_registry = realloc(registry, (nregistered + 1) * sizeof(struct netns_file));
+        if (!new_registry)
+            return -1;
+        registry = new_registry;
+        free_slot = nregistered++;
+    }
+    registry[free_slot] = *file;
+    registry[free_slot].refs = 1;
+    return (long) free_slot;
+}
+
+void netns_retain(unsigned int slot) {
+    if (!slot)
+        return;
+    pthread_mutex_lock(&registry_lock);
+    registry[slot].refs++;
+    pthread_mutex_unlock(&registry_lock);
+}
+
+void netns_release(unsigned int slot) {
+    if (!slot)
+        return;
+    pthread_mutex_lock(&registry_lock);
+    registry[slot].refs--;
+    pthread_mutex_unlock(&registry_lock);
+}
+
+int netns_lookup(const char *netns, unsigned int *slot) {
+#if defined(__linux__)
+    char path[PATH_MAX];
+    struct stat st;
+    if (netns_path(netns, path, sizeof(path)) == -1 || stat(path, &st) == -1) {
+        log_err(LOG_ERR, "can't find network namespace %s", netns);
+        return -1;
+    }
+    struct netns_file file = {st.st_dev, st.st_ino, 0};
+    pthread_mutex_lock(&registry_lock);
+    long r = register_netns(&file);
+    pthread_mutex_unlock(&registry_lock);
+    if (r == -1) {
+        log_err(LOG_ERR, "can't register network namespace %s", netns);
+        return -1;
+    }
+    *slot = (unsigned int) r;
+    return 0;
+#else
+    (void) slot;
+    errno = ENOTSUP;
+    log_err(LOG_ERR, "can't use network namespace %s", netns);
+    return -1;
+#endif
+}
+
+#if defined(__linux__)
+
+struct netns_call {
+    const char *netns;
+    int (*fn)(void *ctx);
+    void *ctx;
+    bool entered;
+    int result;
+    int error;
+};
+
+static void *run_in_netns(void *arg) {
+    struct netns_call *call = arg;
+    char path[PATH_MAX];
+    int fd = -1;
+    if (netns_path(call->netns, path, sizeof(path)) == -1 || (fd = open(path, O_RDONLY | O_CLOEXEC)) == -1 ||
+        setns(fd, CLONE_NEWNET) == -1) {
+        call->error = errno;
+    } else {
+        call->entered = true;
+        call->result = call->fn(call->ctx);
+        call->error = errno;
+    }
+    if (fd >= 0)
+        close(fd);
+    return NULL;
+}
+
+#endif
+
+int netns_run(const char *netns, int (*fn)(void *ctx), void *ctx) {
+    if (!netns[0])
+        return fn(ctx);
+#if defined(__linux__)
+    // The thread ends with the call, so the namespace it entered doesn't outlive it.
+    struct netns_call call = {
+            .netns = netns,
+            .fn = fn,
+            .ctx = ctx,
+            .result = -1,
+    };
+    pthread_t thread;
+    int r = pthread_create(&thread, NULL, run_in_netns, &call);
+    if (r) {
+        errno = r;
+        log_err(LOG_ERR, "can't start a thread for network namespace %s", netns);
+        return -1;
+    }
+    pthread_join(thread, NULL);
+    errno = call.error;
+    if (!call.entered) {
+        log_err(LOG_ERR, "can't enter network namespace %s", netns);
+        return -1;
+    }
+    return call.result;
+#else
+    (void) fn;
+    (void) ctx;
+    errno = ENOTSUP;
+    log_err(LOG_ERR, "can't enter network namespace %s", netns);
+    return -1;
+#endif
+}
+
+int netns_split_ifname(const char *spec, char *netns, char *ifname) {
+    const char *colon = strrchr(spec, ':');
+    size_t netns_len = colon ? (size_t) (colon - spec) : 0;
+    const char *name = colon ? colon + 1 : spec;
+    if (colon && (!netns_len || !*name)) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (netns_len >= NETNS_NAME_MAX || strlen(name) >= IF_NAMESIZE) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    memcpy(netns, spec, netns_len);
+    netns[netns_len] = '\0';
+    snprintf(ifname, IF_NAMESIZE, "%s", name);
+    return 0;
+}
+
+static int load_iftable(void *ctx) {
+    return iftable_load(ctx);
+}
+
+/// Find the interfaces of a namespace, listing them if they were not yet.
+static struct netns_iftable *get_netns_iftable(struct netns_iftables *tables, const char *netns) {
+    for (size_t i = 0; i < tables->n; ++i) {
+        if (strcmp(tables->tables[i].name, netns) == 0)
+            return &tables->tables[i];
+    }
+    unsigned int slot = 0;
+    if (netns[0] && netns_lookup(netns, &slot) == -1)
+        return NULL;
+    struct netns_iftable *new_tables = realloc(tables->tables, (tables->n + 1) * sizeof(struct netns_iftable));
+    if (!new_tables) {
+        log_err(LOG_ERR, "can't malloc");
+        netns_release(slot);
+        return NULL;
+    }
+    tables->tables = new_tables;
+    struct netns_iftable *table = &new_tables[tables->n];
+    memset(table, 0, sizeof(struct netns_iftable));
+    snprintf(table->name, NETNS_NAME_MAX, "%s", netns);
+    table->slot = slot;
+    if (netns_run(slot ? netns : "", load_iftable, &table->iftable) == -1) {
+        log_err(LOG_ERR, "can't list network interfaces%s%s", netns[0] ? " of network namespace " : "", netns);
+        netns_release(slot);
+        return NULL;
+    }
+    tables->n++;
+    return table;
+}
+
+const struct iftable_entry *netns_iftables_find(struct netns_iftables *tables, const char *spec,
+                                                const struct netns_iftable **table) {
+    char netns[NETNS_NAME_MAX];
+    char ifname[IF_NAMESIZE];
+    if (netns_split_ifname(spec, netns, ifname) == -1)
+        return NULL;
+    if (!(*table = get_netns_iftable(tables, netns)))
+        return NULL;
+    const struct iftable_entry *entry = iftable_find(&(*table)->iftable, ifname);
+    if (entry && entry->ifindex >= IFINDEX_LIMIT) {
+        log_msg(LOG_ERR, "interface %s has index %u; only indices below %u are supported", spec, entry->ifindex,
+                IFINDEX_LIMIT);
+        return NULL;
+    }
+    return entry && entry->ifindex ? entry : NULL;
+}
+
+void netns_iftables_free(struct netns_iftables *tables) {
+    for (size_t i = 0; i < tables->n; ++i) {
+        iftable_free(&tables->tables[i].iftable);
+        netns_release(tables->tables[i].slot);
+    }
+    free(tables->tables);
+    tables->tables = NULL;
+    tables->n = 0;
+}
+
+struct reflection_if *netns_new_reflection_if(const struct netns_iftable *table, const struct iftable_entry *entry,
+                                              struct reflection_zone *rz) {
+    struct reflection_if *rif = new_reflection_if_from_entry(entry, rz);
+    if (rif && table->name[0]) {
+        set_reflection_if_netns(rif, table->name, table->slot);
+        netns_retain(rif->netns_slot);
+    }
+    return rif;
+}
+
+void netns_remove_reflection_if(struct reflection_if *rif) {
+    netns_release(rif->netns_slot);
+    remove_reflection_if(rif);
+}
+
+void netns_free_reflection_zones(struct reflection_zone *rz_list) {
+    for (const struct reflection_zone *rz = rz_list; rz; rz = rz->next) {
+        for (const struct reflection_if *rif = rz->first_if; rif; rif = rif->next)
+            netns_release(rif->netns_slot);
+    }
+    free_reflection_zones(rz_list);
+}
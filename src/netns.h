@@ -0,0 +1,93 @@
+/*
+    This file is part of mDNS Reflector (mdns-reflector), a lightweight and performant multicast DNS (mDNS) reflector.
+    Copyright (C) 2021 Yuxiang Zhu <me@yux.im>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef MDNS_REFLECTOR_NETNS_H
+#define MDNS_REFLECTOR_NETNS_H
+
+#include <stddef.h>
+#include "iftable.h"
+#include "reflection_zone.h"
+
+/// Reflecting interfaces of other network namespaces, named as `NETNS:IFNAME`. NETNS is a namespace created with
+/// `ip netns add`, or the path of a namespace file such as /proc/PID/ns/net. Sockets belong to the namespace they
+/// are created in, so only their creation happens in the namespace, on a helper thread; the event loop then uses
+/// them like any other.
+
+/// where `ip netns add` keeps namespace files
+#define NETNS_RUN_DIR "/var/run/netns"
+/// most network namespaces a process can tell apart at once
+#define NETNS_SLOTS (1u << (32 - NETNS_SLOT_SHIFT))
+
+/// Look a network namespace up by name or path, and refer to its slot until netns_release().
+/// \param netns name or path of the namespace
+/// \param slot set to a number identifying the namespace in the process, 0 for the process' own namespace
+/// \return 0 on success or -1 on error
+int netns_lookup(const char *netns, unsigned int *slot);
+
+/// Refer to the slot of a namespace once more.
+void netns_retain(unsigned int slot);
+
+/// Stop referring to the slot of a namespace, which another namespace may take once nothing refers to it.
+void netns_release(unsigned int slot);
+
+/// Run a function on a helper thread that entered a network namespace; the calling thread stays where it is.
+/// \param netns name or path of the namespace, or "" to run the function on the calling thread
+/// \param fn function to run, returning -1 with errno set on error
+/// \return what the function returned, or -1 if the namespace can't be entered
+int netns_run(const char *netns, int (*fn)(void *ctx), void *ctx);
+
+/// Split an interface named as `[NETNS:]IFNAME` at its last colon, which interface names can't contain.
+/// \param netns set to the namespace, or "" if none is given
+/// \param ifname set to the interface name
+/// \return 0 on success, or -1 if a part is too long
+int netns_split_ifname(const char *spec, char *netns, char *ifname);
+
+/// Interfaces of a network namespace.
+struct netns_iftable {
+    /// namespace as configured, or "" for the reflector's own
+    char name[NETNS_NAME_MAX];
+    unsigned int slot;
+    struct iftable iftable;
+};
+
+/// Interfaces of the network namespaces named in a configuration, each listed when first needed.
+struct netns_iftables {
+    size_t n;
+    struct netns_iftable *tables;
+};
+
+/// Find an interface named as `[NETNS:]IFNAME`.
+/// \param table set to the interfaces of its namespace, valid until the next call
+/// \return the interface, or NULL if it or its namespace doesn't exist
+const struct iftable_entry *netns_iftables_find(struct netns_iftables *tables, const char *spec,
+                                                const struct netns_iftable **table);
+
+void netns_iftables_free(struct netns_iftables *tables);
+
+/// Create a reflection interface for an interface found with netns_iftables_find(), referring to the slot of its
+/// namespace.
+struct reflection_if *netns_new_reflection_if(const struct netns_iftable *table, const struct iftable_entry *entry,
+                                              struct reflection_zone *rz);
+
+/// Remove a reflection interface created with netns_new_reflection_if() from its zone and free it.
+void netns_remove_reflection_if(struct reflection_if *rif);
+
+/// Free reflection zones whose interfaces were created with netns_new_reflection_if().
+void netns_free_reflection_zones(struct reflection_zone *rz_list);
+
+#endif //MDNS_REFLECTOR_NETNS_H
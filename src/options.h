@@ -30,7 +30,70 @@ struct options {
     char pid_file[MAXPATHLEN];
     bool ipv6_only;
     bool ipv4_only;
+    /// whether '-4' or '-6' was given, which takes precedence over the configuration file
+    bool family_set;
     int log_level;
+    bool log_level_set;
+    char config_file[MAXPATHLEN];
+    char stats_file[MAXPATHLEN];
+    /// Unix socket where a new instance takes over the sockets of the running one, or empty
+    char handoff_socket[MAXPATHLEN];
+    int rcvbuf;
+    int sndbuf;
+    bool adaptive_buffers;
+    int rcvbuf_max;
+    int sndbuf_max;
+    bool low_latency;
+    bool latency_stats;
+    int busy_poll_usec;
+    int spin_budget_usec;
+    int cpu;
+    int sched_fifo_priority;
+    bool lock_memory;
+    /// interfaces with multicast-to-unicast conversion get unicast copies while they have at most this many hosts
+    int unicast_max_hosts;
+    /// forget hosts not heard from for this long
+    int host_timeout_sec;
+    /// in zones with interest-based forwarding, forget queried types and responders after this long
+    int interest_timeout_sec;
+    /// ... and flood a query for each type at least this often so that new responders are found
+    int interest_flood_interval_sec;
+    /// interfaces with listener awareness are not sent to when no host was known to listen for this long
+    int listener_timeout_sec;
+    /// don't reflect a packet to dual-stack interfaces again when it arrives over the other address family
+    bool dualstack_dedup;
+    /// how long after the first copy the other one is recognized
+    int dualstack_window_ms;
+    /// re-encode names of reflected mDNS messages with optimal compression
+    bool recompress;
+    /// ... if that is estimated to save at least this many bytes
+    int recompress_min_saving;
+    /// how long to collect responses on interfaces with aggregation before sending them
+    int aggregation_window_ms;
+    /// drop off-link and malformed packets before reflecting them
+    bool ingress_validation;
+    /// track top talkers and top service types
+    bool heavy_hitters;
+    /// number of top talkers and service types in the statistics
+    int heavy_hitters_top;
+    /// counts are halved after this long so that they follow recent traffic
+    int heavy_hitters_half_life_sec;
+    /// transmit threads of the pipelined mode, or 0 to send from the event loop
+    int tx_threads;
+    /// entries of the ring feeding each transmit thread; a power of two
+    int tx_ring_size;
+    /// log event loop iterations busy for longer than this, or 0 not to
+    int stall_threshold_ms;
     struct reflection_zone *rz_list6, *rz_list4;
+    /// destination classes for record rewriting
+    struct rewrite_class *rewrite_classes;
+    /// links to remote reflectors
+    struct relay *relays;
+    /// DNS-SD discovery proxies
+    struct discovery *discoveries;
+    /// active/standby pairing with another reflector, or NULL
+    struct ha *ha;
+    /// options before the configuration file was applied; the starting point for reloading it
+    const struct options *base;
 };
 #endif //MDNS_REFLECTOR_OPTIONS_H
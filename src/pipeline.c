@@ -0,0 +1,303 @@
+/*
+    This file is part of mDNS Reflector (mdns-reflector), a lightweight and performant multicast DNS (mDNS) reflector.
+    Copyright (C) 2021 Yuxiang Zhu <me@yux.im>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "pipeline.h"
+#include "spsc.h"
+#include "logging.h"
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <time.h>
+#include <netinet/in.h>
+
+/// A packet queued for a transmit thread.
+struct queued_packet {
+    struct reflection_if *rif;
+    uint32_t buffer;
+    uint32_t len;
+    socklen_t dst_len;
+    union {
+        struct sockaddr sa;
+        struct sockaddr_in sin;
+        struct sockaddr_in6 sin6;
+    } dst;
+};
+
+struct tx_thread {
+    struct pipeline *pipeline;
+    pthread_t thread;
+    bool started;
+    /// packets to send, from the receive thread
+    struct spsc_ring ring;
+    /// buffers sent to their last destination, back to the receive thread
+    struct spsc_ring done;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    atomic_bool sleeping;
+};
+
+struct pipeline {
+    pipeline_send_fn send;
+    void *ctx;
+    struct pipeline_stats *stats;
+    atomic_bool stopping;
+    size_t buffer_size;
+    uint8_t *buffers;
+    /// references to each buffer: one per queued packet, plus one while it is the receive buffer
+    atomic_uint *refs;
+    /// free buffers; used by the receive thread only
+    uint32_t *free_list;
+    size_t nfree;
+    /// receive buffer, or UINT32_MAX if none
+    uint32_t rx;
+    unsigned int nthreads;
+    struct tx_thread threads[TX_THREADS_MAX];
+};
+
+static inline uint8_t *buffer_at(const struct pipeline *pipeline, uint32_t index) {
+    return pipeline->buffers + (size_t) index * pipeline->buffer_size;
+}
+
+static void *tx_thread_main(void *arg) {
+    struct tx_thread *tx = arg;
+    struct pipeline *pipeline = tx->pipeline;
+    for (;;) {
+        struct queued_packet *packet = spsc_ring_peek(&tx->ring);
+        if (!packet) {
+            pthread_mutex_lock(&tx->lock);
+            atomic_store(&tx->sleeping, true);
+            // pairs with the fence in pipeline_submit(): either this sees the packet or the producer sees us asleep
+            atomic_thread_fence(memory_order_seq_cst);
+            while (!(packet = spsc_ring_peek(&tx->ring)) && !atomic_load(&pipeline->stopping))
+                pthread_cond_wait(&tx->wake, &tx->lock);
+            atomic_store(&tx->sleeping, false);
+            pthread_mutex_unlock(&tx->lock);
+            if (!packet)
+                return NULL;
+        }
+        uint32_t index = packet->buffer;
+        pipeline->send(pipeline->ctx, packet->rif, buffer_at(pipeline, index), packet->len, &packet->dst.sa,
+                       packet->dst_len);
+        spsc_ring_consume(&tx->ring);
+        if (atomic_fetch_sub_explicit(&pipeline->refs[index], 1, memory_order_acq_rel) == 1) {
+            // the done ring holds every buffer of the pool, so it is never full
+            spsc_ring_push(&tx->done, &index);
+        }
+    }
+}
+
+/// Take back buffers the transmit threads are done with.
+static void reclaim_buffers(struct pipeline *pipeline) {
+    for (unsigned int i = 0; i < pipeline->nthreads; ++i) {
+        uint32_t *index;
+        while ((index = spsc_ring_peek(&pipeline->threads[i].done))) {
+            pipeline->free_list[pipeline->nfree++] = *index;
+            spsc_ring_consume(&pipeline->threads[i].done);
+        }
+    }
+    pipeline->stats->pool_free = pipeline->nfree;
+}
+
+static void release_buffer(struct pipeline *pipeline, uint32_t index) {
+    if (atomic_fetch_sub_explicit(&pipeline->refs[index], 1, memory_order_acq_rel) == 1) {
+        pipeline->free_list[pipeline->nfree++] = index;
+        pipeline->stats->pool_free = pipeline->nfree;
+    }
+}
+
+/// Take a free buffer, taking back those the transmit threads are done with if the pool is empty. This never
+/// waits, so that reception doesn't slow down with congested interfaces.
+/// \return index of the buffer, with one reference, or UINT32_MAX if the pool is empty
+static uint32_t take_buffer(struct pipeline *pipeline) {
+    if (!pipeline->nfree) {
+        reclaim_buffers(pipeline);
+        if (!pipeline->nfree)
+            return UINT32_MAX;
+    }
+    uint32_t index = pipeline->free_list[--pipeline->nfree];
+    pipeline->stats->pool_free = pipeline->nfree;
+    atomic_store_explicit(&pipeline->refs[index], 1, memory_order_relaxed);
+    return index;
+}
+
+struct pipeline *pipeline_start(unsigned int nthreads, size_t ring_size, size_t buffer_size, pipeline_send_fn send,
+                                void *ctx, struct pipeline_stats *stats) {
+    struct pipeline *pipeline = calloc(1, sizeof(struct pipeline));
+    if (!pipeline) {
+        log_err(LOG_ERR, "calloc");
+        return NULL;
+    }
+    pipeline->send = send;
+    pipeline->ctx = ctx;
+    pipeline->stats = stats;
+    pipeline->buffer_size = buffer_size;
+    // enough for every ring to be full of distinct packets, plus the receive buffer
+    size_t nbuffers = ring_size * nthreads + 1;
+    // the done rings must hold every buffer
+    size_t done_size = ring_size;
+    while (done_size < nbuffers)
+        done_size *= 2;
+    pipeline->rx = UINT32_MAX;
+    atomic_init(&pipeline->stopping, false);
+    pipeline->buffers = malloc(nbuffers * buffer_size);
+    pipeline->refs = calloc(nbuffers, sizeof(atomic_uint));
+    pipeline->free_list = calloc(nbuffers, sizeof(uint32_t));
+    if (!pipeline->buffers || !pipeline->refs || !pipeline->free_list) {
+        log_err(LOG_ERR, "can't allocate %zu packet buffers", nbuffers);
+        goto error;
+    }
+    for (size_t i = 0; i < nbuffers; ++i) {
+        atomic_init(&pipeline->refs[i], 0);
+        pipeline->free_list[pipeline->nfree++] = (uint32_t) (nbuffers - 1 - i);
+    }
+    memset(stats, 0, sizeof(*stats));
+    stats->tx_threads = nthreads;
+    stats->ring_size = ring_size;
+    stats->pool_buffers = nbuffers;
+    stats->pool_free = nbuffers;
+
+    // Signals are handled by the event loop thread only.
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    for (unsigned int i = 0; i < nthreads; ++i) {
+        struct tx_thread *tx = &pipeline->threads[i];
+        tx->pipeline = pipeline;
+        atomic_init(&tx->sleeping, false);
+        if (spsc_ring_init(&tx->ring, ring_size, sizeof(struct queued_packet)) == -1 ||
+            spsc_ring_init(&tx->done, done_size, sizeof(uint32_t)) == -1) {
+            log_err(LOG_ERR, "can't allocate rings of transmit thread %u", i);
+            break;
+        }
+        pthread_mutex_init(&tx->lock, NULL);
+        pthread_cond_init(&tx->wake, NULL);
+        pipeline->nthreads = i + 1;
+        int err = pthread_create(&tx->thread, NULL, tx_thread_main, tx);
+        if (err) {
+            errno = err;
+            log_err(LOG_ERR, "can't start transmit thread %u", i);
+            break;
+        }
+        tx->started = true;
+    }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (pipeline->nthreads == nthreads && pipeline->threads[nthreads - 1].started) {
+        log_msg(LOG_INFO, "pipelined mode: %u transmit thread(s), rings of %zu packets", nthreads, ring_size);
+        return pipeline;
+    }
+    error:
+    pipeline_stop(pipeline);
+    return NULL;
+}
+
+void pipeline_stop(struct pipeline *pipeline) {
+    atomic_store(&pipeline->stopping, true);
+    for (unsigned int i = 0; i < pipeline->nthreads; ++i) {
+        struct tx_thread *tx = &pipeline->threads[i];
+        if (tx->started) {
+            pthread_mutex_lock(&tx->lock);
+            pthread_cond_signal(&tx->wake);
+            pthread_mutex_unlock(&tx->lock);
+            pthread_join(tx->thread, NULL);
+        }
+        pthread_cond_destroy(&tx->wake);
+        pthread_mutex_destroy(&tx->lock);
+        spsc_ring_free(&tx->ring);
+        spsc_ring_free(&tx->done);
+    }
+    free(pipeline->buffers);
+    free(pipeline->refs);
+    free(pipeline->free_list);
+    free(pipeline);
+}
+
+uint8_t *pipeline_rx_buffer(struct pipeline *pipeline) {
+    pipeline_rx_done(pipeline);
+    pipeline->rx = take_buffer(pipeline);
+    if (pipeline->rx == UINT32_MAX) {
+        pipeline->stats->rx_unpooled++;
+        return NULL;
+    }
+    return buffer_at(pipeline, pipeline->rx);
+}
+
+void pipeline_rx_done(struct pipeline *pipeline) {
+    if (pipeline->rx != UINT32_MAX)
+        release_buffer(pipeline, pipeline->rx);
+    pipeline->rx = UINT32_MAX;
+    reclaim_buffers(pipeline);
+}
+
+enum pipeline_submit_result pipeline_submit(struct pipeline *pipeline, struct reflection_if *rif, const void *buf,
+                                            size_t len, const struct sockaddr *dst, socklen_t dst_len) {
+    unsigned int queue = rif->tx_queue % pipeline->nthreads;
+    struct tx_thread *tx = &pipeline->threads[queue];
+    struct tx_queue_stats *stats = &pipeline->stats->queues[queue];
+    struct queued_packet packet = {
+            .rif = rif,
+            .len = (uint32_t) len,
+            .dst_len = dst_len,
+    };
+    if (len > pipeline->buffer_size || dst_len > sizeof(packet.dst)) {
+        stats->too_large++;
+        return PIPELINE_TOO_LARGE;
+    }
+    memcpy(&packet.dst, dst, dst_len);
+    const uint8_t *rx = pipeline->rx == UINT32_MAX ? NULL : buffer_at(pipeline, pipeline->rx);
+    if (rx && (const uint8_t *) buf == rx) {
+        packet.buffer = pipeline->rx;
+        atomic_fetch_add_explicit(&pipeline->refs[packet.buffer], 1, memory_order_relaxed);
+    } else {
+        // rewritten, aggregated or generated packets live in buffers that the event loop reuses
+        packet.buffer = take_buffer(pipeline);
+        if (packet.buffer == UINT32_MAX) {
+            stats->pool_empty++;
+            return PIPELINE_POOL_EMPTY;
+        }
+        memcpy(buffer_at(pipeline, packet.buffer), buf, len);
+    }
+    if (!spsc_ring_push(&tx->ring, &packet)) {
+        stats->ring_full++;
+        release_buffer(pipeline, packet.buffer);
+        return PIPELINE_RING_FULL;
+    }
+    stats->enqueued++;
+    size_t depth = spsc_ring_depth(&tx->ring);
+    if (depth > stats->max_depth)
+        stats->max_depth = depth;
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load(&tx->sleeping)) {
+        pthread_mutex_lock(&tx->lock);
+        pthread_cond_signal(&tx->wake);
+        pthread_mutex_unlock(&tx->lock);
+    }
+    return PIPELINE_QUEUED;
+}
+
+void pipeline_quiesce(struct pipeline *pipeline) {
+    const struct timespec pause = {.tv_sec = 0, .tv_nsec = 50000};
+    for (unsigned int i = 0; i < pipeline->nthreads; ++i) {
+        while (spsc_ring_depth(&pipeline->threads[i].ring))
+            nanosleep(&pause, NULL);
+    }
+}
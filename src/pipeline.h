@@ -0,0 +1,75 @@
+/*
+    This file is part of mDNS Reflector (mdns-reflector), a lightweight and performant multicast DNS (mDNS) reflector.
+    Copyright (C) 2021 Yuxiang Zhu <me@yux.im>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef MDNS_REFLECTOR_PIPELINE_H
+#define MDNS_REFLECTOR_PIPELINE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include "reflection_zone.h"
+#include "stats.h"
+
+/// Pipelined mode: the event loop receives and decides, and transmit threads send. Each transmit thread owns the
+/// send sockets of some interfaces (reflection_if.tx_queue) and is fed by its own single-producer ring of packets
+/// that refer to a shared pool of buffers. A buffer returns to the pool once every destination has sent it.
+struct pipeline;
+
+/// Send a packet; called on a transmit thread.
+typedef void (*pipeline_send_fn)(void *ctx, struct reflection_if *rif, const uint8_t *buf, size_t len,
+                                 const struct sockaddr *dst, socklen_t dst_len);
+
+/// Start the transmit threads.
+/// \param ring_size entries of each ring, a power of two; the pool has enough buffers to fill all rings
+/// \param stats counters to keep, written by the calling thread only
+/// \return the pipeline, or NULL on error
+struct pipeline *pipeline_start(unsigned int nthreads, size_t ring_size, size_t buffer_size, pipeline_send_fn send,
+                                void *ctx, struct pipeline_stats *stats);
+
+/// Send what is queued, then stop the transmit threads and free the pipeline.
+void pipeline_stop(struct pipeline *pipeline);
+
+/// Take a buffer to receive the next packet into, releasing the previous one. This never waits for the transmit
+/// threads: if they hold every buffer, the caller receives into a buffer of its own, and pipeline_submit() copies
+/// the packet into the pool or drops it.
+/// \return the buffer, of the size given to pipeline_start(), or NULL if the pool is empty
+uint8_t *pipeline_rx_buffer(struct pipeline *pipeline);
+
+/// Release the buffer taken by pipeline_rx_buffer().
+void pipeline_rx_done(struct pipeline *pipeline);
+
+/// Outcome of queuing a packet.
+enum pipeline_submit_result {
+    PIPELINE_QUEUED = 0,
+    /// dropped because the ring of the transmit thread was full
+    PIPELINE_RING_FULL,
+    /// dropped because it doesn't fit in a buffer of the pool
+    PIPELINE_TOO_LARGE,
+    /// dropped because the transmit threads hold every buffer of the pool
+    PIPELINE_POOL_EMPTY,
+};
+
+/// Queue a packet for the transmit thread of an interface. A packet in the current receive buffer is queued
+/// without copying; others are copied into a buffer of the pool.
+enum pipeline_submit_result pipeline_submit(struct pipeline *pipeline, struct reflection_if *rif, const void *buf,
+                                            size_t len, const struct sockaddr *dst, socklen_t dst_len);
+
+/// Wait until the transmit threads have sent everything queued, so that interfaces can be closed.
+void pipeline_quiesce(struct pipeline *pipeline);
+
+#endif //MDNS_REFLECTOR_PIPELINE_H
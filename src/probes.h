@@ -0,0 +1,46 @@
+/*
+    This file is part of mDNS Reflector (mdns-reflector), a lightweight and performant multicast DNS (mDNS) reflector.
+    Copyright (C) 2021 Yuxiang Zhu <me@yux.im>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef MDNS_REFLECTOR_PROBES_H
+#define MDNS_REFLECTOR_PROBES_H
+
+/// USDT probes of the provider "mdns_reflector", for bpftrace and perf. A probe that is not attached is a single
+/// nop instruction. Without MDNS_REFLECTOR_USDT, probes are compiled out and their arguments are not evaluated.
+///
+/// loop_start(int nevents), loop_end(int nevents): an event loop iteration handling `nevents` events
+/// packet_received(const char *ifname, size_t size, int family, int ttl)
+/// packet_dropped(const char *ifname, size_t size, const char *reason)
+/// packet_forwarded(const char *src_ifname, const char *dst_ifname, size_t size, int family): src_ifname is "" for
+///   packets from a relay
+/// packet_sent(const char *ifname, size_t size, int family)
+/// send_would_block(const char *ifname, size_t size, int errno)
+///
+/// Interfaces are passed by their name in the configuration, such as "eth0" or "lab:veth0", because an ifindex is
+/// only unique within its network namespace. The name of an interface keeps its address while the interface is open.
+#if defined(MDNS_REFLECTOR_USDT)
+#include <sys/sdt.h>
+#define PROBE1(name, a) DTRACE_PROBE1(mdns_reflector, name, a)
+#define PROBE3(name, a, b, c) DTRACE_PROBE3(mdns_reflector, name, a, b, c)
+#define PROBE4(name, a, b, c, d) DTRACE_PROBE4(mdns_reflector, name, a, b, c, d)
+#else
+#define PROBE1(name, a) ((void) 0)
+#define PROBE3(name, a, b, c) ((void) 0)
+#define PROBE4(name, a, b, c, d) ((void) 0)
+#endif
+
+#endif //MDNS_REFLECTOR_PROBES_H
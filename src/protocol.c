@@ -0,0 +1,93 @@
+/*
+    This file is part of mDNS Reflector (mdns-reflector), a lightweight and performant multicast DNS (mDNS) reflector.
+    Copyright (C) 2021 Yuxiang Zhu <me@yux.im>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "protocol.h"
+#include <string.h>
+#include <arpa/inet.h>
+
+#define LINK_LOCAL6(x, y) {{{ 0xff, 0x02, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, x, y }}}
+
+const struct protocol protocols[PROTOCOLS] = {
+        [PROTOCOL_MDNS] = {
+                .id = PROTOCOL_MDNS,
+                .name = "mdns",
+                .port = 5353,
+                .group4 = 0xe00000fb,  // 224.0.0.251
+                .group6 = LINK_LOCAL6(0x00, 0xfb),
+                // RFC 6762 section 11: send with TTL 255 so that receivers can tell the packet is on-link.
+                .hop_limit = 255,
+                .dns = true,
+                .validate = ingress_check,
+        },
+        [PROTOCOL_SSDP] = {
+                .id = PROTOCOL_SSDP,
+                .name = "ssdp",
+                .port = 1900,
+                .group4 = 0xeffffffa,  // 239.255.255.250
+                .group6 = LINK_LOCAL6(0x00, 0x0c),
+                // UPnP Device Architecture 1.1 section 1.1.2: the TTL should default to 2.
+                .hop_limit = 2,
+                .validate = ingress_check_ssdp,
+        },
+        [PROTOCOL_WSD] = {
+                .id = PROTOCOL_WSD,
+                .name = "wsd",
+                .port = 3702,
+                .group4 = 0xeffffffa,  // 239.255.255.250
+                .group6 = LINK_LOCAL6(0x00, 0x0c),
+                .hop_limit = 1,
+                .validate = ingress_check_wsd,
+        },
+};
+
+const struct protocol *protocol_find(const char *name) {
+    for (size_t i = 0; i < PROTOCOLS; ++i) {
+        if (strcmp(protocols[i].name, name) == 0)
+            return &protocols[i];
+    }
+    return NULL;
+}
+
+socklen_t protocol_bind_address(const struct protocol *protocol, int family, struct sockaddr_storage *sa) {
+    memset(sa, 0, sizeof(*sa));
+    if (family == AF_INET6) {
+        struct sockaddr_in6 *sa6 = (struct sockaddr_in6 *) sa;
+        sa6->sin6_family = AF_INET6;
+        sa6->sin6_port = htons(protocol->port);
+        sa6->sin6_addr = in6addr_any;
+        return sizeof(*sa6);
+    }
+    struct sockaddr_in *sa4 = (struct sockaddr_in *) sa;
+    sa4->sin_family = AF_INET;
+    sa4->sin_port = htons(protocol->port);
+    sa4->sin_addr.s_addr = htonl(INADDR_ANY);
+    return sizeof(*sa4);
+}
+
+socklen_t protocol_group_address(const struct protocol *protocol, int family, unsigned int ifindex,
+                                 struct sockaddr_storage *sa) {
+    socklen_t len = protocol_bind_address(protocol, family, sa);
+    if (family == AF_INET6) {
+        struct sockaddr_in6 *sa6 = (struct sockaddr_in6 *) sa;
+        sa6->sin6_addr = protocol->group6;
+        sa6->sin6_scope_id = ifindex;
+    } else {
+        ((struct sockaddr_in *) sa)->sin_addr.s_addr = htonl(protocol->group4);
+    }
+    return len;
+}
@@ -0,0 +1,70 @@
+/*
+    This file is part of mDNS Reflector (mdns-reflector), a lightweight and performant multicast DNS (mDNS) reflector.
+    Copyright (C) 2021 Yuxiang Zhu <me@yux.im>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef MDNS_REFLECTOR_PROTOCOL_H
+#define MDNS_REFLECTOR_PROTOCOL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include "ingress.h"
+
+enum protocol_id {
+    PROTOCOL_MDNS,
+    PROTOCOL_SSDP,
+    PROTOCOL_WSD,
+    PROTOCOLS
+};
+
+/// Validate a received packet before reflecting it.
+typedef enum ingress_verdict (*protocol_validate)(const uint8_t *msg, size_t len, uint16_t source_port, int ttl);
+
+/// A link-local multicast protocol that can be reflected: where its packets are sent and how they are checked.
+struct protocol {
+    enum protocol_id id;
+    const char *name;
+    uint16_t port;
+    /// IPv4 group, in host byte order
+    uint32_t group4;
+    struct in6_addr group6;
+    /// TTL or hop limit to send with
+    int hop_limit;
+    /// whether packets are DNS messages; record rewriting, splitting and the like only apply to those
+    bool dns;
+    /// ingress validation hook
+    protocol_validate validate;
+};
+
+extern const struct protocol protocols[PROTOCOLS];
+
+/// Find a protocol by name.
+/// \return the protocol, or NULL if not found
+const struct protocol *protocol_find(const char *name);
+
+/// Fill in the address to bind the sockets of a protocol to.
+/// \return length of the address
+socklen_t protocol_bind_address(const struct protocol *protocol, int family, struct sockaddr_storage *sa);
+
+/// Fill in the group address of a protocol on an interface.
+/// \return length of the address
+socklen_t protocol_group_address(const struct protocol *protocol, int family, unsigned int ifindex,
+                                 struct sockaddr_storage *sa);
+
+#endif //MDNS_REFLECTOR_PROTOCOL_H
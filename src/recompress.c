@@ -0,0 +1,89 @@
+/*
+    This file is part of mDNS Reflector (mdns-reflector), a lightweight and performant multicast DNS (mDNS) reflector.
+    Copyright (C) 2021 Yuxiang Zhu <me@yux.im>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "recompress.h"
+#include "dns.h"
+#include <stdbool.h>
+
+/// Measure the labels of a name written out before its root label or a pointer.
+/// \param end output offset right after the name
+/// \return bytes of labels before the root label, or -1 if the name ends with a pointer or is malformed
+static long literal_name(const uint8_t *msg, size_t len, size_t offset, size_t *end) {
+    size_t start = offset;
+    while (offset < len) {
+        uint8_t label = msg[offset];
+        if ((label & 0xc0u) == 0xc0u) {
+            *end = offset + 2 <= len ? offset + 2 : 0;
+            return -1;
+        }
+        if (!label) {
+            *end = offset + 1;
+            return (long) (offset - start);
+        }
+        offset += 1u + label;
+    }
+    *end = 0;
+    return -1;
+}
+
+size_t recompress_estimate(const uint8_t *msg, size_t len) {
+    struct dns_parser parser;
+    struct dns_record record;
+    size_t estimate = 0;
+    bool first = true;
+    int r;
+    if (dns_parser_init(&parser, msg, len) == -1)
+        return 0;
+    while ((r = dns_parser_next(&parser, &record)) == 1) {
+        size_t offset = record.offset;
+        size_t prefix = 0;
+        unsigned int nnames = record.section == DNS_SECTION_QUESTION ? 0 : dns_rdata_names(record.type, &prefix);
+        for (unsigned int i = 0; i <= nnames; ++i) {
+            if (i == 1)
+                offset = record.rdata + prefix;
+            size_t end;
+            long literal = literal_name(msg, len, offset, &end);
+            if (!end)
+                return 0;
+            // a pointer would take 2 bytes in place of the labels
+            if (literal > 2 && !first)
+                estimate += (size_t) literal - 2;
+            if (literal > 0)
+                first = false;
+            offset = end;
+        }
+    }
+    return r == -1 ? 0 : estimate;
+}
+
+size_t recompress_message(const uint8_t *msg, size_t len, uint8_t *out, size_t cap) {
+    struct dns_parser parser;
+    struct dns_record record;
+    struct dns_writer writer;
+    int r;
+    if (dns_parser_init(&parser, msg, len) == -1)
+        return 0;
+    dns_writer_init(&writer, out, cap < len ? cap : len);
+    while ((r = dns_parser_next(&parser, &record)) == 1) {
+        if (dns_writer_record(&writer, msg, len, &record) != 0)
+            return 0;
+    }
+    if (r == -1 || writer.len >= len)
+        return 0;
+    return dns_writer_finish(&writer, parser.header.id, parser.header.flags);
+}
@@ -0,0 +1,35 @@
+/*
+    This file is part of mDNS Reflector (mdns-reflector), a lightweight and performant multicast DNS (mDNS) reflector.
+    Copyright (C) 2021 Yuxiang Zhu <me@yux.im>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef MDNS_REFLECTOR_RECOMPRESS_H
+#define MDNS_REFLECTOR_RECOMPRESS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/// Estimate how many bytes re-compressing a message would save, without decompressing anything: every name after
+/// the first that is written out down to the root label could at best be replaced by a pointer.
+/// \return estimated saving, or 0 if the message is malformed
+size_t recompress_estimate(const uint8_t *msg, size_t len);
+
+/// Re-encode all names of a message with the longest possible compression pointers.
+/// \param out output buffer of `cap` bytes
+/// \return length of the new message, or 0 if the message is malformed or would not get smaller
+size_t recompress_message(const uint8_t *msg, size_t len, uint8_t *out, size_t cap);
+
+#endif //MDNS_REFLECTOR_RECOMPRESS_H
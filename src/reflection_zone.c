@@ -23,57 +23,99 @@
 #include <syslog.h>
 #include <string.h>
 
-static int cmp_unsigned_int(const void *a, const void *b) {
-    unsigned int av = *(unsigned int *) a;
-    unsigned int bv = *(unsigned int *) b;
-    if (av == bv)
-        return 0;
-    if (av < bv)
-        return -1;
-    return 1;
+/// A network namespace, interface index and protocol, to find duplicate interfaces.
+struct if_key {
+    unsigned int netns_slot;
+    unsigned int ifindex;
+    unsigned int protocol;
+};
+
+static int cmp_if_key(const void *a, const void *b) {
+    const struct if_key *ak = a;
+    const struct if_key *bk = b;
+    if (ak->netns_slot != bk->netns_slot)
+        return ak->netns_slot < bk->netns_slot ? -1 : 1;
+    if (ak->ifindex != bk->ifindex)
+        return ak->ifindex < bk->ifindex ? -1 : 1;
+    if (ak->protocol != bk->protocol)
+        return ak->protocol < bk->protocol ? -1 : 1;
+    return 0;
 }
 
 bool check_reflection_zone(const struct reflection_zone *rz_list) {
     if (!rz_list) {
-        fputs("ERROR: At least 1 reflection zone must be specified.\n", stderr);
+        log_msg(LOG_ERR, "at least 1 reflection zone must be specified");
         return false;
     }
     size_t nifs = 0;
     for (const struct reflection_zone *rz = rz_list; rz; rz = rz->next) {
-        if (rz->nifs < 2) {
-            fputs("ERROR: At least 2 interfaces must be specified in each reflection zone.\n", stderr);
+        size_t per_protocol[PROTOCOLS] = {0};
+        for (const struct reflection_if *rif = rz->first_if; rif; rif = rif->next)
+            per_protocol[rif->protocol->id]++;
+        bool too_few = rz->nifs < 2;
+        for (size_t i = 0; i < PROTOCOLS; ++i)
+            too_few = too_few || per_protocol[i] == 1;
+        if (too_few) {
+            log_msg(LOG_ERR, "at least 2 interfaces must be specified in reflection zone %s", rz->name);
             return false;
         }
         nifs += rz->nifs;
     }
-    unsigned int ifindices[nifs];
+    if (!check_unique_reflection_ifs(rz_list)) {
+        log_msg(LOG_ERR, "duplicate interfaces are not allowed");
+        return false;
+    }
+    return true;
+}
+
+bool check_unique_reflection_ifs(const struct reflection_zone *rz_list) {
+    size_t nifs = 0;
+    for (const struct reflection_zone *rz = rz_list; rz; rz = rz->next)
+        nifs += rz->nifs;
+    if (!nifs)
+        return true;
+    struct if_key keys[nifs];
     size_t index = 0;
     for (const struct reflection_zone *rz = rz_list; rz; rz = rz->next) {
         for (struct reflection_if *rif = rz->first_if; rif; rif = rif->next) {
-            ifindices[index++] = rif->ifindex;
+            keys[index].netns_slot = rif->netns_slot;
+            keys[index].ifindex = rif->ifindex;
+            keys[index].protocol = rif->protocol->id;
+            index++;
         }
     }
-    qsort(ifindices, nifs, sizeof(unsigned int), cmp_unsigned_int);
+    qsort(keys, nifs, sizeof(struct if_key), cmp_if_key);
     for (size_t i = 1; i < nifs; ++i) {
-        if (ifindices[i - 1] == ifindices[i]) {
-            fputs("ERROR: Duplicate interfaces are not allowed.\n", stderr);
+        if (cmp_if_key(&keys[i - 1], &keys[i]) == 0)
             return false;
-        }
     }
     return true;
 }
 
-struct reflection_zone *new_reflection_zone(unsigned int zone_index, struct reflection_zone *rz_list) {
+struct reflection_zone *new_reflection_zone(unsigned int zone_index, const char *name, struct reflection_zone *rz_list) {
     struct reflection_zone *rz = malloc(sizeof(struct reflection_zone));
     if (!rz) {
         return NULL;
     }
     memset(rz, 0, sizeof(struct reflection_zone));
     rz->zone_index = zone_index;
+    rz->protocols = 1u << PROTOCOL_MDNS;
+    if (name)
+        snprintf(rz->name, ZONE_NAME_MAX, "%s", name);
+    else
+        snprintf(rz->name, ZONE_NAME_MAX, "%u", zone_index);
     rz->next = rz_list;
     return rz;
 }
 
+struct reflection_zone *find_reflection_zone(const struct reflection_zone *rz_list, const char *name) {
+    for (const struct reflection_zone *rz = rz_list; rz; rz = rz->next) {
+        if (strcmp(rz->name, name) == 0)
+            return (struct reflection_zone *) rz;
+    }
+    return NULL;
+}
+
 struct reflection_if *new_reflection_if(unsigned int ifindex, const char *ifname, struct reflection_zone *rz) {
     struct reflection_if *rif = malloc(sizeof(struct reflection_if));
     if (!rif) {
@@ -83,7 +125,9 @@ struct reflection_if *new_reflection_if(unsigned int ifindex, const char *ifname
     rif->recv_fd = -1;
     rif->send_fd = -1;
     rif->ifindex = ifindex;
-    snprintf(rif->ifname, IF_NAMESIZE, "%s", ifname);
+    snprintf(rif->ifname, IFSPEC_MAX, "%s", ifname);
+    snprintf(rif->device, IF_NAMESIZE, "%s", ifname);
+    rif->protocol = &protocols[PROTOCOL_MDNS];
     rif->zone = rz;
     if (rz) {
         rif->next = rz->first_if;
@@ -92,3 +136,82 @@ struct reflection_if *new_reflection_if(unsigned int ifindex, const char *ifname
     }
     return rif;
 }
+
+struct reflection_if *new_reflection_if_from_entry(const struct iftable_entry *entry, struct reflection_zone *rz) {
+    struct reflection_if *rif = new_reflection_if(entry->ifindex, entry->ifname, rz);
+    if (rif) {
+        rif->has_addr4 = entry->has_addr4;
+        rif->addr4 = entry->addr4;
+        rif->has_addr6 = entry->has_addr6;
+        rif->addr6 = entry->addr6;
+    }
+    return rif;
+}
+
+void set_reflection_if_netns(struct reflection_if *rif, const char *netns, unsigned int slot) {
+    snprintf(rif->netns, NETNS_NAME_MAX, "%s", slot ? netns : "");
+    rif->netns_slot = slot;
+    snprintf(rif->ifname, IFSPEC_MAX, "%s:%s", netns, rif->device);
+}
+
+struct reflection_if *find_reflection_if(const struct reflection_zone *rz_list, unsigned int netns_slot,
+                                         unsigned int ifindex, const struct protocol *protocol) {
+    for (const struct reflection_zone *rz = rz_list; rz; rz = rz->next) {
+        for (struct reflection_if *rif = rz->first_if; rif; rif = rif->next) {
+            if (rif->netns_slot == netns_slot && rif->ifindex == ifindex && rif->protocol == protocol)
+                return rif;
+        }
+    }
+    return NULL;
+}
+
+void pair_dual_stack_ifs(struct reflection_zone *rz_list6, struct reflection_zone *rz_list4) {
+    // twins may have been removed since the last pairing
+    for (struct reflection_zone *rz = rz_list4; rz; rz = rz->next) {
+        for (struct reflection_if *rif = rz->first_if; rif; rif = rif->next)
+            rif->twin = NULL;
+    }
+    for (struct reflection_zone *rz = rz_list6; rz; rz = rz->next) {
+        for (struct reflection_if *rif = rz->first_if; rif; rif = rif->next) {
+            struct reflection_if *twin = find_reflection_if(rz_list4, rif->netns_slot, rif->ifindex,
+                                                            rif->protocol);
+            if (twin && twin->zone->zone_index != rz->zone_index)
+                twin = NULL;
+            rif->twin = twin;
+            if (twin)
+                twin->twin = rif;
+        }
+    }
+}
+
+static void free_reflection_if(struct reflection_if *rif) {
+    free(rif->hosts);
+    free(rif->aggregator);
+    free(rif);
+}
+
+void remove_reflection_if(struct reflection_if *rif) {
+    struct reflection_zone *rz = rif->zone;
+    for (struct reflection_if **p = &rz->first_if; *p; p = &(*p)->next) {
+        if (*p == rif) {
+            *p = rif->next;
+            rz->nifs--;
+            break;
+        }
+    }
+    free_reflection_if(rif);
+}
+
+void free_reflection_zones(struct reflection_zone *rz_list) {
+    while (rz_list) {
+        struct reflection_zone *rz = rz_list;
+        rz_list = rz->next;
+        while (rz->first_if) {
+            struct reflection_if *rif = rz->first_if;
+            rz->first_if = rif->next;
+            free_reflection_if(rif);
+        }
+        free(rz->interest);
+        free(rz);
+    }
+}
@@ -21,27 +21,133 @@
 
 #include <stdbool.h>
 #include <net/if.h>
+#include <netinet/in.h>
+#include "stats.h"
+#include "iftable.h"
+#include "protocol.h"
 
+struct rewrite_class;
+struct host_table;
+struct aggregator;
+struct interest_table;
+
+#define ZONE_NAME_MAX 32
+/// longest name or path of a network namespace, including the terminating NUL
+#define NETNS_NAME_MAX 64
+/// longest interface as configured, `[NETNS:]IFNAME`, including the terminating NUL
+#define IFSPEC_MAX (NETNS_NAME_MAX + IF_NAMESIZE)
+/// bits of a link key that hold the interface index; the namespace slot is above them
+#define NETNS_SLOT_SHIFT 20
+/// interface indices must be below this to fit in a link key
+#define IFINDEX_LIMIT (1u << NETNS_SLOT_SHIFT)
+
+/// An interface of a zone, for one protocol.
 struct reflection_if {
     int recv_fd;
     int send_fd;
     unsigned int ifindex;
     struct reflection_zone *zone;
-    char ifname[IF_NAMESIZE];
+    /// interface as configured: its name, prefixed with `NETNS:` if it is in another network namespace
+    char ifname[IFSPEC_MAX];
+    /// name of the interface in its namespace
+    char device[IF_NAMESIZE];
+    /// network namespace the sockets are opened in, or "" for the reflector's own
+    char netns[NETNS_NAME_MAX];
+    /// number of the namespace in the process, 0 for the reflector's own; see netns_lookup()
+    unsigned int netns_slot;
+    const struct protocol *protocol;
+    /// group address of the protocol on the interface, to send to
+    struct sockaddr_storage group;
+    socklen_t group_len;
+    /// primary IPv4 address of the interface, if any
+    bool has_addr4;
+    struct in_addr addr4;
+    /// IPv6 link-local address of the interface, if any; the source of its MLD reports
+    bool has_addr6;
+    struct in6_addr addr6;
+    /// destination class for record rewriting, if any
+    const struct rewrite_class *rewrite;
+    /// hosts seen on the interface, if multicast-to-unicast conversion is enabled
+    struct host_table *hosts;
+    /// response aggregation state, if enabled
+    struct aggregator *aggregator;
+    /// MTU of the interface, kept up to date at runtime on Linux
+    int mtu;
+    /// largest mDNS message that fits in the MTU; larger ones are split
+    size_t max_message;
+    /// transmit thread sending for the interface in the pipelined mode
+    unsigned int tx_queue;
+    /// the same interface, zone and protocol in the other address family, if reflected there too
+    struct reflection_if *twin;
+    /// send only while hosts listen to the group, as told by IGMP or MLD reports and traffic from the protocol port
+    bool listener_aware;
+    /// when a host was last known to listen, or when the interface was opened
+    uint64_t listener_seen_ns;
+    struct if_stats stats;
     struct reflection_if *next;
 };
 
 struct reflection_zone {
     unsigned int zone_index;
+    char name[ZONE_NAME_MAX];
     size_t nifs;
+    /// protocols reflected in the zone, a bit per enum protocol_id
+    unsigned int protocols;
     struct reflection_if *first_if;
+    /// service types queried and answered on the interfaces, if interest-based forwarding is enabled
+    struct interest_table *interest;
     struct reflection_zone *next;
 };
 
 bool check_reflection_zone(const struct reflection_zone *rz_list);
 
-struct reflection_zone *new_reflection_zone(unsigned int zone_index, struct reflection_zone *rz_list);
+/// Check that no interface is in more than one zone for the same protocol.
+bool check_unique_reflection_ifs(const struct reflection_zone *rz_list);
+
+struct reflection_zone *new_reflection_zone(unsigned int zone_index, const char *name, struct reflection_zone *rz_list);
 
+/// Find a reflection zone by name.
+/// \return the zone, or NULL if not found
+struct reflection_zone *find_reflection_zone(const struct reflection_zone *rz_list, const char *name);
+
+/// Create a reflection interface for mDNS.
 struct reflection_if *new_reflection_if(unsigned int ifindex, const char *ifname, struct reflection_zone *rz);
 
+/// Create a reflection interface from an interface table entry.
+struct reflection_if *new_reflection_if_from_entry(const struct iftable_entry *entry, struct reflection_zone *rz);
+
+/// Place a reflection interface in another network namespace.
+/// \param netns namespace as configured, which also prefixes the interface name
+/// \param slot number of the namespace, or 0 if it turned out to be the reflector's own
+void set_reflection_if_netns(struct reflection_if *rif, const char *netns, unsigned int slot);
+
+/// Find a reflection interface by network namespace, interface index and protocol.
+/// \param rz_list reflection zone list
+/// \param netns_slot number of the network namespace of the interface
+/// \param ifindex interface index in that namespace
+/// \param protocol protocol
+/// \return the reflection interface, or NULL if not found
+struct reflection_if *find_reflection_if(const struct reflection_zone *rz_list, unsigned int netns_slot,
+                                         unsigned int ifindex, const struct protocol *protocol);
+
+/// Key of the link an interface is on, telling apart interfaces with the same index in different network namespaces.
+static inline unsigned int reflection_if_link(const struct reflection_if *rif) {
+    return rif->ifindex | rif->netns_slot << NETNS_SLOT_SHIFT;
+}
+
+/// Link each interface to its twin in the other address family: the same interface and protocol in the zone with
+/// the same index.
+void pair_dual_stack_ifs(struct reflection_zone *rz_list6, struct reflection_zone *rz_list4);
+
+/// Check whether hosts are known to listen to the group of an interface, or the interface doesn't track listeners.
+static inline bool reflection_if_has_listeners(const struct reflection_if *rif, uint64_t now_ns, uint64_t timeout_ns) {
+    return !rif->listener_aware || now_ns - rif->listener_seen_ns < timeout_ns;
+}
+
+/// Unlink a reflection interface from its zone and free it. Its sockets are not closed.
+void remove_reflection_if(struct reflection_if *rif);
+
+/// Free a reflection zone list and all its interfaces. Sockets are not closed.
+void free_reflection_zones(struct reflection_zone *rz_list);
+
 #endif //MDNS_REFLECTOR_REFLECTION_ZONE_H
@@ -21,8 +21,33 @@
 #include "reflection_zone.h"
 #include "options.h"
 #include "mcast.h"
+#include "config.h"
+#include "sockbuf.h"
+#include "lowlatency.h"
+#include "timeutil.h"
+#include "rewrite.h"
+#include "dns.h"
+#include "hosttable.h"
+#include "ingress.h"
+#include "aggregate.h"
+#include "sockaddr.h"
+#include "heavyhitters.h"
+#include "relay.h"
+#include "discovery.h"
+#include "ha.h"
+#include "split.h"
+#include "probes.h"
+#include "pipeline.h"
+#include "protocol.h"
+#include "interest.h"
+#include "dualstack.h"
+#include "recompress.h"
+#include "listener.h"
+#include "handoff.h"
+#include "netns.h"
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <syslog.h>
 #include <errno.h>
@@ -32,22 +57,21 @@
 #include <sys/ioctl.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
-#include <signal.h>
 
 #if defined(__linux__)
 
 #include <sys/epoll.h>
+#include <netinet/icmp6.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
 
 #elif defined(__unix__) || defined(__APPLE__)
 #include <sys/event.h>
 #endif
-#define MDNS_PORT 5353
-#define MDNS_ADDR4 (u_int32_t)0xe00000fb  /* 224.0.0.251 */
-#define MDNS_ADDR6_INIT \
-{{{ 0xff, 0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, \
-0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xfb }}}
 
-int new_recv_socket(const struct sockaddr_storage *sa, socklen_t sa_len, uint32_t ifindex) {
+int new_recv_socket(const struct sockaddr_storage *sa, socklen_t sa_len, uint32_t ifindex, const char *ifname) {
+    (void) ifindex;  // not needed where SO_BINDTODEVICE is available
+    (void) ifname;
     const int ON = 1;
     int fd;
     switch (sa->ss_family) {
@@ -65,13 +89,15 @@ int new_recv_socket(const struct sockaddr_storage *sa, socklen_t sa_len, uint32_
                 log_err(LOG_ERR, "IPv6 setsockopt IPV6_PKTINFO");
                 goto cleanup;
             }
+            if (setsockopt(fd, IPPROTO_IPV6, IPV6_RECVHOPLIMIT, &ON, sizeof(ON)) == -1) {
+                log_err(LOG_ERR, "IPv6 setsockopt IPV6_RECVHOPLIMIT");
+                goto cleanup;
+            }
 #if defined(SO_BINDTODEVICE)
             {
                 struct ifreq ifr;
-                if (if_indextoname(ifindex, ifr.ifr_ifrn.ifrn_name) == NULL) {
-                    log_err(LOG_ERR, "if_indextoname");
-                    goto cleanup;
-                }
+                memset(&ifr, 0, sizeof(ifr));
+                snprintf(ifr.ifr_name, sizeof(ifr.ifr_name), "%s", ifname);
                 if (setsockopt(fd, SOL_SOCKET, SO_BINDTODEVICE, &ifr, sizeof(ifr)) == -1) {
                     log_err(LOG_ERR, "setsockopt SO_BINDTODEVICE");
                     goto cleanup;
@@ -101,13 +127,15 @@ int new_recv_socket(const struct sockaddr_storage *sa, socklen_t sa_len, uint32_
                 goto cleanup;
             }
 #endif
+            if (setsockopt(fd, IPPROTO_IP, IP_RECVTTL, &ON, sizeof(ON)) == -1) {
+                log_err(LOG_ERR, "IPv4 setsockopt IP_RECVTTL");
+                goto cleanup;
+            }
 #if defined(SO_BINDTODEVICE)
             {
                 struct ifreq ifr;
-                if (if_indextoname(ifindex, ifr.ifr_ifrn.ifrn_name) == NULL) {
-                    log_err(LOG_ERR, "if_indextoname");
-                    goto cleanup;
-                }
+                memset(&ifr, 0, sizeof(ifr));
+                snprintf(ifr.ifr_name, sizeof(ifr.ifr_name), "%s", ifname);
                 if (setsockopt(fd, SOL_SOCKET, SO_BINDTODEVICE, &ifr, sizeof(ifr)) == -1) {
                     log_err(LOG_ERR, "setsockopt SO_BINDTODEVICE");
                     goto cleanup;
@@ -133,6 +161,12 @@ int new_recv_socket(const struct sockaddr_storage *sa, socklen_t sa_len, uint32_
         log_err(LOG_ERR, "setsockopt SO_REUSEPORT");
         goto cleanup;
     }
+#endif
+#if defined(SO_RXQ_OVFL)
+    if (setsockopt(fd, SOL_SOCKET, SO_RXQ_OVFL, &ON, sizeof(ON)) == -1) {
+        log_err(LOG_ERR, "setsockopt SO_RXQ_OVFL");
+        goto cleanup;
+    }
 #endif
     int flags = fcntl(fd, F_GETFL, 0);
     if (flags == -1) {
@@ -153,7 +187,8 @@ int new_recv_socket(const struct sockaddr_storage *sa, socklen_t sa_len, uint32_
     return -1;
 }
 
-int new_send_socket(const struct sockaddr_storage *sa, socklen_t sa_len, uint32_t ifindex) {
+int new_send_socket(const struct sockaddr_storage *sa, socklen_t sa_len, uint32_t ifindex,
+                    const struct in_addr *addr4, int hop_limit) {
     const int ON = 1;
     const int OFF = 0;
     int fd;
@@ -176,6 +211,14 @@ int new_send_socket(const struct sockaddr_storage *sa, socklen_t sa_len, uint32_
                 log_err(LOG_ERR, "setsockopt IPV6_MULTICAST_LOOP");
                 goto cleanup;
             }
+            if (setsockopt(fd, IPPROTO_IPV6, IPV6_MULTICAST_HOPS, &hop_limit, sizeof(hop_limit)) == -1) {
+                log_err(LOG_ERR, "setsockopt IPV6_MULTICAST_HOPS");
+                goto cleanup;
+            }
+            if (setsockopt(fd, IPPROTO_IPV6, IPV6_UNICAST_HOPS, &hop_limit, sizeof(hop_limit)) == -1) {
+                log_err(LOG_ERR, "setsockopt IPV6_UNICAST_HOPS");
+                goto cleanup;
+            }
             break;
         case AF_INET:
             fd = socket(AF_INET, SOCK_DGRAM, 0);
@@ -184,24 +227,43 @@ int new_send_socket(const struct sockaddr_storage *sa, socklen_t sa_len, uint32_
                 return -1;
             }
             {
-                struct ifreq ifreq;
-                if (if_indextoname(ifindex, ifreq.ifr_name) == NULL) {
+#if defined(__linux__)
+                // Linux accepts an interface index, so interfaces without an IPv4 address work too.
+                struct ip_mreqn mreqn = {
+                        .imr_ifindex = (int) ifindex,
+                };
+                if (addr4)
+                    mreqn.imr_address = *addr4;
+                if (setsockopt(fd, IPPROTO_IP, IP_MULTICAST_IF, &mreqn, sizeof(mreqn)) == -1) {
+                    log_err(LOG_ERR, "setsockopt IP_MULTICAST_IF");
                     goto cleanup;
                 }
-                struct sockaddr_in *src_addr4 = (struct sockaddr_in *) &ifreq.ifr_addr;
-                if (ioctl(fd, SIOCGIFADDR, &ifreq) == -1) {
+#else
+                if (!addr4) {
+                    errno = EADDRNOTAVAIL;
                     goto cleanup;
                 }
-                if (setsockopt(fd, IPPROTO_IP, IP_MULTICAST_IF, &src_addr4->sin_addr, sizeof(src_addr4->sin_addr)) ==
-                    -1) {
+                if (setsockopt(fd, IPPROTO_IP, IP_MULTICAST_IF, addr4, sizeof(*addr4)) == -1) {
                     log_err(LOG_ERR, "setsockopt IP_MULTICAST_IF");
                     goto cleanup;
                 }
+#endif
             }
             if (setsockopt(fd, IPPROTO_IP, IP_MULTICAST_LOOP, &OFF, sizeof(ON)) == -1) {
                 log_err(LOG_ERR, "setsockopt IP_MULTICAST_LOOP");
                 goto cleanup;
             }
+            {
+                const unsigned char multicast_ttl = (unsigned char) hop_limit;
+                if (setsockopt(fd, IPPROTO_IP, IP_MULTICAST_TTL, &multicast_ttl, sizeof(multicast_ttl)) == -1) {
+                    log_err(LOG_ERR, "setsockopt IP_MULTICAST_TTL");
+                    goto cleanup;
+                }
+                if (setsockopt(fd, IPPROTO_IP, IP_TTL, &hop_limit, sizeof(hop_limit)) == -1) {
+                    log_err(LOG_ERR, "setsockopt IP_TTL");
+                    goto cleanup;
+                }
+            }
             break;
         default:
             errno = EAFNOSUPPORT;
@@ -236,265 +298,3169 @@ int new_send_socket(const struct sockaddr_storage *sa, socklen_t sa_len, uint32_
     return -1;
 }
 
-static const char *sockaddr_storage_to_string(const struct sockaddr_storage *sa) {
-    static __thread char buffer[INET6_ADDRSTRLEN + 2 + 1 + 5 + 1 + 10];
-    uint16_t port;
-    if (sa->ss_family == AF_INET6) {
-        struct sockaddr_in6 *sa6 = (struct sockaddr_in6 *) sa;
-        char addr_buf[INET6_ADDRSTRLEN];
-        if (inet_ntop(AF_INET6, &sa6->sin6_addr, addr_buf, sizeof(addr_buf)) == NULL) {
-            return NULL;
-        }
-        port = ntohs(sa6->sin6_port);
-        if (IN6_IS_ADDR_LINKLOCAL(&sa6->sin6_addr) || IN6_IS_ADDR_MC_LINKLOCAL(&sa6->sin6_addr)) {
-            snprintf(buffer, sizeof(buffer), "[%s%%%u]:%u", addr_buf, sa6->sin6_scope_id, port);
-        } else {
-            snprintf(buffer, sizeof(buffer), "[%s]:%u", addr_buf, port);
-        }
-    } else if (sa->ss_family == AF_INET) {
-        struct sockaddr_in *sa4 = (struct sockaddr_in *) sa;
-        char addr_buf[INET_ADDRSTRLEN];
-        if (inet_ntop(AF_INET, &sa4->sin_addr, addr_buf, sizeof(addr_buf)) == NULL) {
-            return NULL;
-        }
-        port = ntohs(sa4->sin_port);
-        snprintf(buffer, sizeof(buffer), "%s:%u", addr_buf, port);
-    } else {
-        return NULL;
+static int set_nonblocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags == -1) {
+        log_err(LOG_ERR, "fcntl F_GETFL");
+        return -1;
+    }
+    if (fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1) {
+        log_err(LOG_ERR, "fcntl F_SETFL");
+        return -1;
     }
-    return buffer;
+    return 0;
 }
 
-bool stopping;
+/// Create a non-blocking unicast socket bound to an address.
+/// \param type SOCK_DGRAM or SOCK_STREAM; stream sockets are made listening sockets
+static int new_unicast_socket(const struct sockaddr_storage *sa, int type) {
+    const int ON = 1;
+    int fd = socket(sa->ss_family, type, 0);
+    if (fd == -1) {
+        log_err(LOG_ERR, "socket");
+        return -1;
+    }
+    if (sa->ss_family == AF_INET6 && setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &ON, sizeof(ON)) == -1) {
+        log_err(LOG_ERR, "setsockopt IPV6_V6ONLY");
+        goto cleanup;
+    }
+    if (type == SOCK_STREAM && setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &ON, sizeof(ON)) == -1) {
+        log_err(LOG_ERR, "setsockopt SO_REUSEADDR");
+        goto cleanup;
+    }
+    if (set_nonblocking(fd) == -1)
+        goto cleanup;
+    if (bind(fd, (const struct sockaddr *) sa, sockaddr_len(sa)) == -1) {
+        log_err(LOG_ERR, "bind %s", sockaddr_storage_to_string(sa));
+        goto cleanup;
+    }
+    if (type == SOCK_STREAM && listen(fd, DISCOVERY_TCP_CONNECTIONS_MAX) == -1) {
+        log_err(LOG_ERR, "listen");
+        goto cleanup;
+    }
+    return fd;
+    cleanup:
+    close(fd);
+    return -1;
+}
 
 #define PACKET_MAX 10240
 #define MAX_EVENTS 10
 
-static void signal_handler(int sig) {
-    switch (sig) {
-        case SIGTERM:
-            stopping = true;
-            break;
-    }
-}
+/// The client of a discovery proxy may close its TCP connection before the response is sent. The reflector may be
+/// embedded in a program that doesn't ignore SIGPIPE, so don't let that raise it; see also SO_NOSIGPIPE.
+#if defined(MSG_NOSIGNAL)
+#define SEND_FLAGS MSG_NOSIGNAL
+#else
+#define SEND_FLAGS 0
+#endif
 
-int run_event_loop(struct options *options) {
-    int r = -1;
-    signal(SIGTERM, signal_handler);
+#if defined(EVFILT_READ)
+typedef struct kevent reflector_event;
+#elif defined(EPOLLIN)
+typedef struct epoll_event reflector_event;
+#endif
+
+/// Rewritten form of the current packet for one destination class.
+struct rewrite_variant {
+    /// sequence number of the packet this variant was computed for
+    uint64_t seq;
+    /// length of the rewritten packet, or 0 to forward the original
+    size_t len;
+    unsigned int dropped;
+    uint8_t buf[PACKET_MAX];
+};
+
+#if defined(__linux__)
+/// Netlink socket reporting link changes in a network namespace.
+struct link_monitor {
+    int fd;
+    char netns[NETNS_NAME_MAX];
+    unsigned int netns_slot;
+    struct link_monitor *next;
+};
+#endif
+
+struct mdns_reflector {
+    struct options *options;
 #if defined(EVFILT_READ)
     int kq;
-    if ((kq = kqueue()) == -1) {
-        log_err(LOG_ERR, "kqueue");
+#elif defined(EPOLLIN)
+    int epoll_fd;
+#endif
+    struct global_stats stats;
+    /// sequence number of the packet being reflected, used to invalidate rewrite variants
+    uint64_t packet_seq;
+    struct rewrite_variant rewrite_variants[REWRITE_CLASSES_MAX];
+    /// aggregators waiting to be flushed, in deadline order
+    struct aggregator *pending_head, *pending_tail;
+    /// buffer for datagrams received by relays and discovery proxies
+    uint8_t datagram_buffer[RELAY_DATAGRAM_MAX];
+    /// buffer for discovery proxy responses, with room for the TCP length prefix
+    uint8_t response_buffer[2 + 65535];
+    /// transmit threads, in the pipelined mode
+    struct pipeline *pipeline;
+#if defined(__linux__)
+    /// netlink sockets reporting link changes, one per network namespace with reflected interfaces, to follow MTU
+    /// changes and interfaces going away and coming back
+    struct link_monitor *link_monitors;
+    /// raw sockets receiving IGMP and MLD reports, if interfaces have listener awareness
+    int igmp_fd, mld_fd;
+#endif
+    /// the last packet split to fit an MTU, reused for other interfaces with the same MTU
+    uint64_t split_seq;
+    const void *split_buf;
+    size_t split_max;
+    int split_count;
+    struct split split;
+    /// packets recently received, to recognize dual-stack copies
+    struct dualstack_filter dualstack;
+    /// the packet being reflected with its names re-compressed
+    uint8_t recompress_buf[PACKET_MAX];
+    /// options of a reflector created with mdns_reflector_new()
+    struct options own_options;
+    bool started;
+    /// how long to spin before waiting for events, in the low-latency mode
+    uint64_t spin_budget_ns;
+    /// when the previous loop iteration ended; the time since then is idle
+    uint64_t last_end_ns;
+    reflector_event events[MAX_EVENTS];
+    /// buffer for packets received from interfaces, unless they are received into the pipeline pool
+    uint8_t packet_buffer[PACKET_MAX];
+    /// sockets received from the instance this one replaces, while starting
+    struct handoff handoff;
+    /// whether sockets were taken over from another instance
+    bool took_over;
+    /// socket where a new instance connects to take over, and the connection to it
+    int handoff_fd;
+    struct handoff_conn handoff_conn;
+    /// whether all sockets were sent over `handoff_conn`, which then waits for HANDOFF_READY
+    bool handoff_sent;
+    /// whether a new instance took over, so that this one must stop
+    bool handed_off;
+    /// read end of a pipe that wakes the loop up, owned by the caller; see reflector_watch_wakeup()
+    int wakeup_fd;
+};
+
+/// Watch a socket for incoming packets.
+/// \param udata reflection interface or relay the socket belongs to, returned with its events
+/// \param modify whether the socket is already watched and only `udata` changes
+static int watch_fd(struct mdns_reflector *reflector, int fd, void *udata, bool modify) {
+#if defined(EVFILT_READ)
+    (void) modify;
+    struct kevent ev;
+    EV_SET(&ev, fd, EVFILT_READ, EV_ADD, 0, 0, udata);
+    if (kevent(reflector->kq, &ev, 1, NULL, 0, NULL) == -1) {
+        log_err(LOG_ERR, "kevent");
         return -1;
     }
-    struct kevent ev, events[MAX_EVENTS];
 #elif defined(EPOLLIN)
-    int epoll_fd = epoll_create1(0);
-    if (epoll_fd == -1) {
-        log_err(LOG_ERR, "epoll_create1");
+    struct epoll_event ev = {
+            .events = EPOLLIN,
+            .data.ptr = udata,
+    };
+    if (epoll_ctl(reflector->epoll_fd, modify ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, fd, &ev) == -1) {
+        log_err(LOG_ERR, modify ? "epoll_ctl EPOLL_CTL_MOD" : "epoll_ctl EPOLL_CTL_ADD");
         return -1;
     }
-    struct epoll_event ev, events[MAX_EVENTS];
-    ev.events = EPOLLIN;
 #endif
+    return 0;
+}
 
-    // Create recv_socks and send_socks for IPv6 reflection zones.
-    struct sockaddr_in6 sa6 = {
-            .sin6_family=AF_INET6,
-            .sin6_port = htons(MDNS_PORT),
-            .sin6_addr = IN6ADDR_ANY_INIT,
-    };
-    struct sockaddr_in6 sa_group6 = {
-            .sin6_family=AF_INET6,
-            .sin6_port = htons(MDNS_PORT),
-            .sin6_addr = MDNS_ADDR6_INIT,
-    };
-    for (const struct reflection_zone *rz = options->rz_list6; rz; rz = rz->next) {
-        for (struct reflection_if *rif = rz->first_if; rif; rif = rif->next) {
-            rif->send_fd = new_send_socket((struct sockaddr_storage *) &sa6, sizeof(sa6), rif->ifindex);
-            if (rif->send_fd < 0) {
-                log_err(LOG_ERR, "Failed to setup IPv6 send socket for interface %s", rif->ifname);
-                goto end;
-            }
-            rif->recv_fd = new_recv_socket((struct sockaddr_storage *) &sa6, sizeof(sa6), rif->ifindex);
-            if (rif->recv_fd < 0) {
-                log_err(LOG_ERR, "Failed to setup IPv6 recv socket for interface %s", rif->ifname);
-                goto end;
-            }
+/// Switch a watched stream socket between waiting until it is readable and until it is writable.
+static int watch_fd_writable(struct mdns_reflector *reflector, int fd, void *udata, bool writable) {
 #if defined(EVFILT_READ)
-            EV_SET(&ev, rif->recv_fd, EVFILT_READ, EV_ADD, 0, 0, rif);
-            if (kevent(kq, &ev, 1, NULL, 0, NULL) == -1) {
-                log_err(LOG_ERR, "kevent");
-                goto end;
-            }
+    struct kevent ev[2];
+    EV_SET(&ev[0], fd, EVFILT_READ, EV_ADD | (writable ? EV_DISABLE : EV_ENABLE), 0, 0, udata);
+    EV_SET(&ev[1], fd, EVFILT_WRITE, EV_ADD | (writable ? EV_ENABLE : EV_DISABLE), 0, 0, udata);
+    if (kevent(reflector->kq, ev, 2, NULL, 0, NULL) == -1) {
+        log_err(LOG_ERR, "kevent");
+        return -1;
+    }
 #elif defined(EPOLLIN)
-            ev.data.ptr = rif;
-            if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, rif->recv_fd, &ev) == -1) {
-                log_err(LOG_ERR, "epoll_ctl EPOLL_CTL_ADD");
-                goto end;
-            }
+    struct epoll_event ev = {
+            .events = writable ? EPOLLOUT : EPOLLIN,
+            .data.ptr = udata,
+    };
+    if (epoll_ctl(reflector->epoll_fd, EPOLL_CTL_MOD, fd, &ev) == -1) {
+        log_err(LOG_ERR, "epoll_ctl EPOLL_CTL_MOD");
+        return -1;
+    }
 #endif
-            sa_group6.sin6_scope_id = rif->ifindex;
-            if (mcast_join(rif->recv_fd, (struct sockaddr_storage *) &sa_group6, sizeof(sa_group6), rif->ifindex) <
-                0) {
-                log_err(LOG_ERR, "Failed to join interface %s to IPv6 multicast group", rif->ifname);
-                goto end;
-            }
+    return 0;
+}
+
+static int watch_reflection_if(struct mdns_reflector *reflector, struct reflection_if *rif, bool modify) {
+    return watch_fd(reflector, rif->recv_fd, rif, modify);
+}
+
+static void close_reflection_if(struct reflection_if *rif) {
+    if (rif->recv_fd >= 0)
+        close(rif->recv_fd);
+    if (rif->send_fd >= 0)
+        close(rif->send_fd);
+    rif->recv_fd = -1;
+    rif->send_fd = -1;
+}
+
+/// Create the sockets of an interface in the current network namespace.
+static int create_sockets(struct reflection_if *rif, int family) {
+    const char *family_name = family == AF_INET6 ? "IPv6" : "IPv4";
+    struct sockaddr_storage sa;
+    socklen_t sa_len = protocol_bind_address(rif->protocol, family, &sa);
+    rif->group_len = protocol_group_address(rif->protocol, family, rif->ifindex, &rif->group);
+    rif->send_fd = new_send_socket(&sa, sa_len, rif->ifindex, rif->has_addr4 ? &rif->addr4 : NULL,
+                                   rif->protocol->hop_limit);
+    if (rif->send_fd < 0) {
+        log_err(LOG_ERR, "Failed to setup %s %s send socket for interface %s", family_name, rif->protocol->name,
+                rif->ifname);
+        return -1;
+    }
+    rif->recv_fd = new_recv_socket(&sa, sa_len, rif->ifindex, rif->device);
+    if (rif->recv_fd < 0) {
+        log_err(LOG_ERR, "Failed to setup %s %s recv socket for interface %s", family_name, rif->protocol->name,
+                rif->ifname);
+        return -1;
+    }
+    return 0;
+}
+
+/// Interfaces of a zone list whose sockets are created on a helper thread in their network namespace.
+struct netns_sockets {
+    const struct reflection_zone *rz_list;
+    /// only interfaces of this namespace, or all if `rif` is set
+    unsigned int netns_slot;
+    struct reflection_if *rif;
+    int family;
+};
+
+/// Create the sockets of the interfaces of a namespace that have none yet, in that namespace.
+static int create_netns_sockets(void *ctx) {
+    const struct netns_sockets *batch = ctx;
+    if (batch->rif)
+        return create_sockets(batch->rif, batch->family);
+    for (const struct reflection_zone *rz = batch->rz_list; rz; rz = rz->next) {
+        for (struct reflection_if *rif = rz->first_if; rif; rif = rif->next) {
+            if (rif->netns_slot == batch->netns_slot && rif->recv_fd < 0 && create_sockets(rif, batch->family) == -1)
+                return -1;
         }
     }
+    return 0;
+}
 
-    // Create recv_socks and send_socks for IPv4 reflection zones.
-    struct sockaddr_in sa4 = {
-            .sin_family = AF_INET,
-            .sin_port = htons(MDNS_PORT),
-            .sin_addr.s_addr = htonl(INADDR_ANY),
+static int create_reflection_if_sockets(struct reflection_if *rif, int family) {
+    struct netns_sockets batch = {
+            .rif = rif,
+            .family = family,
     };
-    struct sockaddr_in sa_group4 = {
-            .sin_family = AF_INET,
-            .sin_port = htons(MDNS_PORT),
-            .sin_addr.s_addr = htonl(MDNS_ADDR4),
-    };
-    for (const struct reflection_zone *rz = options->rz_list4; rz; rz = rz->next) {
-        for (struct reflection_if *rif = rz->first_if; rif; rif = rif->next) {
-            rif->send_fd = new_send_socket((struct sockaddr_storage *) &sa4, sizeof(sa4), rif->ifindex);
-            if (rif->send_fd < 0) {
-                log_err(LOG_ERR, "Failed to setup IPv4 send socket for interface %s", rif->ifname);
-                goto end;
-            }
-            rif->recv_fd = new_recv_socket((struct sockaddr_storage *) &sa4, sizeof(sa4), rif->ifindex);
-            if (rif->recv_fd < 0) {
-                log_err(LOG_ERR, "Failed to setup IPv4 recv socket for interface %s", rif->ifname);
-                goto end;
-            }
-#if defined(EVFILT_READ)
-            EV_SET(&ev, rif->recv_fd, EVFILT_READ, EV_ADD, 0, 0, rif);
-            if (kevent(kq, &ev, 1, NULL, 0, NULL) == -1) {
-                log_err(LOG_ERR, "kevent");
-                goto end;
-            }
-#elif defined(EPOLLIN)
-            ev.data.ptr = rif;
-            if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, rif->recv_fd, &ev) == -1) {
-                log_err(LOG_ERR, "epoll_ctl EPOLL_CTL_ADD");
-                goto end;
-            }
+    return netns_run(rif->netns, create_netns_sockets, &batch);
+}
+
+static void set_mtu(struct reflection_if *rif, int mtu, int family) {
+    rif->mtu = mtu;
+    int headers = (family == AF_INET6 ? 40 : 20) + 8;
+    rif->max_message = mtu > 512 + headers ? (size_t) (mtu - headers) : 512;
+    if (rif->aggregator)
+        rif->aggregator->max_size = rif->max_message < AGGREGATE_ARENA_SIZE ? rif->max_message
+                                                                            : AGGREGATE_ARENA_SIZE;
+}
+
+/// Size reflected and aggregated messages to the interface MTU.
+static void setup_mtu(struct reflection_if *rif, int family) {
+    int mtu = 1500;
+    struct ifreq ifr;
+    memset(&ifr, 0, sizeof(ifr));
+    // the socket asks its own network namespace
+    snprintf(ifr.ifr_name, sizeof(ifr.ifr_name), "%s", rif->device);
+    if (ioctl(rif->send_fd, SIOCGIFMTU, &ifr) == -1)
+        log_err(LOG_WARNING, "Failed to get MTU of interface %s; assuming %d", rif->ifname, mtu);
+    else
+        mtu = ifr.ifr_mtu;
+    set_mtu(rif, mtu, family);
+}
+
+static int setup_reflection_if(struct mdns_reflector *reflector, struct reflection_if *rif, int family) {
+    const struct options *options = reflector->options;
+    if (options->rcvbuf > 0 && sockbuf_set(rif->recv_fd, SO_RCVBUF, options->rcvbuf) == -1)
+        log_err(LOG_WARNING, "Failed to set receive buffer size for interface %s", rif->ifname);
+    if (options->sndbuf > 0 && sockbuf_set(rif->send_fd, SO_SNDBUF, options->sndbuf) == -1)
+        log_err(LOG_WARNING, "Failed to set send buffer size for interface %s", rif->ifname);
+    if (options->low_latency)
+        lowlatency_setup_socket(rif->recv_fd, options);
+    if (reflector->stats.latency_enabled) {
+        const int ON = 1;
+#if defined(SO_TIMESTAMPNS)
+        if (setsockopt(rif->recv_fd, SOL_SOCKET, SO_TIMESTAMPNS, &ON, sizeof(ON)) == -1)
+            log_err(LOG_WARNING, "setsockopt SO_TIMESTAMPNS");
+#elif defined(SO_TIMESTAMP)
+        if (setsockopt(rif->recv_fd, SOL_SOCKET, SO_TIMESTAMP, &ON, sizeof(ON)) == -1)
+            log_err(LOG_WARNING, "setsockopt SO_TIMESTAMP");
 #endif
-            if (mcast_join(rif->recv_fd, (struct sockaddr_storage *) &sa_group4, sizeof(sa_group4), rif->ifindex) <
-                0) {
-                log_err(LOG_ERR, "Failed to join interface %s to IPv4 multicast group", rif->ifname);
-                goto end;
+    }
+    rif->stats.rcvbuf = sockbuf_get(rif->recv_fd, SO_RCVBUF);
+    atomic_store_explicit(&rif->stats.sndbuf, sockbuf_get(rif->send_fd, SO_SNDBUF), memory_order_relaxed);
+    // Listeners that joined before the interface was opened are not reported again until queried, so assume some.
+    if (!rif->listener_seen_ns)
+        rif->listener_seen_ns = monotonic_ns();
+    setup_mtu(rif, family);
+    return watch_reflection_if(reflector, rif, false);
+}
+
+static int join_reflection_if(struct reflection_if *rif, int family) {
+    // sockets taken over from another instance are members already
+    if (mcast_join(rif->recv_fd, &rif->group, rif->group_len, rif->ifindex,
+                   family == AF_INET && rif->has_addr4 ? &rif->addr4 : NULL) < 0 && errno != EADDRINUSE) {
+        log_err(LOG_ERR, "Failed to join interface %s to %s %s multicast group", rif->ifname,
+                family == AF_INET6 ? "IPv6" : "IPv4", rif->protocol->name);
+        return -1;
+    }
+    return 0;
+}
+
+static int open_reflection_if(struct mdns_reflector *reflector, struct reflection_if *rif, int family) {
+    if (create_reflection_if_sockets(rif, family) == -1 ||
+        setup_reflection_if(reflector, rif, family) == -1 ||
+        join_reflection_if(rif, family) == -1) {
+        close_reflection_if(rif);
+        return -1;
+    }
+    return 0;
+}
+
+static void reflection_if_handoff_key(const struct reflection_if *rif, int family, char *key) {
+    snprintf(key, HANDOFF_KEY_MAX, "if %s %s%s%u %s", family == AF_INET6 ? "ipv6" : "ipv4", rif->netns,
+             rif->netns[0] ? ":" : "", rif->ifindex, rif->protocol->name);
+}
+
+/// Take over the sockets of a reflection interface from the instance this one replaces, with its counters and
+/// learned hosts.
+/// \return whether that instance handed them over
+static bool inherit_reflection_if(struct mdns_reflector *reflector, struct reflection_if *rif, int family) {
+    char key[HANDOFF_KEY_MAX];
+    reflection_if_handoff_key(rif, family, key);
+    struct handoff_entry *entry = handoff_take(&reflector->handoff, key);
+    if (!entry)
+        return false;
+    rif->recv_fd = entry->fds[0];
+    rif->send_fd = entry->fds[1];
+    rif->group_len = protocol_group_address(rif->protocol, family, rif->ifindex, &rif->group);
+    rif->stats = entry->record.stats;
+    rif->listener_seen_ns = entry->record.listener_seen_ns;
+    if (rif->hosts && entry->record.has_hosts)
+        *rif->hosts = entry->record.hosts;
+    log_msg(LOG_INFO, "handoff: took over %s", key);
+    return true;
+}
+
+/// Take over the sockets of a relay, discovery proxy or HA pairing.
+/// \return whether the instance this one replaces handed them over
+static bool inherit_fds(struct mdns_reflector *reflector, const char *key, int *fds, size_t nfds) {
+    struct handoff_entry *entry = handoff_take(&reflector->handoff, key);
+    if (!entry)
+        return false;
+    for (size_t i = 0; i < nfds; ++i)
+        fds[i] = entry->fds[i];
+    log_msg(LOG_INFO, "handoff: took over %s", key);
+    return true;
+}
+
+static void relay_handoff_key(const struct relay *relay, char *key) {
+    snprintf(key, HANDOFF_KEY_MAX, "relay %s %s", relay->name, sockaddr_storage_to_string(&relay->local));
+}
+
+static void discovery_handoff_key(const struct discovery *discovery, char *key) {
+    snprintf(key, HANDOFF_KEY_MAX, "discovery %s %s", discovery->name, sockaddr_storage_to_string(&discovery->listen));
+}
+
+static void ha_handoff_key(const struct ha *ha, char *key) {
+    snprintf(key, HANDOFF_KEY_MAX, "ha %s", sockaddr_storage_to_string(&ha->local));
+}
+
+/// Create the sockets of interfaces in other network namespaces, entering each namespace once.
+static int create_other_netns_sockets(const struct reflection_zone *rz_list, int family) {
+    for (const struct reflection_zone *rz = rz_list; rz; rz = rz->next) {
+        for (struct reflection_if *rif = rz->first_if; rif; rif = rif->next) {
+            // the first interface of a namespace without sockets starts the batch of that namespace
+            if (!rif->netns_slot || rif->recv_fd >= 0)
+                continue;
+            struct netns_sockets batch = {
+                    .rz_list = rz_list,
+                    .netns_slot = rif->netns_slot,
+                    .family = family,
+            };
+            if (netns_run(rif->netns, create_netns_sockets, &batch) == -1)
+                return -1;
+        }
+    }
+    return 0;
+}
+
+enum open_phase {
+    OPEN_PHASE_CREATE,
+    OPEN_PHASE_SETUP,
+    OPEN_PHASE_JOIN,
+    OPEN_PHASES
+};
+
+static const char *const OPEN_PHASE_NAMES[OPEN_PHASES] = {
+        "socket creation",
+        "socket setup",
+        "multicast group join",
+};
+
+static int run_open_phase(struct mdns_reflector *reflector, enum open_phase phase,
+                          const struct reflection_zone *rz_list, int family, size_t *nifs) {
+    for (const struct reflection_zone *rz = rz_list; rz; rz = rz->next) {
+        for (struct reflection_if *rif = rz->first_if; rif; rif = rif->next) {
+            int r;
+            switch (phase) {
+                case OPEN_PHASE_CREATE:
+                    // interfaces of other network namespaces are created below, a helper thread per namespace
+                    r = inherit_reflection_if(reflector, rif, family) || rif->netns_slot ? 0
+                                                                                         : create_sockets(rif, family);
+                    ++*nifs;
+                    break;
+                case OPEN_PHASE_SETUP:
+                    r = setup_reflection_if(reflector, rif, family);
+                    break;
+                default:
+                    r = join_reflection_if(rif, family);
+                    break;
             }
+            if (r == -1)
+                return -1;
         }
     }
+    if (phase == OPEN_PHASE_CREATE)
+        return create_other_netns_sockets(rz_list, family);
+    return 0;
+}
 
-    struct sockaddr_storage peer_addr;
-    char peer_addr_str[INET6_ADDRSTRLEN + 2 + 1 + 5 + 1 + 10];
-    char buffer[PACKET_MAX];
-    char cmbuf[0x100];
-    struct iovec iov = {
-            .iov_base = buffer,
-            .iov_len = sizeof(buffer),
-    };
-    struct msghdr mh = {
-            .msg_name = &peer_addr,
-            .msg_namelen = sizeof(peer_addr),
-            .msg_iov = &iov,
-            .msg_iovlen = 1,
-            .msg_control = cmbuf,
-            .msg_controllen = sizeof(cmbuf),
-    };
+/// Open sockets of all reflection zones. Each step is done for all interfaces before the next one starts,
+/// and the time taken by each step is logged.
+static int open_reflection_zones(struct mdns_reflector *reflector) {
+    const struct options *options = reflector->options;
+    uint64_t start = monotonic_ns();
+    size_t nifs = 0;
+    for (int phase = 0; phase < OPEN_PHASES; ++phase) {
+        uint64_t phase_start = monotonic_ns();
+        if (run_open_phase(reflector, phase, options->rz_list6, AF_INET6, &nifs) == -1 ||
+            run_open_phase(reflector, phase, options->rz_list4, AF_INET, &nifs) == -1)
+            return -1;
+        log_msg(LOG_INFO, "startup: %s took %.3f ms", OPEN_PHASE_NAMES[phase],
+                (double) (monotonic_ns() - phase_start) / 1e6);
+    }
+    log_msg(LOG_INFO, "startup: opened %zu reflection interface(s) in %.3f ms", nifs,
+            (double) (monotonic_ns() - start) / 1e6);
+    return 0;
+}
 
-    while (!stopping) {
-#if defined(EVFILT_READ)
-        log_msg(LOG_DEBUG, "kevent");
-        int nevents = kevent(kq, NULL, 0, events, MAX_EVENTS, NULL);
-        if (nevents == -1) {
-            log_err(LOG_ERR, "kevent");
-            goto end;
+static void close_reflection_zones(const struct reflection_zone *rz_list) {
+    for (const struct reflection_zone *rz = rz_list; rz; rz = rz->next) {
+        for (struct reflection_if *rif = rz->first_if; rif; rif = rif->next) {
+            close_reflection_if(rif);
         }
-#elif defined(EPOLLIN)
-        log_msg(LOG_DEBUG, "epoll_wait");
-        int nevents = epoll_wait(epoll_fd, events, MAX_EVENTS, -1);
-        if (nevents == -1) {
-            log_err(LOG_ERR, "epoll_wait");
-            goto end;
+    }
+}
+
+/// Open sockets for interfaces in `rz_list` that are not present in the running `old_rz_list`.
+static int open_added_ifs(struct mdns_reflector *reflector, const struct reflection_zone *rz_list,
+                          const struct reflection_zone *old_rz_list, int family, size_t *opened) {
+    for (const struct reflection_zone *rz = rz_list; rz; rz = rz->next) {
+        for (struct reflection_if *rif = rz->first_if; rif; rif = rif->next) {
+            const struct reflection_if *old_rif = find_reflection_if(old_rz_list, rif->netns_slot, rif->ifindex,
+                                                                     rif->protocol);
+            if (old_rif && old_rif->recv_fd >= 0)
+                continue;
+            if (open_reflection_if(reflector, rif, family) == -1)
+                return -1;
+            log_msg(LOG_INFO, "reload: opened interface %s in zone %s", rif->ifname, rz->name);
+            ++*opened;
         }
-#endif
-        for (int i = 0; i < nevents; ++i) {
-#if defined(EVFILT_READ)
-            int fd = (int) events[i].ident;
-            struct reflection_if *rif = events[i].udata;
-#elif defined(EPOLLIN)
-            struct reflection_if *rif = events[i].data.ptr;
-            int fd = rif->recv_fd;
-#endif
-            for (;;) {
-                log_msg(LOG_DEBUG, "recvmsg");
-                ssize_t recv_size = recvmsg(fd, &mh, 0);
-                if (recv_size == -1) {
-                    if (errno == EWOULDBLOCK)
-                        break;
-                    log_err(LOG_ERR, "recvfrom");
-                    goto end;
-                }
-                if (options->log_level <= LOG_INFO) {
-                    snprintf(peer_addr_str, sizeof(peer_addr_str), "%s", sockaddr_storage_to_string(&peer_addr));
-                    log_msg(LOG_INFO, "received %u bytes from interface %s with source IP %s",
-                            recv_size, rif->ifname, peer_addr_str);
-                }
-                if (recv_size >= PACKET_MAX) {
-                    log_msg(LOG_WARNING, "ignoring because it is too large (limit is %d bytes)", PACKET_MAX);
-                    continue;
-                }
-                // Send to other interfaces.
-                struct sockaddr *dst;
-                socklen_t dst_len;
-                if (peer_addr.ss_family == AF_INET6) {
-                    dst = (struct sockaddr *) &sa_group6;
-                    dst_len = sizeof(sa_group6);
-                } else if (peer_addr.ss_family == AF_INET) {
-                    dst = (struct sockaddr *) &sa_group4;
-                    dst_len = sizeof(sa_group4);
-                } else {
-                    log_msg(LOG_WARNING, "ignoring packet from unknown address family: %d", peer_addr.ss_family);
-                    continue;
-                }
-                for (struct reflection_if *dst_rif = rif->zone->first_if; dst_rif; dst_rif = dst_rif->next) {
-                    if (dst_rif == rif)
-                        continue;
-                    if (peer_addr.ss_family == AF_INET6)
-                        sa_group6.sin6_scope_id = dst_rif->ifindex;
-                    log_msg(LOG_INFO, "forwarding to interface %s", dst_rif->ifname);
-                    if (sendto(dst_rif->send_fd, buffer, (size_t) recv_size, 0, dst, dst_len) == -1) {
-                        if (errno == EWOULDBLOCK)
-                            continue;  // send queue overwhelmed; skipping
-                        log_err(LOG_ERR, "sendto");
-                        goto end;
-                    }
-                    log_msg(LOG_DEBUG, "sent");
-                }
+    }
+    return 0;
+}
+
+/// Move the sockets of interfaces still present in `rz_list` over from the running `old_rz_list`.
+/// Sockets of interfaces that were removed are left in `old_rz_list`.
+static void adopt_kept_ifs(struct mdns_reflector *reflector, const struct reflection_zone *rz_list,
+                           const struct reflection_zone *old_rz_list, int family, size_t *kept) {
+    for (const struct reflection_zone *rz = rz_list; rz; rz = rz->next) {
+        for (struct reflection_if *rif = rz->first_if; rif; rif = rif->next) {
+            struct reflection_if *old_rif = find_reflection_if(old_rz_list, rif->netns_slot, rif->ifindex,
+                                                               rif->protocol);
+            // an interface that went away is opened again, as an added one
+            if (!old_rif || old_rif->recv_fd < 0)
+                continue;
+            rif->recv_fd = old_rif->recv_fd;
+            rif->send_fd = old_rif->send_fd;
+            rif->group = old_rif->group;
+            rif->group_len = old_rif->group_len;
+            rif->stats = old_rif->stats;
+            rif->listener_seen_ns = old_rif->listener_aware ? old_rif->listener_seen_ns : monotonic_ns();
+            if (rif->hosts && old_rif->hosts) {
+                // keep learned hosts; the empty table is freed along with the old interface record
+                struct host_table *hosts = rif->hosts;
+                rif->hosts = old_rif->hosts;
+                old_rif->hosts = hosts;
             }
+            setup_mtu(rif, family);
+            old_rif->recv_fd = -1;
+            old_rif->send_fd = -1;
+            // Point the event registration to the new interface record; the socket itself is untouched.
+            watch_reflection_if(reflector, rif, true);
+            if (strcmp(old_rif->zone->name, rz->name) != 0)
+                log_msg(LOG_INFO, "reload: moved interface %s from zone %s to zone %s",
+                        rif->ifname, old_rif->zone->name, rz->name);
+            ++*kept;
         }
     }
+}
 
-    r = 0;
-    end:
-    for (const struct reflection_zone *rz = options->rz_list6; rz; rz = rz->next) {
-        for (struct reflection_if *rif = rz->first_if; rif; rif = rif->next) {
-            close(rif->recv_fd);
-            close(rif->send_fd);
+/// Keep what was learned about interest in zones still present in `rz_list`; the empty tables are freed along with
+/// `old_rz_list`.
+static void adopt_interest(struct reflection_zone *rz_list, struct reflection_zone *old_rz_list) {
+    for (struct reflection_zone *rz = rz_list; rz; rz = rz->next) {
+        for (struct reflection_zone *old_rz = old_rz_list; rz->interest && old_rz; old_rz = old_rz->next) {
+            if (old_rz->interest && strcmp(old_rz->name, rz->name) == 0) {
+                struct interest_table *interest = rz->interest;
+                rz->interest = old_rz->interest;
+                old_rz->interest = interest;
+                break;
+            }
         }
     }
-    for (const struct reflection_zone *rz = options->rz_list4; rz; rz = rz->next) {
-        for (struct reflection_if *rif = rz->first_if; rif; rif = rif->next) {
-            close(rif->recv_fd);
-            close(rif->send_fd);
+}
+
+static int open_relay(struct mdns_reflector *reflector, struct relay *relay) {
+    char key[HANDOFF_KEY_MAX];
+    relay_handoff_key(relay, key);
+    if (!inherit_fds(reflector, key, &relay->fd, 1))
+        relay->fd = new_unicast_socket(&relay->local, SOCK_DGRAM);
+    if (relay->fd == -1)
+        return -1;
+    if (watch_fd(reflector, relay->fd, relay, false) == -1) {
+        close(relay->fd);
+        relay->fd = -1;
+        return -1;
+    }
+    char local[INET6_ADDRSTRLEN + 2 + 1 + 5 + 1 + 10];
+    snprintf(local, sizeof(local), "%s", sockaddr_storage_to_string(&relay->local));
+    log_msg(LOG_INFO, "relay %s: relaying zone %s between %s and %s", relay->name, relay->zone_name,
+            local, sockaddr_storage_to_string(&relay->peer));
+    return 0;
+}
+
+static int open_relays(struct mdns_reflector *reflector) {
+    for (struct relay *relay = reflector->options->relays; relay; relay = relay->next) {
+        if (open_relay(reflector, relay) == -1)
+            return -1;
+    }
+    return 0;
+}
+
+static void close_relays(struct relay *list) {
+    for (struct relay *relay = list; relay; relay = relay->next) {
+        if (relay->fd >= 0)
+            close(relay->fd);
+        relay->fd = -1;
+    }
+}
+
+/// Find the running relay that a relay of a new configuration can take over: same name and local address.
+static struct relay *find_kept_relay(struct relay *old_list, const struct relay *relay) {
+    for (struct relay *old = old_list; old; old = old->next) {
+        if (strcmp(old->name, relay->name) == 0 && sockaddr_equal(&old->local, &relay->local))
+            return old;
+    }
+    return NULL;
+}
+
+/// Open sockets for relays in `list` that can't take over a socket from the running `old_list`.
+static int open_added_relays(struct mdns_reflector *reflector, struct relay *list, struct relay *old_list,
+                             size_t *opened) {
+    for (struct relay *relay = list; relay; relay = relay->next) {
+        if (find_kept_relay(old_list, relay))
+            continue;
+        if (open_relay(reflector, relay) == -1)
+            return -1;
+        ++*opened;
+    }
+    return 0;
+}
+
+/// Move the sockets, counters and remembered fingerprints of kept relays over from the running `old_list`.
+static void adopt_kept_relays(struct mdns_reflector *reflector, struct relay *list, struct relay *old_list,
+                              size_t *kept) {
+    for (struct relay *relay = list; relay; relay = relay->next) {
+        struct relay *old = find_kept_relay(old_list, relay);
+        if (!old)
+            continue;
+        relay->fd = old->fd;
+        relay->stats = old->stats;
+        relay->fingerprints = old->fingerprints;
+        old->fd = -1;
+        watch_fd(reflector, relay->fd, relay, true);
+        ++*kept;
+    }
+}
+
+static int open_discovery(struct mdns_reflector *reflector, struct discovery *discovery) {
+    char key[HANDOFF_KEY_MAX];
+    discovery_handoff_key(discovery, key);
+    int fds[2];
+    if (inherit_fds(reflector, key, fds, 2)) {
+        discovery->udp_fd = fds[0];
+        discovery->tcp_fd = fds[1];
+    } else if ((discovery->udp_fd = new_unicast_socket(&discovery->listen, SOCK_DGRAM)) == -1) {
+        return -1;
+    } else {
+        discovery->tcp_fd = new_unicast_socket(&discovery->listen, SOCK_STREAM);
+    }
+    if (discovery->tcp_fd == -1 ||
+        watch_fd(reflector, discovery->udp_fd, &discovery->udp_fd, false) == -1 ||
+        watch_fd(reflector, discovery->tcp_fd, &discovery->tcp_fd, false) == -1) {
+        close(discovery->udp_fd);
+        if (discovery->tcp_fd >= 0)
+            close(discovery->tcp_fd);
+        discovery->udp_fd = discovery->tcp_fd = -1;
+        return -1;
+    }
+    log_msg(LOG_INFO, "discovery proxy %s: answering for %s from zone %s on %s", discovery->name,
+            discovery->domain_text, discovery->zone_name, sockaddr_storage_to_string(&discovery->listen));
+    return 0;
+}
+
+static int open_discoveries(struct mdns_reflector *reflector) {
+    for (struct discovery *discovery = reflector->options->discoveries; discovery; discovery = discovery->next) {
+        if (open_discovery(reflector, discovery) == -1)
+            return -1;
+    }
+    return 0;
+}
+
+static void close_discovery_conn(struct discovery_conn *conn) {
+    if (conn->fd >= 0)
+        close(conn->fd);
+    conn->fd = -1;
+    conn->len = 0;
+}
+
+static void close_discoveries(struct discovery *list) {
+    for (struct discovery *discovery = list; discovery; discovery = discovery->next) {
+        if (discovery->udp_fd >= 0)
+            close(discovery->udp_fd);
+        if (discovery->tcp_fd >= 0)
+            close(discovery->tcp_fd);
+        discovery->udp_fd = discovery->tcp_fd = -1;
+        for (size_t i = 0; i < DISCOVERY_TCP_CONNECTIONS_MAX; ++i)
+            close_discovery_conn(&discovery->conns[i]);
+    }
+}
+
+/// Close a TCP connection of a discovery proxy, along with the query parked for it if any.
+static void drop_discovery_conn(struct discovery *discovery, int conn) {
+    discovery_unpark_conn(discovery, conn);
+    close_discovery_conn(&discovery->conns[conn]);
+}
+
+/// Send a response of a discovery proxy, prefixed with its length over TCP. The response is in
+/// `reflector->response_buffer` after the two bytes reserved for the length.
+static void send_discovery_response(struct mdns_reflector *reflector, struct discovery *discovery, int conn,
+                                    const struct sockaddr_storage *client, size_t len) {
+    uint8_t *response = reflector->response_buffer;
+    if (conn >= 0) {
+        struct discovery_conn *c = &discovery->conns[conn];
+        response[0] = (uint8_t) (len >> 8);
+        response[1] = (uint8_t) len;
+        // Responses are small and the connection was just read from, so the socket buffer has room.
+        if (send(c->fd, response, len + 2, SEND_FLAGS) == -1)
+            log_err(LOG_INFO, "discovery proxy %s: send", discovery->name);
+        close_discovery_conn(c);
+        return;
+    }
+    if (sendto(discovery->udp_fd, response + 2, len, 0, (const struct sockaddr *) client, sockaddr_len(client)) == -1)
+        log_err(LOG_INFO, "discovery proxy %s: sendto %s", discovery->name, sockaddr_storage_to_string(client));
+}
+
+/// Answer parked queries of a discovery proxy whose wait has ended, or that the store can now answer.
+/// \param due_ns answer queries waiting until this time, in addition to those with an answer
+static void unpark_discovery_queries(struct mdns_reflector *reflector, struct discovery *discovery, uint64_t due_ns) {
+    uint64_t now = monotonic_ns();
+    for (size_t i = 0; i < DISCOVERY_PARKED_MAX; ++i) {
+        struct parked_query *parked = &discovery->parked[i];
+        if (!parked->used)
+            continue;
+        struct discovery_answer answer;
+        struct discovery_stats stats = discovery->stats;
+        if (discovery_answer(discovery, parked->query, parked->len, parked->conn >= 0, now,
+                             reflector->response_buffer + 2, sizeof(reflector->response_buffer) - 2, &answer) == -1)
+            answer.len = 0;
+        if (!discovery_parked_due(parked, &answer, due_ns)) {
+            discovery->stats = stats;
+            continue;
         }
+        parked->used = false;
+        if (answer.len)
+            send_discovery_response(reflector, discovery, parked->conn, &parked->client, answer.len);
+        else if (parked->conn >= 0)
+            close_discovery_conn(&discovery->conns[parked->conn]);
     }
-#if defined(EVFILT_READ)
-    close(kq);
-#elif defined(EPOLLIN)
-    close(epoll_fd);
+}
+
+/// Answer parked queries of a discovery proxy whose wait has ended and close its idle TCP connections, or all of them
+/// if `all` is set.
+static void flush_due_discovery(struct mdns_reflector *reflector, struct discovery *discovery, bool all,
+                                uint64_t now) {
+    unpark_discovery_queries(reflector, discovery, all ? UINT64_MAX : now);
+    for (size_t i = 0; i < DISCOVERY_TCP_CONNECTIONS_MAX; ++i) {
+        struct discovery_conn *conn = &discovery->conns[i];
+        if (conn->fd >= 0 && (all || conn->deadline_ns <= now))
+            drop_discovery_conn(discovery, (int) i);
+    }
+}
+
+/// Find the running discovery proxy that one of a new configuration can take over: same name and address.
+static struct discovery *find_kept_discovery(struct discovery *old_list, const struct discovery *discovery) {
+    for (struct discovery *old = old_list; old; old = old->next) {
+        if (strcmp(old->name, discovery->name) == 0 && sockaddr_equal(&old->listen, &discovery->listen))
+            return old;
+    }
+    return NULL;
+}
+
+/// Open sockets for discovery proxies in `list` that can't take over sockets from the running `old_list`.
+static int open_added_discoveries(struct mdns_reflector *reflector, struct discovery *list, struct discovery *old_list,
+                                  size_t *opened) {
+    for (struct discovery *discovery = list; discovery; discovery = discovery->next) {
+        if (find_kept_discovery(old_list, discovery))
+            continue;
+        if (open_discovery(reflector, discovery) == -1)
+            return -1;
+        ++*opened;
+    }
+    return 0;
+}
+
+/// Move the sockets, open connections, parked queries and counters of kept discovery proxies over from the running
+/// `old_list`.
+/// Learned records are kept too if the proxy still serves the same zone.
+static void adopt_kept_discoveries(struct mdns_reflector *reflector, struct discovery *list, struct discovery *old_list,
+                                   size_t *kept) {
+    for (struct discovery *discovery = list; discovery; discovery = discovery->next) {
+        struct discovery *old = find_kept_discovery(old_list, discovery);
+        if (!old)
+            continue;
+        discovery->udp_fd = old->udp_fd;
+        discovery->tcp_fd = old->tcp_fd;
+        old->udp_fd = old->tcp_fd = -1;
+        watch_fd(reflector, discovery->udp_fd, &discovery->udp_fd, true);
+        watch_fd(reflector, discovery->tcp_fd, &discovery->tcp_fd, true);
+        for (size_t i = 0; i < DISCOVERY_TCP_CONNECTIONS_MAX; ++i) {
+            discovery->conns[i] = old->conns[i];
+            old->conns[i].fd = -1;
+            if (discovery->conns[i].fd >= 0)
+                watch_fd(reflector, discovery->conns[i].fd, &discovery->conns[i], true);
+        }
+        // parked queries refer to connections by index, which stays the same
+        memcpy(discovery->parked, old->parked, sizeof(discovery->parked));
+        memset(old->parked, 0, sizeof(old->parked));
+        discovery->stats = old->stats;
+        if (strcmp(old->zone_name, discovery->zone_name) == 0 &&
+            old->store.max_records == discovery->store.max_records) {
+            // the empty store is freed along with the old proxy
+            struct record_store store = discovery->store;
+            discovery->store = old->store;
+            old->store = store;
+            memcpy(discovery->recent_queries, old->recent_queries, sizeof(discovery->recent_queries));
+        }
+        ++*kept;
+    }
+}
+
+static int open_ha(struct mdns_reflector *reflector, struct ha *ha) {
+    char key[HANDOFF_KEY_MAX];
+    ha_handoff_key(ha, key);
+    if (!inherit_fds(reflector, key, &ha->fd, 1))
+        ha->fd = new_unicast_socket(&ha->local, SOCK_DGRAM);
+    if (ha->fd == -1)
+        return -1;
+    if (watch_fd(reflector, ha->fd, ha, false) == -1) {
+        close(ha->fd);
+        ha->fd = -1;
+        return -1;
+    }
+    ha_start(ha, monotonic_ns());
+    char local[INET6_ADDRSTRLEN + 2 + 1 + 5 + 1 + 10];
+    snprintf(local, sizeof(local), "%s", sockaddr_storage_to_string(&ha->local));
+    log_msg(LOG_INFO, "ha: standby with priority %d, heartbeats between %s and %s", ha->priority, local,
+            sockaddr_storage_to_string(&ha->peer));
+    return 0;
+}
+
+static void close_ha(struct ha *ha) {
+    if (ha && ha->fd >= 0)
+        close(ha->fd);
+    if (ha)
+        ha->fd = -1;
+}
+
+/// \return whether a new pairing can take over the socket and state of the running one
+static bool ha_kept(const struct ha *ha, const struct ha *old) {
+    return ha && old && sockaddr_equal(&ha->local, &old->local);
+}
+
+/// Move the socket, state and counters of the running pairing over, so that a reload doesn't cause a failover.
+static void adopt_ha(struct mdns_reflector *reflector, struct ha *ha, struct ha *old) {
+    ha->fd = old->fd;
+    ha->state = old->state;
+    ha->started_ns = old->started_ns;
+    ha->next_heartbeat_ns = old->next_heartbeat_ns;
+    ha->seq = old->seq;
+    ha->stats = old->stats;
+    ha->synced = old->synced;
+    if (sockaddr_equal(&ha->peer, &old->peer)) {
+        ha->peer_seen = old->peer_seen;
+        ha->peer_heard_ns = old->peer_heard_ns;
+        ha->peer_state = old->peer_state;
+        ha->peer_priority = old->peer_priority;
+    }
+    old->fd = -1;
+    watch_fd(reflector, ha->fd, ha, true);
+}
+
+#if defined(__linux__)
+
+static int open_netlink_socket(void *ctx) {
+    (void) ctx;
+    int fd = socket(AF_NETLINK, SOCK_RAW | SOCK_NONBLOCK | SOCK_CLOEXEC, NETLINK_ROUTE);
+    if (fd == -1)
+        log_err(LOG_ERR, "netlink socket");
+    return fd;
+}
+
+/// Subscribe to link changes in a network namespace, to follow MTU changes and interfaces going away and coming back.
+static int open_link_monitor(struct mdns_reflector *reflector, const char *netns, unsigned int netns_slot) {
+    struct link_monitor *monitor = malloc(sizeof(struct link_monitor));
+    if (!monitor) {
+        log_err(LOG_ERR, "can't malloc");
+        return -1;
+    }
+    snprintf(monitor->netns, NETNS_NAME_MAX, "%s", netns);
+    monitor->netns_slot = netns_slot;
+    monitor->fd = netns_run(netns, open_netlink_socket, NULL);
+    if (monitor->fd == -1)
+        goto error;
+    struct sockaddr_nl sa = {
+            .nl_family = AF_NETLINK,
+            .nl_groups = RTMGRP_LINK,
+    };
+    if (bind(monitor->fd, (struct sockaddr *) &sa, sizeof(sa)) == -1) {
+        log_err(LOG_ERR, "netlink bind");
+        goto error;
+    }
+    if (watch_fd(reflector, monitor->fd, monitor, false) == -1)
+        goto error;
+    // the slot must not stand for another namespace while the monitor is open
+    netns_retain(netns_slot);
+    monitor->next = reflector->link_monitors;
+    reflector->link_monitors = monitor;
+    return 0;
+    error:
+    if (monitor->fd >= 0)
+        close(monitor->fd);
+    free(monitor);
+    return -1;
+}
+
+static bool has_netns_ifs(const struct reflection_zone *rz_list, unsigned int netns_slot) {
+    for (const struct reflection_zone *rz = rz_list; rz; rz = rz->next) {
+        for (const struct reflection_if *rif = rz->first_if; rif; rif = rif->next) {
+            if (rif->netns_slot == netns_slot)
+                return true;
+        }
+    }
+    return false;
+}
+
+static struct link_monitor *find_link_monitor(const struct mdns_reflector *reflector, unsigned int netns_slot) {
+    for (struct link_monitor *monitor = reflector->link_monitors; monitor; monitor = monitor->next) {
+        if (monitor->netns_slot == netns_slot)
+            return monitor;
+    }
+    return NULL;
+}
+
+/// Monitor links in our own network namespace and in each other one with reflected interfaces, and stop monitoring
+/// namespaces without.
+/// \return 0 on success or -1 if a namespace can't be monitored
+static int sync_link_monitors(struct mdns_reflector *reflector) {
+    const struct options *options = reflector->options;
+    for (struct link_monitor **p = &reflector->link_monitors; *p;) {
+        struct link_monitor *monitor = *p;
+        if (!monitor->netns_slot || has_netns_ifs(options->rz_list6, monitor->netns_slot) ||
+            has_netns_ifs(options->rz_list4, monitor->netns_slot)) {
+            p = &monitor->next;
+            continue;
+        }
+        *p = monitor->next;
+        close(monitor->fd);
+        netns_release(monitor->netns_slot);
+        free(monitor);
+    }
+    int r = 0;
+    if (!find_link_monitor(reflector, 0) && open_link_monitor(reflector, "", 0) == -1)
+        r = -1;
+    const struct reflection_zone *lists[] = {options->rz_list6, options->rz_list4};
+    for (size_t i = 0; i < 2; ++i) {
+        for (const struct reflection_zone *rz = lists[i]; rz; rz = rz->next) {
+            for (const struct reflection_if *rif = rz->first_if; rif; rif = rif->next) {
+                if (!find_link_monitor(reflector, rif->netns_slot) &&
+                    open_link_monitor(reflector, rif->netns, rif->netns_slot) == -1)
+                    r = -1;
+            }
+        }
+    }
+    return r;
+}
+
+static void update_mtu(const struct reflection_zone *rz_list, unsigned int netns_slot, unsigned int ifindex, int mtu,
+                       int family) {
+    for (const struct reflection_zone *rz = rz_list; rz; rz = rz->next) {
+        for (struct reflection_if *rif = rz->first_if; rif; rif = rif->next) {
+            if (rif->netns_slot != netns_slot || rif->ifindex != ifindex || rif->recv_fd < 0 || rif->mtu == mtu)
+                continue;
+            log_msg(LOG_NOTICE, "MTU of interface %s changed from %d to %d", rif->ifname, rif->mtu, mtu);
+            set_mtu(rif, mtu, family);
+        }
+    }
+}
+
+static void reread_mtus(const struct reflection_zone *rz_list, unsigned int netns_slot, int family) {
+    for (const struct reflection_zone *rz = rz_list; rz; rz = rz->next) {
+        for (struct reflection_if *rif = rz->first_if; rif; rif = rif->next) {
+            if (rif->netns_slot == netns_slot && rif->recv_fd >= 0)
+                setup_mtu(rif, family);
+        }
+    }
+}
+
+/// Close the interfaces on a link that went away. They are opened again when a link with their name comes back.
+static void unplug_ifs(struct mdns_reflector *reflector, unsigned int netns_slot, unsigned int ifindex) {
+    const struct options *options = reflector->options;
+    const struct reflection_zone *lists[] = {options->rz_list6, options->rz_list4};
+    bool quiesced = false;
+    for (size_t i = 0; i < 2; ++i) {
+        for (const struct reflection_zone *rz = lists[i]; rz; rz = rz->next) {
+            for (struct reflection_if *rif = rz->first_if; rif; rif = rif->next) {
+                if (rif->netns_slot != netns_slot || rif->ifindex != ifindex || rif->recv_fd < 0)
+                    continue;
+                // transmit threads must be done with the interface; responses aggregated for it are dropped
+                if (reflector->pipeline && !quiesced)
+                    pipeline_quiesce(reflector->pipeline);
+                quiesced = true;
+                close_reflection_if(rif);
+                log_msg(LOG_NOTICE, "interface %s went away; waiting for it to come back", rif->ifname);
+            }
+        }
+    }
+}
+
+/// Open the closed interfaces named `device` again, now that a link with that name exists.
+static void plug_ifs(struct mdns_reflector *reflector, unsigned int netns_slot, unsigned int ifindex,
+                     const char *device) {
+    const struct options *options = reflector->options;
+    const struct reflection_zone *lists[] = {options->rz_list6, options->rz_list4};
+    const int families[] = {AF_INET6, AF_INET};
+    struct netns_iftables iftables = {0};
+    for (size_t i = 0; i < 2; ++i) {
+        for (const struct reflection_zone *rz = lists[i]; rz; rz = rz->next) {
+            for (struct reflection_if *rif = rz->first_if; rif; rif = rif->next) {
+                if (rif->netns_slot != netns_slot || rif->recv_fd >= 0 || strcmp(rif->device, device) != 0)
+                    continue;
+                if (ifindex >= IFINDEX_LIMIT) {
+                    log_msg(LOG_WARNING, "can't open interface %s again: index %u is not below %u", rif->ifname,
+                            ifindex, IFINDEX_LIMIT);
+                    continue;
+                }
+                // the address of the link it replaces may be gone
+                const struct netns_iftable *table;
+                const struct iftable_entry *entry = netns_iftables_find(&iftables, rif->ifname, &table);
+                rif->has_addr4 = entry && entry->ifindex == ifindex && entry->has_addr4;
+                if (rif->has_addr4)
+                    rif->addr4 = entry->addr4;
+                rif->has_addr6 = entry && entry->ifindex == ifindex && entry->has_addr6;
+                if (rif->has_addr6)
+                    rif->addr6 = entry->addr6;
+                rif->ifindex = ifindex;
+                if (open_reflection_if(reflector, rif, families[i]) == -1) {
+                    log_msg(LOG_WARNING, "can't open interface %s again", rif->ifname);
+                    continue;
+                }
+                log_msg(LOG_NOTICE, "interface %s came back", rif->ifname);
+            }
+        }
+    }
+    netns_iftables_free(&iftables);
+}
+
+/// Ask for all links of a namespace, after notifications were lost, to open interfaces that came back meanwhile.
+static void request_links(const struct link_monitor *monitor) {
+    struct {
+        struct nlmsghdr nh;
+        struct ifinfomsg ifi;
+    } request = {
+            .nh = {
+                    .nlmsg_len = sizeof(request),
+                    .nlmsg_type = RTM_GETLINK,
+                    .nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP,
+            },
+            .ifi.ifi_family = AF_UNSPEC,
+    };
+    if (send(monitor->fd, &request, sizeof(request), 0) == -1)
+        log_err(LOG_WARNING, "netlink send");
+}
+
+/// Apply the pending link change notifications of a network namespace: follow MTU changes, close interfaces whose link
+/// went away and open them again when a link with their name comes back.
+static void receive_link_updates(struct mdns_reflector *reflector, const struct link_monitor *monitor) {
+    const struct options *options = reflector->options;
+    uint8_t *buf = reflector->datagram_buffer;
+    for (;;) {
+        ssize_t len = recv(monitor->fd, buf, sizeof(reflector->datagram_buffer), 0);
+        if (len == -1) {
+            if (errno == ENOBUFS) {
+                // notifications were lost; ask the interfaces and the kernel directly
+                log_msg(LOG_INFO, "netlink notifications overrun; re-reading interface MTUs and links");
+                reread_mtus(options->rz_list6, monitor->netns_slot, AF_INET6);
+                reread_mtus(options->rz_list4, monitor->netns_slot, AF_INET);
+                request_links(monitor);
+                continue;
+            }
+            if (errno != EWOULDBLOCK)
+                log_err(LOG_WARNING, "netlink recv");
+            return;
+        }
+        size_t remaining = (size_t) len;
+        for (const struct nlmsghdr *nh = (const struct nlmsghdr *) buf; NLMSG_OK(nh, remaining);
+             nh = NLMSG_NEXT(nh, remaining)) {
+            if (nh->nlmsg_type != RTM_NEWLINK && nh->nlmsg_type != RTM_DELLINK)
+                continue;
+            if (nh->nlmsg_len < NLMSG_LENGTH(sizeof(struct ifinfomsg)))
+                continue;
+            const struct ifinfomsg *ifi = NLMSG_DATA(nh);
+            unsigned int ifindex = (unsigned int) ifi->ifi_index;
+            if (nh->nlmsg_type == RTM_DELLINK) {
+                unplug_ifs(reflector, monitor->netns_slot, ifindex);
+                continue;
+            }
+            size_t attrs_len = nh->nlmsg_len - NLMSG_LENGTH(sizeof(*ifi));
+            for (const struct rtattr *rta = IFLA_RTA(ifi); RTA_OK(rta, attrs_len); rta = RTA_NEXT(rta, attrs_len)) {
+                if (rta->rta_type == IFLA_MTU && RTA_PAYLOAD(rta) >= sizeof(uint32_t)) {
+                    uint32_t mtu;
+                    memcpy(&mtu, RTA_DATA(rta), sizeof(mtu));
+                    update_mtu(options->rz_list6, monitor->netns_slot, ifindex, (int) mtu, AF_INET6);
+                    update_mtu(options->rz_list4, monitor->netns_slot, ifindex, (int) mtu, AF_INET);
+                } else if (rta->rta_type == IFLA_IFNAME && RTA_PAYLOAD(rta) <= IF_NAMESIZE &&
+                           memchr(RTA_DATA(rta), '\0', RTA_PAYLOAD(rta))) {
+                    plug_ifs(reflector, monitor->netns_slot, ifindex, RTA_DATA(rta));
+                }
+            }
+        }
+    }
+}
+
+static bool has_listener_aware_ifs(const struct reflection_zone *rz_list) {
+    for (const struct reflection_zone *rz = rz_list; rz; rz = rz->next) {
+        for (const struct reflection_if *rif = rz->first_if; rif; rif = rif->next) {
+            if (rif->listener_aware)
+                return true;
+        }
+    }
+    return false;
+}
+
+/// Open a raw socket receiving IGMP or MLD reports.
+/// \return the socket, or -1 on error
+static int open_listener_socket(int family) {
+    const int ON = 1;
+    int fd = socket(family, SOCK_RAW | SOCK_NONBLOCK | SOCK_CLOEXEC, family == AF_INET6 ? IPPROTO_ICMPV6 : IPPROTO_IGMP);
+    if (fd == -1)
+        return -1;
+    if (family == AF_INET6) {
+        struct icmp6_filter filter;
+        ICMP6_FILTER_SETBLOCKALL(&filter);
+        ICMP6_FILTER_SETPASS(LISTENER_MLD_REPORT, &filter);
+        ICMP6_FILTER_SETPASS(LISTENER_MLD_V2_REPORT, &filter);
+        if (setsockopt(fd, IPPROTO_ICMPV6, ICMP6_FILTER, &filter, sizeof(filter)) == -1)
+            goto error;
+    } else if (setsockopt(fd, IPPROTO_IP, IP_PKTINFO, &ON, sizeof(ON)) == -1) {
+        goto error;
+    }
+    return fd;
+    error:
+    close(fd);
+    return -1;
+}
+
+/// Watch IGMP or MLD reports on the interfaces with listener awareness, opening the raw socket if needed. Version 3
+/// IGMP and version 2 MLD reports are sent to a group of their own, which is joined on those interfaces; earlier
+/// versions are sent to the reported group, which the reflection sockets joined already.
+/// Without the privilege to open raw sockets, listeners are only inferred from traffic.
+static void open_listener_monitor(struct mdns_reflector *reflector, int family) {
+    const struct reflection_zone *rz_list = family == AF_INET6 ? reflector->options->rz_list6
+                                                                : reflector->options->rz_list4;
+    int *fd = family == AF_INET6 ? &reflector->mld_fd : &reflector->igmp_fd;
+    const char *name = family == AF_INET6 ? "MLD" : "IGMP";
+    if (!has_listener_aware_ifs(rz_list))
+        return;
+    if (*fd < 0) {
+        *fd = open_listener_socket(family);
+        if (*fd < 0) {
+            log_err(LOG_WARNING, "can't receive %s reports; inferring listeners from traffic only", name);
+            return;
+        }
+        if (watch_fd(reflector, *fd, fd, false) == -1) {
+            close(*fd);
+            *fd = -1;
+            return;
+        }
+    }
+    struct sockaddr_storage group = {0};
+    socklen_t group_len;
+    if (family == AF_INET6) {
+        struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *) &group;
+        sin6->sin6_family = AF_INET6;
+        inet_pton(AF_INET6, "ff02::16", &sin6->sin6_addr);
+        group_len = sizeof(*sin6);
+    } else {
+        struct sockaddr_in *sin = (struct sockaddr_in *) &group;
+        sin->sin_family = AF_INET;
+        inet_pton(AF_INET, "224.0.0.22", &sin->sin_addr);
+        group_len = sizeof(*sin);
+    }
+    for (const struct reflection_zone *rz = rz_list; rz; rz = rz->next) {
+        for (const struct reflection_if *rif = rz->first_if; rif; rif = rif->next) {
+            // interfaces carrying several protocols, and interfaces kept across a reload, are joined already
+            if (rif->listener_aware &&
+                mcast_join(*fd, &group, group_len, rif->ifindex, rif->has_addr4 ? &rif->addr4 : NULL) == -1 &&
+                errno != EADDRINUSE)
+                log_err(LOG_WARNING, "can't receive %s reports on interface %s", name, rif->ifname);
+        }
+    }
+}
+
+/// Check whether a report received on an interface was sent by this host, whose own reports are looped back.
+/// Reports are sent from the primary IPv4 or the link-local IPv6 address of the interface, as cached when it was
+/// opened.
+static bool is_own_report(const struct reflection_if *rif, const struct sockaddr_storage *source) {
+    if (source->ss_family == AF_INET6)
+        return rif->has_addr6 && memcmp(&rif->addr6, &((const struct sockaddr_in6 *) source)->sin6_addr,
+                                        sizeof(struct in6_addr)) == 0;
+    return rif->has_addr4 && rif->addr4.s_addr == ((const struct sockaddr_in *) source)->sin_addr.s_addr;
+}
+
+/// Note a host listening to a group on an interface.
+/// \param group address of the group, `struct in_addr` or `struct in6_addr` by the family of `source`
+/// \param source sender of the report
+static void note_listener(struct mdns_reflector *reflector, unsigned int ifindex, const void *group,
+                          const struct sockaddr_storage *source, uint64_t now) {
+    int family = source->ss_family;
+    const struct reflection_zone *rz_list = family == AF_INET6 ? reflector->options->rz_list6
+                                                                : reflector->options->rz_list4;
+    for (const struct reflection_zone *rz = rz_list; rz; rz = rz->next) {
+        for (struct reflection_if *rif = rz->first_if; rif; rif = rif->next) {
+            if (!rif->listener_aware || rif->ifindex != ifindex)
+                continue;
+            bool match = family == AF_INET6 ?
+                         memcmp(&((const struct sockaddr_in6 *) &rif->group)->sin6_addr, group,
+                                sizeof(struct in6_addr)) == 0 :
+                         memcmp(&((const struct sockaddr_in *) &rif->group)->sin_addr, group,
+                                sizeof(struct in_addr)) == 0;
+            if (!match)
+                continue;
+            if (is_own_report(rif, source))
+                continue;
+            if (!reflection_if_has_listeners(rif, now, (uint64_t) reflector->options->listener_timeout_sec *
+                                                         1000000000u)) {
+                char address[INET6_ADDRSTRLEN];
+                const void *addr = family == AF_INET6 ? (const void *) &((const struct sockaddr_in6 *) source)->sin6_addr
+                                                      : (const void *) &((const struct sockaddr_in *) source)->sin_addr;
+                log_msg(LOG_INFO, "%s listener %s appeared on interface %s", rif->protocol->name,
+                        inet_ntop(family, addr, address, sizeof(address)) ? address : "?", rif->ifname);
+            }
+            rif->listener_seen_ns = now;
+            rif->stats.listener_reports++;
+        }
+    }
+}
+
+/// Receive pending IGMP or MLD reports and note the listeners they announce.
+static void receive_listener_reports(struct mdns_reflector *reflector, int family) {
+    int fd = family == AF_INET6 ? reflector->mld_fd : reflector->igmp_fd;
+    uint8_t *buf = reflector->datagram_buffer;
+    struct sockaddr_storage source;
+    char cmbuf[0x100];
+    struct iovec iov = {
+            .iov_base = buf,
+            .iov_len = sizeof(reflector->datagram_buffer),
+    };
+    struct msghdr mh = {
+            .msg_name = &source,
+            .msg_iov = &iov,
+            .msg_iovlen = 1,
+            .msg_control = cmbuf,
+    };
+    for (;;) {
+        mh.msg_namelen = sizeof(source);
+        mh.msg_controllen = sizeof(cmbuf);
+        ssize_t len = recvmsg(fd, &mh, 0);
+        if (len == -1) {
+            if (errno != EWOULDBLOCK)
+                log_err(LOG_WARNING, "%s recvmsg", family == AF_INET6 ? "MLD" : "IGMP");
+            return;
+        }
+        // MLD reports are sent from link-local addresses, whose scope is the interface.
+        unsigned int ifindex = family == AF_INET6 ? ((const struct sockaddr_in6 *) &source)->sin6_scope_id : 0;
+        for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&mh); cmsg; cmsg = CMSG_NXTHDR(&mh, cmsg)) {
+            if (cmsg->cmsg_level == IPPROTO_IP && cmsg->cmsg_type == IP_PKTINFO) {
+                struct in_pktinfo info;
+                memcpy(&info, CMSG_DATA(cmsg), sizeof(info));
+                ifindex = (unsigned int) info.ipi_ifindex;
+            }
+        }
+        if (!ifindex || source.ss_family != family)
+            continue;
+        uint64_t now = monotonic_ns();
+        if (family == AF_INET6) {
+            struct in6_addr groups[LISTENER_GROUPS_MAX];
+            size_t n = mld_joined_groups(buf, (size_t) len, groups, LISTENER_GROUPS_MAX);
+            for (size_t i = 0; i < n; ++i)
+                note_listener(reflector, ifindex, &groups[i], &source, now);
+        } else {
+            // raw IPv4 sockets receive the IP header
+            size_t header_len = len > 0 ? (size_t) (buf[0] & 0xf) * 4 : 0;
+            if ((size_t) len < header_len)
+                continue;
+            struct in_addr groups[LISTENER_GROUPS_MAX];
+            size_t n = igmp_joined_groups(buf + header_len, (size_t) len - header_len, groups, LISTENER_GROUPS_MAX);
+            for (size_t i = 0; i < n; ++i)
+                note_listener(reflector, ifindex, &groups[i], &source, now);
+        }
+    }
+}
+
+#endif
+
+/// Spread interfaces over the transmit threads of the pipelined mode.
+static void assign_tx_queues(struct mdns_reflector *reflector) {
+    unsigned int next = 0;
+    const struct reflection_zone *lists[] = {reflector->options->rz_list6, reflector->options->rz_list4};
+    for (size_t i = 0; i < 2; ++i) {
+        for (const struct reflection_zone *rz = lists[i]; rz; rz = rz->next) {
+            for (struct reflection_if *rif = rz->first_if; rif; rif = rif->next)
+                rif->tx_queue = next++;
+        }
+    }
+}
+
+static size_t count_open_ifs(const struct reflection_zone *rz_list) {
+    size_t n = 0;
+    for (const struct reflection_zone *rz = rz_list; rz; rz = rz->next) {
+        for (const struct reflection_if *rif = rz->first_if; rif; rif = rif->next) {
+            if (rif->recv_fd >= 0)
+                ++n;
+        }
+    }
+    return n;
+}
+
+/// Reload the configuration file and apply the difference to the running reflection zones.
+/// Interfaces present in both the running and the new configuration keep their sockets and group memberships,
+/// so reflection on them is not interrupted. On error, the running configuration is left untouched.
+/// \return 0 on success or -1 on error
+static int reload_config(struct mdns_reflector *reflector) {
+    struct options *options = reflector->options;
+    struct options new_options = *options->base;
+    new_options.base = options->base;
+    log_msg(LOG_WARNING, "reloading configuration from %s", options->config_file);
+    if (load_config(options->config_file, &new_options) == -1 ||
+        (!new_options.ipv4_only && !check_reflection_zone(new_options.rz_list6)) ||
+        (!new_options.ipv6_only && !check_reflection_zone(new_options.rz_list4))) {
+        log_msg(LOG_ERR, "reload: invalid configuration; keeping the running configuration");
+        netns_free_reflection_zones(new_options.rz_list6);
+        netns_free_reflection_zones(new_options.rz_list4);
+        free_rewrite_classes(new_options.rewrite_classes);
+        free_relays(new_options.relays);
+        free_discoveries(new_options.discoveries);
+        free_ha(new_options.ha);
+        return -1;
+    }
+
+    // Phase 1: open added interfaces, relays, discovery proxies and the HA socket. This is the only step that can
+    // fail.
+    size_t opened = 0, kept = 0, relays_opened = 0, relays_kept = 0, proxies_opened = 0, proxies_kept = 0;
+    if (open_added_ifs(reflector, new_options.rz_list6, options->rz_list6, AF_INET6, &opened) == -1 ||
+        open_added_ifs(reflector, new_options.rz_list4, options->rz_list4, AF_INET, &opened) == -1 ||
+        open_added_relays(reflector, new_options.relays, options->relays, &relays_opened) == -1 ||
+        open_added_discoveries(reflector, new_options.discoveries, options->discoveries, &proxies_opened) == -1 ||
+        (new_options.ha && !ha_kept(new_options.ha, options->ha) && open_ha(reflector, new_options.ha) == -1)) {
+        log_msg(LOG_ERR, "reload: failed to open new interfaces, relays, discovery proxies or the HA socket; "
+                         "keeping the running configuration");
+        close_reflection_zones(new_options.rz_list6);
+        close_reflection_zones(new_options.rz_list4);
+        close_relays(new_options.relays);
+        close_discoveries(new_options.discoveries);
+        close_ha(new_options.ha);
+        netns_free_reflection_zones(new_options.rz_list6);
+        netns_free_reflection_zones(new_options.rz_list4);
+        free_rewrite_classes(new_options.rewrite_classes);
+        free_relays(new_options.relays);
+        free_discoveries(new_options.discoveries);
+        free_ha(new_options.ha);
+        return -1;
+    }
+
+    // Phase 2: take over sockets of kept interfaces, relays and discovery proxies, and close removed ones. Removed
+    // discovery proxies answer their parked queries first.
+    uint64_t now = monotonic_ns();
+    for (struct discovery *old = options->discoveries; old; old = old->next) {
+        if (!find_kept_discovery(new_options.discoveries, old))
+            flush_due_discovery(reflector, old, true, now);
+    }
+    adopt_kept_ifs(reflector, new_options.rz_list6, options->rz_list6, AF_INET6, &kept);
+    adopt_kept_ifs(reflector, new_options.rz_list4, options->rz_list4, AF_INET, &kept);
+    adopt_interest(new_options.rz_list6, options->rz_list6);
+    adopt_interest(new_options.rz_list4, options->rz_list4);
+    adopt_kept_relays(reflector, new_options.relays, options->relays, &relays_kept);
+    adopt_kept_discoveries(reflector, new_options.discoveries, options->discoveries, &proxies_kept);
+    if (ha_kept(new_options.ha, options->ha))
+        adopt_ha(reflector, new_options.ha, options->ha);
+    size_t closed = count_open_ifs(options->rz_list6) + count_open_ifs(options->rz_list4);
+    close_reflection_zones(options->rz_list6);
+    close_reflection_zones(options->rz_list4);
+    close_relays(options->relays);
+    close_discoveries(options->discoveries);
+    close_ha(options->ha);
+    netns_free_reflection_zones(options->rz_list6);
+    netns_free_reflection_zones(options->rz_list4);
+    free_rewrite_classes(options->rewrite_classes);
+    free_relays(options->relays);
+    free_discoveries(options->discoveries);
+    free_ha(options->ha);
+
+    if (reflector->pipeline && (new_options.tx_threads != options->tx_threads ||
+                                new_options.tx_ring_size != options->tx_ring_size))
+        log_msg(LOG_WARNING, "reload: tx_threads and tx_ring_size take effect on restart");
+    *options = new_options;
+    log_setlevel(options->log_level);
+    pair_dual_stack_ifs(options->rz_list6, options->rz_list4);
+#if defined(__linux__)
+    // interfaces in namespaces that can't be monitored are still reflected, only not followed
+    sync_link_monitors(reflector);
+    open_listener_monitor(reflector, AF_INET6);
+    open_listener_monitor(reflector, AF_INET);
+#endif
+    if (reflector->pipeline)
+        assign_tx_queues(reflector);
+    log_msg(LOG_WARNING, "configuration reloaded: %zu interface(s) opened, %zu kept, %zu closed",
+            opened, kept, closed);
+    if (relays_opened || relays_kept)
+        log_msg(LOG_WARNING, "relays reloaded: %zu opened, %zu kept", relays_opened, relays_kept);
+    if (proxies_opened || proxies_kept)
+        log_msg(LOG_WARNING, "discovery proxies reloaded: %zu opened, %zu kept", proxies_opened, proxies_kept);
+    return 0;
+}
+
+/// Ancillary data of a received packet.
+struct recv_info {
+    bool has_rxq_ovfl;
+    uint32_t rxq_ovfl;
+    bool has_timestamp;
+    uint64_t timestamp_ns;
+    /// IP TTL or hop limit, or -1 if unknown
+    int ttl;
+};
+
+static void parse_recv_info(struct msghdr *mh, struct recv_info *info) {
+    memset(info, 0, sizeof(*info));
+    info->ttl = -1;
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(mh); cmsg; cmsg = CMSG_NXTHDR(mh, cmsg)) {
+        if (cmsg->cmsg_level == IPPROTO_IPV6 && cmsg->cmsg_type == IPV6_HOPLIMIT) {
+            memcpy(&info->ttl, CMSG_DATA(cmsg), sizeof(info->ttl));
+            continue;
+        }
+#if defined(__linux__)
+        if (cmsg->cmsg_level == IPPROTO_IP && cmsg->cmsg_type == IP_TTL) {
+            memcpy(&info->ttl, CMSG_DATA(cmsg), sizeof(info->ttl));
+            continue;
+        }
+#else
+        if (cmsg->cmsg_level == IPPROTO_IP && cmsg->cmsg_type == IP_RECVTTL) {
+            // BSDs deliver the TTL as a single byte
+            info->ttl = *(const unsigned char *) CMSG_DATA(cmsg);
+            continue;
+        }
+#endif
+        if (cmsg->cmsg_level != SOL_SOCKET)
+            continue;
+        switch (cmsg->cmsg_type) {
+#if defined(SO_RXQ_OVFL)
+            case SO_RXQ_OVFL:
+                memcpy(&info->rxq_ovfl, CMSG_DATA(cmsg), sizeof(info->rxq_ovfl));
+                info->has_rxq_ovfl = true;
+                break;
+#endif
+#if defined(SCM_TIMESTAMPNS)
+            case SCM_TIMESTAMPNS: {
+                struct timespec ts;
+                memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+                info->timestamp_ns = timespec_to_ns(&ts);
+                info->has_timestamp = true;
+                break;
+            }
+#elif defined(SCM_TIMESTAMP)
+            case SCM_TIMESTAMP: {
+                struct timeval tv;
+                memcpy(&tv, CMSG_DATA(cmsg), sizeof(tv));
+                info->timestamp_ns = (uint64_t) tv.tv_sec * 1000000000u + (uint64_t) tv.tv_usec * 1000u;
+                info->has_timestamp = true;
+                break;
+            }
+#endif
+            default:
+                break;
+        }
+    }
+}
+
+/// Account packets dropped by the kernel since the last received packet, and grow the receive buffer if enabled.
+static void check_kernel_drops(const struct options *options, struct reflection_if *rif,
+                               const struct recv_info *info) {
+    if (!info->has_rxq_ovfl || info->rxq_ovfl == rif->stats.rxq_ovfl)
+        return;
+    uint32_t dropped = info->rxq_ovfl - rif->stats.rxq_ovfl;
+    rif->stats.rxq_ovfl = info->rxq_ovfl;
+    rif->stats.kernel_drops += dropped;
+    log_msg(LOG_INFO, "kernel dropped %u packet(s) on interface %s (receive queue %d bytes)",
+            dropped, rif->ifname, sockbuf_queued(rif->recv_fd, false));
+    if (options->adaptive_buffers &&
+        sockbuf_grow(rif->recv_fd, SO_RCVBUF, &rif->stats.rcvbuf, options->rcvbuf_max)) {
+        rif->stats.rcvbuf_grows++;
+        log_msg(LOG_INFO, "receive buffer of interface %s grown to %d bytes", rif->ifname, rif->stats.rcvbuf);
+    }
+}
+
+/// Get the form of the current packet to send to an interface, rewriting it once per destination class.
+/// \return the variant, or NULL if the original packet should be sent
+static const struct rewrite_variant *get_rewrite_variant(struct mdns_reflector *reflector,
+                                                         const struct rewrite_class *rc, const uint8_t *packet,
+                                                         size_t len) {
+    struct rewrite_variant *variant = &reflector->rewrite_variants[rc->index];
+    if (variant->seq != reflector->packet_seq) {
+        variant->seq = reflector->packet_seq;
+        variant->len = rewrite_message(rc, packet, len, variant->buf, sizeof(variant->buf), &variant->dropped);
+        if (variant->len)
+            log_msg(LOG_DEBUG, "rewrote packet for class %s: %zu -> %zu bytes, %u record(s) dropped",
+                    rc->name, len, variant->len, variant->dropped);
+    }
+    return variant->len ? variant : NULL;
+}
+
+/// Send a packet through the send socket of an interface.
+/// \return 0 if sent, 1 if dropped because the send queue is full, or -1 on error
+static int send_packet(const struct options *options, struct reflection_if *rif, const void *buf, size_t len,
+                       const struct sockaddr *dst, socklen_t dst_len) {
+    if (sendto(rif->send_fd, buf, len, 0, dst, dst_len) == -1) {
+        if (errno == EWOULDBLOCK || errno == ENOBUFS) {
+            // send queue overwhelmed; skipping
+            PROBE3(send_would_block, rif->ifname, len, errno);
+            stats_add(&rif->stats.tx_dropped, 1);
+            int sndbuf = atomic_load_explicit(&rif->stats.sndbuf, memory_order_relaxed);
+            if (options->adaptive_buffers && sockbuf_grow(rif->send_fd, SO_SNDBUF, &sndbuf, options->sndbuf_max)) {
+                atomic_store_explicit(&rif->stats.sndbuf, sndbuf, memory_order_relaxed);
+                stats_add(&rif->stats.sndbuf_grows, 1);
+                log_msg(LOG_INFO, "send queue of interface %s overflowed; send buffer grown to %d bytes",
+                        rif->ifname, sndbuf);
+            }
+            return 1;
+        }
+        if (errno == ENODEV || errno == ENXIO || errno == ENETDOWN) {
+            // the link is down or went away; the link monitor closes the interface in the latter case
+            stats_add(&rif->stats.tx_dropped, 1);
+            log_err(LOG_INFO, "can't send to interface %s", rif->ifname);
+            return 1;
+        }
+        log_err(LOG_ERR, "sendto");
+        return -1;
+    }
+    PROBE3(packet_sent, rif->ifname, len, (int) dst->sa_family);
+    stats_add(&rif->stats.tx_packets, 1);
+    stats_add(&rif->stats.tx_bytes, len);
+    return 0;
+}
+
+/// Send a packet from the event loop, or queue it for the transmit thread of the interface in the pipelined mode.
+/// \return 0 if sent or queued, 1 if dropped, or -1 on error
+static int transmit(struct mdns_reflector *reflector, struct reflection_if *rif, const void *buf, size_t len,
+                    const struct sockaddr *dst, socklen_t dst_len) {
+    // responses aggregated for an interface may be due after its link went away
+    if (rif->send_fd < 0) {
+        stats_add(&rif->stats.tx_dropped, 1);
+        return 1;
+    }
+    if (reflector->pipeline) {
+        enum pipeline_submit_result result = pipeline_submit(reflector->pipeline, rif, buf, len, dst, dst_len);
+        if (result != PIPELINE_QUEUED) {
+            PROBE3(packet_dropped, rif->ifname, len, result == PIPELINE_RING_FULL ? "ring_full" :
+                                                      result == PIPELINE_TOO_LARGE ? "too_large" : "pool_empty");
+            stats_add(&rif->stats.tx_dropped, 1);
+            return 1;
+        }
+        return 0;
+    }
+    return send_packet(reflector->options, rif, buf, len, dst, dst_len);
+}
+
+/// Send a packet queued in the pipelined mode; runs on a transmit thread. Errors are logged by send_packet().
+static void transmit_queued(void *ctx, struct reflection_if *rif, const uint8_t *buf, size_t len,
+                            const struct sockaddr *dst, socklen_t dst_len) {
+    const struct mdns_reflector *reflector = ctx;
+    send_packet(reflector->options, rif, buf, len, dst, dst_len);
+}
+
+/// Send a packet as unicast copies to the hosts learned on an interface.
+/// On Wi-Fi, multicast frames go out at the lowest basic rate; a few unicast copies take less airtime.
+/// \param dropped set to whether every copy was dropped if sent as unicast
+/// \return 1 if sent as unicast, 0 if it should be sent as multicast, or -1 on error
+static int send_to_hosts(struct mdns_reflector *reflector, struct reflection_if *rif, const void *buf, size_t len,
+                         bool *dropped) {
+    const struct options *options = reflector->options;
+    size_t nhosts = host_table_expire(rif->hosts, monotonic_ns(), (uint64_t) options->host_timeout_sec * 1000000000u);
+    if (!nhosts || nhosts > (size_t) options->unicast_max_hosts) {
+        rif->stats.multicast_fallbacks++;
+        return 0;
+    }
+    *dropped = true;
+    for (size_t i = 0; i < nhosts; ++i) {
+        const struct learned_host *host = &rif->hosts->hosts[i];
+        log_msg(LOG_DEBUG, "sending unicast copy to %s",
+                sockaddr_storage_to_string((const struct sockaddr_storage *) &host->addr));
+        int r = transmit(reflector, rif, buf, len, &host->addr.sa, learned_host_len(host));
+        if (r == -1)
+            return -1;
+        if (r == 0) {
+            rif->stats.unicast_copies++;
+            *dropped = false;
+        }
+    }
+    if (!*dropped)
+        rif->stats.unicast_packets++;
+    return 1;
+}
+
+/// Send a packet to a destination interface: as unicast copies to its hosts if enabled and possible,
+/// or to the mDNS group otherwise.
+/// \return 0 if sent or queued, 1 if dropped, or -1 on error
+static int deliver(struct mdns_reflector *reflector, struct reflection_if *rif, const void *buf, size_t len) {
+    if (rif->hosts) {
+        bool dropped;
+        int sent = send_to_hosts(reflector, rif, buf, len, &dropped);
+        if (sent)
+            return sent == -1 ? -1 : dropped;
+    }
+    return transmit(reflector, rif, buf, len, (const struct sockaddr *) &rif->group, rif->group_len);
+}
+
+/// Send a packet, split into messages that fit the MTU of the interface if it is larger.
+/// The split of the last packet is kept for other interfaces with the same MTU.
+/// \return 0 if sent or queued, 1 if every message was dropped, or -1 on error
+static int deliver_sized(struct mdns_reflector *reflector, struct reflection_if *rif, const void *buf, size_t len) {
+    if (len <= rif->max_message)
+        return deliver(reflector, rif, buf, len);
+    if (reflector->split_seq != reflector->packet_seq || reflector->split_buf != buf ||
+        reflector->split_max != rif->max_message) {
+        reflector->split_seq = reflector->packet_seq;
+        reflector->split_buf = buf;
+        reflector->split_max = rif->max_message;
+        reflector->split_count = rif->protocol->dns ? split_message(&reflector->split, buf, len, rif->max_message)
+                                                    : -1;
+    }
+    if (reflector->split_count == -1) {
+        rif->stats.fragmented_packets++;
+        log_msg(LOG_INFO, "can't split %zu bytes for the MTU of interface %s; sending fragmented", len, rif->ifname);
+        return deliver(reflector, rif, buf, len);
+    }
+    rif->stats.split_packets++;
+    rif->stats.split_messages += (uint64_t) reflector->split_count;
+    log_msg(LOG_INFO, "split %zu bytes into %d messages for the MTU of interface %s", len, reflector->split_count,
+            rif->ifname);
+    const struct split *split = &reflector->split;
+    int dropped = 1;
+    for (size_t i = 0; i < split->nmessages; ++i) {
+        int r = deliver(reflector, rif, split->arena + split->messages[i].offset, split->messages[i].len);
+        if (r == -1)
+            return -1;
+        dropped = dropped && r;
+    }
+    return dropped;
+}
+
+static int emit_aggregate(void *ctx, struct aggregator *aggregator, const uint8_t *msg, size_t len) {
+    return deliver(ctx, aggregator->rif, msg, len);
+}
+
+static int flush_aggregator(struct mdns_reflector *reflector, struct aggregator *aggregator) {
+    struct aggregate_result result;
+    struct reflection_if *rif = aggregator->rif;
+    size_t nresponses = aggregator->nmessages;
+    int r = aggregate_flush(aggregator, emit_aggregate, reflector, &result);
+    rif->stats.aggregate_messages += result.messages;
+    rif->stats.aggregate_duplicates += result.duplicates;
+    if (nresponses)
+        log_msg(LOG_INFO, "sent %zu response(s) to interface %s as %zu message(s), %zu duplicate record(s) removed",
+                nresponses, rif->ifname, result.messages, result.duplicates);
+    return r;
+}
+
+/// Queue a response for aggregation, flushing the aggregator first if it is full.
+static int queue_response(struct mdns_reflector *reflector, struct aggregator *aggregator, const void *buf, size_t len,
+                          int family) {
+    if (!aggregate_has_room(aggregator, len) && flush_aggregator(reflector, aggregator) == -1)
+        return -1;
+    aggregate_add(aggregator, buf, len, family);
+    aggregator->rif->stats.aggregated_responses++;
+    if (!aggregator->pending) {
+        // The window is the same for all aggregators, so appending keeps the queue in deadline order.
+        aggregator->pending = true;
+        aggregator->deadline_ns = monotonic_ns() + (uint64_t) reflector->options->aggregation_window_ms * 1000000u;
+        aggregator->next_pending = NULL;
+        if (reflector->pending_tail)
+            reflector->pending_tail->next_pending = aggregator;
+        else
+            reflector->pending_head = aggregator;
+        reflector->pending_tail = aggregator;
+    }
+    return 0;
+}
+
+/// Flush aggregators whose window has ended, or all of them if `all` is set.
+static int flush_due_aggregators(struct mdns_reflector *reflector, bool all) {
+    uint64_t now = monotonic_ns();
+    int r = 0;
+    while (reflector->pending_head && (all || reflector->pending_head->deadline_ns <= now)) {
+        struct aggregator *aggregator = reflector->pending_head;
+        reflector->pending_head = aggregator->next_pending;
+        if (!reflector->pending_head)
+            reflector->pending_tail = NULL;
+        aggregator->pending = false;
+        if (flush_aggregator(reflector, aggregator) == -1)
+            r = -1;
+    }
+    return r;
+}
+
+/// Send the current batch of a relay to its peer. Send errors are logged but not fatal, since the peer may be
+/// unreachable for a while.
+static void flush_relay(struct relay *relay) {
+    relay->pending = false;
+    if (!relay->batch_count)
+        return;
+    if (sendto(relay->fd, relay->batch, relay->batch_len, 0, (const struct sockaddr *) &relay->peer,
+               sockaddr_len(&relay->peer)) == -1) {
+        relay->stats.tx_dropped++;
+        if (errno != EWOULDBLOCK && errno != ENOBUFS)
+            log_err(LOG_WARNING, "relay %s: sendto %s", relay->name, sockaddr_storage_to_string(&relay->peer));
+    } else {
+        relay->stats.tx_datagrams++;
+        relay->stats.tx_messages += relay->batch_count;
+        relay->stats.tx_bytes += relay->batch_len;
+        log_msg(LOG_DEBUG, "relay %s: sent %u message(s) in %zu bytes", relay->name, relay->batch_count,
+                relay->batch_len);
+    }
+    relay_reset_batch(relay);
+}
+
+/// Queue a packet received in a zone for the relays of the zone.
+static void relay_packet(struct mdns_reflector *reflector, const struct reflection_zone *rz, const void *buf,
+                         size_t len, int family) {
+    for (struct relay *relay = reflector->options->relays; relay; relay = relay->next) {
+        if (relay->zone_index != rz->zone_index)
+            continue;
+        uint64_t now = monotonic_ns();
+        if (relay->dedup && relay_is_echo(relay, buf, len, false, now)) {
+            relay->stats.tx_echoes++;
+            log_msg(LOG_INFO, "relay %s: not relaying a packet the peer sent", relay->name);
+            continue;
+        }
+        if (relay->batch_count && !relay_has_room(relay, len))
+            flush_relay(relay);
+        relay_add(relay, buf, len, family);
+        if (!relay->pending) {
+            relay->pending = true;
+            relay->deadline_ns = now + (uint64_t) relay->batch_ms * 1000000u;
+        }
+    }
+}
+
+/// Send relay batches whose window has ended, or all of them if `all` is set.
+static void flush_due_relays(struct mdns_reflector *reflector, bool all) {
+    uint64_t now = monotonic_ns();
+    for (struct relay *relay = reflector->options->relays; relay; relay = relay->next) {
+        if (relay->pending && (all || relay->deadline_ns <= now))
+            flush_relay(relay);
+    }
+}
+
+static uint64_t half_life_ns(const struct options *options) {
+    return (uint64_t) options->heavy_hitters_half_life_sec * 1000000000u;
+}
+
+/// Time until the earliest aggregation window, relay batch window, parked query wait, TCP connection timeout, HA
+/// heartbeat or handoff timeout ends.
+/// \return timeout in milliseconds, or -1 if nothing is waiting
+static int pending_timeout_ms(const struct mdns_reflector *reflector) {
+    bool pending = reflector->pending_head != NULL;
+    uint64_t deadline = pending ? reflector->pending_head->deadline_ns : 0;
+    for (const struct relay *relay = reflector->options->relays; relay; relay = relay->next) {
+        if (relay->pending && (!pending || relay->deadline_ns < deadline))
+            deadline = relay->deadline_ns;
+        pending = pending || relay->pending;
+    }
+    for (const struct discovery *discovery = reflector->options->discoveries; discovery; discovery = discovery->next) {
+        for (size_t i = 0; i < DISCOVERY_PARKED_MAX; ++i) {
+            const struct parked_query *parked = &discovery->parked[i];
+            if (parked->used && (!pending || parked->deadline_ns < deadline))
+                deadline = parked->deadline_ns;
+            pending = pending || parked->used;
+        }
+        for (size_t i = 0; i < DISCOVERY_TCP_CONNECTIONS_MAX; ++i) {
+            const struct discovery_conn *conn = &discovery->conns[i];
+            if (conn->fd >= 0 && (!pending || conn->deadline_ns < deadline))
+                deadline = conn->deadline_ns;
+            pending = pending || conn->fd >= 0;
+        }
+    }
+    const struct handoff_conn *conn = &reflector->handoff_conn;
+    if (conn->fd >= 0 && !reflector->handoff_sent) {
+        if (!pending || conn->deadline_ns < deadline)
+            deadline = conn->deadline_ns;
+        pending = true;
+    }
+    if (reflector->options->ha) {
+        uint64_t ha_deadline = ha_next_deadline(reflector->options->ha);
+        if (!pending || ha_deadline < deadline)
+            deadline = ha_deadline;
+        pending = true;
+    }
+    if (!pending)
+        return -1;
+    uint64_t now = monotonic_ns();
+    return deadline > now ? (int) ((deadline - now + 999999u) / 1000000u) : 0;
+}
+
+/// Wait for events.
+/// \param reflector reflector
+/// \param events event buffer of MAX_EVENTS entries
+/// \param timeout_ms timeout in milliseconds, 0 to poll, or -1 to block
+/// \return number of events, or -1 on error
+static int wait_events(struct mdns_reflector *reflector, reflector_event *events, int timeout_ms) {
+#if defined(EVFILT_READ)
+    struct timespec timeout = {
+            .tv_sec = timeout_ms / 1000,
+            .tv_nsec = (long) (timeout_ms % 1000) * 1000000L,
+    };
+    int nevents = kevent(reflector->kq, NULL, 0, events, MAX_EVENTS, timeout_ms < 0 ? NULL : &timeout);
+    if (nevents == -1 && errno != EINTR)
+        log_err(LOG_ERR, "kevent");
+#elif defined(EPOLLIN)
+    int nevents = epoll_wait(reflector->epoll_fd, events, MAX_EVENTS, timeout_ms);
+    if (nevents == -1 && errno != EINTR)
+        log_err(LOG_ERR, "epoll_wait");
+#endif
+    return nevents;
+}
+
+/// Spin on non-blocking polls for up to `spin_budget_ns` before falling back to a wait of up to `timeout_ms`.
+/// Spinning avoids the wakeup and scheduling latency of a blocking wait when packets arrive back to back.
+static int spin_then_wait_events(struct mdns_reflector *reflector, reflector_event *events, uint64_t spin_budget_ns,
+                                 int timeout_ms) {
+    if (spin_budget_ns) {
+        uint64_t deadline = monotonic_ns() + spin_budget_ns;
+        do {
+            int nevents = wait_events(reflector, events, 0);
+            if (nevents != 0)
+                return nevents;
+        } while (monotonic_ns() < deadline);
+    }
+    log_msg(LOG_DEBUG, "waiting for events");
+    return wait_events(reflector, events, timeout_ms);
+}
+
+static const struct reflection_zone *find_zone_by_index(const struct reflection_zone *rz_list,
+                                                        unsigned int zone_index) {
+    for (const struct reflection_zone *rz = rz_list; rz; rz = rz->next) {
+        if (rz->zone_index == zone_index)
+            return rz;
+    }
+    return NULL;
+}
+
+/// Ask the zone of a discovery proxy for a name with an mDNS query on each of its interfaces.
+static void send_discovery_query(struct mdns_reflector *reflector, struct discovery *discovery,
+                                 const struct discovery_answer *answer) {
+    const struct options *options = reflector->options;
+    // the unicast query may still be in the datagram buffer
+    uint8_t query[DNS_HEADER_SIZE + DNS_NAME_MAX + 4];
+    size_t len = discovery_build_query(answer->local_name, answer->local_name_len, answer->qtype, query,
+                                       sizeof(query));
+    if (!len)
+        return;
+    discovery->stats.mdns_queries++;
+    const struct reflection_zone *zones[] = {
+            find_zone_by_index(options->rz_list6, discovery->zone_index),
+            find_zone_by_index(options->rz_list4, discovery->zone_index),
+    };
+    for (size_t i = 0; i < 2; ++i) {
+        if (!zones[i])
+            continue;
+        for (struct reflection_if *rif = zones[i]->first_if; rif; rif = rif->next) {
+            if (rif->send_fd >= 0 && rif->protocol->id == PROTOCOL_MDNS)
+                deliver(reflector, rif, query, len);
+        }
+    }
+}
+
+/// Answer a query received by a discovery proxy. If nothing is known about the question, an mDNS query is sent
+/// and the query is parked until responses arrive or `query_wait_ms` passes.
+/// \param conn TCP connection the query came on, or -1 for UDP
+static void handle_discovery_query(struct mdns_reflector *reflector, struct discovery *discovery, int conn,
+                                   const struct sockaddr_storage *client, const uint8_t *query, size_t len) {
+    uint64_t now = monotonic_ns();
+    struct discovery_answer answer;
+    struct discovery_stats stats = discovery->stats;
+    if (conn >= 0)
+        discovery->stats.tcp_queries++;
+    else
+        discovery->stats.udp_queries++;
+    if (discovery_answer(discovery, query, len, conn >= 0, now, reflector->response_buffer + 2,
+                         sizeof(reflector->response_buffer) - 2, &answer) == -1) {
+        if (conn >= 0)
+            close_discovery_conn(&discovery->conns[conn]);
+        return;
+    }
+    if (answer.miss && discovery->query_on_demand) {
+        bool asked = discovery_may_query(discovery, answer.local_name, answer.local_name_len, answer.qtype, now);
+        if (asked)
+            send_discovery_query(reflector, discovery, &answer);
+        if (asked && discovery_park(discovery, conn, client, query, len, now)) {
+            // The query is answered again when it is unparked; count it then.
+            discovery->stats.answered = stats.answered;
+            discovery->stats.nxdomain = stats.nxdomain;
+            log_msg(LOG_INFO, "discovery proxy %s: waiting for mDNS responses", discovery->name);
+            return;
+        }
+    }
+    send_discovery_response(reflector, discovery, conn, client, answer.len);
+}
+
+/// Learn the records of a packet received in a zone for the discovery proxies of the zone.
+static void learn_discovery_records(struct mdns_reflector *reflector, const struct reflection_zone *rz, const void *buf,
+                                    size_t len) {
+    for (struct discovery *discovery = reflector->options->discoveries; discovery; discovery = discovery->next) {
+        if (discovery->zone_index != rz->zone_index)
+            continue;
+        if (discovery_learn(discovery, buf, len, monotonic_ns()))
+            unpark_discovery_queries(reflector, discovery, 0);
+    }
+}
+
+/// Answer parked queries whose wait has ended and close idle TCP connections, or all of them if `all` is set.
+static void flush_due_discoveries(struct mdns_reflector *reflector, bool all) {
+    uint64_t now = monotonic_ns();
+    for (struct discovery *discovery = reflector->options->discoveries; discovery; discovery = discovery->next)
+        flush_due_discovery(reflector, discovery, all, now);
+}
+
+/// Receive all pending queries on the UDP socket of a discovery proxy.
+/// \return 0 on success or -1 on error
+static int receive_discovery_udp(struct mdns_reflector *reflector, struct discovery *discovery) {
+    for (;;) {
+        struct sockaddr_storage client;
+        socklen_t client_len = sizeof(client);
+        ssize_t len = recvfrom(discovery->udp_fd, reflector->datagram_buffer, sizeof(reflector->datagram_buffer), 0,
+                               (struct sockaddr *) &client, &client_len);
+        if (len == -1) {
+            if (errno == EWOULDBLOCK)
+                return 0;
+            if (errno == ECONNREFUSED)
+                continue;
+            log_err(LOG_ERR, "discovery proxy %s: recvfrom", discovery->name);
+            return -1;
+        }
+        // a parked query is copied, so it must fit
+        if ((size_t) len > DISCOVERY_TCP_QUERY_MAX)
+            continue;
+        handle_discovery_query(reflector, discovery, -1, &client, reflector->datagram_buffer, (size_t) len);
+    }
+}
+
+/// Accept pending TCP connections of a discovery proxy, closing the oldest ones when all slots are taken.
+static void accept_discovery_conns(struct mdns_reflector *reflector, struct discovery *discovery) {
+    for (;;) {
+        int fd = accept(discovery->tcp_fd, NULL, NULL);
+        if (fd == -1) {
+            if (errno != EWOULDBLOCK && errno != ECONNABORTED && errno != EINTR)
+                log_err(LOG_WARNING, "discovery proxy %s: accept", discovery->name);
+            if (errno == ECONNABORTED || errno == EINTR)
+                continue;
+            return;
+        }
+        struct discovery_conn *slot = &discovery->conns[0];
+        for (size_t i = 0; i < DISCOVERY_TCP_CONNECTIONS_MAX; ++i) {
+            struct discovery_conn *conn = &discovery->conns[i];
+            if (conn->fd < 0) {
+                slot = conn;
+                break;
+            }
+            if (conn->deadline_ns < slot->deadline_ns)
+                slot = conn;
+        }
+        if (slot->fd >= 0)
+            drop_discovery_conn(discovery, (int) (slot - discovery->conns));
+#if !defined(MSG_NOSIGNAL) && defined(SO_NOSIGPIPE)
+        const int ON = 1;
+        if (setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &ON, sizeof(ON)) == -1)
+            log_err(LOG_WARNING, "setsockopt SO_NOSIGPIPE");
+#endif
+        if (set_nonblocking(fd) == -1 || watch_fd(reflector, fd, slot, false) == -1) {
+            close(fd);
+            continue;
+        }
+        slot->fd = fd;
+        slot->len = 0;
+        slot->deadline_ns = monotonic_ns() + (uint64_t) DISCOVERY_TCP_TIMEOUT_MS * 1000000u;
+    }
+}
+
+/// Read from a TCP connection of a discovery proxy, answering the query once it is complete.
+/// Each connection carries a single query; a client sending more or closing while the query is parked gives up.
+static void receive_discovery_conn(struct mdns_reflector *reflector, struct discovery *discovery,
+                                   struct discovery_conn *conn) {
+    int conn_index = (int) (conn - discovery->conns);
+    if (conn->len >= 2 && conn->len >= 2 + ((size_t) conn->buf[0] << 8 | conn->buf[1])) {
+        drop_discovery_conn(discovery, conn_index);
+        return;
+    }
+    for (;;) {
+        ssize_t n = recv(conn->fd, conn->buf + conn->len, sizeof(conn->buf) - conn->len, 0);
+        if (n == -1 && errno == EWOULDBLOCK)
+            return;
+        if (n <= 0) {
+            drop_discovery_conn(discovery, conn_index);
+            return;
+        }
+        conn->len += (size_t) n;
+        if (conn->len < 2)
+            continue;
+        size_t len = (size_t) conn->buf[0] << 8 | conn->buf[1];
+        if (len > DISCOVERY_TCP_QUERY_MAX) {
+            drop_discovery_conn(discovery, conn_index);
+            return;
+        }
+        if (conn->len >= 2 + len) {
+            handle_discovery_query(reflector, discovery, conn_index, NULL, conn->buf + 2, len);
+            return;
+        }
+    }
+}
+
+enum discovery_event {
+    DISCOVERY_EVENT_UDP,
+    DISCOVERY_EVENT_LISTEN,
+    DISCOVERY_EVENT_CONN,
+};
+
+/// \return the discovery proxy an event belongs to, or NULL if it belongs to something else
+static struct discovery *find_event_discovery(const struct mdns_reflector *reflector, const void *udata,
+                                              enum discovery_event *event) {
+    for (struct discovery *discovery = reflector->options->discoveries; discovery; discovery = discovery->next) {
+        if (udata == &discovery->udp_fd) {
+            *event = DISCOVERY_EVENT_UDP;
+            return discovery;
+        }
+        if (udata == &discovery->tcp_fd) {
+            *event = DISCOVERY_EVENT_LISTEN;
+            return discovery;
+        }
+        if (udata >= (const void *) discovery->conns &&
+            udata < (const void *) (discovery->conns + DISCOVERY_TCP_CONNECTIONS_MAX)) {
+            *event = DISCOVERY_EVENT_CONN;
+            return discovery;
+        }
+    }
+    return NULL;
+}
+
+/// Decide whether this node reflects a packet when paired with another reflector.
+/// \param ifname interface the packet was received on, or "" if it came from a relay
+/// \return true if the packet is to be reflected
+static bool ha_admits(struct mdns_reflector *reflector, const struct reflection_zone *rz, const char *ifname,
+                      const struct protocol *protocol, const uint8_t *buf, size_t len) {
+    (void) ifname;  // only used by probes, which may be compiled out
+    struct ha *ha = reflector->options->ha;
+    if (!ha)
+        return true;
+    if (ha->state == HA_STANDBY) {
+        // stay ready to answer for the zone when taking over
+        if (protocol->id == PROTOCOL_MDNS)
+            learn_discovery_records(reflector, rz, buf, len);
+        ha->stats.standby_drops++;
+        PROBE3(packet_dropped, ifname, len, "ha_standby");
+        log_msg(LOG_DEBUG, "not reflecting: ha standby");
+        return false;
+    }
+    if (ha_is_duplicate(ha, buf, len, monotonic_ns())) {
+        ha->stats.duplicate_drops++;
+        PROBE3(packet_dropped, ifname, len, "ha_duplicate");
+        log_msg(LOG_INFO, "not reflecting a packet the ha peer reflected");
+        return false;
+    }
+    return true;
+}
+
+static void send_ha_heartbeat(struct mdns_reflector *reflector, struct ha *ha, uint64_t now) {
+    size_t len = ha_build_heartbeat(ha, reflector->datagram_buffer, sizeof(reflector->datagram_buffer), now);
+    if (sendto(ha->fd, reflector->datagram_buffer, len, 0, (const struct sockaddr *) &ha->peer,
+               sockaddr_len(&ha->peer)) == -1) {
+        // the peer being down is what failover is for
+        log_err(LOG_DEBUG, "ha: sendto");
+        return;
+    }
+    ha->stats.heartbeats_tx++;
+}
+
+/// Fail over or back as needed, and send a heartbeat when due or when it is full of fingerprints of reflected packets.
+static void service_ha(struct mdns_reflector *reflector) {
+    struct ha *ha = reflector->options->ha;
+    if (!ha)
+        return;
+    uint64_t now = monotonic_ns();
+    const char *reason = NULL;
+    if (ha_update(ha, now, &reason))
+        log_msg(LOG_WARNING, "ha: now %s: %s", ha_state_name(ha->state), reason);
+    if (now >= ha->next_heartbeat_ns || ha->npending >= HA_SYNC_MAX)
+        send_ha_heartbeat(reflector, ha, now);
+}
+
+/// Receive all pending heartbeats from the HA peer.
+/// \return 0 on success or -1 on error
+static int receive_ha(struct mdns_reflector *reflector, struct ha *ha) {
+    for (;;) {
+        struct sockaddr_storage peer_addr;
+        socklen_t peer_len = sizeof(peer_addr);
+        ssize_t len = recvfrom(ha->fd, reflector->datagram_buffer, sizeof(reflector->datagram_buffer), 0,
+                               (struct sockaddr *) &peer_addr, &peer_len);
+        if (len == -1) {
+            if (errno == EWOULDBLOCK)
+                return 0;
+            if (errno == ECONNREFUSED)
+                continue;
+            log_err(LOG_ERR, "ha: recvfrom");
+            return -1;
+        }
+        if (!sockaddr_equal(&peer_addr, &ha->peer)) {
+            ha->stats.rx_errors++;
+            log_msg(LOG_INFO, "ha: ignoring datagram from unknown source %s", sockaddr_storage_to_string(&peer_addr));
+            continue;
+        }
+        if (ha_receive_heartbeat(ha, reflector->datagram_buffer, (size_t) len, monotonic_ns()) == -1) {
+            ha->stats.rx_errors++;
+            log_msg(LOG_INFO, "ha: ignoring malformed heartbeat");
+        }
+    }
+}
+
+/// Check whether hosts on the segment of an interface got a packet reflected over the other address family: the
+/// interface must be reflected for both, and IPv4 only reaches segments where the interface has an IPv4 address.
+static bool reaches_other_family(const struct reflection_if *rif, int family, uint64_t now,
+                                 uint64_t listener_timeout) {
+    const struct reflection_if *twin = rif->twin;
+    if (!twin || twin->send_fd == -1 || !reflection_if_has_listeners(twin, now, listener_timeout))
+        return false;
+    return family == AF_INET || twin->has_addr4;
+}
+
+/// Send a packet to the interfaces of a zone with the same protocol, rewriting or aggregating it for each one as
+/// configured.
+/// \param src_rif interface the packet was received on, or NULL if it came from a relay
+/// \return 0 on success or -1 on error
+static int reflect_packet(struct mdns_reflector *reflector, const struct reflection_zone *rz,
+                          const struct reflection_if *src_rif, const struct protocol *protocol, const void *buf,
+                          size_t len, int family) {
+    const struct options *options = reflector->options;
+    struct interest_packet interest;
+    bool filter = rz->interest && protocol->id == PROTOCOL_MDNS;
+    uint64_t now = 0;
+    // a copy of a packet the same host already sent over the other family is only sent to single-stack interfaces
+    bool second_copy = false;
+    size_t family_index = family == AF_INET6 ? 0 : 1;
+    reflector->packet_seq++;
+    if (options->dualstack_dedup && src_rif && src_rif->twin) {
+        now = monotonic_ns();
+        second_copy = dualstack_is_duplicate(&reflector->dualstack, rz->zone_index, reflection_if_link(src_rif),
+                                             protocol->id, buf, len, family, now,
+                                             (uint64_t) options->dualstack_window_ms * 1000000u);
+        if (second_copy)
+            reflector->stats.dualstack.suppressed_packets[family_index]++;
+    }
+    if (protocol->id == PROTOCOL_MDNS && !second_copy)
+        learn_discovery_records(reflector, rz, buf, len);
+    // Re-compress once for all destinations, unless the names are already compressed well.
+    size_t saved = 0;
+    if (options->recompress && protocol->id == PROTOCOL_MDNS &&
+        recompress_estimate(buf, len) >= (size_t) options->recompress_min_saving) {
+        size_t recompressed_len = recompress_message(buf, len, reflector->recompress_buf,
+                                                     sizeof(reflector->recompress_buf));
+        if (recompressed_len) {
+            log_msg(LOG_INFO, "re-compressed %zu bytes into %zu", len, recompressed_len);
+            saved = len - recompressed_len;
+            buf = reflector->recompress_buf;
+            len = recompressed_len;
+        }
+    }
+    if (filter) {
+        if (!now)
+            now = monotonic_ns();
+        interest_expire(rz->interest, now, (uint64_t) options->interest_timeout_sec * 1000000000u);
+        interest_observe(rz->interest, buf, len, src_rif ? reflection_if_link(src_rif) : 0u, now,
+                         (uint64_t) options->interest_flood_interval_sec * 1000000000u, &interest);
+    }
+    uint64_t listener_timeout = (uint64_t) options->listener_timeout_sec * 1000000000u;
+    for (struct reflection_if *dst_rif = rz->first_if; dst_rif; dst_rif = dst_rif->next) {
+        if (dst_rif == src_rif || dst_rif->protocol != protocol || dst_rif->send_fd < 0)
+            continue;
+        if (dst_rif->listener_aware) {
+            if (!now)
+                now = monotonic_ns();
+            if (!reflection_if_has_listeners(dst_rif, now, listener_timeout)) {
+                dst_rif->stats.listener_skips++;
+                PROBE3(packet_dropped, dst_rif->ifname, len, "no_listeners");
+                log_msg(LOG_INFO, "not forwarding to interface %s: no listeners", dst_rif->ifname);
+                continue;
+            }
+        }
+        if (second_copy) {
+            if (reaches_other_family(dst_rif, family, now, listener_timeout)) {
+                reflector->stats.dualstack.suppressed_copies[family_index]++;
+                PROBE3(packet_dropped, dst_rif->ifname, len, "dualstack_duplicate");
+                log_msg(LOG_INFO, "not forwarding to interface %s: already reflected over the other family",
+                        dst_rif->ifname);
+                continue;
+            }
+            reflector->stats.dualstack.single_stack_copies[family_index]++;
+        }
+        if (filter && !interest_wanted(rz->interest, &interest, reflection_if_link(dst_rif), now,
+                                       (uint64_t) options->interest_timeout_sec * 1000000000u)) {
+            rz->interest->stats.pruned++;
+            PROBE3(packet_dropped, dst_rif->ifname, len, "no_interest");
+            log_msg(LOG_INFO, "not forwarding to interface %s: no interest", dst_rif->ifname);
+            continue;
+        }
+        const void *send_buf = buf;
+        size_t send_size = len;
+        const struct rewrite_variant *variant = NULL;
+        if (dst_rif->rewrite) {
+            variant = get_rewrite_variant(reflector, dst_rif->rewrite, buf, len);
+            if (variant) {
+                dst_rif->stats.rewrite_records_dropped += variant->dropped;
+                // re-encoded names can take more room than in the original message
+                if (variant->len < len)
+                    dst_rif->stats.rewrite_bytes_saved += len - variant->len;
+                if (variant->len == DNS_HEADER_SIZE) {
+                    PROBE3(packet_dropped, dst_rif->ifname, len, "rewrite_empty");
+                    log_msg(LOG_INFO, "not forwarding to interface %s: no records left after rewriting",
+                            dst_rif->ifname);
+                    continue;
+                }
+                send_buf = variant->buf;
+                send_size = variant->len;
+            }
+        }
+        if (saved) {
+            dst_rif->stats.recompressed_packets++;
+            dst_rif->stats.recompress_bytes_saved += saved;
+        }
+        PROBE4(packet_forwarded, src_rif ? src_rif->ifname : "", dst_rif->ifname, send_size, family);
+        if (dst_rif->aggregator && aggregate_eligible(dst_rif->aggregator, send_buf, send_size)) {
+            log_msg(LOG_INFO, "queueing response to interface %s", dst_rif->ifname);
+            if (queue_response(reflector, dst_rif->aggregator, send_buf, send_size, family) == -1)
+                return -1;
+            if (variant)
+                dst_rif->stats.rewritten_packets++;
+            continue;
+        }
+        log_msg(LOG_INFO, "forwarding to interface %s", dst_rif->ifname);
+        int r = deliver_sized(reflector, dst_rif, send_buf, send_size);
+        if (r == -1)
+            return -1;
+        // dropped packets are accounted in tx_dropped
+        if (r == 0 && variant)
+            dst_rif->stats.rewritten_packets++;
+        log_msg(LOG_DEBUG, "sent");
+    }
+    return 0;
+}
+
+/// Inject the messages of one datagram received from a relay peer into the relayed zone.
+/// \return 0 on success or -1 on error
+static int inject_relay_datagram(struct mdns_reflector *reflector, struct relay *relay, size_t len) {
+    const struct options *options = reflector->options;
+    const struct protocol *mdns = &protocols[PROTOCOL_MDNS];
+    struct relay_reader reader;
+    const uint8_t *msg;
+    size_t msg_len;
+    int family;
+    if (relay_reader_init(&reader, reflector->datagram_buffer, len) == -1) {
+        relay->stats.rx_errors++;
+        log_msg(LOG_INFO, "relay %s: ignoring datagram with an invalid header", relay->name);
+        return 0;
+    }
+    relay->stats.rx_datagrams++;
+    relay->stats.rx_bytes += len;
+    int r;
+    while ((r = relay_reader_next(&reader, &msg, &msg_len, &family)) == 1) {
+        relay->stats.rx_messages++;
+        if (relay->dedup && relay_is_echo(relay, msg, msg_len, true, monotonic_ns())) {
+            relay->stats.rx_echoes++;
+            log_msg(LOG_INFO, "relay %s: not injecting a packet relayed to the peer", relay->name);
+            continue;
+        }
+        // The peer validated the packet on ingress; check it is still well-formed mDNS.
+        if (options->ingress_validation && mdns->validate(msg, msg_len, mdns->port, 255) != INGRESS_ACCEPT) {
+            relay->stats.rx_errors++;
+            continue;
+        }
+        const struct reflection_zone *rz = find_zone_by_index(family == AF_INET6 ? options->rz_list6
+                                                                                 : options->rz_list4,
+                                                              relay->zone_index);
+        if (!rz)
+            continue;
+        if (!ha_admits(reflector, rz, "", mdns, msg, msg_len))
+            continue;
+        log_msg(LOG_INFO, "relay %s: injecting %zu bytes into zone %s", relay->name, msg_len, rz->name);
+        if (reflect_packet(reflector, rz, NULL, mdns, msg, msg_len, family) == -1)
+            return -1;
+    }
+    if (r == -1) {
+        relay->stats.rx_errors++;
+        log_msg(LOG_INFO, "relay %s: ignoring the rest of a malformed datagram", relay->name);
+    }
+    return 0;
+}
+
+/// Receive all pending datagrams of a relay.
+/// \return 0 on success or -1 on error
+static int receive_relay(struct mdns_reflector *reflector, struct relay *relay) {
+    for (;;) {
+        struct sockaddr_storage peer_addr;
+        socklen_t peer_len = sizeof(peer_addr);
+        ssize_t len = recvfrom(relay->fd, reflector->datagram_buffer, sizeof(reflector->datagram_buffer), 0,
+                               (struct sockaddr *) &peer_addr, &peer_len);
+        if (len == -1) {
+            if (errno == EWOULDBLOCK)
+                return 0;
+            // ICMP errors of earlier sends to an unreachable peer are reported here
+            if (errno == ECONNREFUSED)
+                continue;
+            log_err(LOG_ERR, "relay %s: recvfrom", relay->name);
+            return -1;
+        }
+        if (!sockaddr_equal(&peer_addr, &relay->peer)) {
+            relay->stats.rx_errors++;
+            log_msg(LOG_INFO, "relay %s: ignoring datagram from unknown source %s", relay->name,
+                    sockaddr_storage_to_string(&peer_addr));
+            continue;
+        }
+        if (inject_relay_datagram(reflector, relay, (size_t) len) == -1)
+            return -1;
+    }
+}
+
+/// Queue the sockets and learned state of everything open for a new instance, ending with an empty record.
+static int queue_handoff_records(struct mdns_reflector *reflector, struct handoff_conn *conn) {
+    const struct options *options = reflector->options;
+    struct handoff_record record;
+    const struct reflection_zone *lists[] = {options->rz_list6, options->rz_list4};
+    const int families[] = {AF_INET6, AF_INET};
+    for (size_t i = 0; i < 2; ++i) {
+        for (const struct reflection_zone *rz = lists[i]; rz; rz = rz->next) {
+            for (const struct reflection_if *rif = rz->first_if; rif; rif = rif->next) {
+                if (rif->recv_fd < 0)
+                    continue;
+                memset(&record, 0, sizeof(record));
+                reflection_if_handoff_key(rif, families[i], record.key);
+                record.nfds = 2;
+                record.stats = rif->stats;
+                record.listener_seen_ns = rif->listener_aware ? rif->listener_seen_ns : 0;
+                if (rif->hosts) {
+                    record.has_hosts = true;
+                    record.hosts = *rif->hosts;
+                }
+                const int fds[] = {rif->recv_fd, rif->send_fd};
+                if (handoff_conn_queue(conn, &record, fds) == -1)
+                    return -1;
+            }
+        }
+    }
+    for (const struct relay *relay = options->relays; relay; relay = relay->next) {
+        memset(&record, 0, sizeof(record));
+        relay_handoff_key(relay, record.key);
+        record.nfds = 1;
+        if (relay->fd >= 0 && handoff_conn_queue(conn, &record, &relay->fd) == -1)
+            return -1;
+    }
+    for (const struct discovery *discovery = options->discoveries; discovery; discovery = discovery->next) {
+        memset(&record, 0, sizeof(record));
+        discovery_handoff_key(discovery, record.key);
+        record.nfds = 2;
+        const int fds[] = {discovery->udp_fd, discovery->tcp_fd};
+        if (discovery->udp_fd >= 0 && handoff_conn_queue(conn, &record, fds) == -1)
+            return -1;
+    }
+    if (options->ha && options->ha->fd >= 0) {
+        memset(&record, 0, sizeof(record));
+        ha_handoff_key(options->ha, record.key);
+        record.nfds = 1;
+        if (handoff_conn_queue(conn, &record, &options->ha->fd) == -1)
+            return -1;
+    }
+    memset(&record, 0, sizeof(record));
+    return handoff_conn_queue(conn, &record, NULL);
+}
+
+/// Hand the sockets over to a new instance that connected to the handoff socket. It takes over once it started;
+/// until then both instances read from the same sockets, and each packet is received by one of them.
+static void accept_handoff(struct mdns_reflector *reflector) {
+    int fd = accept(reflector->handoff_fd, NULL, NULL);
+    if (fd == -1) {
+        if (errno != EWOULDBLOCK && errno != ECONNABORTED && errno != EINTR)
+            log_err(LOG_WARNING, "handoff: accept");
+        return;
+    }
+    if (reflector->handoff_conn.fd >= 0) {
+        log_msg(LOG_WARNING, "handoff: already handing over to another instance");
+        close(fd);
+        return;
+    }
+    log_msg(LOG_WARNING, "handoff: a new instance connected; handing over sockets");
+    if (set_nonblocking(fd) == -1 || watch_fd(reflector, fd, &reflector->handoff_conn, false) == -1) {
+        close(fd);
+        return;
+    }
+    handoff_conn_init(&reflector->handoff_conn, fd, monotonic_ns() + (uint64_t) HANDOFF_TIMEOUT_MS * 1000000u);
+    reflector->handoff_sent = false;
+}
+
+/// Close the connection to a new instance, which then cannot take over.
+static void drop_handoff_conn(struct mdns_reflector *reflector) {
+    handoff_conn_close(&reflector->handoff_conn);
+    reflector->handoff_sent = false;
+}
+
+/// Serve the connection to a new instance that became readable or writable: receive its header, then send it the
+/// sockets as far as the connection takes them.
+static void serve_handoff_conn(struct mdns_reflector *reflector) {
+    struct handoff_conn *conn = &reflector->handoff_conn;
+    int r = handoff_conn_receive_header(conn);
+    if (r == -1) {
+        drop_handoff_conn(reflector);
+        return;
+    }
+    if (r == 0)
+        return;
+    if (!conn->nqueued && queue_handoff_records(reflector, conn) == -1)
+        goto fail;
+    r = handoff_conn_flush(conn);
+    if (r == -1 || watch_fd_writable(reflector, conn->fd, conn, r == 0) == -1)
+        goto fail;
+    reflector->handoff_sent = r == 1;
+    return;
+    fail:
+    log_err(LOG_WARNING, "handoff: failed to hand over sockets; carrying on");
+    drop_handoff_conn(reflector);
+}
+
+/// Give up on a new instance that did not take all sockets in time.
+static void flush_due_handoff(struct mdns_reflector *reflector) {
+    const struct handoff_conn *conn = &reflector->handoff_conn;
+    if (conn->fd >= 0 && !reflector->handoff_sent && conn->deadline_ns <= monotonic_ns()) {
+        log_msg(LOG_WARNING, "handoff: the new instance did not take the sockets in time; carrying on");
+        drop_handoff_conn(reflector);
+    }
+}
+
+/// Wait for the new instance to tell that it started, then send what is queued and close everything.
+static int receive_handoff_ready(struct mdns_reflector *reflector) {
+    const struct options *options = reflector->options;
+    char message;
+    ssize_t n = recv(reflector->handoff_conn.fd, &message, 1, 0);
+    if (n == -1 && (errno == EWOULDBLOCK || errno == EINTR))
+        return 0;
+    drop_handoff_conn(reflector);
+    if (n != 1 || message != HANDOFF_READY) {
+        log_msg(LOG_WARNING, "handoff: the new instance failed to start; carrying on");
+        return 0;
+    }
+    log_msg(LOG_WARNING, "handoff: the new instance took over; stopping");
+    reflector->handed_off = true;
+    if (flush_due_aggregators(reflector, true) == -1)
+        return -1;
+    flush_due_relays(reflector, true);
+    flush_due_discoveries(reflector, true);
+    if (reflector->pipeline)
+        pipeline_quiesce(reflector->pipeline);
+    // The new instance holds the sockets open; closing ours stops us from receiving from them.
+    close_reflection_zones(options->rz_list6);
+    close_reflection_zones(options->rz_list4);
+    close_relays(options->relays);
+    close_discoveries(options->discoveries);
+    close_ha(options->ha);
+    return 0;
+}
+
+#if defined(__linux__)
+/// \return the link monitor an event belongs to, or NULL if it belongs to something else
+static const struct link_monitor *find_event_link_monitor(const struct mdns_reflector *reflector, const void *udata) {
+    for (const struct link_monitor *monitor = reflector->link_monitors; monitor; monitor = monitor->next) {
+        if (monitor == udata)
+            return monitor;
+    }
+    return NULL;
+}
+#endif
+
+/// \return the relay an event belongs to, or NULL if it belongs to a reflection interface
+static struct relay *find_event_relay(const struct mdns_reflector *reflector, const void *udata) {
+    for (struct relay *relay = reflector->options->relays; relay; relay = relay->next) {
+        if (relay == udata)
+            return relay;
+    }
+    return NULL;
+}
+
+/// Receive and reflect the packets waiting on a reflection interface.
+/// \param budget most packets to receive, or 0 for no limit
+/// \return number of packets received, or -1 on error
+static int receive_reflection_if(struct mdns_reflector *reflector, struct reflection_if *rif, unsigned int budget) {
+    const struct options *options = reflector->options;
+    struct sockaddr_storage peer_addr;
+    char peer_addr_str[INET6_ADDRSTRLEN + 2 + 1 + 5 + 1 + 10];
+    char cmbuf[0x100];
+    struct iovec iov = {
+            .iov_base = reflector->packet_buffer,
+            .iov_len = sizeof(reflector->packet_buffer),
+    };
+    struct msghdr mh = {
+            .msg_name = &peer_addr,
+            .msg_iov = &iov,
+            .msg_iovlen = 1,
+            .msg_control = cmbuf,
+    };
+    struct recv_info recv_info;
+    int received = 0;
+    while (!budget || (unsigned int) received < budget) {
+        log_msg(LOG_DEBUG, "recvmsg");
+        // Receive into the pool so that the packet is queued without copying.
+        if (reflector->pipeline) {
+            uint8_t *rx = pipeline_rx_buffer(reflector->pipeline);
+            iov.iov_base = rx ? rx : reflector->packet_buffer;
+        }
+        mh.msg_namelen = sizeof(peer_addr);
+        mh.msg_controllen = sizeof(cmbuf);
+        ssize_t recv_size = recvmsg(rif->recv_fd, &mh, 0);
+        if (recv_size == -1) {
+            if (errno == EWOULDBLOCK) {
+                if (reflector->pipeline)
+                    pipeline_rx_done(reflector->pipeline);
+                break;
+            }
+            log_err(LOG_ERR, "recvfrom");
+            return -1;
+        }
+        ++received;
+        const uint8_t *packet = iov.iov_base;
+        rif->stats.rx_packets++;
+        rif->stats.rx_bytes += (uint64_t) recv_size;
+        parse_recv_info(&mh, &recv_info);
+        PROBE4(packet_received, rif->ifname, (size_t) recv_size, (int) peer_addr.ss_family, recv_info.ttl);
+        if (reflector->stats.latency_enabled && !recv_info.has_timestamp)
+            recv_info.timestamp_ns = realtime_ns();  // no kernel timestamp; measure our own processing only
+        check_kernel_drops(options, rif, &recv_info);
+        if (options->log_level <= LOG_INFO) {
+            snprintf(peer_addr_str, sizeof(peer_addr_str), "%s", sockaddr_storage_to_string(&peer_addr));
+            log_msg(LOG_INFO, "received %u bytes from interface %s with source IP %s",
+                    recv_size, rif->ifname, peer_addr_str);
+        }
+        if (options->ingress_validation && rif->protocol->validate) {
+            enum ingress_verdict verdict = rif->protocol->validate(packet, (size_t) recv_size,
+                                                                   sockaddr_port(&peer_addr), recv_info.ttl);
+            if (verdict != INGRESS_ACCEPT) {
+                PROBE3(packet_dropped, rif->ifname, (size_t) recv_size, ingress_verdict_name(verdict));
+                rif->stats.ingress_drops[verdict]++;
+                log_msg(LOG_INFO, "dropping packet from interface %s: failed %s check",
+                        rif->ifname, ingress_verdict_name(verdict));
+                continue;
+            }
+        }
+        // Hosts sending from the protocol port are full implementations and listen on it;
+        // one-shot queriers using other ports are not.
+        if (sockaddr_port(&peer_addr) == rif->protocol->port) {
+            if (rif->hosts)
+                host_table_learn(rif->hosts, &peer_addr, monotonic_ns());
+            if (rif->listener_aware)
+                rif->listener_seen_ns = monotonic_ns();
+        }
+        if (recv_size >= PACKET_MAX) {
+            PROBE3(packet_dropped, rif->ifname, (size_t) recv_size, "too_large");
+            log_msg(LOG_WARNING, "ignoring because it is too large (limit is %d bytes)", PACKET_MAX);
+            continue;
+        }
+        // Send to other interfaces.
+        if (peer_addr.ss_family != AF_INET6 && peer_addr.ss_family != AF_INET) {
+            PROBE3(packet_dropped, rif->ifname, (size_t) recv_size, "address_family");
+            log_msg(LOG_WARNING, "ignoring packet from unknown address family: %d", peer_addr.ss_family);
+            continue;
+        }
+        if (options->heavy_hitters)
+            traffic_top_record(&reflector->stats.top, &peer_addr, rif->ifname, packet, (size_t) recv_size);
+        if (!ha_admits(reflector, rif->zone, rif->ifname, rif->protocol, packet, (size_t) recv_size))
+            continue;
+        if (reflect_packet(reflector, rif->zone, rif, rif->protocol, packet, (size_t) recv_size,
+                           peer_addr.ss_family) == -1)
+            return -1;
+        // relays carry mDNS only
+        if (rif->protocol->id == PROTOCOL_MDNS)
+            relay_packet(reflector, rif->zone, packet, (size_t) recv_size, peer_addr.ss_family);
+        if (reflector->stats.latency_enabled) {
+            uint64_t sent = realtime_ns();
+            uint64_t rx = recv_info.timestamp_ns;
+            latency_record(&reflector->stats.latency, sent > rx ? sent - rx : 0);
+        }
+    }
+    return received;
+}
+
+/// Start a loop iteration. The time since the previous one ended was spent outside the reflector and is idle.
+static void begin_iteration(struct mdns_reflector *reflector) {
+    uint64_t now = monotonic_ns();
+    uint64_t last_end = reflector->last_end_ns ? reflector->last_end_ns : now;
+    loop_begin(&reflector->stats.loop, last_end);
+    loop_waited(&reflector->stats.loop, last_end, now);
+}
+
+static void end_iteration(struct mdns_reflector *reflector) {
+    reflector->last_end_ns = monotonic_ns();
+    loop_end(&reflector->stats.loop, reflector->last_end_ns,
+             (uint64_t) reflector->options->stall_threshold_ms * 1000000u);
+}
+
+/// Wait for events, handle them, and run due timers: one iteration of the event loop.
+/// \param spin_budget_ns how long to spin on non-blocking polls before waiting
+/// \param timeout_ms timeout in milliseconds, 0 to poll, or -1 to block
+/// \param budget most packets to receive from interfaces, or 0 for no limit
+/// \return number of packets received from interfaces, or -1 on error
+static int poll_reflector(struct mdns_reflector *reflector, uint64_t spin_budget_ns, int timeout_ms,
+                          unsigned int budget) {
+    struct options *options = reflector->options;
+    struct loop_stats *loop = &reflector->stats.loop;
+    reflector_event *events = reflector->events;
+    begin_iteration(reflector);
+    uint64_t wait_start = monotonic_ns();
+    int nevents = spin_then_wait_events(reflector, events, spin_budget_ns, timeout_ms);
+    uint64_t now = monotonic_ns();
+    loop_waited(loop, wait_start, now);
+    if (nevents == -1) {
+        end_iteration(reflector);
+        return errno == EINTR ? 0 : -1;
+    }
+    PROBE1(loop_start, nevents);
+    int received = 0;
+    // after a handoff, the sockets of other events are closed
+    for (int i = 0; i < nevents && !reflector->handed_off; ++i) {
+#if defined(EVFILT_READ)
+        void *udata = events[i].udata;
+#elif defined(EPOLLIN)
+        void *udata = events[i].data.ptr;
+#endif
+        if (i)
+            now = monotonic_ns();
+#if defined(__linux__)
+        const struct link_monitor *monitor = find_event_link_monitor(reflector, udata);
+        if (monitor) {
+            loop_event(loop, "netlink", monitor->netns[0] ? monitor->netns : NULL, now);
+            receive_link_updates(reflector, monitor);
+            continue;
+        }
+        if (udata == &reflector->igmp_fd || udata == &reflector->mld_fd) {
+            loop_event(loop, "listener_reports", NULL, now);
+            receive_listener_reports(reflector, udata == &reflector->mld_fd ? AF_INET6 : AF_INET);
+            continue;
+        }
+#endif
+        if (udata == &reflector->wakeup_fd) {
+            char discard[64];
+            while (read(reflector->wakeup_fd, discard, sizeof(discard)) > 0)
+                continue;
+            continue;
+        }
+        if (udata == &reflector->handoff_fd) {
+            loop_event(loop, "handoff", NULL, now);
+            accept_handoff(reflector);
+            continue;
+        }
+        if (udata == &reflector->handoff_conn) {
+            loop_event(loop, "handoff", NULL, now);
+            if (!reflector->handoff_sent)
+                serve_handoff_conn(reflector);
+            else if (receive_handoff_ready(reflector) == -1)
+                goto fail;
+            continue;
+        }
+        if (options->ha && udata == options->ha) {
+            loop_event(loop, "ha", NULL, now);
+            if (receive_ha(reflector, options->ha) == -1)
+                goto fail;
+            continue;
+        }
+        struct relay *relay = find_event_relay(reflector, udata);
+        if (relay) {
+            loop_event(loop, "relay", relay->name, now);
+            if (receive_relay(reflector, relay) == -1)
+                goto fail;
+            continue;
+        }
+        enum discovery_event discovery_event;
+        struct discovery *discovery = find_event_discovery(reflector, udata, &discovery_event);
+        if (discovery) {
+            loop_event(loop, "discovery", discovery->name, now);
+            if (discovery_event == DISCOVERY_EVENT_UDP) {
+                if (receive_discovery_udp(reflector, discovery) == -1)
+                    goto fail;
+            } else if (discovery_event == DISCOVERY_EVENT_LISTEN) {
+                accept_discovery_conns(reflector, discovery);
+            } else {
+                receive_discovery_conn(reflector, discovery, udata);
+            }
+            continue;
+        }
+        // Sockets are watched level-triggered, so interfaces left over when the budget runs out are reported again.
+        if (budget && (unsigned int) received >= budget)
+            continue;
+        struct reflection_if *rif = udata;
+        // closed earlier in this batch, such as by a link going away
+        if (rif->recv_fd < 0)
+            continue;
+        loop_event(loop, "interface", rif->ifname, now);
+        int n = receive_reflection_if(reflector, rif, budget ? budget - (unsigned int) received : 0);
+        if (n == -1)
+            goto fail;
+        received += n;
+    }
+    if (reflector->handed_off)
+        goto end;
+    now = monotonic_ns();
+    loop_event(loop, "timers", NULL, now);
+    if (flush_due_aggregators(reflector, false) == -1)
+        goto fail;
+    flush_due_relays(reflector, false);
+    flush_due_discoveries(reflector, false);
+    flush_due_handoff(reflector);
+    service_ha(reflector);
+    if (options->heavy_hitters)
+        traffic_top_decay(&reflector->stats.top, half_life_ns(options), now);
+    goto end;
+fail:
+    received = -1;
+end:
+    // pairs up with loop_start on every way out, so that tracing scripts see no dangling iteration
+    end_iteration(reflector);
+    PROBE1(loop_end, nevents);
+    return received;
+}
+
+/// Flush everything pending, so that interfaces, records and zones can be freed. Discovery proxies refer to none of
+/// them; those removed by a reload are flushed by reload_config().
+static int flush_all(struct mdns_reflector *reflector) {
+    // Pending aggregators and relay batches belong to records that may be freed.
+    int r = flush_due_aggregators(reflector, true);
+    flush_due_relays(reflector, true);
+    // Transmit threads must be done with the interfaces that may be closed.
+    if (reflector->pipeline)
+        pipeline_quiesce(reflector->pipeline);
+    return r;
+}
+
+struct mdns_reflector *reflector_new(struct options *options) {
+    struct mdns_reflector *reflector = calloc(1, sizeof(struct mdns_reflector));
+    if (!reflector) {
+        log_err(LOG_ERR, "can't malloc");
+        return NULL;
+    }
+    reflector->options = options;
+#if defined(EVFILT_READ)
+    reflector->kq = -1;
+#elif defined(EPOLLIN)
+    reflector->epoll_fd = -1;
+#endif
+#if defined(__linux__)
+    reflector->igmp_fd = -1;
+    reflector->mld_fd = -1;
+#endif
+    reflector->handoff.fd = -1;
+    reflector->handoff_fd = -1;
+    reflector->handoff_conn.fd = -1;
+    reflector->wakeup_fd = -1;
+    return reflector;
+}
+
+int reflector_run_once(struct mdns_reflector *reflector, int timeout_ms) {
+    return poll_reflector(reflector, reflector->spin_budget_ns, timeout_ms, 0) == -1 ? -1 : 0;
+}
+
+bool reflector_took_over(const struct mdns_reflector *reflector) {
+    return reflector->took_over;
+}
+
+bool reflector_handed_off(const struct mdns_reflector *reflector) {
+    return reflector->handed_off;
+}
+
+int reflector_watch_wakeup(struct mdns_reflector *reflector, int fd) {
+    if (watch_fd(reflector, fd, &reflector->wakeup_fd, false) == -1)
+        return -1;
+    reflector->wakeup_fd = fd;
+    return 0;
+}
+
+struct mdns_reflector *mdns_reflector_new(void) {
+    struct mdns_reflector *reflector = reflector_new(NULL);
+    if (reflector) {
+        options_init(&reflector->own_options);
+        reflector->options = &reflector->own_options;
+    }
+    return reflector;
+}
+
+void mdns_reflector_free(struct mdns_reflector *reflector) {
+    if (!reflector)
+        return;
+    struct options *options = reflector->options;
+    handoff_finish(&reflector->handoff, false);
+    if (reflector->handoff_fd >= 0)
+        close(reflector->handoff_fd);
+    if (reflector->handoff_conn.fd >= 0)
+        handoff_conn_close(&reflector->handoff_conn);
+    if (reflector->pipeline)
+        pipeline_stop(reflector->pipeline);
+    close_reflection_zones(options->rz_list6);
+    close_reflection_zones(options->rz_list4);
+    close_relays(options->relays);
+    close_discoveries(options->discoveries);
+    close_ha(options->ha);
+#if defined(__linux__)
+    while (reflector->link_monitors) {
+        struct link_monitor *monitor = reflector->link_monitors;
+        reflector->link_monitors = monitor->next;
+        close(monitor->fd);
+        netns_release(monitor->netns_slot);
+        free(monitor);
+    }
+    if (reflector->igmp_fd >= 0)
+        close(reflector->igmp_fd);
+    if (reflector->mld_fd >= 0)
+        close(reflector->mld_fd);
+#endif
+#if defined(EVFILT_READ)
+    if (reflector->kq >= 0)
+        close(reflector->kq);
+#elif defined(EPOLLIN)
+    if (reflector->epoll_fd >= 0)
+        close(reflector->epoll_fd);
+#endif
+    netns_free_reflection_zones(options->rz_list6);
+    netns_free_reflection_zones(options->rz_list4);
+    free_rewrite_classes(options->rewrite_classes);
+    free_relays(options->relays);
+    free_discoveries(options->discoveries);
+    free_ha(options->ha);
+    free((void *) options->base);
+    options->rz_list6 = options->rz_list4 = NULL;
+    options->rewrite_classes = NULL;
+    options->relays = NULL;
+    options->discoveries = NULL;
+    options->ha = NULL;
+    options->base = NULL;
+    free(reflector);
+}
+
+/// Fail a configuration call made after the reflector started.
+static int check_not_started(const struct mdns_reflector *reflector) {
+    if (reflector->started) {
+        log_msg(LOG_ERR, "the reflector can't be configured after it started");
+        errno = EBUSY;
+        return -1;
+    }
+    return 0;
+}
+
+int mdns_reflector_load_config(struct mdns_reflector *reflector, const char *path) {
+    struct options *options = reflector->options;
+    if (check_not_started(reflector) == -1)
+        return -1;
+    if (options->rz_list6 || options->rz_list4 || options->base) {
+        log_msg(LOG_ERR, "a configuration file must be loaded only once, before zones are added");
+        errno = EINVAL;
+        return -1;
+    }
+    if (strlen(path) >= sizeof(options->config_file)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    // a reload starts over from the options set so far
+    struct options *base = malloc(sizeof(struct options));
+    if (!base) {
+        log_err(LOG_ERR, "can't malloc");
+        return -1;
+    }
+    snprintf(options->config_file, sizeof(options->config_file), "%s", path);
+    *base = *options;
+    options->base = base;
+    if (load_config(path, options) == -1)
+        return -1;
+    log_setlevel(options->log_level);
+    if ((!options->ipv4_only && !check_reflection_zone(options->rz_list6)) ||
+        (!options->ipv6_only && !check_reflection_zone(options->rz_list4)))
+        return -1;
+    return 0;
+}
+
+int mdns_reflector_set_option(struct mdns_reflector *reflector, const char *key, const char *value) {
+    if (check_not_started(reflector) == -1 || set_global_option(reflector->options, key, value) == -1)
+        return -1;
+    log_setlevel(reflector->options->log_level);
+    return 0;
+}
+
+/// Free the zones at the head of a list that were added after `head`.
+static void drop_added_zones(struct reflection_zone **rz_list, struct reflection_zone *head) {
+    while (*rz_list != head) {
+        struct reflection_zone *rz = *rz_list;
+        *rz_list = rz->next;
+        rz->next = NULL;
+        netns_free_reflection_zones(rz);
+    }
+}
+
+int mdns_reflector_add_zone(struct mdns_reflector *reflector, const struct mdns_reflector_zone *zone) {
+    struct options *options = reflector->options;
+    if (check_not_started(reflector) == -1)
+        return -1;
+    const char **settings = calloc(zone->nsettings + 2, sizeof(const char *));
+    size_t interfaces_size = sizeof("interfaces =");
+    for (size_t i = 0; i < zone->ninterfaces; ++i)
+        interfaces_size += 1 + strlen(zone->interfaces[i]);
+    char *interfaces = malloc(interfaces_size);
+    if (!settings || !interfaces) {
+        log_err(LOG_ERR, "can't malloc");
+        free(settings);
+        free(interfaces);
+        return -1;
+    }
+    size_t nsettings = 0;
+    strcpy(interfaces, "interfaces =");
+    for (size_t i = 0; i < zone->ninterfaces; ++i) {
+        strcat(interfaces, " ");
+        strcat(interfaces, zone->interfaces[i]);
+    }
+    if (zone->ninterfaces)
+        settings[nsettings++] = interfaces;
+    if (zone->families == MDNS_REFLECTOR_IPV4)
+        settings[nsettings++] = "family = ipv4";
+    else if (zone->families == MDNS_REFLECTOR_IPV6)
+        settings[nsettings++] = "family = ipv6";
+    for (size_t i = 0; i < zone->nsettings; ++i)
+        settings[nsettings++] = zone->settings[i];
+    struct reflection_zone *head6 = options->rz_list6, *head4 = options->rz_list4;
+    int r = add_zone(options, zone->name ? zone->name : "", settings, nsettings);
+    if (r == 0 && (!check_unique_reflection_ifs(options->rz_list6) ||
+                   !check_unique_reflection_ifs(options->rz_list4))) {
+        log_msg(LOG_ERR, "an interface of zone %s is already in another zone", zone->name);
+        r = -1;
+    }
+    if (r == -1) {
+        drop_added_zones(&options->rz_list6, head6);
+        drop_added_zones(&options->rz_list4, head4);
+    }
+    free(settings);
+    free(interfaces);
+    return r;
+}
+
+int mdns_reflector_start(struct mdns_reflector *reflector) {
+    struct options *options = reflector->options;
+    if (check_not_started(reflector) == -1)
+        return -1;
+    reflector->stats.latency_enabled = options->low_latency || options->latency_stats;
+#if defined(EVFILT_READ)
+    if ((reflector->kq = kqueue()) == -1) {
+        log_err(LOG_ERR, "kqueue");
+        return -1;
+    }
+#elif defined(EPOLLIN)
+    reflector->epoll_fd = epoll_create1(0);
+    if (reflector->epoll_fd == -1) {
+        log_err(LOG_ERR, "epoll_create1");
+        return -1;
+    }
+#endif
+
+    traffic_top_init(&reflector->stats.top, monotonic_ns());
+    if (options->handoff_socket[0]) {
+        if (handoff_connect(&reflector->handoff, options->handoff_socket) == -1)
+            return -1;
+        reflector->took_over = reflector->handoff.fd >= 0;
+    }
+
+    // Create recv_socks and send_socks for IPv6 and IPv4 reflection zones.
+    if (open_reflection_zones(reflector) == -1 || open_relays(reflector) == -1 ||
+        open_discoveries(reflector) == -1 || (options->ha && open_ha(reflector, options->ha) == -1))
+        return -1;
+    pair_dual_stack_ifs(options->rz_list6, options->rz_list4);
+#if defined(__linux__)
+    if (sync_link_monitors(reflector) == -1)
+        return -1;
+    open_listener_monitor(reflector, AF_INET6);
+    open_listener_monitor(reflector, AF_INET);
+#endif
+    if (options->tx_threads) {
+        reflector->pipeline = pipeline_start((unsigned int) options->tx_threads, (size_t) options->tx_ring_size,
+                                             PACKET_MAX, transmit_queued, reflector, &reflector->stats.pipeline);
+        if (!reflector->pipeline)
+            return -1;
+        assign_tx_queues(reflector);
+    }
+    if (options->low_latency) {
+        lowlatency_prefault(reflector->packet_buffer, sizeof(reflector->packet_buffer));
+        reflector->spin_budget_ns = (uint64_t) options->spin_budget_usec * 1000u;
+    }
+    if (options->handoff_socket[0]) {
+        // The instance we replace stops once told; everything is open, so no packet is missed.
+        handoff_finish(&reflector->handoff, true);
+        reflector->handoff_fd = handoff_listen(options->handoff_socket);
+        if (reflector->handoff_fd == -1 ||
+            watch_fd(reflector, reflector->handoff_fd, &reflector->handoff_fd, false) == -1)
+            return -1;
+    }
+    reflector->started = true;
+    reflector->last_end_ns = monotonic_ns();
+    return 0;
+}
+
+int mdns_reflector_fd(const struct mdns_reflector *reflector) {
+#if defined(EVFILT_READ)
+    return reflector->kq;
+#elif defined(EPOLLIN)
+    return reflector->epoll_fd;
+#endif
+}
+
+int mdns_reflector_timeout_ms(const struct mdns_reflector *reflector) {
+    return pending_timeout_ms(reflector);
+}
+
+int mdns_reflector_process(struct mdns_reflector *reflector, unsigned int budget) {
+    if (!reflector->started) {
+        errno = EINVAL;
+        return -1;
+    }
+    return poll_reflector(reflector, 0, 0, budget);
+}
+
+int mdns_reflector_add_interface(struct mdns_reflector *reflector, const char *zone, const char *ifname) {
+    struct options *options = reflector->options;
+    struct reflection_zone *zones[] = {
+            find_reflection_zone(options->rz_list6, zone),
+            find_reflection_zone(options->rz_list4, zone),
+    };
+    const struct reflection_zone *lists[] = {options->rz_list6, options->rz_list4};
+    const int families[] = {AF_INET6, AF_INET};
+    if (!zones[0] && !zones[1]) {
+        log_msg(LOG_ERR, "unknown zone %s", zone);
+        errno = ENOENT;
+        return -1;
+    }
+    struct netns_iftables iftables = {0};
+    int r = -1;
+    struct reflection_if *added[2 * PROTOCOLS];
+    size_t nadded = 0;
+    const struct netns_iftable *table;
+    const struct iftable_entry *entry = netns_iftables_find(&iftables, ifname, &table);
+    if (!entry) {
+        log_msg(LOG_ERR, "unknown interface %s", ifname);
+        errno = ENODEV;
+        goto end;
+    }
+    for (size_t i = 0; i < 2; ++i) {
+        for (unsigned int p = 0; zones[i] && p < PROTOCOLS; ++p) {
+            if ((zones[i]->protocols & 1u << p) &&
+                find_reflection_if(lists[i], table->slot, entry->ifindex, &protocols[p])) {
+                log_msg(LOG_ERR, "interface %s is already in a zone", ifname);
+                errno = EEXIST;
+                goto end;
+            }
+        }
+    }
+    // Transmit threads must not send on interfaces while their queues are reassigned.
+    if (reflector->pipeline)
+        pipeline_quiesce(reflector->pipeline);
+    for (size_t i = 0; i < 2; ++i) {
+        for (unsigned int p = 0; zones[i] && p < PROTOCOLS; ++p) {
+            if (!(zones[i]->protocols & 1u << p))
+                continue;
+            struct reflection_if *rif = netns_new_reflection_if(table, entry, zones[i]);
+            if (!rif) {
+                log_err(LOG_ERR, "can't malloc");
+                goto end;
+            }
+            rif->protocol = &protocols[p];
+            added[nadded++] = rif;
+            if (reflector->started && open_reflection_if(reflector, rif, families[i]) == -1)
+                goto end;
+        }
+    }
+    log_msg(LOG_INFO, "added interface %s to zone %s", ifname, zone);
+    r = 0;
+    end:
+    if (r == -1) {
+        for (size_t i = 0; i < nadded; ++i) {
+            close_reflection_if(added[i]);
+            netns_remove_reflection_if(added[i]);
+        }
+    }
+    if (nadded) {
+        pair_dual_stack_ifs(options->rz_list6, options->rz_list4);
+        if (reflector->pipeline)
+            assign_tx_queues(reflector);
+#if defined(__linux__)
+        if (reflector->started)
+            sync_link_monitors(reflector);
+#endif
+    }
+    netns_iftables_free(&iftables);
+    return r;
+}
+
+int mdns_reflector_remove_interface(struct mdns_reflector *reflector, const char *zone, const char *ifname) {
+    struct options *options = reflector->options;
+    // Responses queued for the interface are sent before it goes away.
+    if (flush_all(reflector) == -1)
+        return -1;
+    size_t removed = 0;
+    struct reflection_zone *zones[] = {
+            find_reflection_zone(options->rz_list6, zone),
+            find_reflection_zone(options->rz_list4, zone),
+    };
+    for (size_t i = 0; i < 2; ++i) {
+        struct reflection_if *rif = zones[i] ? zones[i]->first_if : NULL;
+        while (rif) {
+            struct reflection_if *next = rif->next;
+            if (strcmp(rif->ifname, ifname) == 0) {
+                close_reflection_if(rif);
+                netns_remove_reflection_if(rif);
+                ++removed;
+            }
+            rif = next;
+        }
+    }
+    if (!removed) {
+        log_msg(LOG_ERR, "interface %s is not in zone %s", ifname, zone);
+        errno = ENOENT;
+        return -1;
+    }
+    pair_dual_stack_ifs(options->rz_list6, options->rz_list4);
+    if (reflector->pipeline)
+        assign_tx_queues(reflector);
+#if defined(__linux__)
+    if (reflector->started)
+        sync_link_monitors(reflector);
 #endif
+    log_msg(LOG_INFO, "removed interface %s from zone %s", ifname, zone);
+    return 0;
+}
+
+int mdns_reflector_reload(struct mdns_reflector *reflector) {
+    if (!reflector->started || !reflector->options->config_file[0]) {
+        log_msg(LOG_ERR, "reload: no configuration file was loaded");
+        errno = EINVAL;
+        return -1;
+    }
+    // Only reload between event batches so that no pending event refers to a freed interface.
+    begin_iteration(reflector);
+    loop_event(&reflector->stats.loop, "reload", NULL, monotonic_ns());
+    int r = flush_all(reflector);
+    if (r == 0)
+        r = reload_config(reflector);
+    end_iteration(reflector);
     return r;
 }
+
+void mdns_reflector_dump_stats(struct mdns_reflector *reflector) {
+    const struct options *options = reflector->options;
+    begin_iteration(reflector);
+    loop_event(&reflector->stats.loop, "stats", NULL, monotonic_ns());
+    if (options->heavy_hitters)
+        traffic_top_decay(&reflector->stats.top, half_life_ns(options), monotonic_ns());
+    stats_dump(options, &reflector->stats);
+    loop_mark(&reflector->stats.loop);
+    end_iteration(reflector);
+}
+
+size_t mdns_reflector_get_if_stats(const struct mdns_reflector *reflector, struct mdns_reflector_if_stats *stats,
+                                   size_t max) {
+    const struct reflection_zone *lists[] = {reflector->options->rz_list6, reflector->options->rz_list4};
+    const unsigned int families[] = {MDNS_REFLECTOR_IPV6, MDNS_REFLECTOR_IPV4};
+    size_t n = 0;
+    for (size_t i = 0; i < 2; ++i) {
+        for (const struct reflection_zone *rz = lists[i]; rz; rz = rz->next) {
+            for (const struct reflection_if *rif = rz->first_if; rif; rif = rif->next, ++n) {
+                if (n >= max)
+                    continue;
+                stats[n] = (struct mdns_reflector_if_stats) {
+                        .ifname = rif->ifname,
+                        .zone = rz->name,
+                        .protocol = rif->protocol->name,
+                        .family = families[i],
+                        .rx_packets = rif->stats.rx_packets,
+                        .rx_bytes = rif->stats.rx_bytes,
+                        .tx_packets = stats_load(&rif->stats.tx_packets),
+                        .tx_bytes = stats_load(&rif->stats.tx_bytes),
+                        .tx_dropped = stats_load(&rif->stats.tx_dropped),
+                        .kernel_drops = rif->stats.kernel_drops,
+                };
+            }
+        }
+    }
+    return n;
+}
+
+void mdns_reflector_get_loop_stats(const struct mdns_reflector *reflector, struct mdns_reflector_loop_stats *stats) {
+    const struct loop_stats *loop = &reflector->stats.loop;
+    *stats = (struct mdns_reflector_loop_stats) {
+            .iterations = loop->iterations,
+            .busy_ns = loop->busy_ns,
+            .idle_ns = loop->idle_ns,
+            .longest_iteration_ns = loop->longest_ns,
+            .stalls = loop->stalls,
+    };
+}
@@ -19,7 +19,31 @@
 #ifndef MDNS_REFLECTOR_REFLECTOR_H
 #define MDNS_REFLECTOR_REFLECTOR_H
 
+#include <stdbool.h>
 #include "options.h"
-int run_event_loop(struct options *options);
+#include "mdnsreflector.h"
+
+/// Create a reflector for the daemon, with options parsed from the command line. The zones, relays and other
+/// objects of `options` are freed by mdns_reflector_free(); the structure itself stays with the caller.
+/// \return the reflector, or NULL if out of memory
+struct mdns_reflector *reflector_new(struct options *options);
+
+/// Run one iteration of the event loop: wait for events for up to `timeout_ms`, spinning first in the low-latency
+/// mode, then handle them and due timers.
+/// \param timeout_ms timeout in milliseconds, 0 to poll, or -1 to block
+/// \return 0 on success or -1 on a fatal error
+int reflector_run_once(struct mdns_reflector *reflector, int timeout_ms);
+
+/// \return whether the reflector took over the sockets of another instance when it started
+bool reflector_took_over(const struct mdns_reflector *reflector);
+
+/// \return whether a new instance took over the sockets, so that the reflector must be freed
+bool reflector_handed_off(const struct mdns_reflector *reflector);
+
+/// Make reflector_run_once() return as soon as `fd`, the non-blocking read end of a pipe, becomes readable, and
+/// discard what was written to it. Signal handlers write to the pipe so that a signal is handled even if it arrives
+/// just before the loop waits. Call after mdns_reflector_start(); the caller keeps owning `fd`.
+/// \return 0 on success or -1 on error
+int reflector_watch_wakeup(struct mdns_reflector *reflector, int fd);
 
 #endif //MDNS_REFLECTOR_REFLECTOR_H
@@ -0,0 +1,121 @@
+/*
+    This file is part of mDNS Reflector (mdns-reflector), a lightweight and performant multicast DNS (mDNS) reflector.
+    Copyright (C) 2021 Yuxiang Zhu <me@yux.im>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "relay.h"
+#include "dns.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <netinet/in.h>
+
+#define RELAY_MAGIC0 'm'
+#define RELAY_MAGIC1 'R'
+#define RELAY_FAMILY_IPV4 4
+#define RELAY_FAMILY_IPV6 6
+
+struct relay *new_relay(const char *name, struct relay *list) {
+    struct relay *relay = calloc(1, sizeof(struct relay));
+    if (!relay)
+        return NULL;
+    snprintf(relay->name, sizeof(relay->name), "%s", name);
+    relay->max_datagram = 1400;
+    relay->batch_ms = 5;
+    relay->dedup = true;
+    relay->dedup_ms = 1000;
+    relay->fd = -1;
+    relay->next = list;
+    return relay;
+}
+
+void free_relays(struct relay *list) {
+    while (list) {
+        struct relay *next = list->next;
+        free(list);
+        list = next;
+    }
+}
+
+bool relay_is_echo(struct relay *relay, const void *msg, size_t len, bool inbound, uint64_t now_ns) {
+    uint64_t fingerprint = dns_fingerprint(msg, len);
+    int was_inbound;
+    if (fpcache_find(&relay->fingerprints, fingerprint, now_ns, (uint64_t) relay->dedup_ms * 1000000u, &was_inbound) &&
+        was_inbound != inbound)
+        return true;
+    fpcache_put(&relay->fingerprints, fingerprint, inbound, now_ns);
+    return false;
+}
+
+bool relay_has_room(const struct relay *relay, size_t len) {
+    return relay->batch_count < RELAY_MESSAGES_MAX &&
+           relay->batch_len + RELAY_FRAME_HEADER_SIZE + len <= relay->max_datagram;
+}
+
+void relay_add(struct relay *relay, const void *msg, size_t len, int family) {
+    if (!relay->batch_count) {
+        relay->batch[0] = RELAY_MAGIC0;
+        relay->batch[1] = RELAY_MAGIC1;
+        relay->batch[2] = RELAY_VERSION;
+        relay->batch_len = RELAY_HEADER_SIZE;
+    }
+    uint8_t *frame = relay->batch + relay->batch_len;
+    frame[0] = family == AF_INET6 ? RELAY_FAMILY_IPV6 : RELAY_FAMILY_IPV4;
+    frame[1] = 0;
+    frame[2] = (uint8_t) (len >> 8);
+    frame[3] = (uint8_t) len;
+    memcpy(frame + RELAY_FRAME_HEADER_SIZE, msg, len);
+    relay->batch_len += RELAY_FRAME_HEADER_SIZE + len;
+    relay->batch[3] = (uint8_t) ++relay->batch_count;
+}
+
+void relay_reset_batch(struct relay *relay) {
+    relay->batch_len = 0;
+    relay->batch_count = 0;
+}
+
+int relay_reader_init(struct relay_reader *reader, const uint8_t *datagram, size_t len) {
+    if (len < RELAY_HEADER_SIZE || datagram[0] != RELAY_MAGIC0 || datagram[1] != RELAY_MAGIC1 ||
+        datagram[2] != RELAY_VERSION)
+        return -1;
+    reader->datagram = datagram;
+    reader->len = len;
+    reader->offset = RELAY_HEADER_SIZE;
+    reader->remaining = datagram[3];
+    return 0;
+}
+
+int relay_reader_next(struct relay_reader *reader, const uint8_t **msg, size_t *len, int *family) {
+    if (!reader->remaining)
+        return reader->offset == reader->len ? 0 : -1;
+    if (reader->len - reader->offset < RELAY_FRAME_HEADER_SIZE)
+        return -1;
+    const uint8_t *frame = reader->datagram + reader->offset;
+    size_t msg_len = (size_t) frame[2] << 8 | frame[3];
+    if (reader->len - reader->offset - RELAY_FRAME_HEADER_SIZE < msg_len)
+        return -1;
+    if (frame[0] == RELAY_FAMILY_IPV6)
+        *family = AF_INET6;
+    else if (frame[0] == RELAY_FAMILY_IPV4)
+        *family = AF_INET;
+    else
+        return -1;
+    *msg = frame + RELAY_FRAME_HEADER_SIZE;
+    *len = msg_len;
+    reader->offset += RELAY_FRAME_HEADER_SIZE + msg_len;
+    reader->remaining--;
+    return 1;
+}
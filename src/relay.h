@@ -0,0 +1,121 @@
+/*
+    This file is part of mDNS Reflector (mdns-reflector), a lightweight and performant multicast DNS (mDNS) reflector.
+    Copyright (C) 2021 Yuxiang Zhu <me@yux.im>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef MDNS_REFLECTOR_RELAY_H
+#define MDNS_REFLECTOR_RELAY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include "reflection_zone.h"
+#include "fpcache.h"
+
+#define RELAY_NAME_MAX 32
+/// largest relay datagram; batches are flushed before they grow past `max_datagram`
+#define RELAY_DATAGRAM_MAX 65507
+/// datagram header: two magic bytes, version and message count
+#define RELAY_HEADER_SIZE 4
+#define RELAY_MESSAGES_MAX 255
+/// message header: address family, reserved byte and length
+#define RELAY_FRAME_HEADER_SIZE 4
+#define RELAY_VERSION 1
+
+struct relay_stats {
+    uint64_t tx_datagrams;
+    uint64_t tx_messages;
+    uint64_t tx_bytes;
+    /// datagrams not sent because the send queue was full
+    uint64_t tx_dropped;
+    uint64_t rx_datagrams;
+    uint64_t rx_messages;
+    uint64_t rx_bytes;
+    /// local packets not relayed because the peer sent them recently
+    uint64_t tx_echoes;
+    /// messages from the peer not injected because they were relayed to it recently
+    uint64_t rx_echoes;
+    /// datagrams from unknown sources or with a malformed framing
+    uint64_t rx_errors;
+};
+
+/// A unicast UDP link to a remote reflector. Packets reflected in the zone are batched and sent to the peer;
+/// packets received from the peer are injected into the zone of the same name.
+struct relay {
+    char name[RELAY_NAME_MAX];
+    /// index of the relayed zone, resolved when the configuration is loaded
+    unsigned int zone_index;
+    char zone_name[ZONE_NAME_MAX];
+    struct sockaddr_storage local;
+    struct sockaddr_storage peer;
+    /// largest datagram to send
+    size_t max_datagram;
+    /// how long to collect messages before sending a batch
+    int batch_ms;
+    /// drop messages that went the other way over the relay within `dedup_ms`
+    bool dedup;
+    int dedup_ms;
+    int fd;
+    /// whether a batch is waiting to be sent, and until when
+    bool pending;
+    uint64_t deadline_ns;
+    size_t batch_len;
+    unsigned int batch_count;
+    uint8_t batch[RELAY_DATAGRAM_MAX];
+    /// messages relayed recently, tagged with whether they were received from the peer
+    struct fpcache fingerprints;
+    struct relay_stats stats;
+    struct relay *next;
+};
+
+/// Iterates over the messages of a received relay datagram.
+struct relay_reader {
+    const uint8_t *datagram;
+    size_t len;
+    size_t offset;
+    unsigned int remaining;
+};
+
+struct relay *new_relay(const char *name, struct relay *list);
+
+void free_relays(struct relay *list);
+
+/// Check whether a message is an echo of one that recently went the other way over the relay, and remember it
+/// otherwise. Repeats in the same direction, such as query retransmissions and probes, are not echoes.
+/// \param inbound whether the message was received from the peer
+/// \return true if the message is an echo
+bool relay_is_echo(struct relay *relay, const void *msg, size_t len, bool inbound, uint64_t now_ns);
+
+/// \return true if a message fits in the current batch
+bool relay_has_room(const struct relay *relay, size_t len);
+
+/// Append a message to the current batch. The caller must check relay_has_room() first, unless the batch is empty.
+void relay_add(struct relay *relay, const void *msg, size_t len, int family);
+
+/// Clear the current batch after it was sent.
+void relay_reset_batch(struct relay *relay);
+
+/// Start reading a relay datagram.
+/// \return 0 on success or -1 if the header is invalid
+int relay_reader_init(struct relay_reader *reader, const uint8_t *datagram, size_t len);
+
+/// Get the next message of a relay datagram.
+/// \param family address family the message was received with
+/// \return 1 if a message was found, 0 at the end of the datagram, or -1 if it is malformed
+int relay_reader_next(struct relay_reader *reader, const uint8_t **msg, size_t *len, int *family);
+
+#endif //MDNS_REFLECTOR_RELAY_H
@@ -0,0 +1,113 @@
+/*
+    This file is part of mDNS Reflector (mdns-reflector), a lightweight and performant multicast DNS (mDNS) reflector.
+    Copyright (C) 2021 Yuxiang Zhu <me@yux.im>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "rewrite.h"
+#include "dns.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+struct rewrite_class *new_rewrite_class(unsigned int index, const char *name, struct rewrite_class *list) {
+    struct rewrite_class *rc = calloc(1, sizeof(struct rewrite_class));
+    if (!rc)
+        return NULL;
+    rc->index = index;
+    snprintf(rc->name, REWRITE_CLASS_NAME_MAX, "%s", name);
+    rc->next = list;
+    return rc;
+}
+
+void free_rewrite_classes(struct rewrite_class *list) {
+    while (list) {
+        struct rewrite_class *rc = list;
+        list = rc->next;
+        free(rc->ifnames);
+        free(rc);
+    }
+}
+
+int parse_ipv4_prefix(const char *s, struct ipv4_prefix *prefix) {
+    char addr_buf[INET_ADDRSTRLEN];
+    const char *slash = strchr(s, '/');
+    size_t addr_len = slash ? (size_t) (slash - s) : strlen(s);
+    if (addr_len >= sizeof(addr_buf))
+        return -1;
+    memcpy(addr_buf, s, addr_len);
+    addr_buf[addr_len] = '\0';
+    struct in_addr addr;
+    if (inet_pton(AF_INET, addr_buf, &addr) != 1)
+        return -1;
+    unsigned long bits = 32;
+    if (slash) {
+        char *end;
+        bits = strtoul(slash + 1, &end, 10);
+        if (end == slash + 1 || *end || bits > 32)
+            return -1;
+    }
+    prefix->mask = bits ? UINT32_MAX << (32 - bits) : 0;
+    prefix->addr = ntohl(addr.s_addr) & prefix->mask;
+    return 0;
+}
+
+static bool is_dropped(const struct rewrite_class *rc, const uint8_t *msg, const struct dns_record *record) {
+    if (record->section == DNS_SECTION_QUESTION || (record->rrclass & DNS_CLASS_MASK) != 1)
+        return false;
+    const uint8_t *rdata = msg + record->rdata;
+    if (record->type == DNS_TYPE_AAAA && record->rdlength == 16) {
+        if (rc->drop_aaaa_link_local && rdata[0] == 0xfe && (rdata[1] & 0xc0) == 0x80)
+            return true;
+        if (rc->drop_aaaa_ula && (rdata[0] & 0xfe) == 0xfc)
+            return true;
+    } else if (record->type == DNS_TYPE_A && record->rdlength == 4 && rc->nprefixes4) {
+        uint32_t addr = (uint32_t) rdata[0] << 24 | (uint32_t) rdata[1] << 16 | (uint32_t) rdata[2] << 8 | rdata[3];
+        for (size_t i = 0; i < rc->nprefixes4; ++i) {
+            if ((addr & rc->prefixes4[i].mask) == rc->prefixes4[i].addr)
+                return false;
+        }
+        return true;
+    }
+    return false;
+}
+
+size_t rewrite_message(const struct rewrite_class *rc, const uint8_t *msg, size_t len, uint8_t *out, size_t cap,
+                       unsigned int *dropped) {
+    struct dns_parser parser;
+    struct dns_record record;
+    *dropped = 0;
+    if (dns_parser_init(&parser, msg, len) == -1 || !(parser.header.flags & DNS_FLAG_QR))
+        return 0;
+    // Scan first: messages without matching records are forwarded as they are, without any copy.
+    int r;
+    while ((r = dns_parser_next(&parser, &record)) == 1) {
+        if (is_dropped(rc, msg, &record))
+            ++*dropped;
+    }
+    if (r == -1 || !*dropped)
+        return 0;
+    struct dns_writer writer;
+    dns_writer_init(&writer, out, cap);
+    dns_parser_init(&parser, msg, len);
+    while (dns_parser_next(&parser, &record) == 1) {
+        if (is_dropped(rc, msg, &record))
+            continue;
+        if (dns_writer_record(&writer, msg, len, &record) < 0)
+            return 0;
+    }
+    return dns_writer_finish(&writer, parser.header.id, parser.header.flags);
+}
@@ -0,0 +1,75 @@
+/*
+    This file is part of mDNS Reflector (mdns-reflector), a lightweight and performant multicast DNS (mDNS) reflector.
+    Copyright (C) 2021 Yuxiang Zhu <me@yux.im>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef MDNS_REFLECTOR_REWRITE_H
+#define MDNS_REFLECTOR_REWRITE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <net/if.h>
+#include "reflection_zone.h"
+
+#define REWRITE_CLASSES_MAX 8
+#define REWRITE_CLASS_NAME_MAX 32
+#define REWRITE_PREFIXES_MAX 16
+
+struct ipv4_prefix {
+    /// network address in host byte order
+    uint32_t addr;
+    uint32_t mask;
+};
+
+/// A destination class: a set of record rewriting rules shared by one or more destination interfaces.
+/// Each reflected response is rewritten at most once per class, not once per interface.
+struct rewrite_class {
+    unsigned int index;
+    char name[REWRITE_CLASS_NAME_MAX];
+    /// drop AAAA records in fe80::/10
+    bool drop_aaaa_link_local;
+    /// drop AAAA records in fc00::/7
+    bool drop_aaaa_ula;
+    /// if not empty, drop A records outside these prefixes
+    size_t nprefixes4;
+    struct ipv4_prefix prefixes4[REWRITE_PREFIXES_MAX];
+    size_t nifnames;
+    char (*ifnames)[IFSPEC_MAX];
+    struct rewrite_class *next;
+};
+
+struct rewrite_class *new_rewrite_class(unsigned int index, const char *name, struct rewrite_class *list);
+
+void free_rewrite_classes(struct rewrite_class *list);
+
+/// Parse an IPv4 prefix like "192.168.1.0/24".
+/// \return 0 on success or -1 on error
+int parse_ipv4_prefix(const char *s, struct ipv4_prefix *prefix);
+
+/// Rewrite a response for a destination class by dropping records that are unreachable there.
+/// Header counts are updated and all names are re-encoded, so compression pointers stay valid.
+/// \param rc destination class
+/// \param msg original message
+/// \param len length of the original message
+/// \param out output buffer
+/// \param cap capacity of the output buffer
+/// \param dropped number of dropped records
+/// \return length of the rewritten message, or 0 if the original should be forwarded unchanged
+size_t rewrite_message(const struct rewrite_class *rc, const uint8_t *msg, size_t len, uint8_t *out, size_t cap,
+                       unsigned int *dropped);
+
+#endif //MDNS_REFLECTOR_REWRITE_H
@@ -0,0 +1,113 @@
+/*
+    This file is part of mDNS Reflector (mdns-reflector), a lightweight and performant multicast DNS (mDNS) reflector.
+    Copyright (C) 2021 Yuxiang Zhu <me@yux.im>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "sdnotify.h"
+#include "logging.h"
+#include "timeutil.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <stddef.h>
+
+/// Parse a decimal number from the environment.
+/// \return true if the variable is set to a number
+static bool getenv_u64(const char *name, uint64_t *value) {
+    const char *s = getenv(name);
+    if (!s || !*s)
+        return false;
+    char *end;
+    errno = 0;
+    unsigned long long v = strtoull(s, &end, 10);
+    if (errno || *end)
+        return false;
+    *value = v;
+    return true;
+}
+
+int sdnotify_open(struct sdnotify *notify, uint64_t now_ns) {
+    memset(notify, 0, sizeof(*notify));
+    notify->fd = -1;
+    const char *path = getenv("NOTIFY_SOCKET");
+    if (!path || !*path)
+        return 0;
+    size_t len = strlen(path);
+    if ((path[0] != '/' && path[0] != '@') || len >= sizeof(notify->addr.sun_path)) {
+        log_msg(LOG_ERR, "unsupported NOTIFY_SOCKET: %s", path);
+        return -1;
+    }
+    notify->addr.sun_family = AF_UNIX;
+    memcpy(notify->addr.sun_path, path, len);
+    // a leading '@' names a socket in the abstract namespace
+    if (path[0] == '@')
+        notify->addr.sun_path[0] = '\0';
+    notify->addr_len = (socklen_t) (offsetof(struct sockaddr_un, sun_path) + len + (path[0] == '@' ? 0 : 1));
+    notify->fd = socket(AF_UNIX, SOCK_DGRAM, 0);
+    if (notify->fd == -1) {
+        log_err(LOG_ERR, "socket");
+        return -1;
+    }
+    if (fcntl(notify->fd, F_SETFD, FD_CLOEXEC) == -1 || fcntl(notify->fd, F_SETFL, O_NONBLOCK) == -1) {
+        log_err(LOG_ERR, "fcntl");
+        goto fail;
+    }
+    uint64_t usec, pid;
+    // WATCHDOG_PID names the process the watchdog is meant for, in case the variables were inherited.
+    if (getenv_u64("WATCHDOG_USEC", &usec) && usec &&
+        (!getenv_u64("WATCHDOG_PID", &pid) || pid == (uint64_t) getpid())) {
+        notify->watchdog_interval_ns = usec * 1000u;
+        notify->watchdog_deadline_ns = now_ns;
+        log_msg(LOG_INFO, "systemd watchdog enabled: interval %llu ms", (unsigned long long) (usec / 1000u));
+    }
+    return 0;
+
+    fail:
+    close(notify->fd);
+    notify->fd = -1;
+    return -1;
+}
+
+void sdnotify_close(struct sdnotify *notify) {
+    if (notify->fd >= 0)
+        close(notify->fd);
+    notify->fd = -1;
+}
+
+void sdnotify_send(const struct sdnotify *notify, const char *state) {
+    if (notify->fd < 0)
+        return;
+    if (sendto(notify->fd, state, strlen(state), 0, (const struct sockaddr *) &notify->addr, notify->addr_len) == -1)
+        log_err(LOG_WARNING, "can't notify service manager of %s", state);
+}
+
+void sdnotify_reloading(const struct sdnotify *notify) {
+    char state[64];
+    // the service manager requires the time of the reload request to tell it from earlier reloads
+    snprintf(state, sizeof(state), "RELOADING=1\nMONOTONIC_USEC=%llu", (unsigned long long) (monotonic_ns() / 1000u));
+    sdnotify_send(notify, state);
+}
+
+void sdnotify_watchdog(struct sdnotify *notify, uint64_t now_ns) {
+    if (!sdnotify_watchdog_enabled(notify) || now_ns < notify->watchdog_deadline_ns)
+        return;
+    sdnotify_send(notify, "WATCHDOG=1");
+    notify->watchdog_deadline_ns = now_ns + notify->watchdog_interval_ns / 2;
+}
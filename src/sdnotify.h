@@ -0,0 +1,59 @@
+/*
+    This file is part of mDNS Reflector (mdns-reflector), a lightweight and performant multicast DNS (mDNS) reflector.
+    Copyright (C) 2021 Yuxiang Zhu <me@yux.im>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef MDNS_REFLECTOR_SDNOTIFY_H
+#define MDNS_REFLECTOR_SDNOTIFY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+/// Connection to the service manager's notification socket, as used by systemd's sd_notify(3).
+struct sdnotify {
+    /// datagram socket, or -1 if not started by a service manager listening for notifications
+    int fd;
+    struct sockaddr_un addr;
+    socklen_t addr_len;
+    /// interval at which the service manager expects a keep-alive, or 0 if the watchdog is not enabled
+    uint64_t watchdog_interval_ns;
+    /// when the next keep-alive is due
+    uint64_t watchdog_deadline_ns;
+};
+
+/// Connect to the notification socket named by the NOTIFY_SOCKET environment variable, if any, and enable the
+/// watchdog if WATCHDOG_USEC is set for this process.
+/// \return 0 on success, including if there is no socket, or -1 on error
+int sdnotify_open(struct sdnotify *notify, uint64_t now_ns);
+
+void sdnotify_close(struct sdnotify *notify);
+
+/// Send a state change, such as "READY=1". Does nothing if there is no notification socket.
+void sdnotify_send(const struct sdnotify *notify, const char *state);
+
+/// Tell the service manager that reloading started; "READY=1" tells it that reloading finished.
+void sdnotify_reloading(const struct sdnotify *notify);
+
+/// Send a watchdog keep-alive if one is due. Keep-alives are sent at half the watchdog interval.
+void sdnotify_watchdog(struct sdnotify *notify, uint64_t now_ns);
+
+static inline bool sdnotify_watchdog_enabled(const struct sdnotify *notify) {
+    return notify->fd >= 0 && notify->watchdog_interval_ns;
+}
+
+#endif //MDNS_REFLECTOR_SDNOTIFY_H
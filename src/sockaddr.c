@@ -0,0 +1,120 @@
+/*
+    This file is part of mDNS Reflector (mdns-reflector), a lightweight and performant multicast DNS (mDNS) reflector.
+    Copyright (C) 2021 Yuxiang Zhu <me@yux.im>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "sockaddr.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <arpa/inet.h>
+
+uint16_t sockaddr_port(const struct sockaddr_storage *sa) {
+    if (sa->ss_family == AF_INET6)
+        return ntohs(((const struct sockaddr_in6 *) sa)->sin6_port);
+    if (sa->ss_family == AF_INET)
+        return ntohs(((const struct sockaddr_in *) sa)->sin_port);
+    return 0;
+}
+
+const char *sockaddr_storage_to_string(const struct sockaddr_storage *sa) {
+    static __thread char buffer[INET6_ADDRSTRLEN + 2 + 1 + 5 + 1 + 10];
+    uint16_t port;
+    if (sa->ss_family == AF_INET6) {
+        struct sockaddr_in6 *sa6 = (struct sockaddr_in6 *) sa;
+        char addr_buf[INET6_ADDRSTRLEN];
+        if (inet_ntop(AF_INET6, &sa6->sin6_addr, addr_buf, sizeof(addr_buf)) == NULL) {
+            return NULL;
+        }
+        port = ntohs(sa6->sin6_port);
+        if (IN6_IS_ADDR_LINKLOCAL(&sa6->sin6_addr) || IN6_IS_ADDR_MC_LINKLOCAL(&sa6->sin6_addr)) {
+            snprintf(buffer, sizeof(buffer), "[%s%%%u]:%u", addr_buf, sa6->sin6_scope_id, port);
+        } else {
+            snprintf(buffer, sizeof(buffer), "[%s]:%u", addr_buf, port);
+        }
+    } else if (sa->ss_family == AF_INET) {
+        struct sockaddr_in *sa4 = (struct sockaddr_in *) sa;
+        char addr_buf[INET_ADDRSTRLEN];
+        if (inet_ntop(AF_INET, &sa4->sin_addr, addr_buf, sizeof(addr_buf)) == NULL) {
+            return NULL;
+        }
+        port = ntohs(sa4->sin_port);
+        snprintf(buffer, sizeof(buffer), "%s:%u", addr_buf, port);
+    } else {
+        return NULL;
+    }
+    return buffer;
+}
+
+int sockaddr_parse(const char *s, struct sockaddr_storage *sa) {
+    char addr[INET6_ADDRSTRLEN];
+    const char *port_str;
+    bool ipv6 = *s == '[';
+    if (ipv6) {
+        const char *end = strchr(s, ']');
+        if (!end || end[1] != ':' || (size_t) (end - s - 1) >= sizeof(addr))
+            return -1;
+        memcpy(addr, s + 1, (size_t) (end - s - 1));
+        addr[end - s - 1] = '\0';
+        port_str = end + 2;
+    } else {
+        const char *colon = strchr(s, ':');
+        if (!colon || (size_t) (colon - s) >= sizeof(addr))
+            return -1;
+        memcpy(addr, s, (size_t) (colon - s));
+        addr[colon - s] = '\0';
+        port_str = colon + 1;
+    }
+    char *end;
+    errno = 0;
+    unsigned long port = strtoul(port_str, &end, 10);
+    if (errno || end == port_str || *end || port == 0 || port > 65535)
+        return -1;
+    memset(sa, 0, sizeof(*sa));
+    if (ipv6) {
+        struct sockaddr_in6 *sa6 = (struct sockaddr_in6 *) sa;
+        sa6->sin6_family = AF_INET6;
+        sa6->sin6_port = htons((uint16_t) port);
+        if (inet_pton(AF_INET6, addr, &sa6->sin6_addr) != 1)
+            return -1;
+    } else {
+        struct sockaddr_in *sa4 = (struct sockaddr_in *) sa;
+        sa4->sin_family = AF_INET;
+        sa4->sin_port = htons((uint16_t) port);
+        if (inet_pton(AF_INET, addr, &sa4->sin_addr) != 1)
+            return -1;
+    }
+    return 0;
+}
+
+socklen_t sockaddr_len(const struct sockaddr_storage *sa) {
+    return sa->ss_family == AF_INET6 ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in);
+}
+
+bool sockaddr_equal(const struct sockaddr_storage *a, const struct sockaddr_storage *b) {
+    if (a->ss_family != b->ss_family)
+        return false;
+    if (a->ss_family == AF_INET6) {
+        const struct sockaddr_in6 *a6 = (const struct sockaddr_in6 *) a, *b6 = (const struct sockaddr_in6 *) b;
+        return a6->sin6_port == b6->sin6_port && memcmp(&a6->sin6_addr, &b6->sin6_addr, 16) == 0;
+    }
+    if (a->ss_family == AF_INET) {
+        const struct sockaddr_in *a4 = (const struct sockaddr_in *) a, *b4 = (const struct sockaddr_in *) b;
+        return a4->sin_port == b4->sin_port && a4->sin_addr.s_addr == b4->sin_addr.s_addr;
+    }
+    return false;
+}
@@ -0,0 +1,44 @@
+/*
+    This file is part of mDNS Reflector (mdns-reflector), a lightweight and performant multicast DNS (mDNS) reflector.
+    Copyright (C) 2021 Yuxiang Zhu <me@yux.im>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef MDNS_REFLECTOR_SOCKADDR_H
+#define MDNS_REFLECTOR_SOCKADDR_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/socket.h>
+
+/// Get the port of an IPv4 or IPv6 socket address in host byte order.
+/// \return the port, or 0 for other address families
+uint16_t sockaddr_port(const struct sockaddr_storage *sa);
+
+/// Format an IPv4 or IPv6 socket address as "addr:port" or "[addr%scope]:port".
+/// \return a thread-local buffer, or NULL for other address families
+const char *sockaddr_storage_to_string(const struct sockaddr_storage *sa);
+
+/// Parse a numeric socket address: "192.0.2.1:5380" or "[2001:db8::1]:5380".
+/// \return 0 on success or -1 on error
+int sockaddr_parse(const char *s, struct sockaddr_storage *sa);
+
+/// \return length of an IPv4 or IPv6 socket address
+socklen_t sockaddr_len(const struct sockaddr_storage *sa);
+
+/// Compare the address and port of two IPv4 or IPv6 socket addresses.
+bool sockaddr_equal(const struct sockaddr_storage *a, const struct sockaddr_storage *b);
+
+#endif //MDNS_REFLECTOR_SOCKADDR_H
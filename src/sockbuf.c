@@ -0,0 +1,74 @@
+/*
+    This file is part of mDNS Reflector (mdns-reflector), a lightweight and performant multicast DNS (mDNS) reflector.
+    Copyright (C) 2021 Yuxiang Zhu <me@yux.im>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "sockbuf.h"
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+
+#if defined(__linux__)
+
+#include <linux/sockios.h>
+
+#endif
+
+int sockbuf_get(int fd, int optname) {
+    int size;
+    socklen_t len = sizeof(size);
+    if (getsockopt(fd, SOL_SOCKET, optname, &size, &len) == -1)
+        return -1;
+    return size;
+}
+
+int sockbuf_set(int fd, int optname, int size) {
+    int r = -1;
+#if defined(SO_RCVBUFFORCE) && defined(SO_SNDBUFFORCE)
+    // Requires CAP_NET_ADMIN; falls back to the unprivileged option capped by net.core.[rw]mem_max.
+    r = setsockopt(fd, SOL_SOCKET, optname == SO_RCVBUF ? SO_RCVBUFFORCE : SO_SNDBUFFORCE, &size, sizeof(size));
+#endif
+    if (r == -1 && setsockopt(fd, SOL_SOCKET, optname, &size, sizeof(size)) == -1)
+        return -1;
+    return sockbuf_get(fd, optname);
+}
+
+bool sockbuf_grow(int fd, int optname, int *current, int max) {
+    if (*current <= 0 || *current >= max)
+        return false;
+#if defined(__linux__)
+    // Linux reports twice the requested size to account for bookkeeping overhead.
+    int requested = *current > max / 2 ? max / 2 : *current;
+#else
+    int requested = *current > max / 2 ? max : *current * 2;
+#endif
+    int size = sockbuf_set(fd, optname, requested);
+    if (size <= *current)
+        return false;
+    *current = size;
+    return true;
+}
+
+int sockbuf_queued(int fd, bool output) {
+    int n;
+#if defined(SIOCINQ) && defined(SIOCOUTQ)
+    if (ioctl(fd, output ? SIOCOUTQ : SIOCINQ, &n) == -1)
+        return -1;
+#else
+    if (output || ioctl(fd, FIONREAD, &n) == -1)
+        return -1;
+#endif
+    return n;
+}
@@ -0,0 +1,51 @@
+/*
+    This file is part of mDNS Reflector (mdns-reflector), a lightweight and performant multicast DNS (mDNS) reflector.
+    Copyright (C) 2021 Yuxiang Zhu <me@yux.im>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef MDNS_REFLECTOR_SOCKBUF_H
+#define MDNS_REFLECTOR_SOCKBUF_H
+
+#include <stdbool.h>
+
+/// Get the size of a socket buffer.
+/// \param fd socket fd
+/// \param optname SO_RCVBUF or SO_SNDBUF
+/// \return buffer size as reported by the kernel, or -1 on error
+int sockbuf_get(int fd, int optname);
+
+/// Set the size of a socket buffer. If the process is privileged, the system-wide maximum is bypassed.
+/// \param fd socket fd
+/// \param optname SO_RCVBUF or SO_SNDBUF
+/// \param size requested size
+/// \return buffer size as reported by the kernel, or -1 on error
+int sockbuf_set(int fd, int optname, int size);
+
+/// Double a socket buffer, up to `max` bytes.
+/// \param fd socket fd
+/// \param optname SO_RCVBUF or SO_SNDBUF
+/// \param current current size as reported by the kernel; updated on success
+/// \param max maximum size
+/// \return true if the buffer grew
+bool sockbuf_grow(int fd, int optname, int *current, int max);
+
+/// Get the number of bytes queued in a socket.
+/// \param fd socket fd
+/// \param output false for the receive queue, true for the send queue
+/// \return queued bytes, or -1 if unsupported or on error
+int sockbuf_queued(int fd, bool output);
+
+#endif //MDNS_REFLECTOR_SOCKBUF_H
@@ -0,0 +1,79 @@
+/*
+    This file is part of mDNS Reflector (mdns-reflector), a lightweight and performant multicast DNS (mDNS) reflector.
+    Copyright (C) 2021 Yuxiang Zhu <me@yux.im>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "split.h"
+#include "dns.h"
+
+/// Close the message being written and record it.
+static void finish_message(struct split *split, struct dns_writer *writer, uint16_t id, uint16_t flags) {
+    size_t offset = (size_t) (writer->buf - split->arena);
+    split->messages[split->nmessages].offset = offset;
+    split->messages[split->nmessages].len = dns_writer_finish(writer, id, flags);
+    split->nmessages++;
+}
+
+/// Start the next message after the ones written so far.
+/// \return 0 on success or -1 if the arena or the message table is full
+static int start_message(struct split *split, struct dns_writer *writer, size_t max_size) {
+    size_t used = 0;
+    if (split->nmessages)
+        used = split->messages[split->nmessages - 1].offset + split->messages[split->nmessages - 1].len;
+    if (split->nmessages == SPLIT_MESSAGES_MAX || SPLIT_ARENA_SIZE - used < DNS_HEADER_SIZE)
+        return -1;
+    size_t cap = SPLIT_ARENA_SIZE - used < max_size ? SPLIT_ARENA_SIZE - used : max_size;
+    dns_writer_init(writer, split->arena + used, cap);
+    return 0;
+}
+
+static unsigned int written_records(const struct dns_writer *writer) {
+    unsigned int n = 0;
+    for (unsigned int i = 0; i < DNS_SECTIONS; ++i)
+        n += writer->counts[i];
+    return n;
+}
+
+int split_message(struct split *split, const uint8_t *msg, size_t len, size_t max_size) {
+    struct dns_parser parser;
+    struct dns_record record;
+    struct dns_writer writer;
+    split->nmessages = 0;
+    if (dns_parser_init(&parser, msg, len) == -1 || start_message(split, &writer, max_size) == -1)
+        return -1;
+    uint16_t id = parser.header.id;
+    uint16_t flags = parser.header.flags;
+    bool query = !(flags & DNS_FLAG_QR);
+    int r;
+    while ((r = dns_parser_next(&parser, &record)) == 1) {
+        int w = dns_writer_record(&writer, msg, len, &record);
+        if (w == -1) {
+            // the questions of a query must stay together in the first message
+            if (!written_records(&writer) || (query && record.section == DNS_SECTION_QUESTION))
+                return -1;
+            finish_message(split, &writer, id, query ? (uint16_t) (flags | DNS_FLAG_TC) : flags);
+            if (start_message(split, &writer, max_size) == -1)
+                return -1;
+            w = dns_writer_record(&writer, msg, len, &record);
+        }
+        if (w < 0)
+            return -1;
+    }
+    if (r == -1)
+        return -1;
+    finish_message(split, &writer, id, flags);
+    return (int) split->nmessages;
+}
@@ -0,0 +1,47 @@
+/*
+    This file is part of mDNS Reflector (mdns-reflector), a lightweight and performant multicast DNS (mDNS) reflector.
+    Copyright (C) 2021 Yuxiang Zhu <me@yux.im>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef MDNS_REFLECTOR_SPLIT_H
+#define MDNS_REFLECTOR_SPLIT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/// room for the messages an oversized packet is split into; names compress less across several messages
+#define SPLIT_ARENA_SIZE 32768
+#define SPLIT_MESSAGES_MAX 64
+
+/// Messages that one oversized message was split into, so that none of them needs IP fragmentation.
+struct split {
+    size_t nmessages;
+    struct {
+        size_t offset;
+        size_t len;
+    } messages[SPLIT_MESSAGES_MAX];
+    uint8_t arena[SPLIT_ARENA_SIZE];
+};
+
+/// Split a message at record boundaries into messages of at most `max_size` bytes, re-encoding names.
+/// Responses are split into responses with the same header. Queries follow the known-answer rules of RFC 6762
+/// section 7.2: the first message carries all questions, later ones only known answers, and all but the last have
+/// the TC bit set.
+/// \return number of messages, or -1 if the message is malformed or a record (or the questions of a query) don't
+///         fit in a message by themselves
+int split_message(struct split *split, const uint8_t *msg, size_t len, size_t max_size);
+
+#endif //MDNS_REFLECTOR_SPLIT_H
@@ -0,0 +1,39 @@
+/*
+    This file is part of mDNS Reflector (mdns-reflector), a lightweight and performant multicast DNS (mDNS) reflector.
+    Copyright (C) 2021 Yuxiang Zhu <me@yux.im>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "spsc.h"
+#include <stdlib.h>
+
+int spsc_ring_init(struct spsc_ring *ring, size_t capacity, size_t entry_size) {
+    memset(ring, 0, sizeof(*ring));
+    if (!capacity || (capacity & (capacity - 1)))
+        return -1;
+    ring->entries = calloc(capacity, entry_size);
+    if (!ring->entries)
+        return -1;
+    ring->capacity = capacity;
+    ring->entry_size = entry_size;
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    return 0;
+}
+
+void spsc_ring_free(struct spsc_ring *ring) {
+    free(ring->entries);
+    ring->entries = NULL;
+}
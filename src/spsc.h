@@ -0,0 +1,93 @@
+/*
+    This file is part of mDNS Reflector (mdns-reflector), a lightweight and performant multicast DNS (mDNS) reflector.
+    Copyright (C) 2021 Yuxiang Zhu <me@yux.im>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef MDNS_REFLECTOR_SPSC_H
+#define MDNS_REFLECTOR_SPSC_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define SPSC_CACHE_LINE 64
+
+/// Lock-free ring of fixed-size entries between exactly one producer thread and one consumer thread.
+/// Positions only grow; an entry is at `position & (capacity - 1)`.
+struct spsc_ring {
+    size_t capacity;
+    size_t entry_size;
+    uint8_t *entries;
+    char pad0[SPSC_CACHE_LINE];
+    /// next position to write, advanced by the producer
+    atomic_size_t head;
+    /// producer's copy of `tail`, refreshed only when the ring looks full
+    size_t tail_cache;
+    char pad1[SPSC_CACHE_LINE];
+    /// next position to read, advanced by the consumer after it is done with the entry
+    atomic_size_t tail;
+    /// consumer's copy of `head`, refreshed only when the ring looks empty
+    size_t head_cache;
+    char pad2[SPSC_CACHE_LINE];
+};
+
+/// \param capacity number of entries, a power of two
+/// \return 0 on success or -1 on error
+int spsc_ring_init(struct spsc_ring *ring, size_t capacity, size_t entry_size);
+
+void spsc_ring_free(struct spsc_ring *ring);
+
+/// Append an entry. Producer only.
+/// \return false if the ring is full
+static inline bool spsc_ring_push(struct spsc_ring *ring, const void *entry) {
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    if (head - ring->tail_cache == ring->capacity) {
+        ring->tail_cache = atomic_load_explicit(&ring->tail, memory_order_acquire);
+        if (head - ring->tail_cache == ring->capacity)
+            return false;
+    }
+    memcpy(ring->entries + (head & (ring->capacity - 1)) * ring->entry_size, entry, ring->entry_size);
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+    return true;
+}
+
+/// Look at the oldest entry without removing it. Consumer only.
+/// \return the entry, or NULL if the ring is empty
+static inline void *spsc_ring_peek(struct spsc_ring *ring) {
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    if (tail == ring->head_cache) {
+        ring->head_cache = atomic_load_explicit(&ring->head, memory_order_acquire);
+        if (tail == ring->head_cache)
+            return NULL;
+    }
+    return ring->entries + (tail & (ring->capacity - 1)) * ring->entry_size;
+}
+
+/// Remove the entry returned by spsc_ring_peek(). Consumer only.
+static inline void spsc_ring_consume(struct spsc_ring *ring) {
+    atomic_store_explicit(&ring->tail, atomic_load_explicit(&ring->tail, memory_order_relaxed) + 1,
+                          memory_order_release);
+}
+
+/// \return number of entries in the ring; exact for either side while the other one is idle
+static inline size_t spsc_ring_depth(struct spsc_ring *ring) {
+    return atomic_load_explicit(&ring->head, memory_order_acquire) -
+           atomic_load_explicit(&ring->tail, memory_order_acquire);
+}
+
+#endif //MDNS_REFLECTOR_SPSC_H
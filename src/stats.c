@@ -0,0 +1,276 @@
+/*
+    This file is part of mDNS Reflector (mdns-reflector), a lightweight and performant multicast DNS (mDNS) reflector.
+    Copyright (C) 2021 Yuxiang Zhu <me@yux.im>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "stats.h"
+#include "logging.h"
+#include "reflection_zone.h"
+#include "sockbuf.h"
+#include "rewrite.h"
+#include "hosttable.h"
+#include "relay.h"
+#include "discovery.h"
+#include "ha.h"
+#include "interest.h"
+#include "sockaddr.h"
+#include "timeutil.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <syslog.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+
+struct stats_writer {
+    FILE *file;
+};
+
+static void stats_printf(struct stats_writer *writer, const char *fmt, ...) {
+    char buffer[1024];
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(buffer, sizeof(buffer), fmt, ap);
+    va_end(ap);
+    if (writer->file)
+        fprintf(writer->file, "%s\n", buffer);
+    else
+        log_force(LOG_NOTICE, "stats: %s", buffer);
+}
+
+static void dump_reflection_zones(struct stats_writer *writer, const struct options *options,
+                                  const struct reflection_zone *rz_list,
+                                  const char *family) {
+    for (const struct reflection_zone *rz = rz_list; rz; rz = rz->next) {
+        for (const struct reflection_if *rif = rz->first_if; rif; rif = rif->next) {
+            const struct if_stats *s = &rif->stats;
+            stats_printf(writer, "interface=%s family=%s protocol=%s zone=%s rx_packets=%llu rx_bytes=%llu "
+                                 "tx_packets=%llu tx_bytes=%llu tx_dropped=%llu kernel_drops=%llu "
+                                 "rx_queue=%d tx_queue=%d rcvbuf=%d sndbuf=%d rcvbuf_grows=%llu sndbuf_grows=%llu",
+                         rif->ifname, family, rif->protocol->name, rz->name,
+                         (unsigned long long) s->rx_packets, (unsigned long long) s->rx_bytes,
+                         (unsigned long long) stats_load(&s->tx_packets),
+                         (unsigned long long) stats_load(&s->tx_bytes),
+                         (unsigned long long) stats_load(&s->tx_dropped), (unsigned long long) s->kernel_drops,
+                         sockbuf_queued(rif->recv_fd, false), sockbuf_queued(rif->send_fd, true),
+                         s->rcvbuf, atomic_load_explicit(&s->sndbuf, memory_order_relaxed),
+                         (unsigned long long) s->rcvbuf_grows, (unsigned long long) stats_load(&s->sndbuf_grows));
+            stats_printf(writer, "mtu interface=%s family=%s protocol=%s mtu=%d max_message=%zu split_packets=%llu "
+                                 "split_messages=%llu fragmented_packets=%llu",
+                         rif->ifname, family, rif->protocol->name, rif->mtu, rif->max_message,
+                         (unsigned long long) s->split_packets,
+                         (unsigned long long) s->split_messages, (unsigned long long) s->fragmented_packets);
+            if (options->recompress && rif->protocol->id == PROTOCOL_MDNS)
+                stats_printf(writer, "recompress interface=%s family=%s protocol=%s recompressed_packets=%llu "
+                                     "bytes_saved=%llu",
+                             rif->ifname, family, rif->protocol->name, (unsigned long long) s->recompressed_packets,
+                             (unsigned long long) s->recompress_bytes_saved);
+            if (options->ingress_validation) {
+                char drops[256];
+                size_t len = 0;
+                for (int v = INGRESS_ACCEPT + 1; v < INGRESS_VERDICTS && len < sizeof(drops); ++v)
+                    len += (size_t) snprintf(drops + len, sizeof(drops) - len, " %s=%llu",
+                                             ingress_verdict_name((enum ingress_verdict) v),
+                                             (unsigned long long) s->ingress_drops[v]);
+                stats_printf(writer, "ingress interface=%s family=%s protocol=%s%s", rif->ifname, family,
+                             rif->protocol->name, drops);
+            }
+            if (rif->rewrite)
+                stats_printf(writer, "rewrite interface=%s family=%s class=%s rewritten_packets=%llu "
+                                     "records_dropped=%llu bytes_saved=%llu",
+                             rif->ifname, family, rif->rewrite->name,
+                             (unsigned long long) s->rewritten_packets,
+                             (unsigned long long) s->rewrite_records_dropped,
+                             (unsigned long long) s->rewrite_bytes_saved);
+            if (rif->aggregator)
+                stats_printf(writer, "aggregation interface=%s family=%s responses=%llu messages=%llu ratio=%.2f "
+                                     "duplicate_records=%llu",
+                             rif->ifname, family, (unsigned long long) s->aggregated_responses,
+                             (unsigned long long) s->aggregate_messages,
+                             s->aggregate_messages ? (double) s->aggregated_responses / (double) s->aggregate_messages
+                                                   : 0.0,
+                             (unsigned long long) s->aggregate_duplicates);
+            if (rif->listener_aware) {
+                uint64_t now = monotonic_ns();
+                uint64_t timeout = (uint64_t) options->listener_timeout_sec * 1000000000u;
+                stats_printf(writer, "listeners interface=%s family=%s protocol=%s present=%s last_seen_s=%llu "
+                                     "reports=%llu skipped_packets=%llu",
+                             rif->ifname, family, rif->protocol->name,
+                             reflection_if_has_listeners(rif, now, timeout) ? "yes" : "no",
+                             (unsigned long long) ((now - rif->listener_seen_ns) / 1000000000u),
+                             (unsigned long long) s->listener_reports, (unsigned long long) s->listener_skips);
+            }
+            if (rif->hosts)
+                stats_printf(writer, "unicast interface=%s family=%s learned_hosts=%zu unicast_packets=%llu "
+                                     "unicast_copies=%llu multicast_fallbacks=%llu",
+                             rif->ifname, family, rif->hosts->n,
+                             (unsigned long long) s->unicast_packets, (unsigned long long) s->unicast_copies,
+                             (unsigned long long) s->multicast_fallbacks);
+        }
+        if (rz->interest) {
+            const struct interest_stats *s = &rz->interest->stats;
+            stats_printf(writer, "interest zone=%s family=%s entries=%zu flooded_queries=%llu directed_queries=%llu "
+                                 "filtered_responses=%llu unfiltered_packets=%llu pruned=%llu evictions=%llu",
+                         rz->name, family, rz->interest->n,
+                         (unsigned long long) s->flooded_queries, (unsigned long long) s->directed_queries,
+                         (unsigned long long) s->filtered_responses, (unsigned long long) s->unfiltered_packets,
+                         (unsigned long long) s->pruned, (unsigned long long) s->evictions);
+        }
+    }
+}
+
+static void dump_relays(struct stats_writer *writer, const struct relay *list) {
+    for (const struct relay *relay = list; relay; relay = relay->next) {
+        const struct relay_stats *s = &relay->stats;
+        stats_printf(writer, "relay name=%s zone=%s peer=%s tx_datagrams=%llu tx_messages=%llu "
+                             "messages_per_datagram=%.2f tx_bytes=%llu tx_dropped=%llu tx_echoes=%llu "
+                             "rx_datagrams=%llu rx_messages=%llu rx_bytes=%llu rx_echoes=%llu rx_errors=%llu",
+                     relay->name, relay->zone_name, sockaddr_storage_to_string(&relay->peer),
+                     (unsigned long long) s->tx_datagrams, (unsigned long long) s->tx_messages,
+                     s->tx_datagrams ? (double) s->tx_messages / (double) s->tx_datagrams : 0.0,
+                     (unsigned long long) s->tx_bytes, (unsigned long long) s->tx_dropped,
+                     (unsigned long long) s->tx_echoes,
+                     (unsigned long long) s->rx_datagrams, (unsigned long long) s->rx_messages,
+                     (unsigned long long) s->rx_bytes, (unsigned long long) s->rx_echoes,
+                     (unsigned long long) s->rx_errors);
+    }
+}
+
+static void dump_discoveries(struct stats_writer *writer, const struct discovery *list) {
+    for (const struct discovery *discovery = list; discovery; discovery = discovery->next) {
+        const struct discovery_stats *s = &discovery->stats;
+        stats_printf(writer, "discovery name=%s zone=%s domain=%s records=%zu learned=%llu evicted=%llu "
+                             "udp_queries=%llu tcp_queries=%llu answered=%llu nxdomain=%llu refused=%llu "
+                             "truncated=%llu mdns_queries=%llu",
+                     discovery->name, discovery->zone_name, discovery->domain_text, discovery->store.nrecords,
+                     (unsigned long long) s->learned, (unsigned long long) s->evicted,
+                     (unsigned long long) s->udp_queries, (unsigned long long) s->tcp_queries,
+                     (unsigned long long) s->answered, (unsigned long long) s->nxdomain,
+                     (unsigned long long) s->refused, (unsigned long long) s->truncated,
+                     (unsigned long long) s->mdns_queries);
+    }
+}
+
+static void dump_ha(struct stats_writer *writer, const struct ha *ha) {
+    const struct ha_stats *s = &ha->stats;
+    stats_printf(writer, "ha state=%s priority=%d peer=%s peer_state=%s peer_priority=%d transitions=%llu "
+                         "heartbeats_tx=%llu heartbeats_rx=%llu rx_errors=%llu standby_drops=%llu "
+                         "duplicate_drops=%llu fingerprints_synced=%llu sync_overflows=%llu",
+                 ha_state_name(ha->state), ha->priority, sockaddr_storage_to_string(&ha->peer),
+                 ha->peer_seen ? ha_state_name(ha->peer_state) : "unknown", ha->peer_priority,
+                 (unsigned long long) s->transitions, (unsigned long long) s->heartbeats_tx,
+                 (unsigned long long) s->heartbeats_rx, (unsigned long long) s->rx_errors,
+                 (unsigned long long) s->standby_drops, (unsigned long long) s->duplicate_drops,
+                 (unsigned long long) s->fingerprints_synced, (unsigned long long) s->sync_overflows);
+}
+
+static void dump_pipeline(struct stats_writer *writer, const struct pipeline_stats *pipeline) {
+    stats_printf(writer, "pipeline tx_threads=%u ring_size=%zu pool_buffers=%zu pool_free=%zu rx_unpooled=%llu",
+                 pipeline->tx_threads, pipeline->ring_size, pipeline->pool_buffers, pipeline->pool_free,
+                 (unsigned long long) pipeline->rx_unpooled);
+    for (unsigned int i = 0; i < pipeline->tx_threads; ++i) {
+        const struct tx_queue_stats *s = &pipeline->queues[i];
+        stats_printf(writer, "tx_thread index=%u enqueued=%llu ring_full=%llu too_large=%llu pool_empty=%llu "
+                             "max_depth=%zu", i, (unsigned long long) s->enqueued, (unsigned long long) s->ring_full,
+                     (unsigned long long) s->too_large, (unsigned long long) s->pool_empty, s->max_depth);
+    }
+}
+
+static void dump_latency(struct stats_writer *writer, const struct latency_histogram *latency) {
+    stats_printf(writer, "latency samples=%llu p50_us=%.1f p90_us=%.1f p99_us=%.1f p999_us=%.1f max_us=%.1f",
+                 (unsigned long long) latency->count,
+                 (double) latency_percentile(latency, 50) / 1000.0,
+                 (double) latency_percentile(latency, 90) / 1000.0,
+                 (double) latency_percentile(latency, 99) / 1000.0,
+                 (double) latency_percentile(latency, 99.9) / 1000.0,
+                 (double) latency->max_ns / 1000.0);
+}
+
+static void dump_traffic_top(struct stats_writer *writer, const struct traffic_top *top, size_t n) {
+    const struct heavy_hitter *entries[HEAVY_HITTERS_CAPACITY];
+    size_t count = heavy_hitters_top(&top->talkers, entries, n);
+    for (size_t i = 0; i < count; ++i) {
+        struct talker_key key;
+        char address[INET6_ADDRSTRLEN];
+        memcpy(&key, entries[i]->key, sizeof(key));
+        if (!inet_ntop(key.family, key.addr, address, sizeof(address)))
+            snprintf(address, sizeof(address), "?");
+        stats_printf(writer, "top_talker rank=%zu address=%s interface=%s packets=%llu error=%llu",
+                     i + 1, address, key.ifname,
+                     (unsigned long long) entries[i]->count, (unsigned long long) entries[i]->error);
+    }
+    count = heavy_hitters_top(&top->services, entries, n);
+    for (size_t i = 0; i < count; ++i)
+        stats_printf(writer, "top_service rank=%zu service=%.*s packets=%llu error=%llu",
+                     i + 1, (int) entries[i]->key_len, (const char *) entries[i]->key,
+                     (unsigned long long) entries[i]->count, (unsigned long long) entries[i]->error);
+}
+
+static void dump_dualstack(struct stats_writer *writer, const struct dualstack_stats *s) {
+    static const char *const families[] = {"ipv6", "ipv4"};
+    for (size_t i = 0; i < 2; ++i)
+        stats_printf(writer, "dualstack family=%s suppressed_packets=%llu suppressed_copies=%llu "
+                             "single_stack_copies=%llu",
+                     families[i], (unsigned long long) s->suppressed_packets[i],
+                     (unsigned long long) s->suppressed_copies[i], (unsigned long long) s->single_stack_copies[i]);
+}
+
+static void dump_loop(struct stats_writer *writer, const struct loop_stats *loop) {
+    uint64_t total = loop->busy_ns + loop->idle_ns;
+    uint64_t now = monotonic_ns();
+    stats_printf(writer, "loop iterations=%llu busy_ms=%llu idle_ms=%llu utilization=%.3f interval_utilization=%.3f "
+                         "longest_iteration_us=%llu longest_event=%s stalls=%llu since_last_poll_us=%llu",
+                 (unsigned long long) loop->iterations, (unsigned long long) (loop->busy_ns / 1000000u),
+                 (unsigned long long) (loop->idle_ns / 1000000u),
+                 total ? (double) loop->busy_ns / (double) total : 0.0, loop_interval_utilization(loop),
+                 (unsigned long long) (loop->longest_ns / 1000u),
+                 loop->longest_culprit[0] ? loop->longest_culprit : "none", (unsigned long long) loop->stalls,
+                 (unsigned long long) (loop->last_poll_ns && now > loop->last_poll_ns ?
+                                       (now - loop->last_poll_ns) / 1000u : 0));
+}
+
+void stats_dump(const struct options *options, const struct global_stats *global) {
+    struct stats_writer writer = {0};
+    char tmp_path[MAXPATHLEN + 4];
+    if (options->stats_file[0]) {
+        // Write to a temporary file first so that readers never see a partial dump.
+        snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", options->stats_file);
+        writer.file = fopen(tmp_path, "w");
+        if (!writer.file) {
+            log_err(LOG_ERR, "can't open stats file %s", tmp_path);
+            return;
+        }
+    }
+    dump_reflection_zones(&writer, options, options->rz_list6, "ipv6");
+    dump_reflection_zones(&writer, options, options->rz_list4, "ipv4");
+    dump_relays(&writer, options->relays);
+    dump_discoveries(&writer, options->discoveries);
+    if (options->ha)
+        dump_ha(&writer, options->ha);
+    if (global->pipeline.tx_threads)
+        dump_pipeline(&writer, &global->pipeline);
+    if (options->dualstack_dedup)
+        dump_dualstack(&writer, &global->dualstack);
+    dump_loop(&writer, &global->loop);
+    if (global->latency_enabled)
+        dump_latency(&writer, &global->latency);
+    if (options->heavy_hitters)
+        dump_traffic_top(&writer, &global->top, (size_t) options->heavy_hitters_top);
+    if (writer.file) {
+        if (fclose(writer.file) != 0 || rename(tmp_path, options->stats_file) == -1)
+            log_err(LOG_ERR, "can't write stats file %s", options->stats_file);
+    }
+}
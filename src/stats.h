@@ -0,0 +1,150 @@
+/*
+    This file is part of mDNS Reflector (mdns-reflector), a lightweight and performant multicast DNS (mDNS) reflector.
+    Copyright (C) 2021 Yuxiang Zhu <me@yux.im>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef MDNS_REFLECTOR_STATS_H
+#define MDNS_REFLECTOR_STATS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include "options.h"
+#include "latency.h"
+#include "ingress.h"
+#include "heavyhitters.h"
+#include "loopmon.h"
+
+/// Per-interface counters. Each reflection interface (one per address family) has its own set.
+/// Counters of sending are atomic: in the pipelined mode, the transmit thread of the interface updates them while
+/// the event loop reads them. They are accessed with relaxed ordering through stats_add() and stats_load().
+struct if_stats {
+    uint64_t rx_packets;
+    uint64_t rx_bytes;
+    atomic_uint_least64_t tx_packets;
+    atomic_uint_least64_t tx_bytes;
+    /// packets not sent because the send queue or the transmit ring was full, the pipeline had no room for them,
+    /// or the link went away
+    atomic_uint_least64_t tx_dropped;
+    /// packets dropped by the kernel because the receive queue was full (SO_RXQ_OVFL)
+    uint64_t kernel_drops;
+    /// last cumulative SO_RXQ_OVFL value reported by the kernel
+    uint32_t rxq_ovfl;
+    /// socket buffer sizes as reported by the kernel
+    int rcvbuf;
+    atomic_int sndbuf;
+    uint64_t rcvbuf_grows;
+    atomic_uint_least64_t sndbuf_grows;
+    /// rewritten responses sent or queued for aggregation on the interface
+    uint64_t rewritten_packets;
+    /// records removed by rewriting
+    uint64_t rewrite_records_dropped;
+    /// bytes saved by rewriting, compared to forwarding the original responses
+    uint64_t rewrite_bytes_saved;
+    /// packets sent as unicast copies to learned hosts instead of multicast
+    uint64_t unicast_packets;
+    /// unicast copies sent
+    uint64_t unicast_copies;
+    /// packets sent as multicast because too many or no hosts were known
+    uint64_t multicast_fallbacks;
+    /// responses queued for aggregation
+    uint64_t aggregated_responses;
+    /// messages sent after merging queued responses
+    uint64_t aggregate_messages;
+    /// duplicate records removed while merging
+    uint64_t aggregate_duplicates;
+    /// packets larger than the MTU split into several messages instead of being fragmented
+    uint64_t split_packets;
+    /// messages sent in place of split packets
+    uint64_t split_messages;
+    /// packets larger than the MTU sent fragmented because they couldn't be split
+    uint64_t fragmented_packets;
+    /// packets sent with names re-compressed
+    uint64_t recompressed_packets;
+    /// bytes saved by re-compressing names
+    uint64_t recompress_bytes_saved;
+    /// IGMP or MLD reports of hosts listening to the group of the interface
+    uint64_t listener_reports;
+    /// packets not sent because no host listened to the group of the interface
+    uint64_t listener_skips;
+    /// packets dropped by ingress validation, by reason
+    uint64_t ingress_drops[INGRESS_VERDICTS];
+};
+
+#define TX_THREADS_MAX 16
+
+/// Counters of the ring feeding one transmit thread, kept by the receive thread.
+struct tx_queue_stats {
+    /// packets queued for sending
+    uint64_t enqueued;
+    /// packets dropped because the ring was full
+    uint64_t ring_full;
+    /// packets dropped because they don't fit in a buffer of the pool, such as large relayed datagrams
+    uint64_t too_large;
+    /// packets dropped because no buffer of the pool was free to copy them into
+    uint64_t pool_empty;
+    /// highest number of queued packets seen
+    size_t max_depth;
+};
+
+/// Counters of the pipelined mode, kept by the receive thread.
+struct pipeline_stats {
+    /// number of transmit threads, or 0 if the pipelined mode is off
+    unsigned int tx_threads;
+    size_t ring_size;
+    size_t pool_buffers;
+    /// buffers neither being received into nor waiting to be sent
+    size_t pool_free;
+    /// packets received outside the pool because the transmit threads held every buffer
+    uint64_t rx_unpooled;
+    struct tx_queue_stats queues[TX_THREADS_MAX];
+};
+
+/// Counters of dual-stack duplicate elimination, for packets received over IPv6 (index 0) and IPv4 (index 1).
+struct dualstack_stats {
+    /// packets recognized as copies of a packet already reflected over the other family
+    uint64_t suppressed_packets[2];
+    /// copies of those not sent to dual-stack interfaces
+    uint64_t suppressed_copies[2];
+    /// copies of those still sent to interfaces reflecting only this family
+    uint64_t single_stack_copies[2];
+};
+
+/// Daemon-wide counters.
+struct global_stats {
+    /// whether forwarding latency is measured
+    bool latency_enabled;
+    /// time from kernel receive timestamp to the last copy being sent
+    struct latency_histogram latency;
+    /// top talkers and service types, if options->heavy_hitters is set
+    struct traffic_top top;
+    struct pipeline_stats pipeline;
+    struct dualstack_stats dualstack;
+    struct loop_stats loop;
+};
+
+static inline void stats_add(atomic_uint_least64_t *counter, uint64_t n) {
+    atomic_fetch_add_explicit(counter, n, memory_order_relaxed);
+}
+
+static inline uint64_t stats_load(const atomic_uint_least64_t *counter) {
+    return atomic_load_explicit(counter, memory_order_relaxed);
+}
+
+/// Write statistics of all reflection interfaces to the stats file, or to the log if no stats file is configured.
+void stats_dump(const struct options *options, const struct global_stats *global);
+
+#endif //MDNS_REFLECTOR_STATS_H
@@ -0,0 +1,43 @@
+/*
+    This file is part of mDNS Reflector (mdns-reflector), a lightweight and performant multicast DNS (mDNS) reflector.
+    Copyright (C) 2021 Yuxiang Zhu <me@yux.im>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef MDNS_REFLECTOR_TIMEUTIL_H
+#define MDNS_REFLECTOR_TIMEUTIL_H
+
+#include <stdint.h>
+#include <time.h>
+
+static inline uint64_t timespec_to_ns(const struct timespec *ts) {
+    return (uint64_t) ts->tv_sec * 1000000000u + (uint64_t) ts->tv_nsec;
+}
+
+/// \return nanoseconds of the monotonic clock
+static inline uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return timespec_to_ns(&ts);
+}
+
+/// \return nanoseconds of the real-time clock, which kernel packet timestamps are based on
+static inline uint64_t realtime_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return timespec_to_ns(&ts);
+}
+
+#endif //MDNS_REFLECTOR_TIMEUTIL_H
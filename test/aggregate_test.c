@@ -0,0 +1,175 @@
+/*
+    This file is part of mDNS Reflector (mdns-reflector), a lightweight and performant multicast DNS (mDNS) reflector.
+    Copyright (C) 2021 Yuxiang Zhu <me@yux.im>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "aggregate.h"
+#include "testutil.h"
+#include <sys/socket.h>
+
+#define EMITTED_MAX 8
+
+/// Messages emitted by a flush.
+struct emitted {
+    size_t n;
+    size_t len[EMITTED_MAX];
+    uint8_t msg[EMITTED_MAX][AGGREGATE_ARENA_SIZE];
+    bool fail;
+};
+
+static int emit(void *ctx, struct aggregator *aggregator, const uint8_t *msg, size_t len) {
+    (void) aggregator;
+    struct emitted *emitted = ctx;
+    if (emitted->n < EMITTED_MAX) {
+        memcpy(emitted->msg[emitted->n], msg, len);
+        emitted->len[emitted->n] = len;
+        emitted->n++;
+    }
+    return emitted->fail ? -1 : 0;
+}
+
+/// A response announcing the address of a host, with the address of `other` as additional record.
+static size_t build_address_response(uint8_t *msg, const char *host, uint8_t last, const char *other,
+                                     uint8_t other_last) {
+    const uint8_t a[] = {192, 168, 1, last};
+    const uint8_t b[] = {192, 168, 1, other_last};
+    size_t len = put_header(msg, DNS_FLAG_QR | DNS_FLAG_AA, 0, 1, 0, 1);
+    len = put_record(msg, len, host, DNS_TYPE_A, 120, a, sizeof(a));
+    return put_record(msg, len, other, DNS_TYPE_A, 120, b, sizeof(b));
+}
+
+/// \return number of records of a section in the emitted messages
+static unsigned int count_section(const struct emitted *emitted, unsigned int section) {
+    unsigned int n = 0;
+    for (size_t i = 0; i < emitted->n; ++i) {
+        struct dns_parser parser;
+        CHECK(dns_parser_init(&parser, emitted->msg[i], emitted->len[i]) == 0);
+        n += parser.header.counts[section];
+    }
+    return n;
+}
+
+static void test_eligible(struct aggregator *aggregator, struct emitted *emitted) {
+    (void) emitted;
+    uint8_t msg[2048];
+    size_t len = build_address_response(msg, "printer.local", 20, "scanner.local", 21);
+    CHECK(aggregate_eligible(aggregator, msg, len));
+    CHECK(!aggregate_eligible(aggregator, msg, DNS_HEADER_SIZE - 1));
+    // legacy unicast responses carry the ID of the query
+    put_u16(msg, 0, 1);
+    CHECK(!aggregate_eligible(aggregator, msg, len));
+    put_u16(msg, 0, 0);
+    put_u16(msg, 2, DNS_FLAG_QR | DNS_FLAG_TC);
+    CHECK(!aggregate_eligible(aggregator, msg, len));
+    len = put_header(msg, 0, 1, 0, 0, 0);
+    len = put_question(msg, len, "printer.local", DNS_TYPE_A);
+    CHECK(!aggregate_eligible(aggregator, msg, len));
+    put_u16(msg, 2, DNS_FLAG_QR);
+    CHECK(!aggregate_eligible(aggregator, msg, len));
+    // larger than a message to the interface
+    len = put_header(msg, DNS_FLAG_QR, 0, 0, 0, 0);
+    CHECK(aggregate_eligible(aggregator, msg, aggregator->max_size));
+    CHECK(!aggregate_eligible(aggregator, msg, aggregator->max_size + 1));
+}
+
+static void test_has_room(struct aggregator *aggregator, struct emitted *emitted) {
+    uint8_t msg[2048];
+    size_t len = build_address_response(msg, "printer.local", 20, "scanner.local", 21);
+    for (size_t i = 0; i < AGGREGATE_MESSAGES_MAX; ++i) {
+        CHECK(aggregate_has_room(aggregator, len));
+        aggregate_add(aggregator, msg, len, AF_INET);
+    }
+    CHECK(!aggregate_has_room(aggregator, len));
+    struct aggregate_result result;
+    CHECK(aggregate_flush(aggregator, emit, emitted, &result) == 0);
+    CHECK(aggregate_has_room(aggregator, AGGREGATE_ARENA_SIZE));
+    CHECK(!aggregate_has_room(aggregator, AGGREGATE_ARENA_SIZE + 1));
+}
+
+static void test_flush_merges_and_deduplicates(struct aggregator *aggregator, struct emitted *emitted) {
+    uint8_t msg[2048];
+    struct aggregate_result result;
+    CHECK(aggregate_flush(aggregator, emit, emitted, &result) == 0);
+    CHECK(emitted->n == 0 && result.messages == 0);
+    // the printer is announced twice, and once more as additional record of the scanner
+    size_t len = build_address_response(msg, "printer.local", 20, "scanner.local", 21);
+    aggregate_add(aggregator, msg, len, AF_INET);
+    aggregate_add(aggregator, msg, len, AF_INET);
+    len = build_address_response(msg, "scanner.local", 21, "printer.local", 20);
+    aggregate_add(aggregator, msg, len, AF_INET);
+    CHECK(aggregate_flush(aggregator, emit, emitted, &result) == 0);
+    CHECK(result.messages == 1 && emitted->n == 1);
+    // every record once, in the first section it appeared in
+    CHECK(result.duplicates == 4);
+    CHECK(count_section(emitted, DNS_SECTION_ANSWER) == 2);
+    CHECK(count_section(emitted, DNS_SECTION_ADDITIONAL) == 0);
+    struct dns_parser parser;
+    dns_parser_init(&parser, emitted->msg[0], emitted->len[0]);
+    CHECK(parser.header.id == 0 && parser.header.flags == (DNS_FLAG_QR | DNS_FLAG_AA));
+    CHECK(aggregator->nmessages == 0 && aggregator->arena_len == 0);
+}
+
+static void test_flush_splits_at_max_size(struct aggregator *aggregator, struct emitted *emitted) {
+    uint8_t msg[2048];
+    aggregator->max_size = 128;
+    for (uint8_t i = 0; i < 10; ++i) {
+        char host[32];
+        snprintf(host, sizeof(host), "host%u.local", i);
+        size_t len = build_address_response(msg, host, i, "gateway.local", 1);
+        aggregate_add(aggregator, msg, len, AF_INET);
+    }
+    struct aggregate_result result;
+    CHECK(aggregate_flush(aggregator, emit, emitted, &result) == 0);
+    CHECK(result.messages > 1 && result.messages == emitted->n);
+    for (size_t i = 0; i < emitted->n; ++i)
+        CHECK(emitted->len[i] <= aggregator->max_size);
+    CHECK(count_section(emitted, DNS_SECTION_ANSWER) == 10);
+    CHECK(count_section(emitted, DNS_SECTION_ADDITIONAL) == 1);
+    CHECK(result.duplicates == 9);
+}
+
+static void test_flush_reports_emit_failure(struct aggregator *aggregator, struct emitted *emitted) {
+    uint8_t msg[2048];
+    size_t len = build_address_response(msg, "printer.local", 20, "scanner.local", 21);
+    aggregate_add(aggregator, msg, len, AF_INET);
+    emitted->fail = true;
+    struct aggregate_result result;
+    CHECK(aggregate_flush(aggregator, emit, emitted, &result) == -1);
+    // the queued messages are gone either way
+    CHECK(aggregator->nmessages == 0);
+}
+
+int main(void) {
+    void (*tests[])(struct aggregator *, struct emitted *) = {
+            test_eligible,
+            test_has_room,
+            test_flush_merges_and_deduplicates,
+            test_flush_splits_at_max_size,
+            test_flush_reports_emit_failure,
+    };
+    for (size_t i = 0; i < sizeof(tests) / sizeof(tests[0]); ++i) {
+        struct aggregator *aggregator = new_aggregator(NULL);
+        struct emitted *emitted = calloc(1, sizeof(struct emitted));
+        if (!aggregator || !emitted) {
+            perror("calloc");
+            return EXIT_FAILURE;
+        }
+        tests[i](aggregator, emitted);
+        free(emitted);
+        free(aggregator);
+    }
+    return check_result();
+}
@@ -0,0 +1,247 @@
+/*
+    This file is part of mDNS Reflector (mdns-reflector), a lightweight and performant multicast DNS (mDNS) reflector.
+    Copyright (C) 2021 Yuxiang Zhu <me@yux.im>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "config.h"
+#include "discovery.h"
+#include "ha.h"
+#include "netns.h"
+#include "reflection_zone.h"
+#include "relay.h"
+#include "rewrite.h"
+#include "logging.h"
+#include "sockaddr.h"
+#include "testutil.h"
+#include <syslog.h>
+#include <unistd.h>
+
+/// Write a configuration to a temporary file and load it.
+static int load_text(const char *text, struct options *options) {
+    char path[] = "/tmp/mdns-reflector-config-XXXXXX";
+    int fd = mkstemp(path);
+    if (fd == -1) {
+        perror("mkstemp");
+        exit(EXIT_FAILURE);
+    }
+    size_t len = strlen(text);
+    if (write(fd, text, len) != (ssize_t) len) {
+        perror("write");
+        exit(EXIT_FAILURE);
+    }
+    close(fd);
+    int r = load_config(path, options);
+    unlink(path);
+    return r;
+}
+
+static void free_options(struct options *options) {
+    netns_free_reflection_zones(options->rz_list6);
+    netns_free_reflection_zones(options->rz_list4);
+    free_rewrite_classes(options->rewrite_classes);
+    free_relays(options->relays);
+    free_discoveries(options->discoveries);
+    free_ha(options->ha);
+    options_init(options);
+}
+
+static void test_global_section(void) {
+    struct options options;
+    options_init(&options);
+    CHECK(load_text("# comment\n"
+                    "[global]\n"
+                    "  log_level = debug   ; trailing comment\n"
+                    "recompress = yes\n"
+                    "aggregation_window_ms=50\n"
+                    "tx_ring_size = 64\n"
+                    "socket_rcvbuf = 2M\n"
+                    "family = ipv4\n", &options) == 0);
+    CHECK(options.log_level == LOG_DEBUG);
+    CHECK(options.recompress && options.aggregation_window_ms == 50 && options.tx_ring_size == 64);
+    CHECK(options.rcvbuf == 2 * 1024 * 1024);
+    CHECK(options.ipv4_only && !options.ipv6_only);
+    // untouched options keep their defaults
+    CHECK(options.ingress_validation && options.host_timeout_sec == 600);
+    free_options(&options);
+}
+
+static void test_command_line_precedence(void) {
+    struct options options;
+    options_init(&options);
+    options.log_level = LOG_ERR;
+    options.log_level_set = true;
+    options.ipv6_only = true;
+    options.family_set = true;
+    CHECK(load_text("[global]\nlog_level = debug\nfamily = ipv4\n", &options) == 0);
+    CHECK(options.log_level == LOG_ERR);
+    CHECK(options.ipv6_only && !options.ipv4_only);
+    free_options(&options);
+}
+
+static void test_global_option_values(void) {
+    struct options options;
+    options_init(&options);
+    CHECK(set_global_option(&options, "tx_ring_size", "128") == 0 && options.tx_ring_size == 128);
+    CHECK(set_global_option(&options, "tx_ring_size", "100") == -1);
+    CHECK(set_global_option(&options, "tx_ring_size", "8") == -1);
+    CHECK(set_global_option(&options, "aggregation_window_ms", "0") == -1);
+    CHECK(set_global_option(&options, "aggregation_window_ms", "121") == -1);
+    CHECK(set_global_option(&options, "sched_fifo_priority", "ten") == -1);
+    CHECK(set_global_option(&options, "recompress", "maybe") == -1);
+    CHECK(set_global_option(&options, "log_level", "loud") == -1);
+    CHECK(set_global_option(&options, "no_such_option", "1") == -1);
+    CHECK(set_global_option(&options, "dualstack_dedup", "on") == 0 && options.dualstack_dedup);
+    CHECK(options.tx_ring_size == 128 && options.aggregation_window_ms == 20);
+    free_options(&options);
+}
+
+static void test_zones(void) {
+    struct options options;
+    options_init(&options);
+    CHECK(load_text("[zone lan]\n"
+                    "interfaces = lo\n"
+                    "[zone v6]\n"
+                    "family = ipv6\n"
+                    "interest_forwarding = yes\n", &options) == 0);
+    const struct reflection_zone *lan6 = find_reflection_zone(options.rz_list6, "lan");
+    const struct reflection_zone *lan4 = find_reflection_zone(options.rz_list4, "lan");
+    const struct reflection_zone *v6 = find_reflection_zone(options.rz_list6, "v6");
+    CHECK(lan6 && lan4 && v6 && !find_reflection_zone(options.rz_list4, "v6"));
+    if (!lan6 || !lan4 || !v6)
+        goto cleanup;
+    // both families of a zone share its index
+    CHECK(lan6->zone_index == 0 && lan4->zone_index == 0 && v6->zone_index == 1);
+    CHECK(lan6->first_if && strcmp(lan6->first_if->ifname, "lo") == 0 && !lan6->first_if->next);
+    CHECK(lan6->first_if && lan6->first_if->zone == lan6);
+    CHECK(lan6->protocols == 1u << PROTOCOL_MDNS && !lan6->interest && v6->interest);
+    cleanup:
+    free_options(&options);
+}
+
+static void test_sections(void) {
+    struct options options;
+    options_init(&options);
+    CHECK(load_text("[global]\n"
+                    "[zone lan]\n"
+                    "interfaces = lo\n"
+                    "[rewrite guest]\n"
+                    "interfaces = lo\n"
+                    "drop_aaaa = link-local, ula\n"
+                    "a_prefixes = 192.168.4.0/24 10.0.0.0/8\n"
+                    "[relay b]\n"
+                    "zone = lan\n"
+                    "local = 127.0.0.1:5380\n"
+                    "peer = 127.0.0.2:5380\n"
+                    "batch_ms = 10\n"
+                    "[discovery iot]\n"
+                    "zone = lan\n"
+                    "domain = iot.home.arpa\n"
+                    "listen = [::1]:5300\n"
+                    "max_records = 64\n"
+                    "[ha]\n"
+                    "local = 127.0.0.1:5390\n"
+                    "peer = 127.0.0.2:5390\n"
+                    "priority = 200\n", &options) == 0);
+    const struct rewrite_class *rc = options.rewrite_classes;
+    CHECK(rc && strcmp(rc->name, "guest") == 0 && rc->drop_aaaa_link_local && rc->drop_aaaa_ula);
+    CHECK(rc && rc->nprefixes4 == 2);
+    CHECK(options.rz_list6 && options.rz_list6->first_if && options.rz_list6->first_if->rewrite == rc);
+    CHECK(options.rz_list4 && options.rz_list4->first_if && options.rz_list4->first_if->rewrite == rc);
+    CHECK(options.relays && strcmp(options.relays->name, "b") == 0 && options.relays->batch_ms == 10);
+    CHECK(options.relays && options.relays->zone_index == 0 && sockaddr_port(&options.relays->peer) == 5380);
+    const struct discovery *discovery = options.discoveries;
+    CHECK(discovery && strcmp(discovery->domain_text, "iot.home.arpa") == 0 && discovery->max_records == 64);
+    CHECK(discovery && discovery->listen.ss_family == AF_INET6 && discovery->query_on_demand);
+    CHECK(options.ha && options.ha->priority == 200);
+    free_options(&options);
+}
+
+static void test_errors(void) {
+    static const char *const configs[] = {
+            // syntax
+            "[zone lan\n",
+            "[zone lan] x\n",
+            "[zone lan]\ninterfaces lo\n",
+            "log_level = debug\n",
+            "[zone]\n",
+            "[bridge lan]\n",
+            // values and options
+            "[global]\nlog_level = loud\n",
+            "[global]\nno_such_option = 1\n",
+            "[zone lan]\ninterfaces = lo\nno_such_option = 1\n",
+            "[zone lan]\nprotocols = gopher\n",
+            "[zone lan]\ninterfaces = mdns-test-none0\n",
+            // sections in the wrong place or twice
+            "[zone lan]\ninterfaces = lo\n[zone lan]\n",
+            "[zone lan]\ninterfaces = lo\n[global]\n",
+            "[ha]\nlocal = 127.0.0.1:1\npeer = 127.0.0.2:1\n[ha]\n",
+            // references
+            "[zone lan]\ninterfaces = lo\nunicast_conversion = mdns-test-none0\n",
+            "[zone lan]\n[rewrite guest]\ninterfaces = lo\n",
+            "[zone lan]\ninterfaces = lo\n[rewrite guest]\na_prefixes = 192.168.4.0/33\n",
+            "[zone lan]\ninterfaces = lo\n[relay b]\nzone = lan\nlocal = 127.0.0.1:5380\n",
+            "[zone lan]\ninterfaces = lo\n[relay b]\nzone = wan\nlocal = 127.0.0.1:1\npeer = 127.0.0.2:1\n",
+            "[zone lan]\ninterfaces = lo\n[relay b]\nzone = lan\nlocal = 127.0.0.1:1\npeer = [::1]:1\n",
+            "[zone lan]\ninterfaces = lo\n[discovery iot]\nzone = lan\ndomain = iot.home.arpa\n",
+            "[zone lan]\ninterfaces = lo\n[discovery iot]\nzone = lan\ndomain = a..b\n",
+            "[ha]\nlocal = 127.0.0.1:1\npeer = 127.0.0.2:1\nheartbeat_ms = 100\nfailover_ms = 150\n",
+            "[ha]\nlocal = 127.0.0.1:1\n",
+    };
+    for (size_t i = 0; i < sizeof(configs) / sizeof(configs[0]); ++i) {
+        struct options options;
+        options_init(&options);
+        if (load_text(configs[i], &options) != -1) {
+            fprintf(stderr, "accepted configuration %zu:\n%s", i, configs[i]);
+            failures++;
+        }
+        free_options(&options);
+    }
+    struct options options;
+    options_init(&options);
+    CHECK(load_config("/nonexistent/mdns-reflector.conf", &options) == -1);
+}
+
+static void test_add_zone(void) {
+    struct options options;
+    options_init(&options);
+    const char *const lan[] = {"interfaces = lo", "family = ipv4  # comment"};
+    CHECK(add_zone(&options, "lan", lan, 2) == 0);
+    CHECK(!options.rz_list6 && options.rz_list4 && options.rz_list4->zone_index == 0);
+    // zones added later continue the numbering
+    const char *const iot[] = {"interfaces = lo"};
+    CHECK(add_zone(&options, "iot", iot, 1) == 0);
+    const struct reflection_zone *rz = find_reflection_zone(options.rz_list6, "iot");
+    CHECK(rz && rz->zone_index == 1);
+    CHECK(add_zone(&options, "lan", iot, 1) == -1);
+    CHECK(add_zone(&options, "", iot, 1) == -1);
+    const char *const section[] = {"interfaces = lo", "[zone other]"};
+    CHECK(add_zone(&options, "other", section, 2) == -1);
+    const char *const unknown[] = {"bridge = br0"};
+    CHECK(add_zone(&options, "other", unknown, 1) == -1);
+    free_options(&options);
+}
+
+int main(void) {
+    log_setlevel(LOG_CRIT);
+    test_global_section();
+    test_command_line_precedence();
+    test_global_option_values();
+    test_zones();
+    test_sections();
+    test_errors();
+    test_add_zone();
+    return check_result();
+}
@@ -0,0 +1,252 @@
+/*
+    This file is part of mDNS Reflector (mdns-reflector), a lightweight and performant multicast DNS (mDNS) reflector.
+    Copyright (C) 2021 Yuxiang Zhu <me@yux.im>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "discovery.h"
+#include "testutil.h"
+#include <netinet/in.h>
+
+#define MS UINT64_C(1000000)
+#define SEC (1000 * MS)
+#define RCODE_NXDOMAIN 3
+#define RCODE_REFUSED 5
+
+static const uint8_t PRINTER_A[] = {192, 168, 1, 20};
+
+static struct discovery *new_test_discovery(void) {
+    struct discovery *discovery = new_discovery("test", NULL);
+    if (!discovery)
+        return NULL;
+    discovery->max_records = 4;
+    if (discovery_set_domain(discovery, "test.home.arpa") == -1 ||
+        record_store_init(&discovery->store, discovery->max_records) == -1) {
+        free_discoveries(discovery);
+        return NULL;
+    }
+    return discovery;
+}
+
+static size_t build_unicast_query(uint8_t *msg, const char *name, unsigned int type) {
+    size_t len = put_header(msg, 0x0100, 1, 0, 0, 0);
+    put_u16(msg, 0, 0x1234);
+    return put_question(msg, len, name, type);
+}
+
+static size_t build_address_response(uint8_t *msg, const char *host, uint32_t ttl) {
+    size_t len = put_header(msg, DNS_FLAG_QR | DNS_FLAG_AA, 0, 1, 0, 0);
+    return put_record(msg, len, host, DNS_TYPE_A, ttl, PRINTER_A, sizeof(PRINTER_A));
+}
+
+static void test_set_domain(struct discovery *discovery) {
+    uint8_t expected[DNS_NAME_MAX];
+    size_t expected_len = put_name(expected, 0, "test.home.arpa");
+    CHECK(discovery->domain_len == expected_len && memcmp(discovery->domain, expected, expected_len) == 0);
+    CHECK(strcmp(discovery->domain_text, "test.home.arpa") == 0);
+    CHECK(discovery_set_domain(discovery, "") == -1);
+    CHECK(discovery_set_domain(discovery, "a..b") == -1);
+    char long_label[70];
+    memset(long_label, 'x', 64);
+    strcpy(long_label + 64, ".arpa");
+    CHECK(discovery_set_domain(discovery, long_label) == -1);
+}
+
+static void test_answer_from_learned_records(struct discovery *discovery) {
+    uint8_t msg[512], out[512];
+    struct discovery_answer answer;
+    uint64_t now = 10 * SEC;
+    // nothing known yet: a miss, answered with NXDOMAIN unless the wait finds something
+    size_t len = build_unicast_query(msg, "printer.test.home.arpa", DNS_TYPE_A);
+    CHECK(discovery_answer(discovery, msg, len, false, now, out, sizeof(out), &answer) == 0);
+    CHECK(answer.miss && answer.qtype == DNS_TYPE_A);
+    uint8_t local[DNS_NAME_MAX];
+    size_t local_len = put_name(local, 0, "printer.local");
+    CHECK(answer.local_name_len == local_len && memcmp(answer.local_name, local, local_len) == 0);
+    struct dns_parser parser;
+    CHECK(dns_parser_init(&parser, out, answer.len) == 0);
+    CHECK(parser.header.id == 0x1234 && DNS_RCODE(parser.header.flags) == RCODE_NXDOMAIN);
+    CHECK(parser.header.flags & 0x0100);
+    // learned from an mDNS response, the record is served under the proxy domain with a short TTL
+    size_t response_len = build_address_response(msg, "printer.local", 120);
+    CHECK(discovery_learn(discovery, msg, response_len, now) == 1);
+    len = build_unicast_query(msg, "printer.test.home.arpa", DNS_TYPE_A);
+    CHECK(discovery_answer(discovery, msg, len, false, now, out, sizeof(out), &answer) == 0);
+    CHECK(!answer.miss);
+    CHECK(dns_parser_init(&parser, out, answer.len) == 0);
+    CHECK(DNS_RCODE(parser.header.flags) == 0 && parser.header.counts[DNS_SECTION_ANSWER] == 1);
+    struct dns_record record;
+    CHECK(dns_parser_next(&parser, &record) == 1 && dns_parser_next(&parser, &record) == 1);
+    CHECK(record.type == DNS_TYPE_A && record.ttl == DISCOVERY_TTL_MAX);
+    CHECK(record.rdlength == 4 && memcmp(out + record.rdata, PRINTER_A, 4) == 0);
+    uint8_t name[DNS_NAME_MAX], expected[DNS_NAME_MAX];
+    size_t name_len, expected_len = put_name(expected, 0, "printer.test.home.arpa");
+    CHECK(dns_read_name(out, answer.len, record.offset, name, &name_len));
+    CHECK(dns_name_equal(name, name_len, expected, expected_len));
+    CHECK(discovery->stats.learned == 1 && discovery->stats.answered == 1 && discovery->stats.nxdomain == 1);
+    // a goodbye removes the record a second later
+    response_len = build_address_response(msg, "printer.local", 0);
+    discovery_learn(discovery, msg, response_len, now);
+    len = build_unicast_query(msg, "printer.test.home.arpa", DNS_TYPE_A);
+    CHECK(discovery_answer(discovery, msg, len, false, now + SEC - 1, out, sizeof(out), &answer) == 0);
+    CHECK(!answer.miss);
+    CHECK(discovery_answer(discovery, msg, len, false, now + SEC, out, sizeof(out), &answer) == 0);
+    CHECK(answer.miss);
+}
+
+static void test_refuses_other_queries(struct discovery *discovery) {
+    uint8_t msg[512], out[512];
+    struct discovery_answer answer;
+    size_t len = build_unicast_query(msg, "printer.example.com", DNS_TYPE_A);
+    CHECK(discovery_answer(discovery, msg, len, false, SEC, out, sizeof(out), &answer) == 0);
+    CHECK(!answer.miss && DNS_RCODE(out[3]) == RCODE_REFUSED);
+    // responses are not queries
+    len = build_address_response(msg, "printer.local", 120);
+    CHECK(discovery_answer(discovery, msg, len, false, SEC, out, sizeof(out), &answer) == -1);
+    CHECK(discovery_answer(discovery, msg, DNS_HEADER_SIZE - 1, false, SEC, out, sizeof(out), &answer) == -1);
+    CHECK(discovery->stats.refused == 1);
+}
+
+static void test_store_evicts_oldest(struct discovery *discovery) {
+    uint8_t msg[512];
+    for (unsigned int i = 0; i <= discovery->max_records; ++i) {
+        char host[32];
+        snprintf(host, sizeof(host), "host%u.local", i);
+        size_t len = build_address_response(msg, host, 120);
+        CHECK(discovery_learn(discovery, msg, len, (i + 1) * SEC) == 1);
+    }
+    CHECK(discovery->store.nrecords == discovery->max_records);
+    CHECK(discovery->stats.evicted == 1);
+    // names outside "local" are not learned
+    size_t len = build_address_response(msg, "printer.example.com", 120);
+    CHECK(discovery_learn(discovery, msg, len, SEC) == 0);
+}
+
+static void test_may_query_once_per_second(struct discovery *discovery) {
+    uint8_t name[DNS_NAME_MAX];
+    size_t name_len = put_name(name, 0, "printer.local");
+    CHECK(discovery_may_query(discovery, name, name_len, DNS_TYPE_A, SEC));
+    CHECK(!discovery_may_query(discovery, name, name_len, DNS_TYPE_A, 2 * SEC - 1));
+    CHECK(discovery_may_query(discovery, name, name_len, DNS_TYPE_AAAA, 2 * SEC - 1));
+    CHECK(discovery_may_query(discovery, name, name_len, DNS_TYPE_A, 2 * SEC));
+    // the query asked in the zone
+    uint8_t query[512];
+    size_t len = discovery_build_query(name, name_len, DNS_TYPE_A, query, sizeof(query));
+    struct dns_parser parser;
+    struct dns_record record;
+    CHECK(len && dns_parser_init(&parser, query, len) == 0);
+    CHECK(parser.header.id == 0 && !(parser.header.flags & DNS_FLAG_QR));
+    CHECK(dns_parser_next(&parser, &record) == 1 && record.type == DNS_TYPE_A && record.rrclass == 1);
+    CHECK(dns_parser_next(&parser, &record) == 0);
+    CHECK(discovery_build_query(name, name_len, DNS_TYPE_A, query, DNS_HEADER_SIZE + name_len) == 0);
+}
+
+static void test_park_until_full(struct discovery *discovery) {
+    uint8_t msg[512];
+    size_t len = build_unicast_query(msg, "printer.test.home.arpa", DNS_TYPE_A);
+    struct sockaddr_storage client = {0};
+    client.ss_family = AF_INET;
+    ((struct sockaddr_in *) &client)->sin_port = htons(40000);
+    discovery->query_wait_ms = 300;
+    for (size_t i = 0; i < DISCOVERY_PARKED_MAX; ++i) {
+        struct parked_query *parked = discovery_park(discovery, -1, &client, msg, len, SEC);
+        CHECK(parked != NULL);
+        if (!parked)
+            return;
+        CHECK(parked->deadline_ns == SEC + 300 * MS && parked->conn == -1);
+        CHECK(parked->len == len && memcmp(parked->query, msg, len) == 0);
+        CHECK(((struct sockaddr_in *) &parked->client)->sin_port == htons(40000));
+    }
+    CHECK(discovery_park(discovery, -1, &client, msg, len, SEC) == NULL);
+    // a slot freed is used again
+    discovery->parked[5].used = false;
+    CHECK(discovery_park(discovery, -1, &client, msg, len, SEC) == &discovery->parked[5]);
+}
+
+static void test_park_refused(struct discovery *discovery) {
+    uint8_t msg[DISCOVERY_TCP_QUERY_MAX + 1] = {0};
+    size_t len = build_unicast_query(msg, "printer.test.home.arpa", DNS_TYPE_A);
+    CHECK(discovery_park(discovery, -1, NULL, msg, sizeof(msg), SEC) == NULL);
+    discovery->query_wait_ms = 0;
+    CHECK(discovery_park(discovery, -1, NULL, msg, len, SEC) == NULL);
+}
+
+static void test_park_tcp_queries(struct discovery *discovery) {
+    uint8_t msg[512];
+    size_t len = build_unicast_query(msg, "printer.test.home.arpa", DNS_TYPE_A);
+    // the connection outlives the wait, so the answer can still be sent on it
+    struct parked_query *a = discovery_park(discovery, 3, NULL, msg, len, SEC);
+    struct parked_query *b = discovery_park(discovery, 4, NULL, msg, len, SEC);
+    CHECK(a && b && a != b);
+    if (!a || !b)
+        return;
+    CHECK(discovery->conns[3].deadline_ns > a->deadline_ns);
+    // closing a connection forgets its query only
+    discovery_unpark_conn(discovery, 3);
+    CHECK(!a->used && b->used);
+    discovery_unpark_conn(discovery, 3);
+    CHECK(b->used);
+}
+
+static void test_parked_query_due(struct discovery *discovery) {
+    uint8_t msg[512], out[512];
+    struct discovery_answer answer;
+    size_t len = build_unicast_query(msg, "printer.test.home.arpa", DNS_TYPE_A);
+    struct parked_query *parked = discovery_park(discovery, -1, NULL, msg, len, SEC);
+    CHECK(parked != NULL);
+    if (!parked)
+        return;
+    // still a miss: wait until the deadline
+    CHECK(discovery_answer(discovery, parked->query, parked->len, false, SEC, out, sizeof(out), &answer) == 0);
+    CHECK(answer.miss);
+    CHECK(!discovery_parked_due(parked, &answer, SEC));
+    CHECK(!discovery_parked_due(parked, &answer, parked->deadline_ns - 1));
+    CHECK(discovery_parked_due(parked, &answer, parked->deadline_ns));
+    // flushing everything answers it too
+    CHECK(discovery_parked_due(parked, &answer, UINT64_MAX));
+    // a response to the mDNS query answers it right away
+    size_t response_len = build_address_response(msg, "printer.local", 120);
+    CHECK(discovery_learn(discovery, msg, response_len, SEC + MS) == 1);
+    CHECK(discovery_answer(discovery, parked->query, parked->len, false, SEC + MS, out, sizeof(out), &answer) == 0);
+    CHECK(!answer.miss);
+    CHECK(discovery_parked_due(parked, &answer, 0));
+    // and a query that can't be answered at all isn't kept either
+    answer.len = 0;
+    CHECK(discovery_parked_due(parked, &answer, 0));
+}
+
+int main(void) {
+    void (*tests[])(struct discovery *) = {
+            test_set_domain,
+            test_answer_from_learned_records,
+            test_refuses_other_queries,
+            test_store_evicts_oldest,
+            test_may_query_once_per_second,
+            test_park_until_full,
+            test_park_refused,
+            test_park_tcp_queries,
+            test_parked_query_due,
+    };
+    for (size_t i = 0; i < sizeof(tests) / sizeof(tests[0]); ++i) {
+        struct discovery *discovery = new_test_discovery();
+        if (!discovery) {
+            perror("new_discovery");
+            return EXIT_FAILURE;
+        }
+        tests[i](discovery);
+        free_discoveries(discovery);
+    }
+    return check_result();
+}
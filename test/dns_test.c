@@ -0,0 +1,354 @@
+/*
+    This file is part of mDNS Reflector (mdns-reflector), a lightweight and performant multicast DNS (mDNS) reflector.
+    Copyright (C) 2021 Yuxiang Zhu <me@yux.im>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "dns.h"
+#include "testutil.h"
+
+static const uint8_t A_RDATA[] = {192, 168, 1, 20};
+
+/// A response with one question and two answers, the second one compressed against the first.
+static size_t build_response(uint8_t *msg) {
+    size_t len = put_header(msg, DNS_FLAG_QR | DNS_FLAG_AA, 1, 2, 0, 0);
+    len = put_question(msg, len, "printer.local", DNS_TYPE_A);
+    len = put_record(msg, len, "printer.local", DNS_TYPE_A, 120, A_RDATA, sizeof(A_RDATA));
+    // "scanner" followed by a pointer to "local" of the question
+    uint8_t rdata[] = {7, 's', 'c', 'a', 'n', 'n', 'e', 'r', 0xc0, DNS_HEADER_SIZE + 8};
+    return put_record(msg, len, "_scanner._tcp.local", DNS_TYPE_PTR, 4500, rdata, sizeof(rdata));
+}
+
+static void test_parse_records(void) {
+    uint8_t msg[512];
+    size_t len = build_response(msg);
+    struct dns_parser parser;
+    struct dns_record record;
+    CHECK(dns_parser_init(&parser, msg, len) == 0);
+    CHECK(parser.header.flags == (DNS_FLAG_QR | DNS_FLAG_AA));
+    CHECK(dns_parser_next(&parser, &record) == 1);
+    CHECK(record.section == DNS_SECTION_QUESTION);
+    CHECK(record.offset == DNS_HEADER_SIZE);
+    CHECK(record.type == DNS_TYPE_A && record.rrclass == 1 && record.ttl == 0);
+    CHECK(record.rdata == record.end);
+    CHECK(dns_parser_next(&parser, &record) == 1);
+    CHECK(record.section == DNS_SECTION_ANSWER);
+    CHECK(record.ttl == 120 && record.rdlength == 4);
+    CHECK(memcmp(msg + record.rdata, A_RDATA, 4) == 0);
+    CHECK(dns_parser_next(&parser, &record) == 1);
+    CHECK(record.type == DNS_TYPE_PTR && record.ttl == 4500);
+    CHECK(record.rrclass == 0x8001 && (record.rrclass & DNS_CLASS_MASK) == 1);
+    CHECK(record.end == len);
+    CHECK(dns_parser_next(&parser, &record) == 0);
+}
+
+static void test_parse_short_header(void) {
+    uint8_t msg[DNS_HEADER_SIZE] = {0};
+    struct dns_parser parser;
+    CHECK(dns_parser_init(&parser, msg, DNS_HEADER_SIZE - 1) == -1);
+    CHECK(dns_parser_init(&parser, msg, DNS_HEADER_SIZE) == 0);
+    struct dns_record record;
+    CHECK(dns_parser_next(&parser, &record) == 0);
+}
+
+static void test_parse_truncated(void) {
+    uint8_t msg[512];
+    size_t len = build_response(msg);
+    // Cut anywhere after the header, the message is malformed: its counts promise more than there is.
+    for (size_t cut = DNS_HEADER_SIZE; cut < len; ++cut) {
+        struct dns_parser parser;
+        struct dns_record record;
+        int r;
+        CHECK(dns_parser_init(&parser, msg, cut) == 0);
+        while ((r = dns_parser_next(&parser, &record)) == 1)
+            CHECK(record.end <= cut);
+        CHECK(r == -1);
+    }
+}
+
+static void test_parse_counts_beyond_message(void) {
+    uint8_t msg[512];
+    size_t len = build_response(msg);
+    put_u16(msg, 8, 1);  // one authority record that isn't there
+    struct dns_parser parser;
+    struct dns_record record;
+    CHECK(dns_parser_init(&parser, msg, len) == 0);
+    for (int i = 0; i < 3; ++i)
+        CHECK(dns_parser_next(&parser, &record) == 1);
+    CHECK(dns_parser_next(&parser, &record) == -1);
+}
+
+static void test_parse_rdlength_beyond_message(void) {
+    uint8_t msg[512];
+    size_t len = put_header(msg, DNS_FLAG_QR, 0, 1, 0, 0);
+    len = put_record(msg, len, "printer.local", DNS_TYPE_A, 120, A_RDATA, sizeof(A_RDATA));
+    put_u16(msg, len - 6, 5);
+    struct dns_parser parser;
+    struct dns_record record;
+    CHECK(dns_parser_init(&parser, msg, len) == 0);
+    CHECK(dns_parser_next(&parser, &record) == -1);
+}
+
+static void test_read_compressed_name(void) {
+    uint8_t msg[512];
+    size_t len = build_response(msg);
+    struct dns_parser parser;
+    struct dns_record record;
+    dns_parser_init(&parser, msg, len);
+    for (int i = 0; i < 3; ++i)
+        dns_parser_next(&parser, &record);
+    uint8_t name[DNS_NAME_MAX];
+    size_t name_len;
+    uint8_t expected[DNS_NAME_MAX];
+    size_t expected_len = put_name(expected, 0, "scanner.local");
+    // the name ends with a pointer, so reading continues right after the pointer
+    CHECK(dns_read_name(msg, len, record.rdata, name, &name_len) == record.end);
+    CHECK(name_len == expected_len && memcmp(name, expected, name_len) == 0);
+    CHECK(dns_skip_name(msg, len, record.rdata) == record.end);
+}
+
+static void test_read_name_pointer_chain(void) {
+    // "local" at 12, "b" + pointer to it at 19, "a" + pointer to "b.local" at 23
+    uint8_t msg[64];
+    size_t len = put_header(msg, 0, 0, 0, 0, 0);
+    len = put_name(msg, len, "local");
+    const uint8_t rest[] = {1, 'b', 0xc0, 12, 1, 'a', 0xc0, 19};
+    memcpy(msg + len, rest, sizeof(rest));
+    len += sizeof(rest);
+    uint8_t name[DNS_NAME_MAX];
+    size_t name_len;
+    uint8_t expected[DNS_NAME_MAX];
+    size_t expected_len = put_name(expected, 0, "a.b.local");
+    CHECK(dns_read_name(msg, len, 23, name, &name_len) == len);
+    CHECK(name_len == expected_len && memcmp(name, expected, name_len) == 0);
+}
+
+static void test_read_name_malformed(void) {
+    uint8_t msg[512];
+    uint8_t name[DNS_NAME_MAX];
+    size_t name_len;
+    size_t len = put_header(msg, 0, 0, 0, 0, 0);
+
+    // a pointer to itself, and one to the name after it, would loop
+    msg[len] = 0xc0;
+    msg[len + 1] = (uint8_t) len;
+    CHECK(dns_read_name(msg, len + 2, len, name, &name_len) == 0);
+    msg[len + 1] = (uint8_t) (len + 2);
+    msg[len + 2] = 0;
+    CHECK(dns_read_name(msg, len + 3, len, name, &name_len) == 0);
+
+    // a pointer cut after its first byte
+    CHECK(dns_read_name(msg, len + 1, len, name, &name_len) == 0);
+    CHECK(dns_skip_name(msg, len + 1, len) == 0);
+
+    // a label running past the end, and a name without its root label
+    size_t end = put_name(msg, len, "printer");
+    CHECK(dns_read_name(msg, end - 2, len, name, &name_len) == 0);
+    CHECK(dns_read_name(msg, end - 1, len, name, &name_len) == 0);
+    CHECK(dns_skip_name(msg, end - 1, len) == 0);
+
+    // extended label types
+    msg[len] = 0x41;
+    CHECK(dns_read_name(msg, end, len, name, &name_len) == 0);
+    CHECK(dns_skip_name(msg, end, len) == 0);
+
+    // five labels of 63 bytes make a name longer than 255 bytes
+    size_t pos = len;
+    for (int i = 0; i < 5; ++i) {
+        msg[pos++] = 63;
+        memset(msg + pos, 'x', 63);
+        pos += 63;
+    }
+    msg[pos++] = 0;
+    CHECK(dns_read_name(msg, pos, len, name, &name_len) == 0);
+}
+
+static void test_name_suffix(void) {
+    uint8_t name[DNS_NAME_MAX], suffix[DNS_NAME_MAX], other[DNS_NAME_MAX];
+    size_t name_len = put_name(name, 0, "Printer.LOCAL");
+    size_t suffix_len = put_name(suffix, 0, "local");
+    size_t other_len = put_name(other, 0, "xlocal");
+    CHECK(dns_name_suffix(name, name_len, suffix, suffix_len) == 8);
+    CHECK(dns_name_suffix(other, other_len, suffix, suffix_len) == -1);
+    CHECK(dns_name_suffix(suffix, suffix_len, name, name_len) == -1);
+    CHECK(dns_name_hash(name, name_len) != dns_name_hash(other, other_len));
+}
+
+static void test_service_type(void) {
+    uint8_t msg[512];
+    char type[DNS_NAME_MAX];
+    size_t len = put_name(msg, 0, "Printer._ipp._tcp.local");
+    CHECK(dns_service_type(msg, len, 0, type, sizeof(type)) == strlen("_ipp._tcp.local"));
+    CHECK(strcmp(type, "_ipp._tcp.local") == 0);
+    len = put_name(msg, 0, "_printer._sub._ipp._tcp.local");
+    CHECK(dns_service_type(msg, len, 0, type, sizeof(type)) && strcmp(type, "_ipp._tcp.local") == 0);
+    len = put_name(msg, 0, "printer.local");
+    CHECK(dns_service_type(msg, len, 0, type, sizeof(type)) == 0);
+    len = put_name(msg, 0, "_ipp._tcp.local");
+    CHECK(dns_service_type(msg, len, 0, type, 8) == 0);
+}
+
+static void test_record_hash_ignores_compression_and_case(void) {
+    uint8_t compressed[512], plain[512];
+    size_t compressed_len = build_response(compressed);
+    size_t plain_len = put_header(plain, DNS_FLAG_QR, 0, 1, 0, 0);
+    plain_len = put_name_record(plain, plain_len, "_Scanner._TCP.local", DNS_TYPE_PTR, 4500, "SCANNER.local");
+    struct dns_parser parser;
+    struct dns_record a, b;
+    dns_parser_init(&parser, compressed, compressed_len);
+    for (int i = 0; i < 3; ++i)
+        dns_parser_next(&parser, &a);
+    dns_parser_init(&parser, plain, plain_len);
+    dns_parser_next(&parser, &b);
+    uint64_t hash_a, hash_b;
+    CHECK(dns_record_hash(compressed, compressed_len, &a, &hash_a) == 0);
+    CHECK(dns_record_hash(plain, plain_len, &b, &hash_b) == 0);
+    CHECK(hash_a == hash_b);
+    // the TTL is part of the record
+    put_u32(plain, b.rdata - 6, 120);
+    CHECK(dns_record_hash(plain, plain_len, &b, &hash_b) == 0);
+    CHECK(hash_a != hash_b);
+}
+
+static void test_writer_compresses_suffixes(void) {
+    uint8_t buf[512];
+    uint8_t name[DNS_NAME_MAX];
+    struct dns_writer writer;
+    dns_writer_init(&writer, buf, sizeof(buf));
+    size_t name_len = put_name(name, 0, "printer.local");
+    CHECK(dns_writer_name(&writer, name, name_len) == 0);
+    CHECK(writer.len == DNS_HEADER_SIZE + name_len);
+    // only the new label is written, followed by a pointer to "local"
+    name_len = put_name(name, 0, "scanner.local");
+    size_t start = writer.len;
+    CHECK(dns_writer_name(&writer, name, name_len) == 0);
+    CHECK(writer.len == start + 8 + 2);
+    CHECK(buf[start + 8] == 0xc0 && buf[start + 9] == DNS_HEADER_SIZE + 8);
+    // a repeated name is a single pointer
+    size_t scanner = start;
+    start = writer.len;
+    CHECK(dns_writer_name(&writer, name, name_len) == 0);
+    CHECK(writer.len == start + 2);
+    CHECK(buf[start] == 0xc0 && buf[start + 1] == scanner);
+    // uncompressed names are written in full
+    start = writer.len;
+    CHECK(dns_writer_name_uncompressed(&writer, name, name_len) == 0);
+    CHECK(writer.len == start + name_len);
+    // and what was written reads back the same
+    uint8_t read[DNS_NAME_MAX];
+    size_t read_len;
+    CHECK(dns_read_name(buf, writer.len, start - 2, read, &read_len) == start);
+    CHECK(dns_name_equal(read, read_len, name, name_len));
+}
+
+static void test_writer_rewind_forgets_suffixes(void) {
+    uint8_t buf[512];
+    uint8_t name[DNS_NAME_MAX];
+    struct dns_writer writer;
+    dns_writer_init(&writer, buf, sizeof(buf));
+    size_t name_len = put_name(name, 0, "printer.local");
+    size_t len = writer.len, nsuffixes = writer.nsuffixes;
+    dns_writer_name(&writer, name, name_len);
+    dns_writer_rewind(&writer, len, nsuffixes);
+    CHECK(writer.len == DNS_HEADER_SIZE && writer.nsuffixes == 0);
+    // written again, the name must not point to the bytes that were undone
+    CHECK(dns_writer_name(&writer, name, name_len) == 0);
+    CHECK(writer.len == DNS_HEADER_SIZE + name_len);
+}
+
+static void test_writer_overflow(void) {
+    uint8_t buf[DNS_HEADER_SIZE + 8];
+    uint8_t name[DNS_NAME_MAX];
+    struct dns_writer writer;
+    dns_writer_init(&writer, buf, sizeof(buf));
+    size_t name_len = put_name(name, 0, "printer.local");
+    CHECK(dns_writer_name(&writer, name, name_len) == -1);
+    CHECK(writer.overflow && writer.len == DNS_HEADER_SIZE);
+    CHECK(dns_writer_bytes(&writer, name, 9) == -1);
+    CHECK(dns_writer_bytes(&writer, name, 8) == 0);
+}
+
+static void test_writer_copies_records(void) {
+    uint8_t msg[512], out[512];
+    size_t len = build_response(msg);
+    struct dns_parser parser;
+    struct dns_record record;
+    struct dns_writer writer;
+    dns_writer_init(&writer, out, sizeof(out));
+    dns_parser_init(&parser, msg, len);
+    while (dns_parser_next(&parser, &record) == 1)
+        CHECK(dns_writer_record(&writer, msg, len, &record) == 0);
+    size_t out_len = dns_writer_finish(&writer, 0x1234, DNS_FLAG_QR);
+    // the copy has the same records, with RDLENGTH following the re-encoded RDATA
+    struct dns_record copy;
+    dns_parser_init(&parser, msg, len);
+    struct dns_parser copy_parser;
+    CHECK(dns_parser_init(&copy_parser, out, out_len) == 0);
+    CHECK(copy_parser.header.id == 0x1234);
+    CHECK(copy_parser.header.counts[DNS_SECTION_QUESTION] == 1);
+    CHECK(copy_parser.header.counts[DNS_SECTION_ANSWER] == 2);
+    while (dns_parser_next(&parser, &record) == 1) {
+        CHECK(dns_parser_next(&copy_parser, &copy) == 1);
+        uint64_t hash, copy_hash;
+        CHECK(dns_record_hash(msg, len, &record, &hash) == 0);
+        CHECK(dns_record_hash(out, out_len, &copy, &copy_hash) == 0);
+        CHECK(hash == copy_hash);
+    }
+    CHECK(dns_parser_next(&copy_parser, &copy) == 0);
+}
+
+static void test_writer_rejects_malformed_records(void) {
+    uint8_t msg[512], out[512];
+    size_t len = put_header(msg, DNS_FLAG_QR, 0, 1, 0, 0);
+    // a PTR record whose target points forward
+    const uint8_t rdata[] = {0xc0, 0xff};
+    len = put_record(msg, len, "_ipp._tcp.local", DNS_TYPE_PTR, 120, rdata, sizeof(rdata));
+    struct dns_parser parser;
+    struct dns_record record;
+    struct dns_writer writer;
+    dns_writer_init(&writer, out, sizeof(out));
+    dns_parser_init(&parser, msg, len);
+    CHECK(dns_parser_next(&parser, &record) == 1);
+    CHECK(dns_writer_record(&writer, msg, len, &record) == -2);
+    CHECK(writer.len == DNS_HEADER_SIZE && writer.counts[DNS_SECTION_ANSWER] == 0);
+    // a record that doesn't fit leaves nothing behind either
+    size_t ok_len = put_header(msg, DNS_FLAG_QR, 0, 1, 0, 0);
+    ok_len = put_record(msg, ok_len, "printer.local", DNS_TYPE_A, 120, A_RDATA, sizeof(A_RDATA));
+    dns_writer_init(&writer, out, ok_len - 1);
+    dns_parser_init(&parser, msg, ok_len);
+    CHECK(dns_parser_next(&parser, &record) == 1);
+    CHECK(dns_writer_record(&writer, msg, ok_len, &record) == -1);
+    CHECK(writer.len == DNS_HEADER_SIZE && writer.nsuffixes == 0);
+}
+
+int main(void) {
+    test_parse_records();
+    test_parse_short_header();
+    test_parse_truncated();
+    test_parse_counts_beyond_message();
+    test_parse_rdlength_beyond_message();
+    test_read_compressed_name();
+    test_read_name_pointer_chain();
+    test_read_name_malformed();
+    test_name_suffix();
+    test_service_type();
+    test_record_hash_ignores_compression_and_case();
+    test_writer_compresses_suffixes();
+    test_writer_rewind_forgets_suffixes();
+    test_writer_overflow();
+    test_writer_copies_records();
+    test_writer_rejects_malformed_records();
+    return check_result();
+}
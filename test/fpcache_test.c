@@ -0,0 +1,85 @@
+/*
+    This file is part of mDNS Reflector (mdns-reflector), a lightweight and performant multicast DNS (mDNS) reflector.
+    Copyright (C) 2021 Yuxiang Zhu <me@yux.im>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "fpcache.h"
+#include "testutil.h"
+
+#define WINDOW_NS 1000u
+
+static void test_find_within_window(struct fpcache *cache) {
+    int tag = -1;
+    CHECK(!fpcache_find(cache, 42, 100, WINDOW_NS, &tag));
+    fpcache_put(cache, 42, 7, 100);
+    CHECK(fpcache_find(cache, 42, 100, WINDOW_NS, &tag));
+    CHECK(tag == 7);
+    CHECK(fpcache_find(cache, 42, 100 + WINDOW_NS - 1, WINDOW_NS, NULL));
+    CHECK(!fpcache_find(cache, 42, 100 + WINDOW_NS, WINDOW_NS, NULL));
+    CHECK(!fpcache_find(cache, 43, 100, WINDOW_NS, NULL));
+}
+
+static void test_zero_fingerprint_and_time(struct fpcache *cache) {
+    // an empty slot must not match a zero fingerprint seen at time zero
+    CHECK(!fpcache_find(cache, 0, 0, WINDOW_NS, NULL));
+    fpcache_put(cache, 0, 1, 0);
+    CHECK(fpcache_find(cache, 0, 0, WINDOW_NS, NULL));
+}
+
+static void test_put_replaces_tag_and_time(struct fpcache *cache) {
+    int tag = -1;
+    fpcache_put(cache, 99, 1, 100);
+    fpcache_put(cache, 99, 2, 500);
+    CHECK(fpcache_find(cache, 99, 500 + WINDOW_NS - 1, WINDOW_NS, &tag));
+    CHECK(tag == 2);
+}
+
+static void test_collision_evicts_older(struct fpcache *cache) {
+    // the low bits pick the slot, so these two share one
+    uint64_t a = 5, b = 5 + FPCACHE_SIZE;
+    fpcache_put(cache, a, 1, 100);
+    fpcache_put(cache, b, 2, 100);
+    CHECK(!fpcache_find(cache, a, 100, WINDOW_NS, NULL));
+    CHECK(fpcache_find(cache, b, 100, WINDOW_NS, NULL));
+}
+
+static void test_remove(struct fpcache *cache) {
+    fpcache_put(cache, 1234, 1, 100);
+    fpcache_remove(cache, 4321);
+    CHECK(fpcache_find(cache, 1234, 100, WINDOW_NS, NULL));
+    fpcache_remove(cache, 1234);
+    CHECK(!fpcache_find(cache, 1234, 100, WINDOW_NS, NULL));
+}
+
+int main(void) {
+    void (*tests[])(struct fpcache *) = {
+            test_find_within_window,
+            test_zero_fingerprint_and_time,
+            test_put_replaces_tag_and_time,
+            test_collision_evicts_older,
+            test_remove,
+    };
+    for (size_t i = 0; i < sizeof(tests) / sizeof(tests[0]); ++i) {
+        struct fpcache *cache = calloc(1, sizeof(struct fpcache));
+        if (!cache) {
+            perror("calloc");
+            return EXIT_FAILURE;
+        }
+        tests[i](cache);
+        free(cache);
+    }
+    return check_result();
+}
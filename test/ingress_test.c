@@ -0,0 +1,110 @@
+/*
+    This file is part of mDNS Reflector (mdns-reflector), a lightweight and performant multicast DNS (mDNS) reflector.
+    Copyright (C) 2021 Yuxiang Zhu <me@yux.im>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "ingress.h"
+#include "testutil.h"
+
+#define MDNS_PORT 5353
+
+static void test_accepts_queries_and_responses(void) {
+    uint8_t msg[512];
+    size_t len = put_header(msg, 0, 1, 0, 0, 0);
+    len = put_question(msg, len, "_ipp._tcp.local", DNS_TYPE_PTR);
+    CHECK(ingress_check(msg, len, MDNS_PORT, 255) == INGRESS_ACCEPT);
+    // legacy unicast queries come from other ports
+    CHECK(ingress_check(msg, len, 49152, 255) == INGRESS_ACCEPT);
+    // the TTL isn't known on every platform
+    CHECK(ingress_check(msg, len, MDNS_PORT, -1) == INGRESS_ACCEPT);
+    const uint8_t a[] = {192, 168, 1, 20};
+    len = put_header(msg, DNS_FLAG_QR | DNS_FLAG_AA, 0, 1, 0, 0);
+    len = put_record(msg, len, "printer.local", DNS_TYPE_A, 120, a, sizeof(a));
+    CHECK(ingress_check(msg, len, MDNS_PORT, 255) == INGRESS_ACCEPT);
+}
+
+static void test_drops_off_link_and_foreign_packets(void) {
+    uint8_t msg[512];
+    const uint8_t a[] = {192, 168, 1, 20};
+    size_t len = put_header(msg, DNS_FLAG_QR, 0, 1, 0, 0);
+    len = put_record(msg, len, "printer.local", DNS_TYPE_A, 120, a, sizeof(a));
+    CHECK(ingress_check(msg, len, MDNS_PORT, 254) == INGRESS_DROP_TTL);
+    CHECK(ingress_check(msg, len, MDNS_PORT, 1) == INGRESS_DROP_TTL);
+    CHECK(ingress_check(msg, len, 53, 255) == INGRESS_DROP_SOURCE_PORT);
+    CHECK(ingress_check(msg, DNS_HEADER_SIZE - 1, MDNS_PORT, 255) == INGRESS_DROP_SHORT);
+    put_u16(msg, 2, DNS_FLAG_QR | 5u << 11);
+    CHECK(ingress_check(msg, len, MDNS_PORT, 255) == INGRESS_DROP_OPCODE);
+    put_u16(msg, 2, DNS_FLAG_QR | 3u);
+    CHECK(ingress_check(msg, len, MDNS_PORT, 255) == INGRESS_DROP_RCODE);
+}
+
+static void test_drops_impossible_counts(void) {
+    uint8_t msg[512];
+    // no records at all
+    size_t len = put_header(msg, DNS_FLAG_QR, 0, 0, 0, 0);
+    CHECK(ingress_check(msg, len, MDNS_PORT, 255) == INGRESS_DROP_COUNTS);
+    // the smallest question takes 5 bytes and the smallest record 11
+    len = put_header(msg, 0, 2, 0, 0, 0);
+    memset(msg + len, 0, 10);
+    CHECK(ingress_check(msg, len + 10, MDNS_PORT, 255) == INGRESS_ACCEPT);
+    CHECK(ingress_check(msg, len + 9, MDNS_PORT, 255) == INGRESS_DROP_COUNTS);
+    len = put_header(msg, DNS_FLAG_QR, 0, 1, 1, 1);
+    memset(msg + len, 0, 33);
+    CHECK(ingress_check(msg, len + 33, MDNS_PORT, 255) == INGRESS_ACCEPT);
+    CHECK(ingress_check(msg, len + 32, MDNS_PORT, 255) == INGRESS_DROP_COUNTS);
+    // counts that would overflow 16 bits when added up
+    len = put_header(msg, DNS_FLAG_QR, 0, 0xffff, 0xffff, 0xffff);
+    CHECK(ingress_check(msg, sizeof(msg), MDNS_PORT, 255) == INGRESS_DROP_COUNTS);
+}
+
+static void test_ssdp(void) {
+    const char notify[] = "NOTIFY * HTTP/1.1\r\nHOST: 239.255.255.250:1900\r\n\r\n";
+    const char search[] = "M-SEARCH * HTTP/1.1\r\nHOST: 239.255.255.250:1900\r\n\r\n";
+    const char response[] = "HTTP/1.1 200 OK\r\n\r\n";
+    CHECK(ingress_check_ssdp((const uint8_t *) notify, sizeof(notify) - 1, 1900, 2) == INGRESS_ACCEPT);
+    CHECK(ingress_check_ssdp((const uint8_t *) search, sizeof(search) - 1, 50000, 2) == INGRESS_ACCEPT);
+    CHECK(ingress_check_ssdp((const uint8_t *) response, sizeof(response) - 1, 1900, 2) == INGRESS_DROP_FORMAT);
+    // cut within the request line
+    CHECK(ingress_check_ssdp((const uint8_t *) notify, 10, 1900, 2) == INGRESS_DROP_FORMAT);
+}
+
+static void test_wsd(void) {
+    const char xml[] = "<?xml version=\"1.0\"?><soap:Envelope/>";
+    const char bom[] = "\xef\xbb\xbf\r\n  <soap:Envelope/>";
+    const char text[] = "hello";
+    CHECK(ingress_check_wsd((const uint8_t *) xml, sizeof(xml) - 1, 3702, 1) == INGRESS_ACCEPT);
+    CHECK(ingress_check_wsd((const uint8_t *) bom, sizeof(bom) - 1, 3702, 1) == INGRESS_ACCEPT);
+    CHECK(ingress_check_wsd((const uint8_t *) text, sizeof(text) - 1, 3702, 1) == INGRESS_DROP_FORMAT);
+    CHECK(ingress_check_wsd((const uint8_t *) bom, 5, 3702, 1) == INGRESS_DROP_FORMAT);
+}
+
+static void test_verdict_names(void) {
+    CHECK(strcmp(ingress_verdict_name(INGRESS_ACCEPT), "accepted") == 0);
+    CHECK(strcmp(ingress_verdict_name(INGRESS_DROP_TTL), "ttl") == 0);
+    for (int verdict = 0; verdict < INGRESS_VERDICTS; ++verdict)
+        CHECK(ingress_verdict_name((enum ingress_verdict) verdict) != NULL);
+    CHECK(strcmp(ingress_verdict_name(INGRESS_VERDICTS), "unknown") == 0);
+}
+
+int main(void) {
+    test_accepts_queries_and_responses();
+    test_drops_off_link_and_foreign_packets();
+    test_drops_impossible_counts();
+    test_ssdp();
+    test_wsd();
+    test_verdict_names();
+    return check_result();
+}
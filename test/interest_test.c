@@ -0,0 +1,172 @@
+/*
+    This file is part of mDNS Reflector (mdns-reflector), a lightweight and performant multicast DNS (mDNS) reflector.
+    Copyright (C) 2021 Yuxiang Zhu <me@yux.im>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "interest.h"
+#include "testutil.h"
+
+#define MS UINT64_C(1000000)
+#define FLOOD_INTERVAL_NS (1000 * MS)
+#define TIMEOUT_NS (60000 * MS)
+
+static size_t build_query(uint8_t *msg, const char *type) {
+    size_t len = put_header(msg, 0, 1, 0, 0, 0);
+    return put_question(msg, len, type, DNS_TYPE_PTR);
+}
+
+static size_t build_response(uint8_t *msg, const char *type) {
+    char instance[DNS_NAME_MAX];
+    snprintf(instance, sizeof(instance), "Printer.%s", type);
+    size_t len = put_header(msg, DNS_FLAG_QR | DNS_FLAG_AA, 0, 1, 0, 0);
+    return put_name_record(msg, len, type, DNS_TYPE_PTR, 4500, instance);
+}
+
+static void test_queries_go_where_responders_are(struct interest_table *table) {
+    uint8_t msg[512];
+    struct interest_packet packet;
+    uint64_t now = 1000 * MS;
+    // the first query for a type is flooded to find responders
+    size_t len = build_query(msg, "_ipp._tcp.local");
+    interest_observe(table, msg, len, 1, now, FLOOD_INTERVAL_NS, &packet);
+    CHECK(packet.flood && !packet.response && packet.ntypes == 1);
+    CHECK(table->stats.flooded_queries == 1);
+    // a responder answers on interface 2; the response is wanted where the query came from
+    len = build_response(msg, "_ipp._tcp.local");
+    interest_observe(table, msg, len, 2, now + MS, FLOOD_INTERVAL_NS, &packet);
+    CHECK(!packet.flood && packet.response);
+    CHECK(interest_wanted(table, &packet, 1, now + MS, TIMEOUT_NS));
+    CHECK(!interest_wanted(table, &packet, 3, now + MS, TIMEOUT_NS));
+    // the next query within the flood interval only goes to the responder
+    len = build_query(msg, "_ipp._tcp.local");
+    interest_observe(table, msg, len, 1, now + 2 * MS, FLOOD_INTERVAL_NS, &packet);
+    CHECK(!packet.flood);
+    CHECK(table->stats.directed_queries == 1);
+    CHECK(interest_wanted(table, &packet, 2, now + 2 * MS, TIMEOUT_NS));
+    CHECK(!interest_wanted(table, &packet, 3, now + 2 * MS, TIMEOUT_NS));
+    // until the responder was last heard too long ago
+    CHECK(!interest_wanted(table, &packet, 2, now + MS + TIMEOUT_NS, TIMEOUT_NS));
+    // once the interval passed, a query is flooded again
+    interest_observe(table, msg, len, 1, now + FLOOD_INTERVAL_NS, FLOOD_INTERVAL_NS, &packet);
+    CHECK(packet.flood);
+}
+
+static void test_types_ignore_case(struct interest_table *table) {
+    uint8_t msg[512];
+    struct interest_packet a, b;
+    size_t len = build_query(msg, "_ipp._tcp.local");
+    interest_observe(table, msg, len, 1, MS, FLOOD_INTERVAL_NS, &a);
+    len = build_query(msg, "Printer._IPP._TCP.local");
+    interest_observe(table, msg, len, 1, MS, FLOOD_INTERVAL_NS, &b);
+    CHECK(a.ntypes == 1 && b.ntypes == 1 && a.types[0] == b.types[0]);
+    // the type was flooded already
+    CHECK(!b.flood);
+}
+
+static void test_unfiltered_packets_are_flooded(struct interest_table *table) {
+    uint8_t msg[512];
+    struct interest_packet packet;
+    // probes carry their proposed records in the authority section
+    size_t len = put_header(msg, 0, 1, 0, 1, 0);
+    len = put_question(msg, len, "Printer._ipp._tcp.local", DNS_TYPE_ANY);
+    uint8_t srv[DNS_NAME_MAX] = {0, 0, 0, 0, 0x02, 0x77};
+    len = put_record(msg, len, "Printer._ipp._tcp.local", DNS_TYPE_SRV, 120, srv, put_name(srv, 6, "printer.local"));
+    interest_observe(table, msg, len, 1, MS, FLOOD_INTERVAL_NS, &packet);
+    CHECK(packet.flood && packet.ntypes == 0);
+    // names that aren't DNS-SD names
+    len = build_query(msg, "printer.local");
+    interest_observe(table, msg, len, 1, MS, FLOOD_INTERVAL_NS, &packet);
+    CHECK(packet.flood && packet.ntypes == 0);
+    // more types than are tracked per packet
+    len = put_header(msg, 0, INTEREST_TYPES_PER_PACKET + 1, 0, 0, 0);
+    for (unsigned int i = 0; i <= INTEREST_TYPES_PER_PACKET; ++i) {
+        char type[32];
+        snprintf(type, sizeof(type), "_svc%u._tcp.local", i);
+        len = put_question(msg, len, type, DNS_TYPE_PTR);
+    }
+    interest_observe(table, msg, len, 1, MS, FLOOD_INTERVAL_NS, &packet);
+    CHECK(packet.flood && packet.ntypes == 0);
+    // malformed and short packets
+    len = build_query(msg, "_ipp._tcp.local");
+    interest_observe(table, msg, len - 1, 1, MS, FLOOD_INTERVAL_NS, &packet);
+    CHECK(packet.flood);
+    interest_observe(table, msg, DNS_HEADER_SIZE - 1, 1, MS, FLOOD_INTERVAL_NS, &packet);
+    CHECK(packet.flood);
+    CHECK(table->stats.unfiltered_packets == 5);
+    CHECK(table->n == 0);
+    CHECK(interest_wanted(table, &packet, 7, MS, TIMEOUT_NS));
+}
+
+static void test_least_recently_used_is_evicted(struct interest_table *table) {
+    uint8_t msg[512];
+    struct interest_packet packet;
+    size_t len = build_response(msg, "_ipp._tcp.local");
+    // responses make one entry per interface, and no flood entry
+    for (unsigned int ifindex = 1; ifindex <= INTEREST_ENTRIES_MAX + 1; ++ifindex)
+        interest_observe(table, msg, len, ifindex, ifindex * MS, FLOOD_INTERVAL_NS, &packet);
+    CHECK(table->n == INTEREST_ENTRIES_MAX);
+    CHECK(table->stats.evictions == 1);
+    // a query of the type goes where responders were heard
+    packet.response = false;
+    uint64_t now = (INTEREST_ENTRIES_MAX + 2) * MS;
+    CHECK(!interest_wanted(table, &packet, 1, now, TIMEOUT_NS));
+    CHECK(interest_wanted(table, &packet, 2, now, TIMEOUT_NS));
+    CHECK(interest_wanted(table, &packet, INTEREST_ENTRIES_MAX + 1, now, TIMEOUT_NS));
+}
+
+static void test_expire_keeps_the_index_intact(struct interest_table *table) {
+    uint8_t msg[512];
+    struct interest_packet packets[300];
+    // many types on one interface, so that probe sequences of the index overlap
+    for (unsigned int i = 0; i < 300; ++i) {
+        char type[32];
+        snprintf(type, sizeof(type), "_svc%u._tcp.local", i);
+        size_t len = build_response(msg, type);
+        interest_observe(table, msg, len, 1, (i + 1) * MS, FLOOD_INTERVAL_NS, &packets[i]);
+    }
+    // a refreshed entry survives the expiry of those around it
+    size_t len = build_response(msg, "_svc10._tcp.local");
+    interest_observe(table, msg, len, 1, 301 * MS, FLOOD_INTERVAL_NS, &packets[10]);
+    uint64_t now = 150 * MS + TIMEOUT_NS;
+    CHECK(interest_expire(table, now, TIMEOUT_NS) == 151);
+    for (unsigned int i = 0; i < 300; ++i) {
+        // as a query, the type is wanted where its responder was heard
+        packets[i].response = false;
+        CHECK(interest_wanted(table, &packets[i], 1, now, UINT64_MAX) == (i >= 150 || i == 10));
+    }
+    CHECK(interest_expire(table, 302 * MS + TIMEOUT_NS, TIMEOUT_NS) == 0);
+    CHECK(table->lru_head == 0 && table->lru_tail == 0);
+}
+
+int main(void) {
+    void (*tests[])(struct interest_table *) = {
+            test_queries_go_where_responders_are,
+            test_types_ignore_case,
+            test_unfiltered_packets_are_flooded,
+            test_least_recently_used_is_evicted,
+            test_expire_keeps_the_index_intact,
+    };
+    for (size_t i = 0; i < sizeof(tests) / sizeof(tests[0]); ++i) {
+        struct interest_table *table = new_interest_table();
+        if (!table) {
+            perror("calloc");
+            return EXIT_FAILURE;
+        }
+        tests[i](table);
+        free(table);
+    }
+    return check_result();
+}
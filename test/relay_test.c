@@ -0,0 +1,164 @@
+/*
+    This file is part of mDNS Reflector (mdns-reflector), a lightweight and performant multicast DNS (mDNS) reflector.
+    Copyright (C) 2021 Yuxiang Zhu <me@yux.im>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "relay.h"
+#include "testutil.h"
+#include <netinet/in.h>
+
+#define MS UINT64_C(1000000)
+
+static const uint8_t QUERY[] = {0, 0, 0, 0, 0, 1, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 1};
+static const uint8_t RESPONSE[] = {0, 0, 0x84, 0, 0, 0, 0, 1, 0, 0, 0, 0, 0, 0, 1, 0, 1, 0, 0, 0, 120, 0, 0};
+
+/// A batch of a query over IPv4 and a response over IPv6.
+static void fill_batch(struct relay *relay) {
+    relay_add(relay, QUERY, sizeof(QUERY), AF_INET);
+    relay_add(relay, RESPONSE, sizeof(RESPONSE), AF_INET6);
+}
+
+static void test_reader_reads_a_batch(struct relay *relay) {
+    fill_batch(relay);
+    struct relay_reader reader;
+    const uint8_t *msg;
+    size_t len;
+    int family;
+    CHECK(relay_reader_init(&reader, relay->batch, relay->batch_len) == 0);
+    CHECK(relay_reader_next(&reader, &msg, &len, &family) == 1);
+    CHECK(family == AF_INET && len == sizeof(QUERY) && memcmp(msg, QUERY, len) == 0);
+    CHECK(relay_reader_next(&reader, &msg, &len, &family) == 1);
+    CHECK(family == AF_INET6 && len == sizeof(RESPONSE) && memcmp(msg, RESPONSE, len) == 0);
+    CHECK(relay_reader_next(&reader, &msg, &len, &family) == 0);
+    CHECK(relay_reader_next(&reader, &msg, &len, &family) == 0);
+    // a new batch starts over
+    relay_reset_batch(relay);
+    relay_add(relay, RESPONSE, sizeof(RESPONSE), AF_INET);
+    CHECK(relay_reader_init(&reader, relay->batch, relay->batch_len) == 0);
+    CHECK(relay_reader_next(&reader, &msg, &len, &family) == 1);
+    CHECK(relay_reader_next(&reader, &msg, &len, &family) == 0);
+}
+
+static void test_reader_rejects_bad_headers(struct relay *relay) {
+    fill_batch(relay);
+    struct relay_reader reader;
+    uint8_t datagram[RELAY_DATAGRAM_MAX];
+    CHECK(relay_reader_init(&reader, relay->batch, RELAY_HEADER_SIZE - 1) == -1);
+    for (size_t i = 0; i < 3; ++i) {
+        memcpy(datagram, relay->batch, relay->batch_len);
+        datagram[i] ^= 0x40;
+        CHECK(relay_reader_init(&reader, datagram, relay->batch_len) == -1);
+    }
+}
+
+static void test_reader_rejects_malformed_frames(struct relay *relay) {
+    fill_batch(relay);
+    struct relay_reader reader;
+    const uint8_t *msg;
+    size_t len;
+    int family;
+    uint8_t datagram[RELAY_DATAGRAM_MAX];
+    // cut anywhere within the frames
+    for (size_t cut = RELAY_HEADER_SIZE; cut < relay->batch_len; ++cut) {
+        int r;
+        CHECK(relay_reader_init(&reader, relay->batch, cut) == 0);
+        while ((r = relay_reader_next(&reader, &msg, &len, &family)) == 1)
+            CHECK(msg + len <= relay->batch + cut);
+        CHECK(r == -1);
+    }
+    // trailing bytes after the last message
+    memcpy(datagram, relay->batch, relay->batch_len);
+    datagram[relay->batch_len] = 0;
+    CHECK(relay_reader_init(&reader, datagram, relay->batch_len + 1) == 0);
+    CHECK(relay_reader_next(&reader, &msg, &len, &family) == 1);
+    CHECK(relay_reader_next(&reader, &msg, &len, &family) == 1);
+    CHECK(relay_reader_next(&reader, &msg, &len, &family) == -1);
+    // more messages announced than there are
+    memcpy(datagram, relay->batch, relay->batch_len);
+    datagram[3] = 3;
+    CHECK(relay_reader_init(&reader, datagram, relay->batch_len) == 0);
+    CHECK(relay_reader_next(&reader, &msg, &len, &family) == 1);
+    CHECK(relay_reader_next(&reader, &msg, &len, &family) == 1);
+    CHECK(relay_reader_next(&reader, &msg, &len, &family) == -1);
+    // an unknown address family
+    memcpy(datagram, relay->batch, relay->batch_len);
+    datagram[RELAY_HEADER_SIZE] = 5;
+    CHECK(relay_reader_init(&reader, datagram, relay->batch_len) == 0);
+    CHECK(relay_reader_next(&reader, &msg, &len, &family) == -1);
+    // a length beyond the datagram
+    memcpy(datagram, relay->batch, relay->batch_len);
+    datagram[RELAY_HEADER_SIZE + 2] = 0xff;
+    CHECK(relay_reader_init(&reader, datagram, relay->batch_len) == 0);
+    CHECK(relay_reader_next(&reader, &msg, &len, &family) == -1);
+}
+
+static void test_batch_room(struct relay *relay) {
+    relay->max_datagram = RELAY_HEADER_SIZE + 2 * (RELAY_FRAME_HEADER_SIZE + sizeof(QUERY));
+    relay_add(relay, QUERY, sizeof(QUERY), AF_INET);
+    CHECK(relay_has_room(relay, sizeof(QUERY)));
+    CHECK(!relay_has_room(relay, sizeof(QUERY) + 1));
+    relay_add(relay, QUERY, sizeof(QUERY), AF_INET);
+    CHECK(relay->batch_len == relay->max_datagram);
+    CHECK(!relay_has_room(relay, 0));
+    // the message count fits in one byte
+    relay_reset_batch(relay);
+    relay->max_datagram = RELAY_DATAGRAM_MAX;
+    for (unsigned int i = 0; i < RELAY_MESSAGES_MAX; ++i) {
+        CHECK(relay_has_room(relay, sizeof(QUERY)));
+        relay_add(relay, QUERY, sizeof(QUERY), AF_INET);
+    }
+    CHECK(!relay_has_room(relay, sizeof(QUERY)));
+    struct relay_reader reader;
+    const uint8_t *msg;
+    size_t len;
+    int family;
+    unsigned int n = 0;
+    CHECK(relay_reader_init(&reader, relay->batch, relay->batch_len) == 0);
+    while (relay_reader_next(&reader, &msg, &len, &family) == 1)
+        n++;
+    CHECK(n == RELAY_MESSAGES_MAX);
+}
+
+static void test_echoes(struct relay *relay) {
+    // sent to the peer, then received back: an echo
+    CHECK(!relay_is_echo(relay, QUERY, sizeof(QUERY), false, 100 * MS));
+    CHECK(relay_is_echo(relay, QUERY, sizeof(QUERY), true, 200 * MS));
+    // retransmissions in the same direction are not
+    CHECK(!relay_is_echo(relay, RESPONSE, sizeof(RESPONSE), true, 100 * MS));
+    CHECK(!relay_is_echo(relay, RESPONSE, sizeof(RESPONSE), true, 200 * MS));
+    // nor is the same message once the window passed
+    CHECK(!relay_is_echo(relay, RESPONSE, sizeof(RESPONSE), false, 200 * MS + (uint64_t) relay->dedup_ms * MS));
+}
+
+int main(void) {
+    void (*tests[])(struct relay *) = {
+            test_reader_reads_a_batch,
+            test_reader_rejects_bad_headers,
+            test_reader_rejects_malformed_frames,
+            test_batch_room,
+            test_echoes,
+    };
+    for (size_t i = 0; i < sizeof(tests) / sizeof(tests[0]); ++i) {
+        struct relay *relay = new_relay("test", NULL);
+        if (!relay) {
+            perror("calloc");
+            return EXIT_FAILURE;
+        }
+        tests[i](relay);
+        free_relays(relay);
+    }
+    return check_result();
+}
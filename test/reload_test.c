@@ -0,0 +1,266 @@
+/*
+    This file is part of mDNS Reflector (mdns-reflector), a lightweight and performant multicast DNS (mDNS) reflector.
+    Copyright (C) 2021 Yuxiang Zhu <me@yux.im>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#define _GNU_SOURCE
+#include "mdnsreflector.h"
+#include "testutil.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sched.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+// exit status telling ctest that the test was skipped
+#define SKIPPED 77
+#define PROXY_PORT 5300
+#define ADDED_PROXY_PORT 5301
+
+static char config_path[] = "/tmp/mdns-reflector-reload-XXXXXX";
+
+static int write_file(const char *path, const char *text) {
+    int fd = open(path, O_WRONLY | O_TRUNC);
+    if (fd == -1)
+        return -1;
+    size_t len = strlen(text);
+    ssize_t written = write(fd, text, len);
+    close(fd);
+    return written == (ssize_t) len ? 0 : -1;
+}
+
+/// Enter new user and network namespaces with a veth pair, so that interfaces can be added and removed freely.
+static int enter_namespaces(void) {
+    char map[32];
+    unsigned int uid = getuid(), gid = getgid();
+    if (unshare(CLONE_NEWUSER | CLONE_NEWNET) == -1)
+        return -1;
+    snprintf(map, sizeof(map), "0 %u 1", uid);
+    if (write_file("/proc/self/uid_map", map) == -1)
+        return -1;
+    // setgroups must be denied before an unprivileged process may write gid_map
+    write_file("/proc/self/setgroups", "deny");
+    snprintf(map, sizeof(map), "0 %u 1", gid);
+    if (write_file("/proc/self/gid_map", map) == -1)
+        return -1;
+    return system("ip link set lo up && ip link add mrt0 type veth peer name mrt1 && "
+                  "ip link set mrt0 up && ip link set mrt1 up && "
+                  "ip addr add 10.99.0.1/24 dev mrt0 && ip addr add 10.99.0.2/24 dev mrt1") == 0 ? 0 : -1;
+}
+
+static void write_config(const char *text) {
+    if (write_file(config_path, text) == -1) {
+        perror(config_path);
+        exit(EXIT_FAILURE);
+    }
+}
+
+static uint64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000 + (uint64_t) ts.tv_nsec / 1000000;
+}
+
+/// Run the reflector for a while.
+static void run(struct mdns_reflector *reflector, unsigned int ms) {
+    uint64_t end = now_ms() + ms;
+    for (uint64_t now = now_ms(); now < end; now = now_ms()) {
+        int timeout = (int) (end - now);
+        int reflector_timeout = mdns_reflector_timeout_ms(reflector);
+        if (reflector_timeout >= 0 && reflector_timeout < timeout)
+            timeout = reflector_timeout;
+        struct pollfd pfd = {.fd = mdns_reflector_fd(reflector), .events = POLLIN};
+        poll(&pfd, 1, timeout);
+        if (mdns_reflector_process(reflector, 0) == -1) {
+            fprintf(stderr, "mdns_reflector_process failed\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+static int open_client(uint16_t port) {
+    int fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+    struct sockaddr_in addr = {.sin_family = AF_INET, .sin_port = htons(port)};
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (fd == -1 || connect(fd, (const struct sockaddr *) &addr, sizeof(addr)) == -1) {
+        perror("client socket");
+        exit(EXIT_FAILURE);
+    }
+    return fd;
+}
+
+/// Ask a discovery proxy for an address nobody has. Each ID asks for another name, as the proxy asks for a name in
+/// the zone only once per second and answers right away in between.
+static void send_query(int fd, uint16_t id) {
+    uint8_t msg[512];
+    char name[64];
+    snprintf(name, sizeof(name), "nobody%u.test.home.arpa", id);
+    size_t len = put_header(msg, 0x0100, 1, 0, 0, 0);
+    put_u16(msg, 0, id);
+    len = put_question(msg, len, name, DNS_TYPE_A);
+    if (send(fd, msg, len, 0) != (ssize_t) len) {
+        perror("send");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/// \return ID of the response waiting on the socket, or -1 if there is none
+static int receive_answer(int fd) {
+    uint8_t msg[512];
+    ssize_t len = recv(fd, msg, sizeof(msg), 0);
+    if (len < DNS_HEADER_SIZE || !(msg[2] & 0x80))
+        return -1;
+    return msg[0] << 8 | msg[1];
+}
+
+static size_t count_ifs(const struct mdns_reflector *reflector, const char *ifname) {
+    struct mdns_reflector_if_stats stats[16];
+    size_t n = mdns_reflector_get_if_stats(reflector, stats, 16);
+    size_t count = 0;
+    for (size_t i = 0; i < n && i < 16; ++i) {
+        if (!ifname || strcmp(stats[i].ifname, ifname) == 0)
+            count++;
+    }
+    return count;
+}
+
+/// \return whether something is bound to the UDP port on the loopback address
+static bool port_in_use(uint16_t port) {
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in addr = {.sin_family = AF_INET, .sin_port = htons(port)};
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    bool in_use = bind(fd, (const struct sockaddr *) &addr, sizeof(addr)) == -1 && errno == EADDRINUSE;
+    close(fd);
+    return in_use;
+}
+
+static const char *const CONFIG_LAN =
+        "[global]\n"
+        "family = ipv4\n"
+        "[zone lan]\n"
+        "interfaces = mrt0 lo\n"
+        "[discovery iot]\n"
+        "zone = lan\n"
+        "domain = test.home.arpa\n"
+        "listen = 127.0.0.1:5300\n"
+        "query_wait_ms = 300\n";
+
+static const char *const CONFIG_LAN_ADDED =
+        "[global]\n"
+        "family = ipv4\n"
+        "[zone lan]\n"
+        "interfaces = mrt0 mrt1 lo\n"
+        "[discovery iot]\n"
+        "zone = lan\n"
+        "domain = test.home.arpa\n"
+        "listen = 127.0.0.1:5300\n"
+        "query_wait_ms = 300\n"
+        "[discovery lab]\n"
+        "zone = lan\n"
+        "domain = test.home.arpa\n"
+        "listen = 127.0.0.1:5301\n"
+        "query_wait_ms = 300\n";
+
+static const char *const CONFIG_LAN_REMOVED =
+        "[global]\n"
+        "family = ipv4\n"
+        "[zone lan]\n"
+        "interfaces = mrt1 lo\n"
+        "[discovery iot]\n"
+        "zone = lan\n"
+        "domain = test.home.arpa\n"
+        "listen = 127.0.0.1:5300\n"
+        "query_wait_ms = 300\n";
+
+static const char *const CONFIG_INVALID =
+        "[zone lan]\n"
+        "interfaces = mrt-none0 lo\n";
+
+static void test_reload(struct mdns_reflector *reflector) {
+    int client = open_client(PROXY_PORT);
+    CHECK(count_ifs(reflector, NULL) == 2 && count_ifs(reflector, "mrt0") == 1);
+
+    // a query nothing answers is parked until query_wait_ms has passed
+    send_query(client, 1);
+    run(reflector, 100);
+    CHECK(receive_answer(client) == -1);
+    run(reflector, 300);
+    CHECK(receive_answer(client) == 1);
+
+    // adding an interface and a proxy keeps the running ones, and the query parked in between
+    send_query(client, 2);
+    run(reflector, 50);
+    CHECK(receive_answer(client) == -1);
+    write_config(CONFIG_LAN_ADDED);
+    CHECK(mdns_reflector_reload(reflector) == 0);
+    CHECK(count_ifs(reflector, NULL) == 3 && count_ifs(reflector, "mrt1") == 1);
+    CHECK(port_in_use(ADDED_PROXY_PORT));
+    run(reflector, 400);
+    CHECK(receive_answer(client) == 2);
+    int added_client = open_client(ADDED_PROXY_PORT);
+    send_query(added_client, 3);
+    run(reflector, 400);
+    CHECK(receive_answer(added_client) == 3);
+
+    // removing a proxy answers its parked queries before its socket is closed
+    send_query(added_client, 4);
+    run(reflector, 50);
+    CHECK(receive_answer(added_client) == -1);
+    write_config(CONFIG_LAN_REMOVED);
+    CHECK(mdns_reflector_reload(reflector) == 0);
+    CHECK(receive_answer(added_client) == 4);
+    CHECK(!port_in_use(ADDED_PROXY_PORT));
+    CHECK(count_ifs(reflector, NULL) == 2 && count_ifs(reflector, "mrt0") == 0);
+    close(added_client);
+
+    // an invalid configuration changes nothing
+    write_config(CONFIG_INVALID);
+    CHECK(mdns_reflector_reload(reflector) == -1);
+    CHECK(count_ifs(reflector, NULL) == 2 && count_ifs(reflector, "mrt1") == 1);
+    send_query(client, 5);
+    run(reflector, 400);
+    CHECK(receive_answer(client) == 5);
+    close(client);
+}
+
+int main(void) {
+    if (enter_namespaces() == -1) {
+        fprintf(stderr, "can't create network namespaces and interfaces; skipped\n");
+        return SKIPPED;
+    }
+    int fd = mkstemp(config_path);
+    if (fd == -1) {
+        perror("mkstemp");
+        return EXIT_FAILURE;
+    }
+    close(fd);
+    write_config(CONFIG_LAN);
+    struct mdns_reflector *reflector = mdns_reflector_new();
+    if (!reflector || mdns_reflector_load_config(reflector, config_path) == -1 ||
+        mdns_reflector_start(reflector) == -1) {
+        fprintf(stderr, "can't start the reflector\n");
+        unlink(config_path);
+        return EXIT_FAILURE;
+    }
+    test_reload(reflector);
+    mdns_reflector_free(reflector);
+    unlink(config_path);
+    return check_result();
+}
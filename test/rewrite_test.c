@@ -0,0 +1,168 @@
+/*
+    This file is part of mDNS Reflector (mdns-reflector), a lightweight and performant multicast DNS (mDNS) reflector.
+    Copyright (C) 2021 Yuxiang Zhu <me@yux.im>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "rewrite.h"
+#include "recompress.h"
+#include "testutil.h"
+
+static const uint8_t LAN_A[] = {192, 168, 1, 20};
+static const uint8_t OTHER_A[] = {10, 0, 0, 5};
+static const uint8_t LINK_LOCAL_AAAA[] = {0xfe, 0x80, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1};
+static const uint8_t ULA_AAAA[] = {0xfd, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1};
+static const uint8_t GLOBAL_AAAA[] = {0x20, 0x01, 0x0d, 0xb8, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1};
+
+/// A service response whose names are all written out, with one address of every kind.
+static size_t build_response(uint8_t *msg) {
+    size_t len = put_header(msg, DNS_FLAG_QR | DNS_FLAG_AA, 0, 2, 0, 5);
+    len = put_name_record(msg, len, "_ipp._tcp.local", DNS_TYPE_PTR, 4500, "Printer._ipp._tcp.local");
+    uint8_t srv[DNS_NAME_MAX] = {0, 0, 0, 0, 0x02, 0x77};
+    len = put_record(msg, len, "Printer._ipp._tcp.local", DNS_TYPE_SRV, 120, srv, put_name(srv, 6, "printer.local"));
+    len = put_record(msg, len, "printer.local", DNS_TYPE_A, 120, LAN_A, sizeof(LAN_A));
+    len = put_record(msg, len, "printer.local", DNS_TYPE_A, 120, OTHER_A, sizeof(OTHER_A));
+    len = put_record(msg, len, "printer.local", DNS_TYPE_AAAA, 120, LINK_LOCAL_AAAA, sizeof(LINK_LOCAL_AAAA));
+    len = put_record(msg, len, "printer.local", DNS_TYPE_AAAA, 120, ULA_AAAA, sizeof(ULA_AAAA));
+    return put_record(msg, len, "printer.local", DNS_TYPE_AAAA, 120, GLOBAL_AAAA, sizeof(GLOBAL_AAAA));
+}
+
+/// Check that two messages hold the same records in the same order, whatever their compression.
+static void check_same_records(const uint8_t *a, size_t a_len, const uint8_t *b, size_t b_len) {
+    struct dns_parser pa, pb;
+    struct dns_record ra, rb;
+    CHECK(dns_parser_init(&pa, a, a_len) == 0 && dns_parser_init(&pb, b, b_len) == 0);
+    CHECK(memcmp(&pa.header, &pb.header, sizeof(pa.header)) == 0);
+    int r;
+    while ((r = dns_parser_next(&pa, &ra)) == 1) {
+        CHECK(dns_parser_next(&pb, &rb) == 1);
+        uint64_t ha, hb;
+        CHECK(dns_record_hash(a, a_len, &ra, &ha) == 0 && dns_record_hash(b, b_len, &rb, &hb) == 0);
+        CHECK(ha == hb && ra.section == rb.section);
+    }
+    CHECK(r == 0);
+    CHECK(dns_parser_next(&pb, &rb) == 0);
+}
+
+static void test_parse_ipv4_prefix(void) {
+    struct ipv4_prefix prefix;
+    CHECK(parse_ipv4_prefix("192.168.1.7/24", &prefix) == 0);
+    CHECK(prefix.addr == 0xc0a80100u && prefix.mask == 0xffffff00u);
+    CHECK(parse_ipv4_prefix("10.0.0.1", &prefix) == 0);
+    CHECK(prefix.addr == 0x0a000001u && prefix.mask == UINT32_MAX);
+    CHECK(parse_ipv4_prefix("0.0.0.0/0", &prefix) == 0 && prefix.mask == 0);
+    CHECK(parse_ipv4_prefix("10.0.0.0/33", &prefix) == -1);
+    CHECK(parse_ipv4_prefix("10.0.0.0/", &prefix) == -1);
+    CHECK(parse_ipv4_prefix("10.0.0.0/8x", &prefix) == -1);
+    CHECK(parse_ipv4_prefix("printer", &prefix) == -1);
+}
+
+static void test_rewrite_drops_unreachable_addresses(void) {
+    struct rewrite_class *rc = new_rewrite_class(0, "iot", NULL);
+    CHECK(rc != NULL);
+    if (!rc)
+        return;
+    rc->drop_aaaa_link_local = true;
+    rc->drop_aaaa_ula = true;
+    rc->nprefixes4 = 1;
+    parse_ipv4_prefix("192.168.1.0/24", &rc->prefixes4[0]);
+    uint8_t msg[1024], out[1024], expected[1024];
+    size_t len = build_response(msg);
+    unsigned int dropped;
+    size_t out_len = rewrite_message(rc, msg, len, out, sizeof(out), &dropped);
+    CHECK(dropped == 3);
+    CHECK(out_len && out_len < len);
+    size_t expected_len = put_header(expected, DNS_FLAG_QR | DNS_FLAG_AA, 0, 2, 0, 2);
+    expected_len = put_name_record(expected, expected_len, "_ipp._tcp.local", DNS_TYPE_PTR, 4500,
+                                   "Printer._ipp._tcp.local");
+    uint8_t srv[DNS_NAME_MAX] = {0, 0, 0, 0, 0x02, 0x77};
+    expected_len = put_record(expected, expected_len, "Printer._ipp._tcp.local", DNS_TYPE_SRV, 120, srv,
+                              put_name(srv, 6, "printer.local"));
+    expected_len = put_record(expected, expected_len, "printer.local", DNS_TYPE_A, 120, LAN_A, sizeof(LAN_A));
+    expected_len = put_record(expected, expected_len, "printer.local", DNS_TYPE_AAAA, 120, GLOBAL_AAAA,
+                              sizeof(GLOBAL_AAAA));
+    check_same_records(out, out_len, expected, expected_len);
+    // too small a buffer forwards the original
+    CHECK(rewrite_message(rc, msg, len, out, out_len - 1, &dropped) == 0);
+    free_rewrite_classes(rc);
+}
+
+static void test_rewrite_keeps_what_it_cannot_judge(void) {
+    struct rewrite_class *rc = new_rewrite_class(0, "iot", NULL);
+    CHECK(rc != NULL);
+    if (!rc)
+        return;
+    rc->drop_aaaa_link_local = true;
+    rc->nprefixes4 = 1;
+    parse_ipv4_prefix("192.168.1.0/24", &rc->prefixes4[0]);
+    uint8_t msg[1024], out[1024];
+    unsigned int dropped;
+    // nothing to drop: forwarded unchanged, without a copy
+    size_t len = put_header(msg, DNS_FLAG_QR, 0, 1, 0, 0);
+    len = put_record(msg, len, "printer.local", DNS_TYPE_A, 120, LAN_A, sizeof(LAN_A));
+    CHECK(rewrite_message(rc, msg, len, out, sizeof(out), &dropped) == 0 && dropped == 0);
+    // queries are not rewritten, even with known answers
+    len = put_header(msg, 0, 1, 1, 0, 0);
+    len = put_question(msg, len, "printer.local", DNS_TYPE_A);
+    len = put_record(msg, len, "printer.local", DNS_TYPE_A, 120, OTHER_A, sizeof(OTHER_A));
+    CHECK(rewrite_message(rc, msg, len, out, sizeof(out), &dropped) == 0);
+    // records of other classes and of unexpected sizes are not addresses
+    len = put_header(msg, DNS_FLAG_QR, 0, 2, 0, 0);
+    len = put_record(msg, len, "printer.local", DNS_TYPE_A, 120, OTHER_A, sizeof(OTHER_A));
+    put_u16(msg, len - 12, 3);
+    len = put_record(msg, len, "printer.local", DNS_TYPE_AAAA, 120, LINK_LOCAL_AAAA, 8);
+    CHECK(rewrite_message(rc, msg, len, out, sizeof(out), &dropped) == 0 && dropped == 0);
+    // malformed responses are forwarded as they are
+    len = build_response(msg);
+    CHECK(rewrite_message(rc, msg, len - 1, out, sizeof(out), &dropped) == 0);
+    free_rewrite_classes(rc);
+}
+
+static void test_recompress_shrinks_and_keeps_records(void) {
+    uint8_t msg[1024], out[1024], again[1024];
+    size_t len = build_response(msg);
+    size_t estimate = recompress_estimate(msg, len);
+    size_t out_len = recompress_message(msg, len, out, sizeof(out));
+    CHECK(out_len && out_len < len);
+    // the estimate is an upper bound of the saving
+    CHECK(estimate >= len - out_len);
+    check_same_records(msg, len, out, out_len);
+    // nothing left to gain
+    CHECK(recompress_message(out, out_len, again, sizeof(again)) == 0);
+    // and nothing to gain without room for the result
+    CHECK(recompress_message(msg, len, again, out_len - 1) == 0);
+}
+
+static void test_recompress_malformed(void) {
+    uint8_t msg[1024], out[1024];
+    size_t len = build_response(msg);
+    CHECK(recompress_estimate(msg, len - 1) == 0);
+    CHECK(recompress_message(msg, len - 1, out, sizeof(out)) == 0);
+    CHECK(recompress_estimate(msg, DNS_HEADER_SIZE - 1) == 0);
+    // a single name has nothing to point to
+    len = put_header(msg, 0, 1, 0, 0, 0);
+    len = put_question(msg, len, "printer.local", DNS_TYPE_A);
+    CHECK(recompress_estimate(msg, len) == 0);
+    CHECK(recompress_message(msg, len, out, sizeof(out)) == 0);
+}
+
+int main(void) {
+    test_parse_ipv4_prefix();
+    test_rewrite_drops_unreachable_addresses();
+    test_rewrite_keeps_what_it_cannot_judge();
+    test_recompress_shrinks_and_keeps_records();
+    test_recompress_malformed();
+    return check_result();
+}
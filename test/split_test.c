@@ -0,0 +1,142 @@
+/*
+    This file is part of mDNS Reflector (mdns-reflector), a lightweight and performant multicast DNS (mDNS) reflector.
+    Copyright (C) 2021 Yuxiang Zhu <me@yux.im>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "split.h"
+#include "testutil.h"
+
+/// largest message on an Ethernet link: 1500 bytes less the IPv4 and UDP headers
+#define ETHERNET_MAX_MESSAGE (1500 - 20 - 8)
+
+/// A response of `n` TXT records of 100 bytes of RDATA each, under distinct names.
+static size_t build_txt_response(uint8_t *msg, unsigned int n) {
+    size_t len = put_header(msg, DNS_FLAG_QR | DNS_FLAG_AA, 0, n, 0, 0);
+    uint8_t txt[100];
+    txt[0] = sizeof(txt) - 1;
+    memset(txt + 1, 'x', sizeof(txt) - 1);
+    for (unsigned int i = 0; i < n; ++i) {
+        char name[32];
+        snprintf(name, sizeof(name), "host%u._ipp._tcp.local", i);
+        len = put_record(msg, len, name, DNS_TYPE_TXT, 4500, txt, sizeof(txt));
+    }
+    return len;
+}
+
+/// Check that the messages of a split hold the records of the original in order, each within `max_size`.
+static void check_split(const struct split *split, const uint8_t *msg, size_t len, size_t max_size) {
+    struct dns_parser parser, part;
+    struct dns_record record, copy;
+    dns_parser_init(&parser, msg, len);
+    for (size_t i = 0; i < split->nmessages; ++i) {
+        const uint8_t *m = split->arena + split->messages[i].offset;
+        size_t m_len = split->messages[i].len;
+        CHECK(m_len <= max_size);
+        CHECK(dns_parser_init(&part, m, m_len) == 0);
+        CHECK(part.header.id == parser.header.id);
+        int r;
+        while ((r = dns_parser_next(&part, &copy)) == 1) {
+            CHECK(dns_parser_next(&parser, &record) == 1);
+            uint64_t a, b;
+            CHECK(dns_record_hash(msg, len, &record, &a) == 0 && dns_record_hash(m, m_len, &copy, &b) == 0);
+            CHECK(a == b && record.section == copy.section);
+        }
+        CHECK(r == 0);
+    }
+    CHECK(dns_parser_next(&parser, &record) == 0);
+}
+
+static void test_split_at_mtu(void) {
+    static uint8_t msg[8192];
+    static struct split split;
+    size_t len = build_txt_response(msg, 30);
+    CHECK(len > 2 * ETHERNET_MAX_MESSAGE);
+    int n = split_message(&split, msg, len, ETHERNET_MAX_MESSAGE);
+    CHECK(n == 3);
+    check_split(&split, msg, len, ETHERNET_MAX_MESSAGE);
+    for (size_t i = 0; i < split.nmessages; ++i) {
+        struct dns_parser parser;
+        dns_parser_init(&parser, split.arena + split.messages[i].offset, split.messages[i].len);
+        // responses keep their header, without TC
+        CHECK(parser.header.flags == (DNS_FLAG_QR | DNS_FLAG_AA));
+    }
+}
+
+static void test_split_boundary(void) {
+    static uint8_t msg[8192];
+    static struct split split;
+    size_t len = build_txt_response(msg, 4);
+    // names are compressed again, so the whole message takes less than the original
+    CHECK(split_message(&split, msg, len, len) == 1);
+    size_t whole = split.messages[0].len;
+    CHECK(whole < len);
+    // a message that fits exactly is left whole, one byte less splits it
+    CHECK(split_message(&split, msg, len, whole) == 1);
+    CHECK(split_message(&split, msg, len, whole - 1) == 2);
+    check_split(&split, msg, len, whole - 1);
+    // the smallest size that still fits the largest record, with the header
+    struct dns_parser parser;
+    struct dns_record record;
+    dns_parser_init(&parser, msg, len);
+    dns_parser_next(&parser, &record);
+    size_t record_size = record.end - record.offset;
+    CHECK(split_message(&split, msg, len, DNS_HEADER_SIZE + record_size) == 4);
+    check_split(&split, msg, len, DNS_HEADER_SIZE + record_size);
+    CHECK(split_message(&split, msg, len, DNS_HEADER_SIZE + record_size - 1) == -1);
+}
+
+static void test_split_query_with_known_answers(void) {
+    static uint8_t msg[8192];
+    static struct split split;
+    uint8_t rdata[DNS_NAME_MAX];
+    size_t len = put_header(msg, 0, 2, 30, 0, 0);
+    len = put_question(msg, len, "_ipp._tcp.local", DNS_TYPE_PTR);
+    len = put_question(msg, len, "_ipps._tcp.local", DNS_TYPE_PTR);
+    for (unsigned int i = 0; i < 30; ++i) {
+        char name[64];
+        snprintf(name, sizeof(name), "A printer with a long name number %u._ipp._tcp.local", i);
+        len = put_record(msg, len, "_ipp._tcp.local", DNS_TYPE_PTR, 4500, rdata, put_name(rdata, 0, name));
+    }
+    size_t max_size = 512;
+    int n = split_message(&split, msg, len, max_size);
+    CHECK(n > 1);
+    check_split(&split, msg, len, max_size);
+    // RFC 6762 section 7.2: questions first, TC on all but the last message
+    for (int i = 0; i < n; ++i) {
+        struct dns_parser parser;
+        dns_parser_init(&parser, split.arena + split.messages[i].offset, split.messages[i].len);
+        CHECK(parser.header.counts[DNS_SECTION_QUESTION] == (i ? 0 : 2));
+        CHECK(!(parser.header.flags & DNS_FLAG_TC) == (i == n - 1));
+    }
+    // questions that don't fit in one message can't be split
+    CHECK(split_message(&split, msg, len, DNS_HEADER_SIZE + 30) == -1);
+}
+
+static void test_split_malformed(void) {
+    static uint8_t msg[8192];
+    static struct split split;
+    size_t len = build_txt_response(msg, 4);
+    CHECK(split_message(&split, msg, len - 1, ETHERNET_MAX_MESSAGE) == -1);
+    CHECK(split_message(&split, msg, DNS_HEADER_SIZE - 1, ETHERNET_MAX_MESSAGE) == -1);
+}
+
+int main(void) {
+    test_split_at_mtu();
+    test_split_boundary();
+    test_split_query_with_known_answers();
+    test_split_malformed();
+    return check_result();
+}
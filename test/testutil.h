@@ -0,0 +1,113 @@
+/*
+    This file is part of mDNS Reflector (mdns-reflector), a lightweight and performant multicast DNS (mDNS) reflector.
+    Copyright (C) 2021 Yuxiang Zhu <me@yux.im>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef MDNS_REFLECTOR_TESTUTIL_H
+#define MDNS_REFLECTOR_TESTUTIL_H
+
+/// Helpers shared by the unit tests: checks that count failures instead of aborting, and builders of DNS messages
+/// written out without compression, so that tests control every byte.
+
+#include "dns.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int failures;
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            failures++; \
+        } \
+    } while (0)
+
+/// \return exit status of the test program
+static inline int check_result(void) {
+    if (failures) {
+        fprintf(stderr, "%d check(s) failed\n", failures);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
+
+/// Write a dotted name like "printer.local" in wire format; "" is the root name.
+/// \return offset after the name
+static inline size_t put_name(uint8_t *buf, size_t len, const char *name) {
+    while (*name) {
+        const char *dot = strchr(name, '.');
+        size_t label = dot ? (size_t) (dot - name) : strlen(name);
+        buf[len++] = (uint8_t) label;
+        memcpy(buf + len, name, label);
+        len += label;
+        name += label + (dot ? 1 : 0);
+    }
+    buf[len++] = 0;
+    return len;
+}
+
+static inline size_t put_u16(uint8_t *buf, size_t len, unsigned int v) {
+    buf[len++] = (uint8_t) (v >> 8);
+    buf[len++] = (uint8_t) v;
+    return len;
+}
+
+static inline size_t put_u32(uint8_t *buf, size_t len, uint32_t v) {
+    len = put_u16(buf, len, v >> 16);
+    return put_u16(buf, len, v & 0xffffu);
+}
+
+/// Write a header with ID 0.
+/// \return offset after the header
+static inline size_t put_header(uint8_t *buf, unsigned int flags, unsigned int questions, unsigned int answers,
+                                unsigned int authorities, unsigned int additionals) {
+    size_t len = put_u16(buf, 0, 0);
+    len = put_u16(buf, len, flags);
+    len = put_u16(buf, len, questions);
+    len = put_u16(buf, len, answers);
+    len = put_u16(buf, len, authorities);
+    return put_u16(buf, len, additionals);
+}
+
+/// Write a question of class IN.
+static inline size_t put_question(uint8_t *buf, size_t len, const char *name, unsigned int type) {
+    len = put_name(buf, len, name);
+    len = put_u16(buf, len, type);
+    return put_u16(buf, len, 1);
+}
+
+/// Write a resource record of class IN with the cache-flush bit set.
+static inline size_t put_record(uint8_t *buf, size_t len, const char *name, unsigned int type, uint32_t ttl,
+                                const void *rdata, size_t rdlength) {
+    len = put_name(buf, len, name);
+    len = put_u16(buf, len, type);
+    len = put_u16(buf, len, 0x8001);
+    len = put_u32(buf, len, ttl);
+    len = put_u16(buf, len, (unsigned int) rdlength);
+    memcpy(buf + len, rdata, rdlength);
+    return len + rdlength;
+}
+
+/// Write a resource record whose RDATA is a single name, such as a PTR record.
+static inline size_t put_name_record(uint8_t *buf, size_t len, const char *name, unsigned int type, uint32_t ttl,
+                                     const char *target) {
+    uint8_t rdata[DNS_NAME_MAX];
+    return put_record(buf, len, name, type, ttl, rdata, put_name(rdata, 0, target));
+}
+
+#endif //MDNS_REFLECTOR_TESTUTIL_H